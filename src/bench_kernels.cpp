@@ -0,0 +1,609 @@
+/*
+ * bench_kernels main() function
+ */
+
+/*!
+ * Microbenchmarks for the inner loops of preflight: the RNG, fixed
+ * probability connectivity, delay generation, the writeVLBinaryData
+ * implementations, ConnectionList::writeBinary, rapidxml parsing and
+ * printing and AllocAndRead. Each is run repeatedly for at least
+ * --min_time seconds and reported as nanoseconds per element and
+ * bytes per second, so that a change to one of them can be compared
+ * against a baseline.
+ */
+
+#include <exception>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <iterator>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include "rapidxml.hpp"
+#include "rapidxml_print.hpp"
+#include "rng.h"
+#include "allocandread.h"
+#include "connection_list.h"
+#include "fixedvalue.h"
+#include "uniformdistribution.h"
+#include "normaldistribution.h"
+#include "valuelist.h"
+#include "util.h"
+
+extern "C" {
+#include <popt.h>
+}
+
+using namespace std;
+using namespace rapidxml;
+using namespace spineml;
+
+/*!
+ * Results of the kernels are added to this, so that the compiler
+ * can't drop the work.
+ */
+volatile double benchSink = 0;
+
+/*!
+ * One microbenchmark. setup() prepares for a run and isn't timed;
+ * run() is timed. elements and bytes say how much one run() does.
+ */
+class Kernel
+{
+public:
+    Kernel (const string& n, double e, double b)
+        : name (n)
+        , elements (e)
+        , bytes (b)
+    {
+    }
+    virtual ~Kernel() {}
+    virtual void setup (void) {}
+    virtual void run (void) = 0;
+
+    string name;
+    double elements;
+    double bytes;
+};
+
+/*!
+ * Draws from uniformGCC.
+ */
+class UniformGCCKernel : public Kernel
+{
+public:
+    UniformGCCKernel (unsigned int n) : Kernel ("uniformGCC", n, n * sizeof(float)) {}
+    void run (void)
+    {
+        RngData rd;
+        rngDataInit (&rd);
+        zigset (&rd, 11);
+        rd.seed = 123;
+        double sum = 0;
+        unsigned int n = static_cast<unsigned int>(this->elements);
+        for (unsigned int i = 0; i < n; ++i) {
+            sum += UNI(&rd);
+        }
+        benchSink += sum;
+    }
+};
+
+/*!
+ * Draws from RNOR.
+ */
+class RnorKernel : public Kernel
+{
+public:
+    RnorKernel (unsigned int n) : Kernel ("RNOR", n, n * sizeof(float)) {}
+    void run (void)
+    {
+        RngData rd;
+        rngDataInit (&rd);
+        zigset (&rd, 11);
+        rd.seed = 123;
+        double sum = 0;
+        unsigned int n = static_cast<unsigned int>(this->elements);
+        for (unsigned int i = 0; i < n; ++i) {
+            sum += RNOR(&rd);
+        }
+        benchSink += sum;
+    }
+};
+
+/*!
+ * Setting up the ziggurat tables; one element per call.
+ */
+class ZigsetKernel : public Kernel
+{
+public:
+    ZigsetKernel (unsigned int n) : Kernel ("zigset", n, 0) {}
+    void run (void)
+    {
+        RngData rd;
+        rngDataInit (&rd);
+        unsigned int n = static_cast<unsigned int>(this->elements);
+        for (unsigned int i = 0; i < n; ++i) {
+            zigset (&rd, 11 + i);
+        }
+        benchSink += rd.kn[1];
+    }
+};
+
+/*!
+ * ConnectionList::generateFixedProbability for srcNum = dstNum = N.
+ * An element is one candidate (source, destination) pair; bytes are
+ * those of the connectivity held in memory.
+ */
+class FixedProbabilityKernel : public Kernel
+{
+public:
+    FixedProbabilityKernel (unsigned int n, float p)
+        : Kernel ("", static_cast<double>(n) * n, static_cast<double>(n) * n * p * 2 * sizeof(int))
+        , num (n)
+        , probability (p)
+    {
+        stringstream ss;
+        ss << "generateFixedProbability N=" << n << " p=" << p;
+        this->name = ss.str();
+    }
+    void run (void)
+    {
+        ConnectionList cl;
+        cl.generateFixedProbability (123, this->probability, this->num, this->num);
+        benchSink += cl.connectivityC2D.size();
+    }
+private:
+    unsigned int num;
+    float probability;
+};
+
+/*!
+ * ConnectionList::generateDelays for a normal or uniform delay
+ * distribution over a list of N connections.
+ */
+class DelaysKernel : public Kernel
+{
+public:
+    DelaysKernel (unsigned int n, Distribution d)
+        : Kernel (d == Dist_Normal ? "generateNormalDelays" : "generateUniformDelays",
+                  n, n * sizeof(float))
+    {
+        this->cl.connectivityC2D.resize (n);
+        this->cl.delayDistributionType = d;
+        this->cl.delayMean = 2;
+        this->cl.delayVariance = 0.5;
+        this->cl.delayRangeMin = 1;
+        this->cl.delayRangeMax = 4;
+        this->cl.delayDistributionSeed = 7;
+    }
+    void setup (void)
+    {
+        vector<float>().swap (this->cl.connectivityC2Delay);
+    }
+    void run (void)
+    {
+        this->cl.generateDelays();
+        benchSink += this->cl.connectivityC2Delay[0];
+    }
+private:
+    ConnectionList cl;
+};
+
+/*!
+ * PropertyContent::writeVLBinary, and so writeVLBinaryData, for one
+ * kind of property content given as XML, writing N values to a file.
+ */
+class PropertyKernel : public Kernel
+{
+public:
+    PropertyKernel (const string& kind, const string& xml, unsigned int n, const string& dir)
+        : Kernel ("writeVLBinaryData " + kind, n, n * (sizeof(unsigned int) + sizeof(double)))
+        , content ((PropertyContent*)0)
+        , text (xml.begin(), xml.end())
+        , modelRoot (dir)
+    {
+        this->text.push_back ('\0');
+        this->doc.parse<0> (&this->text[0]);
+        xml_node<>* node = this->doc.first_node();
+        if (kind == "FixedValue") {
+            this->content = new FixedValue (node, n);
+        } else if (kind == "UniformDistribution") {
+            this->content = new UniformDistribution (node, n);
+        } else if (kind == "NormalDistribution") {
+            this->content = new NormalDistribution (node, n);
+        } else {
+            this->content = new ValueList (node, n);
+        }
+    }
+    ~PropertyKernel()
+    {
+        delete this->content;
+        unlink ((this->modelRoot + "bench_property.bin").c_str());
+    }
+    void run (void)
+    {
+        this->content->writeVLBinary ((xml_node<>*)0, this->modelRoot, "bench_property.bin");
+    }
+private:
+    PropertyContent* content;
+    vector<char> text;
+    xml_document<> doc;
+    string modelRoot;
+};
+
+/*!
+ * ConnectionList::writeBinary of a list of about N connections with
+ * explicit delays.
+ */
+class WriteBinaryKernel : public Kernel
+{
+public:
+    WriteBinaryKernel (unsigned int n, const string& dir)
+        : Kernel ("ConnectionList::writeBinary", 0, 0)
+        , modelRoot (dir)
+    {
+        // A square fixed probability connection of about n connections.
+        unsigned int side = 1000;
+        float p = static_cast<float>(n) / (static_cast<float>(side) * side);
+        this->cl.delayDistributionType = Dist_Normal;
+        this->cl.delayMean = 2;
+        this->cl.delayVariance = 0.5;
+        this->cl.generateFixedProbability (123, p, side, side);
+        this->cl.generateDelays();
+        this->elements = this->cl.connectivityC2D.size();
+        this->bytes = this->cl.binaryFileSize (this->elements);
+    }
+    ~WriteBinaryKernel()
+    {
+        unlink ((this->modelRoot + "bench_connection.bin").c_str());
+    }
+    void run (void)
+    {
+        this->cl.writeBinary ((xml_node<>*)0, this->modelRoot, "bench_connection.bin");
+    }
+private:
+    ConnectionList cl;
+    string modelRoot;
+};
+
+/*!
+ * Build the text of a model holding an explicit ConnectionList of
+ * @param n Connection elements, as a large model.xml would.
+ */
+string largeModelText (unsigned int n)
+{
+    stringstream ss;
+    ss << "<?xml version=\"1.0\"?>\n"
+       << "<LL:SpineML xmlns=\"http://www.shef.ac.uk/SpineMLNetworkLayer\""
+       << " xmlns:LL=\"http://www.shef.ac.uk/SpineMLLowLevelNetworkLayer\" name=\"Bench\">\n"
+       << "    <LL:Population>\n"
+       << "        <LL:Neuron name=\"A\" size=\"1000\" url=\"A.xml\"/>\n"
+       << "        <LL:Projection dst_population=\"A\">\n"
+       << "            <LL:Synapse>\n"
+       << "                <ConnectionList>\n";
+    for (unsigned int i = 0; i < n; ++i) {
+        ss << "                    <Connection src_neuron=\"" << (i / 100) % 1000
+           << "\" dst_neuron=\"" << (i * 7) % 1000 << "\" delay=\"" << (i % 40) * 0.1 << "\"/>\n";
+    }
+    ss << "                </ConnectionList>\n"
+       << "            </LL:Synapse>\n"
+       << "        </LL:Projection>\n"
+       << "    </LL:Population>\n"
+       << "</LL:SpineML>\n";
+    return ss.str();
+}
+
+/*!
+ * rapidxml parse of a large model, as ModelPreflight::init does it.
+ * An element is one Connection.
+ */
+class ParseKernel : public Kernel
+{
+public:
+    ParseKernel (unsigned int n)
+        : Kernel ("rapidxml parse", n, 0)
+    {
+        string t = largeModelText (n);
+        this->text.assign (t.begin(), t.end());
+        this->text.push_back ('\0');
+        this->bytes = t.size();
+    }
+    void setup (void)
+    {
+        // Parsing is destructive, so parse a fresh copy each time.
+        this->doc.clear();
+        this->work = this->text;
+    }
+    void run (void)
+    {
+        this->doc.parse<parse_declaration_node | parse_no_data_nodes>(&this->work[0]);
+        benchSink += this->doc.first_node() ? 1 : 0;
+    }
+private:
+    vector<char> text;
+    vector<char> work;
+    xml_document<> doc;
+};
+
+/*!
+ * rapidxml print of a large parsed model, with indenting.
+ */
+class PrintKernel : public Kernel
+{
+public:
+    PrintKernel (unsigned int n)
+        : Kernel ("rapidxml print", n, 0)
+    {
+        string t = largeModelText (n);
+        this->text.assign (t.begin(), t.end());
+        this->text.push_back ('\0');
+        this->doc.parse<parse_declaration_node | parse_no_data_nodes>(&this->text[0]);
+        this->bytes = t.size();
+    }
+    void setup (void)
+    {
+        this->out.clear();
+        this->out.reserve (static_cast<size_t>(this->bytes) * 2);
+    }
+    void run (void)
+    {
+        rapidxml::print (back_inserter (this->out), this->doc, 0);
+        benchSink += this->out.size();
+    }
+private:
+    vector<char> text;
+    xml_document<> doc;
+    string out;
+};
+
+/*!
+ * AllocAndRead::read of a large model file. An element is one line.
+ */
+class AllocAndReadKernel : public Kernel
+{
+public:
+    AllocAndReadKernel (unsigned int n, const string& dir)
+        : Kernel ("AllocAndRead::read", 0, 0)
+        , path (dir + "bench_model.xml")
+    {
+        string t = largeModelText (n);
+        ofstream f (this->path.c_str(), ios::out|ios::trunc);
+        f << t;
+        f.close();
+        this->bytes = t.size();
+        for (size_t i = 0; i < t.size(); ++i) {
+            if (t[i] == '\n') {
+                this->elements += 1;
+            }
+        }
+    }
+    ~AllocAndReadKernel()
+    {
+        unlink (this->path.c_str());
+    }
+    void run (void)
+    {
+        AllocAndRead ar (this->path);
+        benchSink += ar.getsize();
+    }
+private:
+    string path;
+};
+
+/*!
+ * The timing of one kernel.
+ */
+struct Result {
+    string name;
+    unsigned int reps;
+    double elements;
+    double bytes;
+    double seconds;
+};
+
+/*!
+ * Run @param k until it has been timed for at least @param minTime
+ * seconds (and at least twice, after a warm up run).
+ */
+Result measure (Kernel& k, double minTime)
+{
+    Result r;
+    r.name = k.name;
+    r.reps = 0;
+    r.elements = k.elements;
+    r.bytes = k.bytes;
+    r.seconds = 0;
+
+    k.setup();
+    k.run();
+    while (r.seconds < minTime || r.reps < 2) {
+        k.setup();
+        double t0 = Util::monotonicSeconds();
+        k.run();
+        r.seconds += Util::monotonicSeconds() - t0;
+        r.reps++;
+    }
+    return r;
+}
+
+/*!
+ * A stream buffer which throws away what is written to it, for
+ * quietening the library's progress messages during the runs.
+ */
+class NullBuf : public streambuf
+{
+protected:
+    int overflow (int c) { return c; }
+};
+
+/*!
+ * libpopt features - the features that are available to change on the
+ * command line.
+ */
+struct CmdOptions {
+    //! To hold the minimum time in seconds to run each kernel for.
+    double min_time;
+    //! To hold a substring; only kernels whose names contain it are run.
+    char * filter;
+    //! To hold the path for JSON results. None if NULL.
+    char * json;
+    //! To hold the directory for the scratch files. TMPDIR or /tmp if NULL.
+    char * work_dir;
+};
+
+/*!
+ * Initializes a CmdOptions object via a @param copts pointer
+ */
+void zeroCmdOptions (CmdOptions* copts)
+{
+    copts->min_time = 0.5;
+    copts->filter = NULL;
+    copts->json = NULL;
+    copts->work_dir = NULL;
+}
+
+/*!
+ * main entry point for bench_kernels
+ */
+int main (int argc, char * argv[])
+{
+    int rtn = 0;
+
+    CmdOptions cmdOptions;
+    zeroCmdOptions (&cmdOptions);
+
+    struct poptOption opt[] = {
+        POPT_AUTOHELP
+
+        {"min_time", '\0',
+         POPT_ARG_DOUBLE, &(cmdOptions.min_time), 0,
+         "Run each kernel for at least this many seconds. Default: 0.5"},
+
+        {"filter", '\0',
+         POPT_ARG_STRING, &(cmdOptions.filter), 0,
+         "Only run the kernels whose names contain this string."},
+
+        {"json", '\0',
+         POPT_ARG_STRING, &(cmdOptions.json), 0,
+         "Also write the results to this file as JSON."},
+
+        {"work_dir", '\0',
+         POPT_ARG_STRING, &(cmdOptions.work_dir), 0,
+         "The directory for the files the write kernels make. Default: $TMPDIR or /tmp"},
+
+        POPT_AUTOALIAS
+        POPT_TABLEEND
+    };
+    poptContext con;
+    con = poptGetContext (argv[0], argc, (const char**)argv, opt, 0);
+    while (poptGetNextOpt(con) != -1) {}
+
+    vector<Kernel*> kernels;
+    try {
+        string dir;
+        if (cmdOptions.work_dir != NULL) {
+            dir = cmdOptions.work_dir;
+        } else {
+            const char* tmp = getenv ("TMPDIR");
+            dir = (tmp && tmp[0]) ? tmp : "/tmp";
+        }
+        if (dir[dir.size()-1] != '/') {
+            dir += "/";
+        }
+
+        const unsigned int M = 1000000;
+        kernels.push_back (new UniformGCCKernel (10*M));
+        kernels.push_back (new RnorKernel (10*M));
+        kernels.push_back (new ZigsetKernel (1000));
+        kernels.push_back (new FixedProbabilityKernel (1000, 0.1f));
+        kernels.push_back (new FixedProbabilityKernel (3000, 0.01f));
+        kernels.push_back (new FixedProbabilityKernel (3000, 0.1f));
+        kernels.push_back (new FixedProbabilityKernel (3000, 0.5f));
+        kernels.push_back (new DelaysKernel (M, Dist_Normal));
+        kernels.push_back (new DelaysKernel (M, Dist_Uniform));
+        kernels.push_back (new PropertyKernel ("FixedValue", "<FixedValue value=\"0.5\"/>", M, dir));
+        kernels.push_back (new PropertyKernel ("UniformDistribution",
+                                               "<UniformDistribution minimum=\"0\" maximum=\"1\" seed=\"9\"/>",
+                                               M, dir));
+        kernels.push_back (new PropertyKernel ("NormalDistribution",
+                                               "<NormalDistribution mean=\"0\" variance=\"1\" seed=\"3\"/>",
+                                               M, dir));
+        {
+            stringstream vl;
+            vl << "<ValueList>";
+            for (unsigned int i = 0; i < 100000; ++i) {
+                vl << "<Value index=\"" << i << "\" value=\"" << i * 0.5 << "\"/>";
+            }
+            vl << "</ValueList>";
+            kernels.push_back (new PropertyKernel ("ValueList", vl.str(), 100000, dir));
+        }
+        kernels.push_back (new WriteBinaryKernel (M, dir));
+        kernels.push_back (new ParseKernel (200000));
+        kernels.push_back (new PrintKernel (200000));
+        kernels.push_back (new AllocAndReadKernel (200000, dir));
+
+        string filter (cmdOptions.filter != NULL ? cmdOptions.filter : "");
+        vector<Result> results;
+        NullBuf nb;
+        for (unsigned int i = 0; i < kernels.size(); ++i) {
+            if (!filter.empty() && kernels[i]->name.find (filter) == string::npos) {
+                continue;
+            }
+            cerr << kernels[i]->name << "..." << endl;
+            streambuf* coutbuf = cout.rdbuf (&nb);
+            Result r = measure (*kernels[i], cmdOptions.min_time);
+            cout.rdbuf (coutbuf);
+            results.push_back (r);
+        }
+
+        cout << left << setw(44) << "kernel" << right << setw(8) << "reps"
+             << setw(12) << "elements" << setw(12) << "ns/element" << setw(12) << "MB/s" << "\n";
+        for (unsigned int i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            double perRep = r.seconds / r.reps;
+            cout << left << setw(44) << r.name << right << setw(8) << r.reps
+                 << setw(12) << setprecision(0) << fixed << r.elements
+                 << setw(12) << setprecision(2) << perRep * 1e9 / r.elements
+                 << setw(12) << setprecision(1) << r.bytes / perRep / 1e6 << "\n";
+        }
+
+        if (cmdOptions.json != NULL) {
+            ofstream f (cmdOptions.json, ios::out|ios::trunc);
+            f << fixed << "{ \"kernels\": [";
+            for (unsigned int i = 0; i < results.size(); ++i) {
+                const Result& r = results[i];
+                double perRep = r.seconds / r.reps;
+                f << (i ? ",\n" : "\n")
+                  << "  { \"name\": " << Util::jsonString (r.name)
+                  << ", \"reps\": " << r.reps
+                  << ", \"elements\": " << setprecision(0) << r.elements
+                  << ", \"bytes\": " << r.bytes
+                  << ", \"seconds_per_rep\": " << setprecision(9) << perRep
+                  << ", \"ns_per_element\": " << setprecision(3) << perRep * 1e9 / r.elements
+                  << ", \"bytes_per_second\": " << setprecision(1) << r.bytes / perRep << " }";
+            }
+            f << "\n] }\n";
+            f.close();
+            if (f.fail()) {
+                stringstream ee;
+                ee << "Failed to write results to '" << cmdOptions.json << "'.";
+                throw runtime_error (ee.str());
+            }
+        }
+    } catch (const exception& e) {
+        cerr << "Bench Error: " << e.what() << endl;
+        rtn = -1;
+    }
+
+    for (unsigned int i = 0; i < kernels.size(); ++i) {
+        delete kernels[i];
+    }
+    poptFreeContext(con);
+    return rtn;
+}
@@ -0,0 +1,356 @@
+/*
+ * bench_preflight main() function
+ */
+
+/*!
+ * End-to-end benchmark of spineml_preflight. For each of a range of
+ * model sizes, from 10^min_exp to 10^max_exp connections, writes a
+ * synthetic model with ModelGenerator, runs spineml_preflight on it
+ * in a child process and records the wall time, CPU time, peak
+ * resident memory and the size of the files written. The results
+ * are written out as JSON.
+ */
+
+#include <exception>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "modelgenerator.h"
+#include "util.h"
+
+extern "C" {
+#include <popt.h>
+}
+
+using namespace std;
+using spineml::Util;
+
+/*!
+ * libpopt features - the features that are available to change on the
+ * command line.
+ */
+struct CmdOptions {
+    //! To hold the path to spineml_preflight. Alongside this program if NULL.
+    char * preflight;
+    //! To hold the directory in which the models are written.
+    char * work_dir;
+    //! To hold the path of the JSON results. stdout if NULL.
+    char * out;
+    //! To hold the smallest model size, as a power of ten connections.
+    int min_exp;
+    //! To hold the largest model size, as a power of ten connections.
+    int max_exp;
+    //! To hold the number of populations in each model.
+    int populations;
+    //! To hold the connection probability.
+    double probability;
+    //! To hold the delay distribution.
+    char * delay;
+    //! To hold the number of neuron state variables.
+    int state_vars;
+    //! To hold extra arguments for spineml_preflight, separated by spaces.
+    char * preflight_args;
+    //! To hold a flag to say that the models and their output should be kept.
+    int keep;
+};
+
+/*!
+ * Initializes a CmdOptions object via a @param copts pointer
+ */
+void zeroCmdOptions (CmdOptions* copts)
+{
+    copts->preflight = NULL;
+    copts->work_dir = NULL;
+    copts->out = NULL;
+    copts->min_exp = 3;
+    copts->max_exp = 6;
+    copts->populations = 2;
+    copts->probability = 0.1;
+    copts->delay = NULL;
+    copts->state_vars = 2;
+    copts->preflight_args = NULL;
+    copts->keep = 0;
+}
+
+/*!
+ * The measurements from one run of spineml_preflight.
+ */
+struct RunResult {
+    RunResult() : status (0), wall (0), user (0), sys (0), maxRss (0),
+                  outputBytes (0), outputFiles (0) {}
+    int status;
+    double wall;
+    double user;
+    double sys;
+    double maxRss;
+    double outputBytes;
+    unsigned int outputFiles;
+};
+
+/*!
+ * Run @param args (args[0] being the program) with stdout sent to
+ * /dev/null, and fill in the time and memory it used.
+ */
+void runPreflight (const vector<string>& args, RunResult& r)
+{
+    vector<char*> argv;
+    for (unsigned int i = 0; i < args.size(); ++i) {
+        argv.push_back (const_cast<char*>(args[i].c_str()));
+    }
+    argv.push_back ((char*)0);
+
+    double t0 = Util::monotonicSeconds();
+    pid_t pid = fork();
+    if (pid < 0) {
+        throw runtime_error ("Failed to fork to run spineml_preflight.");
+    }
+    if (pid == 0) {
+        if (freopen ("/dev/null", "w", stdout) == (FILE*)0) {
+            _exit (127);
+        }
+        execvp (argv[0], &argv[0]);
+        _exit (127);
+    }
+
+    int status = 0;
+    struct rusage ru;
+    if (wait4 (pid, &status, 0, &ru) < 0) {
+        throw runtime_error ("Failed to wait for spineml_preflight.");
+    }
+    r.wall = Util::monotonicSeconds() - t0;
+    r.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    r.user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6;
+    r.sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+    r.maxRss = static_cast<double>(ru.ru_maxrss) * 1024; // kB on Linux
+}
+
+/*!
+ * Add up the sizes of the pf_*.bin files in @param dir into @param r.
+ */
+void measureOutput (const string& dir, RunResult& r)
+{
+    DIR* d = opendir (dir.c_str());
+    if (!d) {
+        return;
+    }
+    struct dirent* e;
+    while ((e = readdir (d)) != (struct dirent*)0) {
+        string name (e->d_name);
+        if (name.compare (0, 3, "pf_") != 0) {
+            continue;
+        }
+        struct stat st;
+        if (stat ((dir + "/" + name).c_str(), &st) == 0) {
+            r.outputBytes += static_cast<double>(st.st_size);
+            r.outputFiles++;
+        }
+    }
+    closedir (d);
+}
+
+/*!
+ * Remove the files in @param dir and then @param dir itself.
+ */
+void removeModel (const string& dir)
+{
+    DIR* d = opendir (dir.c_str());
+    if (!d) {
+        return;
+    }
+    struct dirent* e;
+    while ((e = readdir (d)) != (struct dirent*)0) {
+        string name (e->d_name);
+        if (name != "." && name != "..") {
+            unlink ((dir + "/" + name).c_str());
+        }
+    }
+    closedir (d);
+    rmdir (dir.c_str());
+}
+
+/*!
+ * main entry point for bench_preflight
+ */
+int main (int argc, char * argv[])
+{
+    int rtn = 0;
+
+    CmdOptions cmdOptions;
+    zeroCmdOptions (&cmdOptions);
+
+    struct poptOption opt[] = {
+        POPT_AUTOHELP
+
+        {"preflight", '\0',
+         POPT_ARG_STRING, &(cmdOptions.preflight), 0,
+         "The spineml_preflight program to benchmark. Default: the one alongside this program."},
+
+        {"work_dir", 'w',
+         POPT_ARG_STRING, &(cmdOptions.work_dir), 0,
+         "The directory in which to write the models; it needs room for the output of "
+         "the largest. Default: the current directory."},
+
+        {"out", 'o',
+         POPT_ARG_STRING, &(cmdOptions.out), 0,
+         "Write the JSON results to this file. Default: stdout."},
+
+        {"min_exp", '\0',
+         POPT_ARG_INT, &(cmdOptions.min_exp), 0,
+         "The smallest model has about 10^min_exp connections. Default: 3"},
+
+        {"max_exp", '\0',
+         POPT_ARG_INT, &(cmdOptions.max_exp), 0,
+         "The largest model has about 10^max_exp connections. Default: 6"},
+
+        {"populations", '\0',
+         POPT_ARG_INT, &(cmdOptions.populations), 0,
+         "The number of populations in each model. Default: 2"},
+
+        {"probability", '\0',
+         POPT_ARG_DOUBLE, &(cmdOptions.probability), 0,
+         "The connection probability. Default: 0.1"},
+
+        {"delay", '\0',
+         POPT_ARG_STRING, &(cmdOptions.delay), 0,
+         "The delay distribution: fixed, normal or uniform. Default: normal"},
+
+        {"state_vars", '\0',
+         POPT_ARG_INT, &(cmdOptions.state_vars), 0,
+         "The number of neuron state variables. Default: 2"},
+
+        {"preflight_args", '\0',
+         POPT_ARG_STRING, &(cmdOptions.preflight_args), 0,
+         "Extra arguments for spineml_preflight, separated by spaces, "
+         "e.g. \"--threads 4\"."},
+
+        {"keep", '\0',
+         POPT_ARG_NONE, &(cmdOptions.keep), 0,
+         "If set, keep each model and its preflighted output."},
+
+        POPT_AUTOALIAS
+        POPT_TABLEEND
+    };
+    poptContext con;
+    con = poptGetContext (argv[0], argc, (const char**)argv, opt, 0);
+    while (poptGetNextOpt(con) != -1) {}
+
+    try {
+        string preflight;
+        if (cmdOptions.preflight != NULL) {
+            preflight = cmdOptions.preflight;
+        } else {
+            // Alongside this program or, if it was found on the PATH, on the PATH.
+            string dir (argv[0]);
+            Util::stripUnixFile (dir);
+            preflight = (dir == argv[0]) ? "spineml_preflight" : dir + "/spineml_preflight";
+        }
+        string work_dir (cmdOptions.work_dir != NULL ? cmdOptions.work_dir : ".");
+
+        spineml::ModelGenerator gen;
+        gen.populations = static_cast<unsigned int>(cmdOptions.populations);
+        gen.probability = static_cast<float>(cmdOptions.probability);
+        gen.stateVariables = static_cast<unsigned int>(cmdOptions.state_vars);
+        string delay (cmdOptions.delay != NULL ? cmdOptions.delay : "normal");
+        gen.setDelayType (delay);
+
+        vector<string> extra;
+        if (cmdOptions.preflight_args != NULL) {
+            stringstream ss (cmdOptions.preflight_args);
+            string a;
+            while (ss >> a) {
+                extra.push_back (a);
+            }
+        }
+
+        stringstream json;
+        json << fixed << "{\n"
+             << "  \"preflight\": " << Util::jsonString (preflight) << ",\n"
+             << "  \"preflight_args\": "
+             << Util::jsonString (cmdOptions.preflight_args != NULL ? cmdOptions.preflight_args : "")
+             << ",\n"
+             << "  \"populations\": " << gen.populations << ",\n"
+             << "  \"probability\": " << setprecision(6) << gen.probability << ",\n"
+             << "  \"delay\": " << Util::jsonString (delay) << ",\n"
+             << "  \"state_vars\": " << gen.stateVariables << ",\n"
+             << "  \"runs\": [";
+
+        for (int e = cmdOptions.min_exp; e <= cmdOptions.max_exp; ++e) {
+            gen.setSizeForConnections (pow (10.0, e));
+            stringstream dss;
+            dss << work_dir << "/bench_1e" << e;
+            string dir = dss.str();
+            gen.write (dir);
+
+            vector<string> args;
+            args.push_back (preflight);
+            args.push_back ("-e");
+            args.push_back (dir + "/experiment.xml");
+            args.push_back ("--component_cache");
+            args.push_back ("none");
+            args.insert (args.end(), extra.begin(), extra.end());
+
+            cerr << "bench_preflight: 1e" << e << " connections ("
+                 << gen.populations << " x " << gen.size << " neurons)... ";
+            RunResult r;
+            runPreflight (args, r);
+            measureOutput (dir, r);
+            cerr << setprecision(3) << r.wall << " s" << (r.status ? " FAILED" : "") << endl;
+
+            json << (e == cmdOptions.min_exp ? "\n" : ",\n")
+                 << "    { \"exp\": " << e
+                 << ", \"size\": " << gen.size
+                 << ", \"expected_connections\": " << setprecision(0) << gen.expectedConnections()
+                 << ", \"status\": " << r.status
+                 << ", \"wall_seconds\": " << setprecision(6) << r.wall
+                 << ", \"user_seconds\": " << r.user
+                 << ", \"sys_seconds\": " << r.sys
+                 << ", \"max_rss_bytes\": " << setprecision(0) << r.maxRss
+                 << ", \"output_files\": " << r.outputFiles
+                 << ", \"output_bytes\": " << r.outputBytes
+                 << ", \"connections_per_second\": " << setprecision(1)
+                 << (r.wall > 0 ? gen.expectedConnections() / r.wall : 0)
+                 << ", \"output_bytes_per_second\": "
+                 << (r.wall > 0 ? r.outputBytes / r.wall : 0) << " }";
+
+            if (!cmdOptions.keep) {
+                removeModel (dir);
+            }
+            if (r.status != 0) {
+                rtn = -1;
+            }
+        }
+        json << "\n  ]\n}\n";
+
+        if (cmdOptions.out != NULL) {
+            ofstream f (cmdOptions.out, ios::out|ios::trunc);
+            f << json.str();
+            f.close();
+            if (f.fail()) {
+                stringstream ee;
+                ee << "Failed to write results to '" << cmdOptions.out << "'.";
+                throw runtime_error (ee.str());
+            }
+        } else {
+            cout << json.str();
+        }
+    } catch (const exception& e) {
+        cerr << "Benchmark Error: " << e.what() << endl;
+        rtn = -1;
+    }
+
+    poptFreeContext(con);
+    return rtn;
+}
@@ -0,0 +1,406 @@
+/*
+ * Implementation of BinaryTranscoder.
+ */
+
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "binarytranscoder.h"
+#include "trace.h"
+
+using namespace std;
+using namespace rapidxml;
+using namespace spineml;
+
+/*!
+ * Records converted by each iteration of the parallel loop.
+ */
+#define TRANSCODE_BLOCK 65536
+
+BinaryTranscoder::Layout::Layout()
+    : connections (false)
+    , delays (false)
+    , indexBits (32)
+    , valueBits (64)
+    , dense (false)
+{
+}
+
+size_t
+BinaryTranscoder::Layout::recordBytes (void) const
+{
+    if (this->connections) {
+        return 2 * this->indexBits / 8 + (this->delays ? this->valueBits / 8 : 0);
+    }
+    return (this->dense ? 0 : this->indexBits / 8) + this->valueBits / 8;
+}
+
+void
+BinaryTranscoder::Layout::setStandard (void)
+{
+    this->indexBits = 32;
+    this->valueBits = this->connections ? 32 : 64;
+    this->dense = false;
+}
+
+string
+BinaryTranscoder::Layout::describe (void) const
+{
+    stringstream ss;
+    string idx = this->indexBits == 16 ? "uint16" : "int32";
+    string val = this->valueBits == 32 ? "float" : "double";
+    if (this->connections) {
+        ss << idx << "," << idx;
+        if (this->delays) {
+            ss << "," << val;
+        }
+    } else if (this->dense) {
+        ss << val;
+    } else {
+        ss << idx << "," << val;
+    }
+    return ss.str();
+}
+
+bool
+BinaryTranscoder::Layout::operator== (const Layout& other) const
+{
+    return this->connections == other.connections
+        && this->delays == other.delays
+        && this->indexBits == other.indexBits
+        && (this->valueBits == other.valueBits || (this->connections && !this->delays))
+        && this->dense == other.dense;
+}
+
+BinaryTranscoder::Layout
+BinaryTranscoder::layoutOf (xml_node<>* binaryfile_node)
+{
+    Layout l;
+    xml_node<>* parent = binaryfile_node->parent();
+    string pname (parent ? parent->name() : "");
+    if (pname == "ConnectionList") {
+        l.connections = true;
+        l.valueBits = 32;
+        xml_attribute<>* attr = binaryfile_node->first_attribute ("explicit_delay_flag");
+        l.delays = (attr && string(attr->value()) == "1");
+        // Delays which are kept in their own file (delay_file_name)
+        // aren't a column of this one, which is all that's converted.
+        if (binaryfile_node->first_attribute ("delay_file_name")) {
+            l.delays = false;
+        }
+    } else if (pname != "ValueList") {
+        stringstream ee;
+        ee << "BinaryTranscoder: A BinaryFile in a " << pname
+           << ", rather than a ConnectionList or ValueList.";
+        throw runtime_error (ee.str());
+    }
+
+    xml_attribute<>* attr;
+    if ((attr = binaryfile_node->first_attribute ("index_bits"))) {
+        string v (attr->value());
+        if (v == "16") {
+            l.indexBits = 16;
+        } else if (v != "32") {
+            throw runtime_error ("BinaryTranscoder: index_bits should be 16 or 32.");
+        }
+    }
+    if ((attr = binaryfile_node->first_attribute ("value_bits"))) {
+        string v (attr->value());
+        if (v == "32") {
+            l.valueBits = 32;
+        } else if (v == "64") {
+            l.valueBits = 64;
+        } else {
+            throw runtime_error ("BinaryTranscoder: value_bits should be 32 or 64.");
+        }
+    }
+    if ((attr = binaryfile_node->first_attribute ("dense"))) {
+        l.dense = (string(attr->value()) == "true");
+        if (l.dense && l.connections) {
+            throw runtime_error ("BinaryTranscoder: A connection list can't be dense.");
+        }
+    }
+    return l;
+}
+
+void
+BinaryTranscoder::setLayout (xml_document<>& doc, xml_node<>* binaryfile_node,
+                             const Layout& layout)
+{
+    const char* names[] = { "index_bits", "value_bits", "dense" };
+    for (int i = 0; i < 3; ++i) {
+        xml_attribute<>* attr = binaryfile_node->first_attribute (names[i]);
+        if (attr) {
+            binaryfile_node->remove_attribute (attr);
+        }
+    }
+    if (layout.indexBits != 32) {
+        binaryfile_node->append_attribute (doc.allocate_attribute ("index_bits", "16"));
+    }
+    unsigned int standardValueBits = layout.connections ? 32 : 64;
+    if (layout.valueBits != standardValueBits && (!layout.connections || layout.delays)) {
+        binaryfile_node->append_attribute (doc.allocate_attribute ("value_bits",
+                                                                   layout.valueBits == 32 ? "32" : "64"));
+    }
+    if (layout.dense) {
+        binaryfile_node->append_attribute (doc.allocate_attribute ("dense", "true"));
+    }
+}
+
+/*!
+ * Read an index of width @param bits from @param p.
+ */
+static inline long long
+readIndex (const char* p, unsigned int bits)
+{
+    if (bits == 16) {
+        unsigned short v;
+        memcpy (&v, p, sizeof(v));
+        return v;
+    }
+    int v;
+    memcpy (&v, p, sizeof(v));
+    return v;
+}
+
+/*!
+ * Write @param v to @param p with width @param bits. Returns false
+ * if it doesn't fit.
+ */
+static inline bool
+writeIndex (char* p, long long v, unsigned int bits)
+{
+    if (bits == 16) {
+        if (v < 0 || v > 0xffff) {
+            return false;
+        }
+        unsigned short s = static_cast<unsigned short>(v);
+        memcpy (p, &s, sizeof(s));
+        return true;
+    }
+    int i = static_cast<int>(v);
+    memcpy (p, &i, sizeof(i));
+    return true;
+}
+
+/*!
+ * Read a value of width @param bits from @param p.
+ */
+static inline double
+readValue (const char* p, unsigned int bits)
+{
+    if (bits == 32) {
+        float f;
+        memcpy (&f, p, sizeof(f));
+        return f;
+    }
+    double d;
+    memcpy (&d, p, sizeof(d));
+    return d;
+}
+
+/*!
+ * Write @param v to @param p with width @param bits.
+ */
+static inline void
+writeValue (char* p, double v, unsigned int bits)
+{
+    if (bits == 32) {
+        float f = static_cast<float>(v);
+        memcpy (p, &f, sizeof(f));
+    } else {
+        memcpy (p, &v, sizeof(v));
+    }
+}
+
+/*!
+ * Convert the records @param first to @param last of @param in into
+ * @param out. Returns the number of the first record whose index
+ * didn't fit, or @param last if they all did. Not for conversions
+ * from an indexed to a dense value list.
+ */
+static unsigned long long
+convertRecords (const char* in, const BinaryTranscoder::Layout& from,
+                char* out, const BinaryTranscoder::Layout& to,
+                unsigned long long first, unsigned long long last)
+{
+    const size_t inrec = from.recordBytes();
+    const size_t outrec = to.recordBytes();
+    const size_t inidx = from.indexBits / 8;
+    const size_t outidx = to.indexBits / 8;
+    for (unsigned long long i = first; i < last; ++i) {
+        const char* ip = in + i * inrec;
+        char* op = out + i * outrec;
+        if (from.connections) {
+            if (!writeIndex (op, readIndex (ip, from.indexBits), to.indexBits)
+                || !writeIndex (op + outidx, readIndex (ip + inidx, from.indexBits), to.indexBits)) {
+                return i;
+            }
+            if (to.delays) {
+                writeValue (op + 2*outidx, readValue (ip + 2*inidx, from.valueBits), to.valueBits);
+            }
+        } else {
+            long long index = static_cast<long long>(i);
+            if (!from.dense) {
+                index = readIndex (ip, from.indexBits);
+                ip += inidx;
+            }
+            if (!to.dense) {
+                if (!writeIndex (op, index, to.indexBits)) {
+                    return i;
+                }
+                op += outidx;
+            }
+            writeValue (op, readValue (ip, from.valueBits), to.valueBits);
+        }
+    }
+    return last;
+}
+
+unsigned long long
+BinaryTranscoder::transcode (const string& inpath, const Layout& from,
+                             const string& outpath, const Layout& to,
+                             unsigned long long elements, unsigned int threads)
+{
+    Trace::Scope ts ("transcode");
+    ts.arg ("file", inpath);
+
+    if (from.connections != to.connections || (to.delays && !from.delays)
+        || (to.dense && to.connections)) {
+        throw runtime_error ("BinaryTranscoder: Can only change the widths of a "
+                             "connection list, or remove its delays.");
+    }
+
+    int ifd = open (inpath.c_str(), O_RDONLY);
+    if (ifd < 0) {
+        stringstream ee;
+        ee << "BinaryTranscoder: Failed to open '" << inpath << "': " << strerror (errno);
+        throw runtime_error (ee.str());
+    }
+    struct stat st;
+    fstat (ifd, &st);
+    const unsigned long long inbytes = static_cast<unsigned long long>(st.st_size);
+    const size_t inrec = from.recordBytes();
+
+    // How many records? A value list may hold fewer than
+    // num_elements, unless it's dense.
+    unsigned long long n = inbytes / inrec;
+    stringstream ee;
+    if (inbytes % inrec != 0) {
+        ee << "BinaryTranscoder: '" << inpath << "' (" << inbytes << " bytes) is not a whole "
+           << "number of " << from.describe() << " records.";
+    } else if ((from.connections || from.dense) && n != elements) {
+        ee << "BinaryTranscoder: '" << inpath << "' holds " << n << " "
+           << from.describe() << " records, but the model says " << elements << ".";
+    } else if (to.dense && !from.dense && n != elements) {
+        ee << "BinaryTranscoder: '" << inpath << "' holds values for " << n << " of "
+           << elements << " indices, so it can't be made dense.";
+    }
+    if (!ee.str().empty()) {
+        close (ifd);
+        throw runtime_error (ee.str());
+    }
+    ts.arg ("records", static_cast<double>(n));
+
+    int ofd = open (outpath.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if (ofd < 0) {
+        close (ifd);
+        stringstream ee2;
+        ee2 << "BinaryTranscoder: Failed to open '" << outpath << "' for writing: " << strerror (errno);
+        throw runtime_error (ee2.str());
+    }
+
+    const unsigned long long outbytes = n * to.recordBytes();
+    if (n == 0) {
+        close (ifd);
+        close (ofd);
+        return 0;
+    }
+
+    char* in = static_cast<char*>(mmap (0, inbytes, PROT_READ, MAP_SHARED, ifd, 0));
+    char* out = static_cast<char*>(MAP_FAILED);
+    if (in != MAP_FAILED && ftruncate (ofd, outbytes) == 0) {
+        out = static_cast<char*>(mmap (0, outbytes, PROT_READ|PROT_WRITE, MAP_SHARED, ofd, 0));
+    }
+    close (ifd);
+    if (in == MAP_FAILED || out == MAP_FAILED) {
+        if (in != MAP_FAILED) {
+            munmap (in, inbytes);
+        }
+        close (ofd);
+        unlink (outpath.c_str());
+        stringstream ee2;
+        ee2 << "BinaryTranscoder: Failed to map '" << inpath << "' or '" << outpath
+            << "': " << strerror (errno);
+        throw runtime_error (ee2.str());
+    }
+
+    unsigned long long bad = n;
+    string error ("");
+    if (to.dense && !from.dense) {
+        // Each value goes where its index says, so this is done in
+        // order, checking that no index is repeated.
+        vector<bool> seen (n, false);
+        const size_t inidx = from.indexBits / 8;
+        const size_t outrec = to.recordBytes();
+        for (unsigned long long i = 0; i < n; ++i) {
+            const char* ip = in + i * inrec;
+            long long index = readIndex (ip, from.indexBits);
+            if (index < 0 || static_cast<unsigned long long>(index) >= n || seen[index]) {
+                stringstream es;
+                es << "BinaryTranscoder: '" << inpath << "' has index " << index
+                   << " (record " << i << ") which is out of range or repeated, "
+                   << "so it can't be made dense.";
+                error = es.str();
+                break;
+            }
+            seen[index] = true;
+            writeValue (out + index * outrec, readValue (ip + inidx, from.valueBits), to.valueBits);
+        }
+    } else {
+        // Records are independent, so blocks of them are converted in
+        // parallel.
+        int nblocks = static_cast<int>((n + TRANSCODE_BLOCK - 1) / TRANSCODE_BLOCK);
+#pragma omp parallel for schedule(static) num_threads(threads)
+        for (int b = 0; b < nblocks; ++b) {
+            unsigned long long first = static_cast<unsigned long long>(b) * TRANSCODE_BLOCK;
+            unsigned long long last = first + TRANSCODE_BLOCK < n ? first + TRANSCODE_BLOCK : n;
+            unsigned long long r = convertRecords (in, from, out, to, first, last);
+            if (r < last) {
+#pragma omp critical (spineml_transcode)
+                {
+                    if (r < bad) {
+                        bad = r;
+                    }
+                }
+            }
+        }
+        if (bad < n) {
+            stringstream es;
+            es << "BinaryTranscoder: An index in record " << bad << " of '" << inpath
+               << "' doesn't fit in " << to.indexBits << " bits.";
+            error = es.str();
+        }
+    }
+
+    munmap (in, inbytes);
+    munmap (out, outbytes);
+    if (error.empty() && fsync (ofd) != 0) {
+        stringstream es;
+        es << "BinaryTranscoder: Failed to write '" << outpath << "': " << strerror (errno);
+        error = es.str();
+    }
+    close (ofd);
+    if (!error.empty()) {
+        unlink (outpath.c_str());
+        throw runtime_error (error);
+    }
+    return n;
+}
@@ -0,0 +1,109 @@
+/*!
+ * Conversion of preflight binary files between layouts.
+ */
+
+#ifndef _BINARYTRANSCODER_H_
+#define _BINARYTRANSCODER_H_
+
+#include <string>
+#include "rapidxml.hpp"
+
+namespace spineml
+{
+    /*!
+     * Converts the binary files written by preflight - connection
+     * lists of (src, dst[, delay]) records and explicit value lists
+     * of (index, value) records - between layouts which differ in the
+     * width of the indices, the precision of the values (for a
+     * connection list, the delays) and, for value lists, whether the
+     * index is stored at all.
+     *
+     * The layout of a file is described by attributes of its
+     * BinaryFile element, each of which is omitted when it has its
+     * default value, so that files in the layout preflight writes
+     * carry no new attributes:
+     *
+     *   index_bits="16"   indices are unsigned 16 bit (default: 32 bit int)
+     *   value_bits="32"   values are floats (default for a ValueList: 64, a double)
+     *   value_bits="64"   delays are doubles (default for a ConnectionList: 32, a float)
+     *   dense="true"      a ValueList holds num_elements values and no indices,
+     *                     the value for index i being the i-th
+     *
+     * A connection list whose delays are in a separate file (a
+     * delay_file_name attribute) is converted without its delays,
+     * which stay as floats.
+     */
+    class BinaryTranscoder
+    {
+    public:
+        /*!
+         * The layout of one binary file.
+         */
+        struct Layout {
+            Layout();
+
+            //! True for a connection list, false for a value list.
+            bool connections;
+            //! For a connection list, true if it has a delay column.
+            bool delays;
+            //! The width of each index (src and dst for a connection list): 32 or 16.
+            unsigned int indexBits;
+            //! The width of each value or delay: 64 or 32.
+            unsigned int valueBits;
+            //! For a value list, true if the indices are implicit.
+            bool dense;
+
+            //! The number of bytes in each record.
+            size_t recordBytes (void) const;
+
+            //! Set this to the layout that preflight writes, keeping connections and delays.
+            void setStandard (void);
+
+            //! A short description, e.g. "int32,double".
+            std::string describe (void) const;
+
+            bool operator== (const Layout& other) const;
+            bool operator!= (const Layout& other) const { return !(*this == other); }
+        };
+
+        /*!
+         * Read the layout of the file referred to by @param
+         * binaryfile_node from its attributes and those of its
+         * parent (a ConnectionList or a ValueList). Throws if the
+         * attributes are not understood.
+         */
+        static Layout layoutOf (rapidxml::xml_node<>* binaryfile_node);
+
+        /*!
+         * Set the layout attributes of @param binaryfile_node to
+         * describe @param layout, allocating strings from @param doc.
+         */
+        static void setLayout (rapidxml::xml_document<>& doc,
+                               rapidxml::xml_node<>* binaryfile_node,
+                               const Layout& layout);
+
+        /*!
+         * Convert the file at @param inpath, in layout @param from,
+         * into a new file at @param outpath in layout @param to,
+         * using @param threads threads. @param elements is
+         * num_connections for a connection list and num_elements for
+         * a value list. A connection list's delays can be dropped
+         * (to.delays false) but not added.
+         *
+         * The size of the input is checked against its layout.
+         * Throws if it doesn't match, if an index doesn't fit in the
+         * new width, or if a value list is to be made dense and its
+         * indices are not each of 0 to elements-1 exactly once. On
+         * failure, outpath is removed.
+         *
+         * @return the number of records converted.
+         */
+        static unsigned long long transcode (const std::string& inpath, const Layout& from,
+                                             const std::string& outpath, const Layout& to,
+                                             unsigned long long elements,
+                                             unsigned int threads = 1);
+    };
+
+} // namespace spineml
+
+#endif // _BINARYTRANSCODER_H_
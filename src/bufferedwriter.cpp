@@ -0,0 +1,125 @@
+/*
+ * Implementation of BufferedWriter.
+ */
+
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "rapidxml.hpp"
+#include "rapidxml_print.hpp"
+#include "bufferedwriter.h"
+#include "trace.h"
+
+using namespace std;
+using namespace spineml;
+
+BufferedWriter::BufferedWriter (const string& p, size_t bufsz)
+    : fd (-1)
+    , buf (bufsz > 0 ? bufsz : 1)
+    , pos (0)
+    , flushed (0)
+    , path (p)
+{
+    this->fd = open (this->path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (this->fd < 0) {
+        stringstream ee;
+        ee << "Failed to open '" << this->path << "' for writing: " << strerror (errno);
+        throw runtime_error (ee.str());
+    }
+}
+
+BufferedWriter::~BufferedWriter()
+{
+    if (this->fd >= 0) {
+        try {
+            this->flush();
+        } catch (const std::exception& e) {
+            // Nothing to be done in a destructor.
+        }
+        ::close (this->fd);
+    }
+}
+
+void
+BufferedWriter::write (const char* p, size_t n)
+{
+    if (n >= this->buf.size()) {
+        // Bigger than the buffer; no point copying it.
+        this->flush();
+        size_t done = 0;
+        while (done < n) {
+            ssize_t w = ::write (this->fd, p + done, n - done);
+            if (w < 0) {
+                if (errno == EINTR) { continue; }
+                stringstream ee;
+                ee << "Failed to write to '" << this->path << "': " << strerror (errno);
+                throw runtime_error (ee.str());
+            }
+            done += w;
+        }
+        this->flushed += n;
+        return;
+    }
+    if (this->pos + n > this->buf.size()) {
+        this->flush();
+    }
+    memcpy (&this->buf[this->pos], p, n);
+    this->pos += n;
+}
+
+void
+BufferedWriter::writeXml (const rapidxml::xml_node<>& node, bool indent)
+{
+    Trace::Scope ts ("print_xml");
+    ts.arg ("file", this->path);
+    rapidxml::print (this->begin(), node, indent ? 0 : rapidxml::print_no_indenting);
+}
+
+void
+BufferedWriter::flush (void)
+{
+    size_t done = 0;
+    while (done < this->pos) {
+        ssize_t w = ::write (this->fd, &this->buf[done], this->pos - done);
+        if (w < 0) {
+            if (errno == EINTR) { continue; }
+            stringstream ee;
+            ee << "Failed to write to '" << this->path << "': " << strerror (errno);
+            throw runtime_error (ee.str());
+        }
+        done += w;
+    }
+    this->flushed += this->pos;
+    this->pos = 0;
+}
+
+void
+BufferedWriter::sync (void)
+{
+    this->flush();
+    if (fsync (this->fd)) {
+        stringstream ee;
+        ee << "Failed to sync '" << this->path << "': " << strerror (errno);
+        throw runtime_error (ee.str());
+    }
+}
+
+void
+BufferedWriter::close (void)
+{
+    if (this->fd < 0) {
+        return;
+    }
+    this->flush();
+    int rtn = ::close (this->fd);
+    this->fd = -1;
+    if (rtn) {
+        stringstream ee;
+        ee << "Failed to close '" << this->path << "': " << strerror (errno);
+        throw runtime_error (ee.str());
+    }
+}
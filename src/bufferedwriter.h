@@ -0,0 +1,143 @@
+/*!
+ * A buffered file writer for large XML output.
+ */
+
+#ifndef _BUFFEREDWRITER_H_
+#define _BUFFEREDWRITER_H_
+
+#include <string>
+#include <vector>
+#include <iterator>
+#include <cstddef>
+#include "rapidxml.hpp"
+
+/*!
+ * The default size of the BufferedWriter's buffer: 4 MB.
+ */
+#define BUFFEREDWRITER_BUFSZ (4*1024*1024)
+
+namespace spineml
+{
+    /*!
+     * Writes to a file through one large contiguous buffer, which is
+     * passed to write(2) only when it fills up. The iterator can be
+     * given to rapidxml::print, so that an XML document is
+     * serialised with a couple of inline operations per character
+     * rather than going through a std::ostream_iterator (which makes
+     * a full stream insertion for every character).
+     */
+    class BufferedWriter
+    {
+    public:
+        /*!
+         * An output iterator which puts characters into the
+         * BufferedWriter it was made from.
+         */
+        class iterator
+        {
+        public:
+            typedef std::output_iterator_tag iterator_category;
+            typedef void value_type;
+            typedef void difference_type;
+            typedef void pointer;
+            typedef void reference;
+
+            explicit iterator (BufferedWriter* w) : writer(w) {}
+            iterator& operator* (void) { return *this; }
+            iterator& operator= (char c) { this->writer->put (c); return *this; }
+            iterator& operator++ (void) { return *this; }
+            iterator operator++ (int) { return *this; }
+
+        private:
+            BufferedWriter* writer;
+        };
+
+        /*!
+         * Open (creating or truncating) the file at @param path for
+         * writing, with a buffer of @param bufsz bytes. Throws on
+         * failure.
+         */
+        BufferedWriter (const std::string& path, size_t bufsz = BUFFEREDWRITER_BUFSZ);
+
+        /*!
+         * Flushes and closes the file if close() wasn't called. Any
+         * error is lost, so call close() to find out about errors.
+         */
+        ~BufferedWriter();
+
+        /*!
+         * Add the character @param c to the buffer.
+         */
+        void put (char c)
+        {
+            if (this->pos == this->buf.size()) {
+                this->flush();
+            }
+            this->buf[this->pos++] = c;
+        }
+
+        /*!
+         * Add @param n characters from @param p. Large blocks are
+         * written straight to the file.
+         */
+        void write (const char* p, size_t n);
+
+        /*!
+         * Add the string @param s.
+         */
+        void write (const std::string& s) { this->write (s.data(), s.size()); }
+
+        /*!
+         * Serialise the XML node (or document) @param node. If
+         * @param indent is false, no indentation or newlines are
+         * added between elements, which makes the output smaller and
+         * faster to write.
+         */
+        void writeXml (const rapidxml::xml_node<>& node, bool indent = true);
+
+        /*!
+         * Get an output iterator for this writer.
+         */
+        iterator begin (void) { return iterator (this); }
+
+        /*!
+         * Write the contents of the buffer to the file.
+         */
+        void flush (void);
+
+        /*!
+         * The number of bytes written so far, including those still
+         * in the buffer.
+         */
+        size_t size (void) const { return this->flushed + this->pos; }
+
+        /*!
+         * Flush, then fsync the file so that its content is on disk.
+         */
+        void sync (void);
+
+        /*!
+         * Flush and close the file. Throws on error.
+         */
+        void close (void);
+
+    private:
+        //! The file descriptor
+        int fd;
+
+        //! The buffer
+        std::vector<char> buf;
+
+        //! The number of characters in the buffer
+        size_t pos;
+
+        //! The number of characters already written to the file
+        size_t flushed;
+
+        //! The path, for error messages
+        std::string path;
+    };
+
+} // namespace spineml
+
+#endif // _BUFFEREDWRITER_H_
@@ -20,39 +20,63 @@ Component::Component(const string& d, const string& n)
     , name(n)
     , root_node((xml_node<>*)0)
     , class_node((xml_node<>*)0)
+    , doc((xml_document<>*)0)
 {
     this->read();
 }
 
+Component::Component(const string& d, const string& n,
+                     const string& t, const map<string, string>& svs)
+    : dir(d)
+    , name(n)
+    , type(t)
+    , stateVariables(svs)
+    , root_node((xml_node<>*)0)
+    , class_node((xml_node<>*)0)
+    , doc((xml_document<>*)0)
+{
+}
+
 void
 Component::read (void)
 {
-    // Read data with allocandread object:
+    // Read data with allocandread object. The raw text is only
+    // needed during parsing, so it's local and freed on return.
     string filepath = this->dir + this->name + ".xml";
-    this->xmlraw.read (filepath);
+    AllocAndRead xmlraw;
+    xmlraw.read (filepath);
 
     this->doc = new xml_document<>;
-    this->doc->parse<parse_declaration_node | parse_no_data_nodes>(this->xmlraw.data());
-
-    // Get the root node.
-    this->root_node = this->doc->first_node ("SpineML");
-    if (!this->root_node) {
-        // Possibly look for HL:SpineML, if we have a high level model (not
-        // used by anyone at present).
-        stringstream ee;
-        ee << "spineml::Component: No SpineML node in component " << this->name;
-        throw runtime_error (ee.str());
-    }
+    try {
+        this->doc->parse<parse_declaration_node | parse_no_data_nodes>(xmlraw.data());
+
+        // Get the root node.
+        this->root_node = this->doc->first_node ("SpineML");
+        if (!this->root_node) {
+            // Possibly look for HL:SpineML, if we have a high level model (not
+            // used by anyone at present).
+            stringstream ee;
+            ee << "spineml::Component: No SpineML node in component " << this->name;
+            throw runtime_error (ee.str());
+        }
 
-    // Now extract the information we want from this component xml
-    // file; type, name (for verification), state variables (and if we
-    // needed them, parameters, but we don't need those, so they're
-    // ignored).
-    this->readNameAndType();
-    this->readStateVariables();
+        // Now extract the information we want from this component xml
+        // file; type, name (for verification), state variables (and if we
+        // needed them, parameters, but we don't need those, so they're
+        // ignored).
+        this->readNameAndType();
+        this->readStateVariables();
+    } catch (...) {
+        delete this->doc;
+        this->doc = (xml_document<>*)0;
+        throw;
+    }
 
-    // Free up this->doc.
+    // Free up this->doc; the node pointers point into it.
     delete this->doc;
+    this->doc = (xml_document<>*)0;
+    this->root_node = (xml_node<>*)0;
+    this->class_node = (xml_node<>*)0;
 }
 
 void
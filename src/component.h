@@ -28,6 +28,31 @@ namespace spineml
          */
         Component(const std::string& d, const std::string& n);
 
+        /*!
+         * Construct from already known information, without reading
+         * the component's XML file. Used by @see ComponentCache.
+         */
+        Component(const std::string& d, const std::string& n,
+                  const std::string& t, const std::map<std::string, std::string>& svs);
+
+        /*!
+         * @return the component name.
+         */
+        const std::string& getName (void) const { return this->name; }
+
+        /*!
+         * @return the component type, e.g. "neuron_body"
+         */
+        const std::string& getType (void) const { return this->type; }
+
+        /*!
+         * @return the map of state variable names to dimensions.
+         */
+        const std::map<std::string, std::string>& getStateVariables (void) const
+        {
+            return this->stateVariables;
+        }
+
         /*!
          * Output a comma separated list of the state variable
          * names. @see stateVariables
@@ -95,17 +120,13 @@ namespace spineml
         std::map<std::string, std::string> stateVariables;
 
         /*!
-         * An object into which to read the xml text prior to parsing.
-         */
-        spineml::AllocAndRead xmlraw;
-
-        /*!
-         * the root node pointer.
+         * the root node pointer. Only valid whilst reading.
          */
         rapidxml::xml_node<>* root_node;
 
         /*!
-         * The node pointer for the ComponentClass element.
+         * The node pointer for the ComponentClass element. Only valid
+         * whilst reading.
          */
         rapidxml::xml_node<>* class_node;
 
@@ -0,0 +1,292 @@
+/*
+ * Implementation of ComponentCache.
+ */
+
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <cstdlib>
+#include <climits>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "componentcache.h"
+#include "bufferedwriter.h"
+#include "metrics.h"
+#include "util.h"
+
+using namespace std;
+using namespace spineml;
+
+/*!
+ * The first line of a cache file. Change the number if the format
+ * changes, and old caches will be ignored.
+ */
+#define COMPONENTCACHE_HEADER "spineml_preflight component cache 1"
+
+ComponentCache::ComponentCache()
+    : cacheFile (ComponentCache::defaultCacheFile())
+    , cacheRead (false)
+    , dirty (false)
+{
+}
+
+ComponentCache::~ComponentCache()
+{
+    map<string, Component*>::iterator i = this->components.begin();
+    while (i != this->components.end()) {
+        delete i->second;
+        ++i;
+    }
+}
+
+void
+ComponentCache::setCacheFile (const string& path)
+{
+    this->cacheFile = (path == "none") ? string("") : path;
+    this->cacheRead = false;
+    this->entries.clear();
+}
+
+string
+ComponentCache::defaultCacheFile (void)
+{
+    string dir("");
+    const char* xdg = getenv ("XDG_CACHE_HOME");
+    const char* home = getenv ("HOME");
+    if (xdg && xdg[0] != '\0') {
+        dir = xdg;
+    } else if (home && home[0] != '\0') {
+        dir = string(home) + "/.cache";
+    } else {
+        return dir;
+    }
+    return dir + "/spineml_preflight/components";
+}
+
+bool
+ComponentCache::count (const string& name) const
+{
+    return this->components.count (name) > 0;
+}
+
+Component*
+ComponentCache::at (const string& name)
+{
+    return this->components.at (name);
+}
+
+Component*
+ComponentCache::load (const string& dir, const string& name)
+{
+    map<string, Component*>::iterator ci = this->components.find (name);
+    if (ci != this->components.end()) {
+        return ci->second;
+    }
+
+    Metrics::Scope ms (Metrics::Phase, "component_load");
+    ms.count (1);
+    Component* c = this->fromCache (dir, name);
+    if (c) {
+        this->components.insert (make_pair (name, c));
+    } else {
+        c = new Component (dir, name);
+        this->addParsed (dir, c);
+    }
+    return c;
+}
+
+void
+ComponentCache::prefetch (const string& dir, const set<string>& names)
+{
+    Metrics::Scope ms (Metrics::Phase, "component_load");
+    ms.count (names.size());
+
+    // Cache hits are cheap; take those first, on this thread.
+    vector<string> toParse;
+    set<string>::const_iterator ni = names.begin();
+    while (ni != names.end()) {
+        if (!this->components.count (*ni)) {
+            Component* c = this->fromCache (dir, *ni);
+            if (c) {
+                this->components.insert (make_pair (*ni, c));
+            } else {
+                toParse.push_back (*ni);
+            }
+        }
+        ++ni;
+    }
+
+    // Each Component reads and parses its own file, so the misses
+    // can all be in flight at once. Exceptions mustn't leave the
+    // parallel region.
+    int n = static_cast<int>(toParse.size());
+    vector<Component*> parsed (toParse.size(), (Component*)0);
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < n; ++i) {
+        try {
+            parsed[i] = new Component (dir, toParse[i]);
+        } catch (const std::exception& e) {
+            parsed[i] = (Component*)0;
+        }
+    }
+
+    for (int i = 0; i < n; ++i) {
+        if (parsed[i]) {
+            this->addParsed (dir, parsed[i]);
+        }
+    }
+}
+
+Component*
+ComponentCache::fromCache (const string& dir, const string& name)
+{
+    string abspath("");
+    long long mtime = 0, size = 0;
+    if (this->cacheFile.empty()
+        || !ComponentCache::fileKey (dir + name + ".xml", abspath, mtime, size)) {
+        return (Component*)0;
+    }
+    this->readCacheFile();
+    map<string, Entry>::const_iterator ei = this->entries.find (abspath);
+    if (ei == this->entries.end() || ei->second.mtime != mtime || ei->second.size != size) {
+        return (Component*)0;
+    }
+    return new Component (dir, name, ei->second.type, ei->second.stateVariables);
+}
+
+void
+ComponentCache::addParsed (const string& dir, Component* c)
+{
+    this->components.insert (make_pair (c->getName(), c));
+
+    string abspath("");
+    long long mtime = 0, size = 0;
+    if (this->cacheFile.empty()
+        || !ComponentCache::fileKey (dir + c->getName() + ".xml", abspath, mtime, size)) {
+        return;
+    }
+    Entry e;
+    e.mtime = mtime;
+    e.size = size;
+    e.type = c->getType();
+    e.stateVariables = c->getStateVariables();
+    this->entries[abspath] = e;
+    this->dirty = true;
+}
+
+bool
+ComponentCache::fileKey (const string& path, string& abspath, long long& mtime, long long& size)
+{
+    struct stat st;
+    if (stat (path.c_str(), &st)) {
+        return false;
+    }
+    char rp[PATH_MAX];
+    if (!realpath (path.c_str(), rp)) {
+        return false;
+    }
+    abspath = rp;
+    mtime = static_cast<long long>(st.st_mtime) * 1000000000LL;
+#ifdef __linux__
+    mtime += st.st_mtim.tv_nsec;
+#endif
+    size = static_cast<long long>(st.st_size);
+    return true;
+}
+
+void
+ComponentCache::readCacheFile (void)
+{
+    if (this->cacheRead) {
+        return;
+    }
+    this->cacheRead = true;
+
+    ifstream f (this->cacheFile.c_str());
+    if (!f.is_open()) {
+        return;
+    }
+    string line("");
+    if (!getline (f, line) || line != COMPONENTCACHE_HEADER) {
+        return;
+    }
+    // Each line is: path<TAB>mtime<TAB>size<TAB>type<TAB>sv=dim;sv=dim;...
+    while (getline (f, line)) {
+        vector<string> fields = Util::stringToVector (line, "\t");
+        if (fields.size() != 5) {
+            continue;
+        }
+        Entry e;
+        e.mtime = strtoll (fields[1].c_str(), 0, 10);
+        e.size = strtoll (fields[2].c_str(), 0, 10);
+        e.type = fields[3];
+        vector<string> svs = Util::stringToVector (fields[4], ";", true);
+        vector<string>::const_iterator si = svs.begin();
+        while (si != svs.end()) {
+            string::size_type eq = si->find ('=');
+            if (eq != string::npos) {
+                e.stateVariables[si->substr (0, eq)] = si->substr (eq+1);
+            }
+            ++si;
+        }
+        this->entries[fields[0]] = e;
+    }
+}
+
+void
+ComponentCache::save (void)
+{
+    if (!this->dirty || this->cacheFile.empty()) {
+        return;
+    }
+
+    // Entries written by another run since we read the file are
+    // merged in, rather than lost.
+    map<string, Entry> ours = this->entries;
+    this->cacheRead = false;
+    this->readCacheFile();
+    map<string, Entry>::const_iterator oi = ours.begin();
+    while (oi != ours.end()) {
+        this->entries[oi->first] = oi->second;
+        ++oi;
+    }
+
+    // Make the directory, if necessary (one level only, plus its parent).
+    string dir (this->cacheFile);
+    Util::stripUnixFile (dir);
+    if (dir != this->cacheFile) {
+        string parent (dir);
+        Util::stripUnixFile (parent);
+        mkdir (parent.c_str(), 0755);
+        mkdir (dir.c_str(), 0755);
+    }
+
+    string tmppath = Util::tempPathFor (this->cacheFile);
+    try {
+        BufferedWriter f (tmppath, 65536);
+        f.write (COMPONENTCACHE_HEADER "\n");
+        map<string, Entry>::const_iterator ei = this->entries.begin();
+        while (ei != this->entries.end()) {
+            stringstream ss;
+            ss << ei->first << "\t" << ei->second.mtime << "\t" << ei->second.size
+               << "\t" << ei->second.type << "\t";
+            map<string, string>::const_iterator si = ei->second.stateVariables.begin();
+            while (si != ei->second.stateVariables.end()) {
+                ss << si->first << "=" << si->second << ";";
+                ++si;
+            }
+            ss << "\n";
+            f.write (ss.str());
+            ++ei;
+        }
+        f.close();
+        Util::replaceFile (tmppath, this->cacheFile);
+        this->dirty = false;
+    } catch (const std::exception& e) {
+        // It's only a cache.
+        unlink (tmppath.c_str());
+    }
+}
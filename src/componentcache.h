@@ -0,0 +1,144 @@
+/*!
+ * A store of Components, backed by a persistent on-disk cache of
+ * their state variables.
+ */
+
+#ifndef _COMPONENTCACHE_H_
+#define _COMPONENTCACHE_H_
+
+#include <string>
+#include <map>
+#include <set>
+#include "component.h"
+
+namespace spineml
+{
+    /*!
+     * Holds the Components used by a model, keyed by component
+     * name. The Components are allocated once and owned by this
+     * object; nothing is copied.
+     *
+     * The only information preflight needs from a component's XML is
+     * its type and its state variables. These are kept in a cache
+     * file (by default ~/.cache/spineml_preflight/components), keyed
+     * by the absolute path of the component file along with its
+     * modification time and size. When a component file hasn't
+     * changed since it was last seen, the Component is built from
+     * the cache without reading or parsing the XML.
+     */
+    class ComponentCache
+    {
+    public:
+        ComponentCache();
+        ~ComponentCache();
+
+        /*!
+         * Use @param path as the cache file. An empty path, or
+         * "none", disables the on-disk cache.
+         */
+        void setCacheFile (const std::string& path);
+
+        /*!
+         * The default cache file: $XDG_CACHE_HOME/spineml_preflight/components
+         * or $HOME/.cache/spineml_preflight/components. Empty if
+         * neither variable is set.
+         */
+        static std::string defaultCacheFile (void);
+
+        /*!
+         * Return the Component called @param name, whose XML is
+         * @param dir + name + ".xml", reading it if necessary. Throws
+         * if the component can't be read.
+         */
+        spineml::Component* load (const std::string& dir, const std::string& name);
+
+        /*!
+         * Load all the components named in @param names from @param
+         * dir, so that later calls to load() find them ready. Those
+         * which are not in the cache file are read and parsed
+         * concurrently (when built with OpenMP). A component which
+         * fails to read is skipped here; load() will report the error
+         * when that component is needed.
+         */
+        void prefetch (const std::string& dir, const std::set<std::string>& names);
+
+        /*!
+         * Return the already loaded Component called @param
+         * name. Throws std::out_of_range if it hasn't been loaded.
+         */
+        spineml::Component* at (const std::string& name);
+
+        /*!
+         * @return true if the Component called @param name has been
+         * loaded.
+         */
+        bool count (const std::string& name) const;
+
+        /*!
+         * Write the cache file, if anything new was parsed. Errors
+         * are ignored; it's only a cache.
+         */
+        void save (void);
+
+    private:
+        //! Not copyable; the Components are owned here.
+        ComponentCache (const ComponentCache&);
+        ComponentCache& operator= (const ComponentCache&);
+
+        /*!
+         * What is stored in the cache file for one component file.
+         */
+        struct Entry {
+            //! File modification time, in ns
+            long long mtime;
+            //! File size in bytes
+            long long size;
+            //! Component type
+            std::string type;
+            //! State variable names and dimensions
+            std::map<std::string, std::string> stateVariables;
+        };
+
+        /*!
+         * Make the Component @param name from the cache file
+         * entry. Returns null if there is no up to date entry.
+         */
+        spineml::Component* fromCache (const std::string& dir, const std::string& name);
+
+        /*!
+         * Add the newly parsed Component @param c to @see components
+         * and record it in @see entries.
+         */
+        void addParsed (const std::string& dir, spineml::Component* c);
+
+        /*!
+         * Read the cache file into @see entries, once.
+         */
+        void readCacheFile (void);
+
+        /*!
+         * Get the absolute path, mtime and size of the file at
+         * @param path. Returns false if it can't be stat()ed.
+         */
+        static bool fileKey (const std::string& path, std::string& abspath,
+                             long long& mtime, long long& size);
+
+        //! The loaded Components, by name.
+        std::map<std::string, spineml::Component*> components;
+
+        //! The contents of the cache file, by absolute component file path.
+        std::map<std::string, Entry> entries;
+
+        //! Path to the cache file. Empty for no cache.
+        std::string cacheFile;
+
+        //! True once the cache file has been read.
+        bool cacheRead;
+
+        //! True if entries has changed since it was read.
+        bool dirty;
+    };
+
+} // namespace spineml
+
+#endif // _COMPONENTCACHE_H_
@@ -5,14 +5,49 @@
  */
 
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "rng.h"
 #include "rapidxml.hpp"
 #include "rapidxml_print.hpp"
 #include "connection_list.h"
+#include "coupledsampler.h"
+#include "distanceconnectivity.h"
+#include "rowsampler.h"
+#include "metrics.h"
+#include "trace.h"
+
+/*!
+ * The number of rows of a fixed number connection generated by each
+ * RowSampler, which costs one integer per neuron to set up.
+ */
+#define FIXEDNUMBER_BLOCK 1024
+
+/*!
+ * The number of delays written at a time by streamFixedNumber.
+ */
+#define STREAM_DELAY_CHUNK 4096
+
+/*!
+ * The number of rows of a distance-based connection generated in
+ * each block; a block's rows are kept together until all the blocks
+ * are done.
+ */
+#define DISTANCE_BLOCK 256
+
+/*!
+ * The number of rows of a distance-based connection sampled to
+ * estimate its size for the memory budget.
+ */
+#define DISTANCE_MEMORY_ROWS 1000
 
 using namespace std;
 using namespace rapidxml;
@@ -27,6 +62,12 @@ ConnectionList::ConnectionList ()
     , delayRangeMax(0)
     , delayDistributionSeed(123)
     , delayDimension("")
+    , separateDelays(false)
+    , coupledSampling(false)
+    , noAutapses(false)
+    , samplingCache("")
+    , threads(1)
+    , memory(MemoryUse::ConnectionLists)
 {
 }
 
@@ -39,6 +80,12 @@ ConnectionList::ConnectionList (unsigned int srcNum, unsigned int dstNum)
     , delayRangeMax(0)
     , delayDistributionSeed(123)
     , delayDimension("")
+    , separateDelays(false)
+    , coupledSampling(false)
+    , noAutapses(false)
+    , samplingCache("")
+    , threads(1)
+    , memory(MemoryUse::ConnectionLists)
 {
     // run through connections, creating connectivity pattern:
     this->connectivityS2C.reserve (srcNum); // probably src_num.
@@ -57,6 +104,9 @@ ConnectionList::write (xml_node<>* into_node, const string& model_root,
 void
 ConnectionList::generateDelays (void)
 {
+    Metrics::Scope ms (Metrics::Phase, "delays");
+    Trace::Scope ts ("generateDelays");
+    ts.arg ("connections", this->connectivityC2D.size());
     // First, how many connections do we have? It's assumed
     // that generateFixedProbability was called first to
     // generate the connectivity maps.
@@ -64,9 +114,11 @@ ConnectionList::generateDelays (void)
     switch (this->delayDistributionType) {
     case spineml::Dist_Normal:
         this->generateNormalDelays();
+        ms.count (this->connectivityC2Delay.size());
         break;
     case spineml::Dist_Uniform:
         this->generateUniformDelays();
+        ms.count (this->connectivityC2Delay.size());
         break;
     case spineml::Dist_FixedValue:
     default:
@@ -76,38 +128,25 @@ ConnectionList::generateDelays (void)
         // data.
         break;
     }
+    this->account();
 }
 
 void
 ConnectionList::generateFixedProbability (const int& seed, const float& probability,
                                           const unsigned int& srcNum, const unsigned int& dstNum)
 {
+    Metrics::Scope ms (Metrics::Phase, "connectivity");
+    Trace::Scope ts ("generateFixedProbability");
+    ts.arg ("src_num", srcNum);
+    ts.arg ("dst_num", dstNum);
+    ts.arg ("probability", probability);
     this->connectivityS2C.reserve (srcNum); // probably src_num.
     this->connectivityS2C.resize (srcNum);  // We have to resize connectivityS2C here.
     this->connectivityC2D.reserve (dstNum); // probably num from dst_population
 
     RngData rngData;
     rngDataInit (&rngData);
-
-    // seed the rng: 2 questions about origin code. Why the additional
-    // 1 in front of the seed in 2nd arg to zigset, and why was
-    // rngData.seed hardcoded to 123? I think it basically doesn't
-    // matter, and the seed to zigset is different from the one to
-    // rngData.seed.
-    //
-    // Here, I've reproduced the exact behaviour of
-    // SpineML_2_BRAHMS_CL_weight.xsl around line 271
-    //
-    // Update: 20160220. This must have been implemented (the extra
-    // "1") to get around the problem that a zero seed is INCOMPATIBLE
-    // with the rng.h code.
-    int zigset_seed = 0; // BAD, but gets updated.
-    {
-        stringstream seed_ss;
-        seed_ss << "1" << seed; // "1" then the seed. So for seed=123, we pass 1123 to zigset_seed.
-        seed_ss >> zigset_seed;
-    }
-    zigset (&rngData, zigset_seed);
+    zigset (&rngData, ConnectionList::fixedProbabilityZigsetSeed (seed));
     rngData.seed = 123; // Hardcoded, as in SpineML_2_BRAHMS_CL_weight.xsl around line 272
 
     // run through connections, creating connectivity pattern:
@@ -118,9 +157,41 @@ ConnectionList::generateFixedProbability (const int& seed, const float& probabil
     for (unsigned int i = 0; i < this->connectivityS2C.size(); ++i) {
         this->connectivityS2C[i].reserve((int) round(dstNum*probability));
     }
+    this->account();
+    if (this->coupledSampling) {
+        CoupledSampler sampler (seed, srcNum, dstNum);
+        if (!this->samplingCache.empty()) {
+            sampler.load (this->samplingCache);
+        }
+        vector<int> row;
+        for (unsigned int srcIndex = 0; srcIndex < srcNum; ++srcIndex) {
+            sampler.row (srcIndex, probability, row);
+            for (vector<int>::const_iterator d = row.begin(); d != row.end(); ++d) {
+                if (this->noAutapses && *d == static_cast<int>(srcIndex)) {
+                    continue;
+                }
+                this->connectivityC2D.push_back (*d);
+                this->connectivityS2C[srcIndex].push_back (this->connectivityC2D.size()-1);
+            }
+        }
+        if (!this->samplingCache.empty()) {
+            sampler.save (this->samplingCache);
+        }
+        this->account();
+        ms.count (this->connectivityC2D.size());
+        ts.arg ("connections", this->connectivityC2D.size());
+        return;
+    }
+
+    // Memory held other than by connectivityC2D while it grows.
+    double otherBytes = this->memory.bytes()
+        - static_cast<double>(this->connectivityC2D.capacity() * sizeof(int));
     for (unsigned int srcIndex = 0; srcIndex < srcNum; ++srcIndex) {
         for (unsigned int dstIndex = 0; dstIndex < dstNum; ++dstIndex) {
-            if (UNI(&rngData) < probability) {
+            // The draw for an autapse is still made, so that every
+            // other pair is connected as it would be without noAutapses.
+            if (UNI(&rngData) < probability
+                && !(this->noAutapses && dstIndex == srcIndex)) {
                 this->connectivityC2D.push_back(dstIndex);
 #ifdef DEBUG
                 cout << "Pushing back connection " << (this->connectivityC2D.size()-1)
@@ -132,69 +203,592 @@ ConnectionList::generateFixedProbability (const int& seed, const float& probabil
             }
         }
         if (float(this->connectivityC2D.size()) > 0.9*float(this->connectivityC2D.capacity())) {
+            // reserve() holds the old and the new storage at once.
+            size_t oldcap = this->connectivityC2D.capacity();
+            this->memory.set (otherBytes + static_cast<double>((2*oldcap + dstNum) * sizeof(int)));
             this->connectivityC2D.reserve(this->connectivityC2D.capacity()+dstNum);
+            this->memory.set (otherBytes
+                              + static_cast<double>(this->connectivityC2D.capacity() * sizeof(int)));
         }
     }
+    this->account();
+    ms.count (this->connectivityC2D.size());
+    ts.arg ("connections", this->connectivityC2D.size());
 }
 
 void
-ConnectionList::generateNormalDelays (void)
+ConnectionList::generateFixedNumber (const int& seed, const unsigned int& number, bool pre,
+                                     const unsigned int& srcNum, const unsigned int& dstNum)
 {
-    RngData rngData;
-    rngDataInit (&rngData);
-
-    // The zigset seed is a different seed from the rngData.seed:
-    zigset (&rngData, static_cast<unsigned int>(this->delayDistributionSeed+1));
-    rngData.seed = static_cast<int>(this->delayDistributionSeed);
-
-    float max_delay_val = 0;
+    Metrics::Scope ms (Metrics::Phase, "connectivity");
+    Trace::Scope ts ("generateFixedNumber");
+    ts.arg ("src_num", srcNum);
+    ts.arg ("dst_num", dstNum);
+    ts.arg ("number", number);
+
+    unsigned int candidates = this->fixedNumberCandidates (number, pre, srcNum, dstNum);
+    unsigned int numRows = pre ? dstNum : srcNum;
+
+    // The neurons chosen for each row, one row after another.
+    size_t total = static_cast<size_t>(numRows) * number;
+    this->memory.set (this->memoryBytes() + static_cast<double>(total * sizeof(int)));
+    vector<int> chosen;
+    this->chooseFixedNumberRows (seed, candidates, number, 0, numRows, chosen);
+
+    this->connectivityS2C.clear();
+    this->connectivityS2C.resize (srcNum);
+    if (pre) {
+        // Rows are destinations; gather them by source, keeping the
+        // destinations of each source in ascending order.
+        vector<size_t> offsets (srcNum + 1, 0);
+        for (size_t i = 0; i < total; ++i) {
+            ++offsets[chosen[i] + 1];
+        }
+        for (unsigned int s = 0; s < srcNum; ++s) {
+            offsets[s+1] += offsets[s];
+        }
+        this->connectivityC2D.assign (total, 0);
+        vector<size_t> next (offsets.begin(), offsets.end() - 1);
+        for (unsigned int d = 0; d < dstNum; ++d) {
+            for (unsigned int i = 0; i < number; ++i) {
+                this->connectivityC2D[next[chosen[static_cast<size_t>(d) * number + i]]++] = d;
+            }
+        }
+        for (unsigned int s = 0; s < srcNum; ++s) {
+            this->connectivityS2C[s].reserve (offsets[s+1] - offsets[s]);
+            for (size_t c = offsets[s]; c < offsets[s+1]; ++c) {
+                this->connectivityS2C[s].push_back (static_cast<int>(c));
+            }
+        }
+    } else {
+        // Rows are sources, already in order.
+        this->connectivityC2D.swap (chosen);
+        for (unsigned int s = 0; s < srcNum; ++s) {
+            this->connectivityS2C[s].reserve (number);
+            for (unsigned int i = 0; i < number; ++i) {
+                this->connectivityS2C[s].push_back (static_cast<int>(static_cast<size_t>(s) * number + i));
+            }
+        }
+    }
+    vector<int>().swap (chosen);
+    this->account();
+    ms.count (this->connectivityC2D.size());
+    ts.arg ("connections", this->connectivityC2D.size());
+}
 
-    this->connectivityC2Delay.resize (this->connectivityC2D.size());
+void
+ConnectionList::generateDistanceBased (const DistanceConnectivity& dc)
+{
+    Metrics::Scope ms (Metrics::Phase, "connectivity");
+    Trace::Scope ts ("generateDistanceBased");
+    ts.arg ("src_num", dc.srcNum);
+    ts.arg ("dst_num", dc.dstNum);
+
+    const unsigned int srcNum = dc.srcNum;
+    int nblocks = static_cast<int>((srcNum + DISTANCE_BLOCK - 1) / DISTANCE_BLOCK);
+    // Each block's destinations, one row after another, and the
+    // length of each row.
+    vector<vector<int> > blockDsts (nblocks);
+    vector<vector<unsigned int> > blockLengths (nblocks);
+#pragma omp parallel for schedule(dynamic) num_threads(this->threads)
+    for (int b = 0; b < nblocks; ++b) {
+        vector<int> row;
+        unsigned int first = static_cast<unsigned int>(b) * DISTANCE_BLOCK;
+        unsigned int last = first + DISTANCE_BLOCK < srcNum ? first + DISTANCE_BLOCK : srcNum;
+        for (unsigned int s = first; s < last; ++s) {
+            dc.row (s, row);
+            if (this->noAutapses) {
+                row.erase (remove (row.begin(), row.end(), static_cast<int>(s)), row.end());
+            }
+            blockDsts[b].insert (blockDsts[b].end(), row.begin(), row.end());
+            blockLengths[b].push_back (static_cast<unsigned int>(row.size()));
+        }
+    }
 
-    for (unsigned int i = 0; i < this->connectivityC2Delay.size(); ++i) {
+    size_t total = 0;
+    for (int b = 0; b < nblocks; ++b) {
+        total += blockDsts[b].size();
+    }
+    this->connectivityS2C.clear();
+    this->connectivityS2C.resize (srcNum);
+    this->connectivityC2D.clear();
+    this->connectivityC2D.reserve (total);
+    this->memory.set (this->memoryBytes() + static_cast<double>(total * sizeof(int)));
+    unsigned int s = 0;
+    for (int b = 0; b < nblocks; ++b) {
+        vector<int>::const_iterator d = blockDsts[b].begin();
+        for (size_t r = 0; r < blockLengths[b].size(); ++r, ++s) {
+            this->connectivityS2C[s].reserve (blockLengths[b][r]);
+            for (unsigned int i = 0; i < blockLengths[b][r]; ++i, ++d) {
+                this->connectivityS2C[s].push_back (static_cast<int>(this->connectivityC2D.size()));
+                this->connectivityC2D.push_back (*d);
+            }
+        }
+        vector<int>().swap (blockDsts[b]);
+    }
+    this->account();
+    ms.count (this->connectivityC2D.size());
+    ts.arg ("connections", this->connectivityC2D.size());
+}
 
-        // NB: delayVariance and delayMean HAVE to be in
-        // milliseconds. this->delayVariance and this->delayMean are
-        // assumed to have dimension ms.
-        this->connectivityC2Delay[i] = (RNOR(&rngData) * this->delayVariance + this->delayMean);
+unsigned int
+ConnectionList::fixedNumberCandidates (unsigned int number, bool pre,
+                                       unsigned int srcNum, unsigned int dstNum) const
+{
+    unsigned int rowFrom = pre ? srcNum : dstNum;
+    // Without autapses, row r is chosen from the other rowFrom-1
+    // neurons, numbered as if r weren't there, so that each row
+    // still has number connections.
+    unsigned int candidates = rowFrom;
+    if (this->noAutapses && candidates > 0) {
+        --candidates;
+    }
+    if (number > candidates) {
+        stringstream ee;
+        ee << "Can't choose " << number << " distinct "
+           << (pre ? "source" : "destination") << " neurons from a population of " << rowFrom
+           << (this->noAutapses ? " without autapses." : ".");
+        throw runtime_error (ee.str());
+    }
+    return candidates;
+}
 
-        if (this->connectivityC2Delay[i] < 0) {
-            this->connectivityC2Delay[i] = 0;
+void
+ConnectionList::chooseFixedNumberRows (int seed, unsigned int candidates, unsigned int number,
+                                       unsigned int first, unsigned int last,
+                                       vector<int>& chosen) const
+{
+    chosen.resize (static_cast<size_t>(last - first) * number);
+    int nblocks = static_cast<int>((last - first + FIXEDNUMBER_BLOCK - 1) / FIXEDNUMBER_BLOCK);
+#pragma omp parallel for schedule(dynamic) num_threads(this->threads)
+    for (int b = 0; b < nblocks; ++b) {
+        RowSampler sampler (seed, candidates);
+        vector<int> row;
+        unsigned int bfirst = first + static_cast<unsigned int>(b) * FIXEDNUMBER_BLOCK;
+        unsigned int blast = last - bfirst > FIXEDNUMBER_BLOCK ? bfirst + FIXEDNUMBER_BLOCK : last;
+        for (unsigned int r = bfirst; r < blast; ++r) {
+            sampler.choose (r, number, row);
+            if (this->noAutapses) {
+                // Still in ascending order.
+                for (vector<int>::iterator i = row.begin(); i != row.end(); ++i) {
+                    if (*i >= static_cast<int>(r)) {
+                        ++(*i);
+                    }
+                }
+            }
+            copy (row.begin(), row.end(), chosen.begin() + static_cast<size_t>(r - first) * number);
         }
+    }
+}
 
-        if (this->connectivityC2Delay[i] > max_delay_val) {
-            max_delay_val = this->connectivityC2Delay[i];
+void
+ConnectionList::openStreamFiles (const string& path, ofstream& f, ofstream& df) const
+{
+    f.open (path.c_str(), ios::out|ios::trunc);
+    if (!f.is_open()) {
+        stringstream ee;
+        ee << __FUNCTION__ << " Failed to open file '" << path << "' for writing.";
+        throw runtime_error (ee.str());
+    }
+    cout << "Preflight: Opened connection binary file " << path << endl;
+    bool explicitDelays = (this->delayDistributionType == spineml::Dist_Normal
+                           || this->delayDistributionType == spineml::Dist_Uniform);
+    if (explicitDelays && this->separateDelays) {
+        string dpath = ConnectionList::delayFileName (path);
+        df.open (dpath.c_str(), ios::out|ios::trunc);
+        if (!df.is_open()) {
+            stringstream ee;
+            ee << __FUNCTION__ << " Failed to open file '" << dpath << "' for writing.";
+            throw runtime_error (ee.str());
         }
     }
 }
 
 void
-ConnectionList::generateUniformDelays (void)
+ConnectionList::writeStreamedRow (int src, const int* dsts, size_t n,
+                                  ofstream& f, ofstream& df, RngData* rd,
+                                  vector<char>& rowbuf, vector<float>& delaybuf) const
+{
+    bool explicitDelays = (this->delayDistributionType == spineml::Dist_Normal
+                           || this->delayDistributionType == spineml::Dist_Uniform);
+    bool delayColumn = explicitDelays && !this->separateDelays;
+    size_t recsz = delayColumn ? 2*sizeof(int)+sizeof(float) : 2*sizeof(int);
+    // Write the row out in one go.
+    rowbuf.resize (n * recsz);
+    delaybuf.clear();
+    char* p = rowbuf.empty() ? (char*)0 : &rowbuf[0];
+    for (size_t i = 0; i < n; ++i) {
+        memcpy (p, &src, sizeof(int)); p += sizeof(int);
+        memcpy (p, &dsts[i], sizeof(int)); p += sizeof(int);
+        if (explicitDelays) {
+            float delay = this->nextDelay (rd);
+            if (delayColumn) {
+                memcpy (p, &delay, sizeof(float)); p += sizeof(float);
+            } else {
+                delaybuf.push_back (delay);
+            }
+        }
+    }
+    if (!rowbuf.empty() && f.is_open()) {
+        f.write (&rowbuf[0], rowbuf.size());
+    }
+    if (!delaybuf.empty() && df.is_open()) {
+        df.write (reinterpret_cast<const char*>(&delaybuf[0]), delaybuf.size() * sizeof(float));
+    }
+}
+
+unsigned int
+ConnectionList::streamFixedProbability (const int& seed, const float& probability,
+                                        const unsigned int& srcNum, const unsigned int& dstNum,
+                                        const string& path)
 {
+    Metrics::Scope ms (Metrics::Phase, "connectivity");
+    // Set up the connectivity RNG exactly as generateFixedProbability does.
     RngData rngData;
     rngDataInit (&rngData);
+    zigset (&rngData, ConnectionList::fixedProbabilityZigsetSeed (seed));
+    rngData.seed = 123;
+
+    // Delays are drawn in connection index order, which for a fixed
+    // probability connection is the order in which they're written.
+    bool explicitDelays = (this->delayDistributionType == spineml::Dist_Normal
+                           || this->delayDistributionType == spineml::Dist_Uniform);
+    RngData delayRngData;
+    if (explicitDelays) {
+        this->initDelayRng (&delayRngData);
+    }
 
-    // The zigset seed is a different seed from the rngData.seed:
-    zigset (&rngData, static_cast<unsigned int>(this->delayDistributionSeed+1));
-    rngData.seed = static_cast<int>(this->delayDistributionSeed);
+    ofstream f;
+    ofstream df;
+    if (!path.empty()) {
+        this->openStreamFiles (path, f, df);
+    }
 
-    this->connectivityC2Delay.resize (this->connectivityC2D.size());
+    unsigned int numConnections = 0;
+    vector<int> row;
+    row.reserve ((int) round(dstNum*probability));
+    vector<char> rowbuf;
+    vector<float> delaybuf;
+    CoupledSampler sampler (seed, srcNum, dstNum);
+    for (unsigned int srcIndex = 0; srcIndex < srcNum; ++srcIndex) {
+        row.clear();
+        if (this->coupledSampling) {
+            sampler.row (srcIndex, probability, row);
+            if (this->noAutapses) {
+                row.erase (remove (row.begin(), row.end(), static_cast<int>(srcIndex)), row.end());
+            }
+        } else {
+            for (unsigned int dstIndex = 0; dstIndex < dstNum; ++dstIndex) {
+                if (UNI(&rngData) < probability
+                    && !(this->noAutapses && dstIndex == srcIndex)) {
+                    row.push_back (dstIndex);
+                }
+            }
+        }
+        this->writeStreamedRow (static_cast<int>(srcIndex), row.empty() ? (const int*)0 : &row[0],
+                                row.size(), f, df, &delayRngData, rowbuf, delaybuf);
+        numConnections += row.size();
+    }
+    this->memory.set (static_cast<double>(row.capacity() * sizeof(int) + rowbuf.capacity()
+                                          + delaybuf.capacity() * sizeof(float)));
+    f.close();
+    df.close();
 
-    float max_delay_val = 0;
+    if (numConnections == 0) {
+        cout << "Preflight: WARNING: no connectivity between source and destination populations!\n";
+    }
+    ms.count (numConnections, this->binaryFileSize (numConnections));
 
-    for (unsigned int i = 0; i < this->connectivityC2Delay.size(); ++i) {
+    return numConnections;
+}
 
-        this->connectivityC2Delay[i] = (_randomUniform(&rngData)
-                                        * (this->delayRangeMax - this->delayRangeMin)
-                                        + this->delayRangeMin);
+unsigned int
+ConnectionList::streamFixedNumber (const int& seed, const unsigned int& number, bool pre,
+                                   const unsigned int& srcNum, const unsigned int& dstNum,
+                                   const string& path)
+{
+    Metrics::Scope ms (Metrics::Phase, "connectivity");
+    Trace::Scope ts ("streamFixedNumber");
+    ts.arg ("src_num", srcNum);
+    ts.arg ("dst_num", dstNum);
+    ts.arg ("number", number);
+    unsigned int candidates = this->fixedNumberCandidates (number, pre, srcNum, dstNum);
+    unsigned int numRows = pre ? dstNum : srcNum;
+    size_t total = static_cast<size_t>(numRows) * number;
+    if (path.empty()) {
+        // Every row has number connections.
+        return static_cast<unsigned int>(total);
+    }
 
-        if (this->connectivityC2Delay[i] < 0) {
-            this->connectivityC2Delay[i] = 0;
+    // Delays are drawn in connection index order, which is the order
+    // of the file.
+    bool explicitDelays = (this->delayDistributionType == spineml::Dist_Normal
+                           || this->delayDistributionType == spineml::Dist_Uniform);
+    bool delayColumn = explicitDelays && !this->separateDelays;
+    RngData delayRngData;
+    if (explicitDelays) {
+        this->initDelayRng (&delayRngData);
+    }
+
+    ofstream f;
+    ofstream df;
+    this->openStreamFiles (path, f, df);
+    if (total == 0) {
+        cout << "Preflight: WARNING: no connectivity between source and destination populations!\n";
+    }
+
+    // Rows are generated a block per thread at a time.
+    const unsigned int batch = FIXEDNUMBER_BLOCK * (this->threads > 0 ? this->threads : 1);
+    vector<int> chosen;
+    vector<size_t> next;
+    if (!pre) {
+        // Rows are sources, so they go straight out in order.
+        vector<char> rowbuf;
+        vector<float> delaybuf;
+        for (unsigned int first = 0; first < numRows;) {
+            unsigned int last = numRows - first > batch ? first + batch : numRows;
+            this->chooseFixedNumberRows (seed, candidates, number, first, last, chosen);
+            for (unsigned int r = first; r < last; ++r) {
+                this->writeStreamedRow (static_cast<int>(r), &chosen[static_cast<size_t>(r - first) * number],
+                                        number, f, df, &delayRngData, rowbuf, delaybuf);
+            }
+            first = last;
         }
+        this->memory.set (static_cast<double>(chosen.capacity() * sizeof(int) + rowbuf.capacity()
+                                              + delaybuf.capacity() * sizeof(float)));
+        f.close();
+        df.close();
+        ms.count (total, this->binaryFileSize (static_cast<double>(total)));
+        return static_cast<unsigned int>(total);
+    }
 
-        if (this->connectivityC2Delay[i] > max_delay_val) {
-            max_delay_val = this->connectivityC2Delay[i];
+    // Rows are destinations, but the file is grouped by source. Count
+    // each source's connections, then choose the rows again and put
+    // each connection straight into its slot, through a memory map.
+    // A source's destinations are in ascending order, as
+    // generateFixedNumber leaves them.
+    f.close();
+    next.assign (srcNum, 0);
+    for (unsigned int first = 0; first < numRows;) {
+        unsigned int last = numRows - first > batch ? first + batch : numRows;
+        this->chooseFixedNumberRows (seed, candidates, number, first, last, chosen);
+        for (vector<int>::const_iterator i = chosen.begin(); i != chosen.end(); ++i) {
+            ++next[*i];
         }
+        first = last;
+    }
+    size_t offset = 0;
+    for (unsigned int s = 0; s < srcNum; ++s) {
+        size_t n = next[s];
+        next[s] = offset;
+        offset += n;
+    }
+
+    const size_t recsz = delayColumn ? 2*sizeof(int)+sizeof(float) : 2*sizeof(int);
+    if (total > 0) {
+        int fd = open (path.c_str(), O_RDWR);
+        char* mapped = (char*)MAP_FAILED;
+        if (fd < 0 || ftruncate (fd, total * recsz)
+            || (mapped = static_cast<char*>(mmap (0, total * recsz, PROT_READ|PROT_WRITE,
+                                                  MAP_SHARED, fd, 0))) == MAP_FAILED) {
+            stringstream ee;
+            ee << __FUNCTION__ << " Failed to write '" << path << "': " << strerror (errno);
+            if (fd >= 0) {
+                close (fd);
+            }
+            throw runtime_error (ee.str());
+        }
+        for (unsigned int first = 0; first < numRows;) {
+            unsigned int last = numRows - first > batch ? first + batch : numRows;
+            this->chooseFixedNumberRows (seed, candidates, number, first, last, chosen);
+            vector<int>::const_iterator i = chosen.begin();
+            for (unsigned int r = first; r < last; ++r) {
+                int d = static_cast<int>(r);
+                for (unsigned int k = 0; k < number; ++k, ++i) {
+                    char* p = mapped + next[*i]++ * recsz;
+                    memcpy (p, &(*i), sizeof(int));
+                    memcpy (p + sizeof(int), &d, sizeof(int));
+                }
+            }
+            first = last;
+        }
+        if (explicitDelays) {
+            vector<float> delaybuf;
+            delaybuf.reserve (STREAM_DELAY_CHUNK);
+            for (size_t c = 0; c < total; ++c) {
+                float delay = this->nextDelay (&delayRngData);
+                if (delayColumn) {
+                    memcpy (mapped + c * recsz + 2*sizeof(int), &delay, sizeof(float));
+                    continue;
+                }
+                delaybuf.push_back (delay);
+                if (delaybuf.size() == STREAM_DELAY_CHUNK || c + 1 == total) {
+                    df.write (reinterpret_cast<const char*>(&delaybuf[0]),
+                              delaybuf.size() * sizeof(float));
+                    delaybuf.clear();
+                }
+            }
+        }
+        munmap (mapped, total * recsz);
+        close (fd);
+    }
+    this->memory.set (static_cast<double>(chosen.capacity() * sizeof(int)
+                                          + next.capacity() * sizeof(size_t)));
+    df.close();
+    ms.count (total, this->binaryFileSize (static_cast<double>(total)));
+    return static_cast<unsigned int>(total);
+}
+
+unsigned int
+ConnectionList::streamDistanceBased (const DistanceConnectivity& dc, const string& path)
+{
+    Metrics::Scope ms (Metrics::Phase, "connectivity");
+    Trace::Scope ts ("streamDistanceBased");
+    ts.arg ("src_num", dc.srcNum);
+    ts.arg ("dst_num", dc.dstNum);
+
+    bool explicitDelays = (this->delayDistributionType == spineml::Dist_Normal
+                           || this->delayDistributionType == spineml::Dist_Uniform);
+    RngData delayRngData;
+    if (explicitDelays) {
+        this->initDelayRng (&delayRngData);
+    }
+    ofstream f;
+    ofstream df;
+    if (!path.empty()) {
+        this->openStreamFiles (path, f, df);
+    }
+
+    // As generateDistanceBased, a block of rows per thread at a time,
+    // each written out once all the rows before it have been.
+    const unsigned int srcNum = dc.srcNum;
+    const int batch = static_cast<int>(this->threads > 0 ? this->threads : 1);
+    vector<vector<int> > blockDsts (batch);
+    vector<vector<unsigned int> > blockLengths (batch);
+    vector<char> rowbuf;
+    vector<float> delaybuf;
+    size_t numConnections = 0;
+    for (unsigned int first = 0; first < srcNum;) {
+        unsigned int last = (srcNum - first) / DISTANCE_BLOCK >= static_cast<unsigned int>(batch)
+            ? first + batch * DISTANCE_BLOCK : srcNum;
+        int nblocks = static_cast<int>((last - first + DISTANCE_BLOCK - 1) / DISTANCE_BLOCK);
+#pragma omp parallel for schedule(dynamic) num_threads(this->threads)
+        for (int b = 0; b < nblocks; ++b) {
+            vector<int> row;
+            blockDsts[b].clear();
+            blockLengths[b].clear();
+            unsigned int bfirst = first + static_cast<unsigned int>(b) * DISTANCE_BLOCK;
+            unsigned int blast = last - bfirst > DISTANCE_BLOCK ? bfirst + DISTANCE_BLOCK : last;
+            for (unsigned int s = bfirst; s < blast; ++s) {
+                dc.row (s, row);
+                if (this->noAutapses) {
+                    row.erase (remove (row.begin(), row.end(), static_cast<int>(s)), row.end());
+                }
+                blockDsts[b].insert (blockDsts[b].end(), row.begin(), row.end());
+                blockLengths[b].push_back (static_cast<unsigned int>(row.size()));
+            }
+        }
+        unsigned int s = first;
+        for (int b = 0; b < nblocks; ++b) {
+            size_t d = 0;
+            for (size_t r = 0; r < blockLengths[b].size(); ++r, ++s) {
+                this->writeStreamedRow (static_cast<int>(s),
+                                        blockLengths[b][r] ? &blockDsts[b][d] : (const int*)0,
+                                        blockLengths[b][r], f, df, &delayRngData, rowbuf, delaybuf);
+                d += blockLengths[b][r];
+            }
+            numConnections += d;
+        }
+        first = last;
+    }
+    double held = static_cast<double>(rowbuf.capacity() + delaybuf.capacity() * sizeof(float));
+    for (int b = 0; b < batch; ++b) {
+        held += static_cast<double>(blockDsts[b].capacity() * sizeof(int)
+                                    + blockLengths[b].capacity() * sizeof(unsigned int));
+    }
+    this->memory.set (held);
+    f.close();
+    df.close();
+
+    if (numConnections == 0 && !path.empty()) {
+        cout << "Preflight: WARNING: no connectivity between source and destination populations!\n";
+    }
+    ms.count (numConnections, this->binaryFileSize (static_cast<double>(numConnections)));
+    return static_cast<unsigned int>(numConnections);
+}
+
+unsigned int
+ConnectionList::fixedProbabilityZigsetSeed (const int& seed)
+{
+    // seed the rng: 2 questions about origin code. Why the additional
+    // 1 in front of the seed in 2nd arg to zigset, and why was
+    // rngData.seed hardcoded to 123? I think it basically doesn't
+    // matter, and the seed to zigset is different from the one to
+    // rngData.seed.
+    //
+    // Here, I've reproduced the exact behaviour of
+    // SpineML_2_BRAHMS_CL_weight.xsl around line 271
+    //
+    // Update: 20160220. This must have been implemented (the extra
+    // "1") to get around the problem that a zero seed is INCOMPATIBLE
+    // with the rng.h code.
+    int zigset_seed = 0; // BAD, but gets updated.
+    stringstream seed_ss;
+    seed_ss << "1" << seed; // "1" then the seed. So for seed=123, we pass 1123 to zigset_seed.
+    seed_ss >> zigset_seed;
+    return zigset_seed;
+}
+
+void
+ConnectionList::initDelayRng (RngData* rd) const
+{
+    rngDataInit (rd);
+    // The zigset seed is a different seed from the rngData.seed:
+    zigset (rd, static_cast<unsigned int>(this->delayDistributionSeed+1));
+    rd->seed = static_cast<int>(this->delayDistributionSeed);
+}
+
+float
+ConnectionList::nextDelay (RngData* rd) const
+{
+    float delay = 0;
+    if (this->delayDistributionType == spineml::Dist_Normal) {
+        // NB: delayVariance and delayMean HAVE to be in
+        // milliseconds. this->delayVariance and this->delayMean are
+        // assumed to have dimension ms.
+        delay = (RNOR(rd) * this->delayVariance + this->delayMean);
+    } else if (this->delayDistributionType == spineml::Dist_Uniform) {
+        delay = (_randomUniform(rd)
+                 * (this->delayRangeMax - this->delayRangeMin)
+                 + this->delayRangeMin);
+    }
+    if (delay < 0) {
+        delay = 0;
+    }
+    return delay;
+}
+
+void
+ConnectionList::generateNormalDelays (void)
+{
+    RngData rngData;
+    this->initDelayRng (&rngData);
+
+    this->connectivityC2Delay.resize (this->connectivityC2D.size());
+    for (unsigned int i = 0; i < this->connectivityC2Delay.size(); ++i) {
+        this->connectivityC2Delay[i] = this->nextDelay (&rngData);
+    }
+}
+
+void
+ConnectionList::generateUniformDelays (void)
+{
+    RngData rngData;
+    this->initDelayRng (&rngData);
+
+    this->connectivityC2Delay.resize (this->connectivityC2D.size());
+    for (unsigned int i = 0; i < this->connectivityC2Delay.size(); ++i) {
+        this->connectivityC2Delay[i] = this->nextDelay (&rngData);
     }
 }
 
@@ -206,6 +800,10 @@ ConnectionList::writeBinary (xml_node<>* into_node,
                              const string& model_root,
                              const string& binary_file_name)
 {
+    Metrics::Scope ms (Metrics::Phase, "binary_write");
+    Trace::Scope ts ("writeBinary");
+    ts.arg ("file", binary_file_name);
+    ts.arg ("connections", this->connectivityC2D.size());
     if (this->delayDistributionType != spineml::Dist_FixedValue
         && this->connectivityC2Delay.size() != this->connectivityC2D.size()) {
         stringstream ee;
@@ -230,6 +828,18 @@ ConnectionList::writeBinary (xml_node<>* into_node,
     }
     cout << "Preflight: Opened connection binary file " << path << endl;
 
+    bool explicitDelays = (this->delayDistributionType != spineml::Dist_FixedValue);
+    ofstream df;
+    if (explicitDelays && this->separateDelays) {
+        string dpath = model_root + ConnectionList::delayFileName (binary_file_name);
+        df.open (dpath.c_str(), ios::out|ios::trunc);
+        if (!df.is_open()) {
+            stringstream ee;
+            ee << __FUNCTION__ << " Failed to open file '" << dpath << "' for writing.";
+            throw runtime_error (ee.str());
+        }
+    }
+
     if (this->connectivityC2D.empty()) {
         cout << "Preflight: WARNING: no connectivity between source and destination populations!\n";
     }
@@ -243,8 +853,9 @@ ConnectionList::writeBinary (xml_node<>* into_node,
             // File output
             f.write (reinterpret_cast<const char*>(&(s_idx)), sizeof(int));
             f.write (reinterpret_cast<const char*>(&(this->connectivityC2D[*c])), sizeof(int));
-            if (this->delayDistributionType != spineml::Dist_FixedValue) {
-                f.write (reinterpret_cast<const char*>(&(this->connectivityC2Delay[*c])), sizeof(float));
+            if (explicitDelays) {
+                ostream& o = this->separateDelays ? static_cast<ostream&>(df) : f;
+                o.write (reinterpret_cast<const char*>(&(this->connectivityC2Delay[*c])), sizeof(float));
             }
             ++c;
         }
@@ -252,7 +863,102 @@ ConnectionList::writeBinary (xml_node<>* into_node,
         ++s;
         ++s_idx;
     }
+    ms.count (this->connectivityC2D.size(), this->binaryFileSize (this->connectivityC2D.size()));
     f.close();
+    df.close();
+}
+
+string
+ConnectionList::delayFileName (const string& binary_file_name)
+{
+    string name (binary_file_name);
+    string::size_type dot = name.rfind ('.');
+    string::size_type slash = name.rfind ('/');
+    if (dot == string::npos || (slash != string::npos && dot < slash)) {
+        return name + "_delays";
+    }
+    return name.substr (0, dot) + "_delays" + name.substr (dot);
+}
+
+double
+ConnectionList::binaryFileSize (double num_connections) const
+{
+    size_t recsz = 2 * sizeof(int);
+    if (this->delayDistributionType != spineml::Dist_FixedValue) {
+        recsz += sizeof(float);
+    }
+    return num_connections * recsz;
+}
+
+double
+ConnectionList::memoryBytes (void) const
+{
+    double b = static_cast<double>(this->connectivityC2D.capacity() * sizeof(int)
+                                   + this->connectivityC2Delay.capacity() * sizeof(float)
+                                   + this->connectivityC2S.capacity() * sizeof(int)
+                                   + this->connectivityS2C.capacity() * sizeof(vector<int>)
+                                   + this->connectivityD2C.capacity() * sizeof(vector<int>));
+    vector<vector<int> >::const_iterator i = this->connectivityS2C.begin();
+    while (i != this->connectivityS2C.end()) {
+        b += static_cast<double>(i->capacity() * sizeof(int));
+        ++i;
+    }
+    i = this->connectivityD2C.begin();
+    while (i != this->connectivityD2C.end()) {
+        b += static_cast<double>(i->capacity() * sizeof(int));
+        ++i;
+    }
+    return b;
+}
+
+double
+ConnectionList::fixedProbabilityMemory (float probability, unsigned int srcNum,
+                                        unsigned int dstNum) const
+{
+    double n = static_cast<double>(probability) * srcNum * dstNum;
+    // connectivityS2C: a vector per source plus an index per connection.
+    double b = srcNum * static_cast<double>(sizeof(vector<int>)) + n * sizeof(int);
+    // connectivityC2D, with room for a row to spare, and either the
+    // old copy while it grows or the delays once it has.
+    b += (n + dstNum) * sizeof(int) + n * sizeof(float);
+    if (this->coupledSampling && !this->samplingCache.empty()) {
+        b += CoupledSampler::cacheMemory (n, srcNum);
+    }
+    return b;
+}
+
+double
+ConnectionList::fixedNumberMemory (unsigned int number, bool pre, unsigned int srcNum,
+                                   unsigned int dstNum) const
+{
+    double n = static_cast<double>(number) * (pre ? dstNum : srcNum);
+    // connectivityS2C: a vector per source plus an index per connection.
+    double b = srcNum * static_cast<double>(sizeof(vector<int>)) + n * sizeof(int);
+    // The rows as chosen alongside connectivityC2D, then the delays.
+    b += 2 * n * sizeof(int) + n * sizeof(float);
+    if (pre) {
+        b += 2 * (srcNum + 1.0) * sizeof(size_t);
+    }
+    return b;
+}
+
+double
+ConnectionList::distanceBasedMemory (const DistanceConnectivity& dc) const
+{
+    double n = dc.expectedConnections (DISTANCE_MEMORY_ROWS);
+    // connectivityS2C: a vector per source plus an index per
+    // connection, and the length of each row while it is generated.
+    double b = dc.srcNum * static_cast<double>(sizeof(vector<int>) + sizeof(unsigned int))
+        + n * sizeof(int);
+    // The rows as generated alongside connectivityC2D, then the delays.
+    b += 2 * n * sizeof(int) + n * sizeof(float);
+    return b;
+}
+
+void
+ConnectionList::account (void)
+{
+    this->memory.set (this->memoryBytes());
 }
 
 void
@@ -260,61 +966,58 @@ ConnectionList::writeXml (xml_node<>* into_node,
                           const string& model_root,
                           const string& binary_file_name)
 {
-    xml_document<>* thedoc = into_node->document();
+    // Number of source to destination connections is same as size of the C2D map:
+    this->writeXml (into_node, model_root, binary_file_name, this->connectivityC2D.size());
+}
 
-    // 1. Remove any attributes and child nodes from into_node.
-    into_node->remove_all_attributes();
-    into_node->remove_all_nodes();
+void
+ConnectionList::writeXml (xml_node<>* into_node,
+                          const string& model_root,
+                          const string& binary_file_name,
+                          const unsigned int num_connections)
+{
+    this->xmlEdit (into_node, binary_file_name, num_connections).apply();
+}
 
-    // 2. Change name of node from whatever
-    // (e.g. FixedProbabilityConnection) to ConnectionList.
-    into_node->name("ConnectionList");
+XmlEdit
+ConnectionList::xmlEdit (xml_node<>* into_node,
+                         const string& binary_file_name,
+                         const unsigned int num_connections) const
+{
+    // Any attributes and child nodes of into_node go, and it's
+    // renamed from whatever (e.g. FixedProbabilityConnection) to
+    // ConnectionList.
+    XmlEdit edit (into_node, "ConnectionList");
 
-    // 4. Add the BinaryFile node
-    xml_node<>* binfile_node = thedoc->allocate_node (node_element, "BinaryFile");
-    char* bfn_alloced = thedoc->allocate_string (binary_file_name.c_str());
-    xml_attribute<>* file_name_attr = thedoc->allocate_attribute ("file_name", bfn_alloced);
-    stringstream nc_ss;
-    // Number of source to destination connections is same as size of the C2D map:
-    nc_ss << this->connectivityC2D.size();
-    char* nc_alloced = thedoc->allocate_string(nc_ss.str().c_str());
-    xml_attribute<>* num_connections_attr = thedoc->allocate_attribute ("num_connections", nc_alloced);
+    if (this->delayDistributionType == spineml::Dist_FixedValue) {
+        // A Delay element comes before the BinaryFile
+        int delay_el = edit.addElement ("Delay");
+        edit.addAttribute (delay_el, "dimension", "ms");
+        int fv_el = edit.addElement ("FixedValue", delay_el);
+        stringstream valss;
+        valss << this->delayFixedValue;
+        edit.addAttribute (fv_el, "value", valss.str());
+    }
 
-    xml_attribute<>* explicit_delay_attr = (xml_attribute<>*)0;
+    int binfile_el = edit.addElement ("BinaryFile");
+    edit.addAttribute (binfile_el, "file_name", binary_file_name);
+    stringstream nc_ss;
+    nc_ss << num_connections;
+    edit.addAttribute (binfile_el, "num_connections", nc_ss.str());
     if (this->delayDistributionType == spineml::Dist_FixedValue) {
-        explicit_delay_attr = thedoc->allocate_attribute ("explicit_delay_flag", "0");
+        edit.addAttribute (binfile_el, "explicit_delay_flag", "0");
     } else {
-        explicit_delay_attr = thedoc->allocate_attribute ("explicit_delay_flag", "1");
+        edit.addAttribute (binfile_el, "explicit_delay_flag", "1");
+        if (this->separateDelays) {
+            edit.addAttribute (binfile_el, "delay_file_name",
+                               ConnectionList::delayFileName (binary_file_name));
+        }
     }
-
     // "packed_data" is used by SpineCreator when reading
     // SpineML. "packed_data" signifies that the data is not output
     // using the Qt serialisation streams. We therefore add it here in
     // all cases.
-    xml_attribute<>* packed_data_attr = thedoc->allocate_attribute ("packed_data", "true");
-
-    binfile_node->append_attribute (file_name_attr);
-    binfile_node->append_attribute (num_connections_attr);
-    binfile_node->append_attribute (explicit_delay_attr);
-    binfile_node->append_attribute (packed_data_attr);
+    edit.addAttribute (binfile_el, "packed_data", "true");
 
-    into_node->prepend_node (binfile_node);
-
-    if (this->delayDistributionType == spineml::Dist_FixedValue) {
-        // Add Delay alongside BinaryFile
-        xml_node<>* delay_node = thedoc->allocate_node (node_element, "Delay");
-        char* dim_alloced = thedoc->allocate_string ("ms");
-        xml_attribute<>* dim_attr = thedoc->allocate_attribute ("dimension", dim_alloced);
-        delay_node->append_attribute (dim_attr);
-
-        xml_node<>* fv_node = thedoc->allocate_node (node_element, "FixedValue");
-        stringstream valss;
-        valss << this->delayFixedValue;
-        char* fv_alloced = thedoc->allocate_string (valss.str().c_str());
-        xml_attribute<>* val_attr = thedoc->allocate_attribute ("value", fv_alloced);
-        fv_node->append_attribute (val_attr);
-
-        delay_node->prepend_node (fv_node);
-        into_node->prepend_node (delay_node);
-    }
+    return edit;
 }
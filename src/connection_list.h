@@ -10,10 +10,18 @@
 
 #include <vector>
 #include <string>
+#include <fstream>
 #include "rapidxml.hpp"
+#include "xmledit.h"
+#include "memoryuse.h"
+
+// Defined in rng.h
+struct RngData;
 
 namespace spineml
 {
+    class DistanceConnectivity;
+
     /*!
      * An enum to denote the type of a random distribution.
      */
@@ -156,10 +164,183 @@ namespace spineml
          * Note this accepts seed, probability in the arg list,
          * whereas generateDelays works on member attributes such as
          * delayMean, delayVariance, etc.
+         *
+         * See coupledSampling and samplingCache for the alternative
+         * generator.
          */
         void generateFixedProbability (const int& seed, const float& probability,
                                        const unsigned int& srcNum, const unsigned int& dstNum);
 
+        /*!
+         * Generate connectivity in which each destination neuron
+         * receives connections from exactly @param number distinct
+         * source neurons (@param pre true; a FixedNumberPreConnection,
+         * or fixed fan-in) or each source neuron connects to exactly
+         * @param number distinct destination neurons (pre false; a
+         * FixedNumberPostConnection, or fixed fan-out).
+         *
+         * Each row (a destination neuron for pre, a source neuron for
+         * post) is chosen on its own with a RowSampler seeded with
+         * @param seed, so the rows are generated on up to @see
+         * threads threads, and the result doesn't depend on how many.
+         * The time taken is proportional to the number of
+         * connections. Throws if @param number is more than the size
+         * of the population it is chosen from.
+         */
+        void generateFixedNumber (const int& seed, const unsigned int& number, bool pre,
+                                  const unsigned int& srcNum, const unsigned int& dstNum);
+
+        /*!
+         * Generate distance-dependent connectivity, each source
+         * neuron's row coming from @param dc, whose layouts have been
+         * set. The rows are generated in blocks on up to @see threads
+         * threads, and the result doesn't depend on how many.
+         */
+        void generateDistanceBased (const spineml::DistanceConnectivity& dc);
+
+        /*!
+         * Generate exactly the same fixed probability connection
+         * mapping (and delays) as generateFixedProbability followed
+         * by generateDelays, but write each source neuron's
+         * connections straight out to the binary file at @param
+         * path rather than storing them in connectivityS2C and
+         * connectivityC2D. Memory use is proportional to dstNum, not
+         * to the number of connections. If @param path is empty,
+         * the connections are only counted.
+         *
+         * @return The number of connections written.
+         */
+        unsigned int streamFixedProbability (const int& seed, const float& probability,
+                                             const unsigned int& srcNum, const unsigned int& dstNum,
+                                             const std::string& path);
+
+        /*!
+         * As streamFixedProbability, for the connections (and delays)
+         * of generateFixedNumber followed by generateDelays. Rows are
+         * generated a block per thread at a time. For a
+         * FixedNumberPreConnection, whose rows are destinations, the
+         * rows are generated twice: once to count the connections
+         * from each source neuron, and once to put each connection
+         * in its place in the file. If @param path is empty, the
+         * connections are only counted.
+         *
+         * @return The number of connections written.
+         */
+        unsigned int streamFixedNumber (const int& seed, const unsigned int& number, bool pre,
+                                        const unsigned int& srcNum, const unsigned int& dstNum,
+                                        const std::string& path);
+
+        /*!
+         * As streamFixedProbability, for the connections (and delays)
+         * of generateDistanceBased with @param dc followed by
+         * generateDelays. Only a block of rows per thread is held at
+         * once. If @param path is empty, the connections are only
+         * counted.
+         *
+         * @return The number of connections written.
+         */
+        unsigned int streamDistanceBased (const spineml::DistanceConnectivity& dc,
+                                          const std::string& path);
+
+        /*!
+         * Re-writes the ConnectionList node's XML for a connection
+         * list of @param num_connections connections which has
+         * already been written out to @param binary_file_name (for
+         * example by streamFixedProbability).
+         */
+        void writeXml (rapidxml::xml_node<>* into_node,
+                       const std::string& model_root,
+                       const std::string& binary_file_name,
+                       const unsigned int num_connections);
+
+        /*!
+         * Describe the change which writeXml makes to @param
+         * into_node, without making it.
+         */
+        spineml::XmlEdit xmlEdit (rapidxml::xml_node<>* into_node,
+                                  const std::string& binary_file_name,
+                                  const unsigned int num_connections) const;
+
+        /*!
+         * Seed @param rd ready to generate delays from this
+         * connection list's normal or uniform delay distribution.
+         */
+        void initDelayRng (RngData* rd) const;
+
+        /*!
+         * Generate the next delay from this connection list's normal
+         * or uniform delay distribution using @param rd, which
+         * should have been set up with initDelayRng. Delays are
+         * clamped at 0.
+         */
+        float nextDelay (RngData* rd) const;
+
+        /*!
+         * The seed for zigset used by generateFixedProbability: the
+         * user's @param seed prefixed with a "1".
+         */
+        static unsigned int fixedProbabilityZigsetSeed (const int& seed);
+
+        /*!
+         * Write out the connection list as an explicit binary
+         * file. Doesn't touch the XML.
+         */
+        void writeBinary (rapidxml::xml_node<>* into_node,
+                          const std::string& model_root,
+                          const std::string& binary_file_name);
+
+        /*!
+         * The name of the file which holds the delays, when @see
+         * separateDelays is set, for the connection file @param
+         * binary_file_name: pf_connection0.bin gives
+         * pf_connection0_delays.bin.
+         */
+        static std::string delayFileName (const std::string& binary_file_name);
+
+        /*!
+         * The size, in bytes, of a binary connection list file of
+         * @param num_connections connections, with this list's delay
+         * settings (and including any separate delay file).
+         */
+        double binaryFileSize (double num_connections) const;
+
+        /*!
+         * The memory allocated for the connectivity and delay
+         * vectors, in bytes.
+         */
+        double memoryBytes (void) const;
+
+        /*!
+         * Roughly the most memory which generateFixedProbability
+         * followed by generateDelays will hold at once for the given
+         * @param probability, @param srcNum and @param dstNum. This
+         * includes the copy made while connectivityC2D grows.
+         */
+        double fixedProbabilityMemory (float probability, unsigned int srcNum,
+                                       unsigned int dstNum) const;
+
+        /*!
+         * Roughly the most memory which generateFixedNumber followed
+         * by generateDelays will hold at once, for @param number
+         * connections per row.
+         */
+        double fixedNumberMemory (unsigned int number, bool pre, unsigned int srcNum,
+                                  unsigned int dstNum) const;
+
+        /*!
+         * Roughly the most memory which generateDistanceBased with
+         * @param dc, whose layouts have been set, followed by
+         * generateDelays will hold at once. The number of connections
+         * is estimated from a sample of the rows.
+         */
+        double distanceBasedMemory (const spineml::DistanceConnectivity& dc) const;
+
+        /*!
+         * Update @see memory after the vectors have been changed from
+         * outside this class.
+         */
+        void account (void);
+
     private:
 
         /*!
@@ -174,13 +355,6 @@ namespace spineml
          */
         void generateUniformDelays (void);
 
-        /*!
-         * Write out the connection list as an explicit binary file.
-         */
-        void writeBinary (rapidxml::xml_node<>* into_node,
-                          const std::string& model_root,
-                          const std::string& binary_file_name);
-
         /*!
          * Re-writes the ConnectionList node's XML, in preparation for
          * writing out the connection list as an explicit binary file.
@@ -189,6 +363,41 @@ namespace spineml
                        const std::string& model_root,
                        const std::string& binary_file_name);
 
+        /*!
+         * The number of neurons from which each row of a fixed
+         * number connection is chosen. Throws if @param number
+         * distinct neurons can't be chosen.
+         */
+        unsigned int fixedNumberCandidates (unsigned int number, bool pre,
+                                            unsigned int srcNum, unsigned int dstNum) const;
+
+        /*!
+         * Choose rows @param first to @param last (exclusive) of a
+         * fixed number connection into @param chosen, one row after
+         * another, on up to @see threads threads.
+         */
+        void chooseFixedNumberRows (int seed, unsigned int candidates, unsigned int number,
+                                    unsigned int first, unsigned int last,
+                                    std::vector<int>& chosen) const;
+
+        /*!
+         * Open the connection file @param path as @param f and, if
+         * the delays are generated and go in a file of their own,
+         * the delay file as @param df, for the stream functions.
+         */
+        void openStreamFiles (const std::string& path, std::ofstream& f,
+                              std::ofstream& df) const;
+
+        /*!
+         * Write the connections from @param src to the @param n
+         * destinations @param dsts to @param f, drawing any delays
+         * from @param rd into the file or into @param df. @param
+         * rowbuf and @param delaybuf are scratch space.
+         */
+        void writeStreamedRow (int src, const int* dsts, size_t n,
+                               std::ofstream& f, std::ofstream& df, RngData* rd,
+                               std::vector<char>& rowbuf, std::vector<float>& delaybuf) const;
+
     public:
         /*!
          * A list of "Source" to "Connection index" connection
@@ -285,6 +494,57 @@ namespace spineml
          * Dimensions string for the delay. E.g. "ms".
          */
         std::string delayDimension;
+
+        /*!
+         * If true, explicit delays are written to their own file
+         * (see delayFileName) of one float per connection, in the
+         * same order as the connections, instead of as a third
+         * column of the connection file. The BinaryFile element
+         * names it in a delay_file_name attribute.
+         */
+        bool separateDelays;
+
+        /*!
+         * If true, fixed probability connectivity comes from a
+         * CoupledSampler, so that the connections for a smaller
+         * probability are a subset of those for a larger one, rather
+         * than from the SpineML_2_BRAHMS generator.
+         */
+        bool coupledSampling;
+
+        /*!
+         * If true, the fixed probability, fixed number and
+         * distance-based generators make no connection from a neuron
+         * to itself (an autapse). Only meaningful when the source and
+         * destination are the same population. A fixed probability
+         * or distance-based connection still connects each other
+         * pair with the same probability, and the same pairs as
+         * without noAutapses; a fixed number
+         * connection chooses each row's number neurons from the rest
+         * of the population.
+         */
+        bool noAutapses;
+
+        /*!
+         * With coupledSampling, a directory in which to keep a
+         * CoupledSampler cache for each fixed probability
+         * connection, from which later runs at other probabilities
+         * are derived. Empty for no cache. The cache isn't used when
+         * the connections are streamed to file.
+         */
+        std::string samplingCache;
+
+        /*!
+         * The number of threads on which generateFixedNumber and
+         * generateDistanceBased may generate rows.
+         */
+        unsigned int threads;
+
+        /*!
+         * This list's share of MemoryUse::ConnectionLists. Kept up
+         * to date by the generate functions and by account().
+         */
+        spineml::MemoryUse::Hold memory;
     };
 
 } // namespace spineml
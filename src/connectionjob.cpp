@@ -0,0 +1,162 @@
+/*
+ * Implementation of ConnectionJob.
+ */
+
+#include <string>
+#include <vector>
+#include "connectionjob.h"
+#include "modelpreflight.h"
+#include "metrics.h"
+#include "trace.h"
+
+using namespace std;
+using namespace rapidxml;
+using namespace spineml;
+
+ConnectionJob::ConnectionJob (xml_node<>* n, const ConnectionList& c,
+                              const string& model_root, const string& binary_file_name)
+    : node (n)
+    , cl (c)
+    , modelRoot (model_root)
+    , binaryFileName (binary_file_name)
+    , fixedProbability (false)
+    , fixedNumber (false)
+    , distanceBased (false)
+    , srcLayout ((xml_node<>*)0)
+    , dstLayout ((xml_node<>*)0)
+    , pre (false)
+    , number (0)
+    , seed (0)
+    , probability (0)
+    , srcNum (0)
+    , dstNum (0)
+    , haveDelayElement (false)
+    , generateDelays (false)
+{
+}
+
+void
+ConnectionJob::setFixedProbability (int s, float p, unsigned int srcN, unsigned int dstN)
+{
+    this->fixedProbability = true;
+    this->seed = s;
+    this->probability = p;
+    this->srcNum = srcN;
+    this->dstNum = dstN;
+    this->generateDelays = true;
+}
+
+void
+ConnectionJob::setFixedNumber (int s, unsigned int n, bool p, unsigned int srcN, unsigned int dstN)
+{
+    this->fixedNumber = true;
+    this->seed = s;
+    this->number = n;
+    this->pre = p;
+    this->srcNum = srcN;
+    this->dstNum = dstN;
+    this->generateDelays = true;
+}
+
+void
+ConnectionJob::setDistanceBased (const DistanceConnectivity& dc,
+                                 xml_node<>* src_layout, unsigned int srcN,
+                                 xml_node<>* dst_layout, unsigned int dstN)
+{
+    this->distanceBased = true;
+    this->distance = dc;
+    this->srcLayout = src_layout;
+    this->srcNum = srcN;
+    this->dstLayout = dst_layout;
+    this->dstNum = dstN;
+    this->generateDelays = true;
+}
+
+void
+ConnectionJob::setExplicitList (bool have_delay_element, bool generate_delays)
+{
+    this->fixedProbability = false;
+    this->fixedNumber = false;
+    this->distanceBased = false;
+    this->haveDelayElement = have_delay_element;
+    this->generateDelays = generate_delays;
+}
+
+void
+ConnectionJob::run (void)
+{
+    Metrics::Scope ps (Metrics::Projection,
+                       Metrics::enabled() ? ModelPreflight::connection_label (this->node) : "");
+    Trace::Scope ts ("ConnectionJob");
+    if (Trace::enabled()) {
+        ts.arg ("projection", ModelPreflight::connection_label (this->node));
+    }
+    if (this->distanceBased) {
+        // The Layouts are only read, as for an explicit list.
+        this->distance.setLayouts (this->srcLayout, this->srcNum, this->dstLayout, this->dstNum,
+                                   this->modelRoot, this->cl.threads);
+    }
+    bool overBudget = false;
+    if (this->fixedProbability) {
+        overBudget = !this->cl.memory.claim (this->cl.fixedProbabilityMemory (this->probability,
+                                                                              this->srcNum,
+                                                                              this->dstNum));
+    } else if (this->fixedNumber) {
+        overBudget = !this->cl.memory.claim (this->cl.fixedNumberMemory (this->number, this->pre,
+                                                                          this->srcNum,
+                                                                          this->dstNum));
+    } else if (this->distanceBased) {
+        overBudget = !this->cl.memory.claim (this->cl.distanceBasedMemory (this->distance));
+    }
+    if (overBudget) {
+        // Over the memory budget; write the connections out as they
+        // are generated (or, for a dry run, just count them).
+        string path = this->writeFiles ? this->modelRoot + this->binaryFileName : "";
+        unsigned int n = 0;
+        if (this->fixedProbability) {
+            n = this->cl.streamFixedProbability (this->seed, this->probability,
+                                                 this->srcNum, this->dstNum, path);
+        } else if (this->fixedNumber) {
+            n = this->cl.streamFixedNumber (this->seed, this->number, this->pre,
+                                            this->srcNum, this->dstNum, path);
+        } else {
+            n = this->cl.streamDistanceBased (this->distance, path);
+            this->distance.clear();
+        }
+        this->edit = this->cl.xmlEdit (this->node, this->binaryFileName, n);
+        ps.count (n, this->writeFiles ? this->cl.binaryFileSize (n) : 0);
+        this->cl.memory.set (0);
+        return;
+    }
+
+    if (this->fixedProbability) {
+        this->cl.generateFixedProbability (this->seed, this->probability,
+                                           this->srcNum, this->dstNum);
+    } else if (this->fixedNumber) {
+        this->cl.generateFixedNumber (this->seed, this->number, this->pre,
+                                      this->srcNum, this->dstNum);
+    } else if (this->distanceBased) {
+        this->cl.generateDistanceBased (this->distance);
+        this->distance.clear();
+    } else {
+        // Only reads the document, which nothing modifies until the
+        // jobs have all run.
+        ModelPreflight::read_connection_list (this->node, this->cl, this->haveDelayElement);
+    }
+    if (this->generateDelays) {
+        this->cl.generateDelays();
+    }
+    if (this->writeFiles) {
+        this->cl.writeBinary (this->node, this->modelRoot, this->binaryFileName);
+    }
+    this->edit = this->cl.xmlEdit (this->node, this->binaryFileName,
+                                   this->cl.connectivityC2D.size());
+    ps.count (this->cl.connectivityC2D.size(),
+              this->writeFiles ? this->cl.binaryFileSize (this->cl.connectivityC2D.size()) : 0);
+
+    // The connectivity itself is no longer needed.
+    vector<vector<int> >().swap (this->cl.connectivityS2C);
+    vector<int>().swap (this->cl.connectivityC2D);
+    vector<float>().swap (this->cl.connectivityC2Delay);
+    this->cl.account();
+}
@@ -0,0 +1,116 @@
+/*!
+ * A PreflightJob which expands a connection into a binary
+ * connection list.
+ */
+
+#ifndef _CONNECTIONJOB_H_
+#define _CONNECTIONJOB_H_
+
+#include <string>
+#include "rapidxml.hpp"
+#include "connection_list.h"
+#include "distanceconnectivity.h"
+#include "preflightjob.h"
+
+namespace spineml
+{
+    /*!
+     * Generates the connectivity for a FixedProbabilityConnection,
+     * a FixedNumberPreConnection or FixedNumberPostConnection, a
+     * DistanceBasedConnection, or an inline ConnectionList and
+     * writes it to a binary file. The edit replaces the element
+     * with a ConnectionList with a BinaryFile child.
+     */
+    class ConnectionJob : public PreflightJob
+    {
+    public:
+        /*!
+         * @param node The FixedProbabilityConnection,
+         * FixedNumberPre/PostConnection, DistanceBasedConnection or
+         * ConnectionList element.
+         *
+         * @param cl A ConnectionList whose delays have been set up
+         * with ModelPreflight::setup_connection_delays().
+         *
+         * @param model_root The model directory, with trailing '/'.
+         *
+         * @param binary_file_name The pre-assigned name for the
+         * binary connection file.
+         */
+        ConnectionJob (rapidxml::xml_node<>* node, const spineml::ConnectionList& cl,
+                       const std::string& model_root, const std::string& binary_file_name);
+
+        /*!
+         * Make this a job to generate fixed probability connectivity.
+         */
+        void setFixedProbability (int seed, float probability,
+                                  unsigned int srcNum, unsigned int dstNum);
+
+        /*!
+         * Make this a job to generate fixed number connectivity; see
+         * ConnectionList::generateFixedNumber.
+         */
+        void setFixedNumber (int seed, unsigned int number, bool pre,
+                             unsigned int srcNum, unsigned int dstNum);
+
+        /*!
+         * Make this a job to generate distance-based connectivity
+         * with @param dc, which has been read but whose layouts are
+         * set from @param src_layout and @param dst_layout when the
+         * job runs; see DistanceConnectivity::setLayouts.
+         */
+        void setDistanceBased (const spineml::DistanceConnectivity& dc,
+                               rapidxml::xml_node<>* src_layout, unsigned int srcNum,
+                               rapidxml::xml_node<>* dst_layout, unsigned int dstNum);
+
+        /*!
+         * Make this a job to expand the Connection elements of an
+         * inline ConnectionList. @param have_delay_element is as
+         * returned by setup_connection_delays and @param
+         * generate_delays says whether the delays need to be
+         * generated.
+         */
+        void setExplicitList (bool have_delay_element, bool generate_delays);
+
+    protected:
+        void run (void);
+
+    private:
+        //! The element to be replaced
+        rapidxml::xml_node<>* node;
+
+        //! The connectivity; freed once the binary file is written.
+        spineml::ConnectionList cl;
+
+        std::string modelRoot;
+        std::string binaryFileName;
+
+        //! True for a FixedProbabilityConnection
+        bool fixedProbability;
+        //! True for a FixedNumberPre/PostConnection
+        bool fixedNumber;
+        //! True for a DistanceBasedConnection
+        bool distanceBased;
+        //! For a distance-based connection, its function and the populations' Layouts
+        spineml::DistanceConnectivity distance;
+        rapidxml::xml_node<>* srcLayout;
+        rapidxml::xml_node<>* dstLayout;
+        //! For a fixed number connection, true for FixedNumberPre
+        bool pre;
+        unsigned int number;
+        int seed;
+        float probability;
+        unsigned int srcNum;
+        unsigned int dstNum;
+
+        //! For an explicit list, whether there was a Delay element
+        bool haveDelayElement;
+
+        //! Whether to call ConnectionList::generateDelays
+        bool generateDelays;
+
+    };
+
+} // namespace spineml
+
+#endif // _CONNECTIONJOB_H_
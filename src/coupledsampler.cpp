@@ -0,0 +1,194 @@
+/*
+ * Implementation of CoupledSampler.
+ */
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cmath>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "coupledsampler.h"
+#include "rowsampler.h"
+#include "bufferedwriter.h"
+#include "util.h"
+
+using namespace std;
+using namespace spineml;
+
+/*!
+ * The first line of a cache file; change it if the format, or the
+ * way the thresholds are drawn, changes.
+ */
+#define COUPLEDSAMPLER_HEADER "spineml_preflight coupled sampler cache 1"
+
+CoupledSampler::CoupledSampler (int s, unsigned int srcN, unsigned int dstN)
+    : seed (s)
+    , srcNum (srcN)
+    , dstNum (dstN)
+    , sampler (s, dstN)
+    , caching (false)
+    , dirty (false)
+{
+}
+
+void
+CoupledSampler::extend (unsigned int srcIndex, Row& r, double probability)
+{
+    if (probability <= r.covered) {
+        return;
+    }
+    const unsigned int n = this->dstNum;
+
+    // The sampler's shuffle is undone at the end of each row. Replay
+    // the part of it which chose the row so far before carrying on
+    // from where it left off.
+    unsigned int k = static_cast<unsigned int>(r.dst.size());
+    for (unsigned int i = 0; i < k; ++i) {
+        this->sampler.next (srcIndex, i);
+    }
+
+    double t = (k > 0) ? r.thresh[k-1] : 0.0;
+    while (k < n) {
+        // The next of the order statistics of the n-k thresholds
+        // which are above t.
+        double u = this->sampler.uniform (srcIndex, k, 0);
+        double next = 1.0 - (1.0 - t) * pow (1.0 - u, 1.0 / static_cast<double>(n - k));
+        if (next >= probability) {
+            break;
+        }
+        r.dst.push_back (this->sampler.next (srcIndex, k));
+        r.thresh.push_back (next);
+        t = next;
+        ++k;
+    }
+    r.covered = probability;
+    this->sampler.reset();
+}
+
+void
+CoupledSampler::row (unsigned int srcIndex, double probability, vector<int>& dsts)
+{
+    dsts.clear();
+    Row fresh;
+    Row* r = &fresh;
+    if (this->caching) {
+        r = &this->rows[srcIndex];
+        if (probability > r->covered) {
+            this->extend (srcIndex, *r, probability);
+            this->dirty = true;
+        }
+    } else {
+        this->extend (srcIndex, fresh, probability);
+    }
+    // The row is in threshold order, so the connections at this
+    // probability are a prefix of it.
+    size_t n = lower_bound (r->thresh.begin(), r->thresh.end(), probability) - r->thresh.begin();
+    dsts.assign (r->dst.begin(), r->dst.begin() + n);
+    sort (dsts.begin(), dsts.end());
+}
+
+void
+CoupledSampler::useCache (void)
+{
+    if (!this->caching) {
+        this->caching = true;
+        this->rows.assign (this->srcNum, Row());
+    }
+}
+
+string
+CoupledSampler::cacheFileName (int seed, unsigned int srcNum, unsigned int dstNum)
+{
+    stringstream ss;
+    ss << "coupled_" << seed << "_" << srcNum << "x" << dstNum << ".cache";
+    return ss.str();
+}
+
+double
+CoupledSampler::cacheMemory (double num_connections, unsigned int srcNum)
+{
+    return num_connections * (sizeof(unsigned int) + sizeof(double))
+        + static_cast<double>(srcNum) * sizeof(Row);
+}
+
+bool
+CoupledSampler::load (const string& dir)
+{
+    this->useCache();
+    string path = dir + "/" + CoupledSampler::cacheFileName (this->seed, this->srcNum, this->dstNum);
+    ifstream f (path.c_str(), ios::in|ios::binary);
+    if (!f.is_open()) {
+        return false;
+    }
+    string line("");
+    if (!getline (f, line) || line != COUPLEDSAMPLER_HEADER) {
+        return false;
+    }
+    int s = 0;
+    unsigned int sn = 0, dn = 0;
+    f.read (reinterpret_cast<char*>(&s), sizeof(s));
+    f.read (reinterpret_cast<char*>(&sn), sizeof(sn));
+    f.read (reinterpret_cast<char*>(&dn), sizeof(dn));
+    if (!f || s != this->seed || sn != this->srcNum || dn != this->dstNum) {
+        return false;
+    }
+    // Each row is: covered, count, count destinations, count thresholds.
+    vector<Row> loaded (this->srcNum);
+    for (unsigned int i = 0; i < this->srcNum; ++i) {
+        unsigned int count = 0;
+        f.read (reinterpret_cast<char*>(&loaded[i].covered), sizeof(double));
+        f.read (reinterpret_cast<char*>(&count), sizeof(count));
+        if (!f || count > this->dstNum) {
+            return false;
+        }
+        if (count > 0) {
+            loaded[i].dst.resize (count);
+            loaded[i].thresh.resize (count);
+            f.read (reinterpret_cast<char*>(&loaded[i].dst[0]), count * sizeof(unsigned int));
+            f.read (reinterpret_cast<char*>(&loaded[i].thresh[0]), count * sizeof(double));
+        }
+    }
+    if (!f) {
+        return false;
+    }
+    this->rows.swap (loaded);
+    return true;
+}
+
+void
+CoupledSampler::save (const string& dir)
+{
+    if (!this->caching || !this->dirty) {
+        return;
+    }
+    mkdir (dir.c_str(), 0755);
+    string path = dir + "/" + CoupledSampler::cacheFileName (this->seed, this->srcNum, this->dstNum);
+    string tmppath = Util::tempPathFor (path);
+    try {
+        BufferedWriter f (tmppath, 65536);
+        f.write (COUPLEDSAMPLER_HEADER "\n");
+        f.write (reinterpret_cast<const char*>(&this->seed), sizeof(this->seed));
+        f.write (reinterpret_cast<const char*>(&this->srcNum), sizeof(this->srcNum));
+        f.write (reinterpret_cast<const char*>(&this->dstNum), sizeof(this->dstNum));
+        for (unsigned int i = 0; i < this->srcNum; ++i) {
+            const Row& r = this->rows[i];
+            unsigned int count = static_cast<unsigned int>(r.dst.size());
+            f.write (reinterpret_cast<const char*>(&r.covered), sizeof(double));
+            f.write (reinterpret_cast<const char*>(&count), sizeof(count));
+            if (count > 0) {
+                f.write (reinterpret_cast<const char*>(&r.dst[0]), count * sizeof(unsigned int));
+                f.write (reinterpret_cast<const char*>(&r.thresh[0]), count * sizeof(double));
+            }
+        }
+        f.close();
+        Util::replaceFile (tmppath, path);
+        this->dirty = false;
+    } catch (const std::exception& e) {
+        // It's only a cache.
+        unlink (tmppath.c_str());
+    }
+}
@@ -0,0 +1,116 @@
+/*!
+ * Coupled sampling of fixed probability connectivity.
+ */
+
+#ifndef _COUPLEDSAMPLER_H_
+#define _COUPLEDSAMPLER_H_
+
+#include <string>
+#include <vector>
+#include "rowsampler.h"
+
+namespace spineml
+{
+    /*!
+     * Generates fixed probability connectivity in which every (src,
+     * dst) pair has a fixed uniform threshold and is connected when
+     * its threshold is below the probability. The connections made
+     * with a probability p1 are therefore a subset of those made with
+     * any p2 > p1, for the same seed and population sizes; a sweep
+     * over the probability only adds or removes connections.
+     *
+     * The thresholds come from a RowSampler, so any row can be
+     * generated on its own, in any order. For each source
+     * neuron, the thresholds are drawn in increasing order (as the
+     * order statistics of dstNum uniforms) and each is given to a
+     * destination chosen by a Fisher-Yates shuffle. A row stops
+     * at the first threshold above the probability, so the work is
+     * proportional to the number of connections, not to dstNum.
+     *
+     * The rows can be kept in a cache file which holds every
+     * connection below the largest probability yet generated. A
+     * smaller probability is then a prefix of each cached row, and a
+     * larger one continues each row from where the cache left off.
+     *
+     * This is not the generator that ConnectionList uses by default
+     * (which reproduces SpineML_2_BRAHMS); the connectivity is
+     * different for the same seed.
+     */
+    class CoupledSampler
+    {
+    public:
+        CoupledSampler (int seed, unsigned int srcNum, unsigned int dstNum);
+
+        /*!
+         * Set @param dsts to the destinations, in ascending order, to
+         * which source @param srcIndex connects at @param
+         * probability. With a cache loaded (or in use: see
+         * useCache), the row is taken from, or added to, the cache.
+         */
+        void row (unsigned int srcIndex, double probability, std::vector<int>& dsts);
+
+        /*!
+         * Keep the rows generated by row() so that they can be
+         * saved. Called by load().
+         */
+        void useCache (void);
+
+        /*!
+         * Load the cache file for this seed and these population
+         * sizes from the directory @param dir. Returns false (and
+         * starts an empty cache) if there is no such file or it
+         * can't be read.
+         */
+        bool load (const std::string& dir);
+
+        /*!
+         * Write the cache to @param dir, if row() has added to it.
+         * Failures are ignored; it's only a cache.
+         */
+        void save (const std::string& dir);
+
+        /*!
+         * The name of the cache file for @param seed, @param srcNum
+         * and @param dstNum.
+         */
+        static std::string cacheFileName (int seed, unsigned int srcNum, unsigned int dstNum);
+
+        /*!
+         * The memory held by a cache of about @param num_connections
+         * connections, in bytes.
+         */
+        static double cacheMemory (double num_connections, unsigned int srcNum);
+
+    private:
+        /*!
+         * A row, in increasing order of threshold. Every destination
+         * with a threshold below covered is in it.
+         */
+        struct Row {
+            Row() : covered (0) {}
+            std::vector<unsigned int> dst;
+            std::vector<double> thresh;
+            double covered;
+        };
+
+        /*!
+         * Add to @param r, the row for @param srcIndex, every
+         * destination with a threshold below @param probability.
+         */
+        void extend (unsigned int srcIndex, Row& r, double probability);
+
+        int seed;
+        unsigned int srcNum;
+        unsigned int dstNum;
+        //! The thresholds and the shuffle of each row.
+        spineml::RowSampler sampler;
+
+        //! The cached rows; empty unless the cache is in use.
+        std::vector<Row> rows;
+        bool caching;
+        bool dirty;
+    };
+
+} // namespace spineml
+
+#endif // _COUPLEDSAMPLER_H_
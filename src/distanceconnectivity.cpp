@@ -0,0 +1,278 @@
+/*
+ * Implementation of DistanceConnectivity.
+ */
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <cmath>
+#include "rapidxml.hpp"
+#include "distanceconnectivity.h"
+#include "neuronlayout.h"
+#include "rowsampler.h"
+#include "trace.h"
+
+using namespace std;
+using namespace rapidxml;
+using namespace spineml;
+
+/*!
+ * The fraction of its peak at which the connection probability is
+ * cut off, unless a cutoff is given.
+ */
+#define DISTANCE_CUTOFF_FRACTION 0.001
+
+DistanceConnectivity::DistanceConnectivity()
+    : srcNum (0)
+    , dstNum (0)
+    , function (Gaussian)
+    , peak (1)
+    , scale (0)
+    , cutoff (0)
+    , seed (0)
+    , sampler (0, 0)
+    , cellSize (1)
+    , memory (MemoryUse::ConnectionLists)
+{
+    for (int i = 0; i < 3; ++i) {
+        this->origin[i] = 0;
+        this->cells[i] = 1;
+    }
+}
+
+void
+DistanceConnectivity::read (xml_node<>* conn_node)
+{
+    string func("gaussian");
+    bool have_seed = false, have_scale = false, have_cutoff = false;
+    for (xml_attribute<>* a = conn_node->first_attribute(); a; a = a->next_attribute()) {
+        string name = a->name();
+        stringstream ss;
+        ss << a->value();
+        if (name == "function") {
+            func = a->value();
+        } else if (name == "probability") {
+            ss >> this->peak;
+        } else if (name == "scale") {
+            ss >> this->scale;
+            have_scale = true;
+        } else if (name == "cutoff") {
+            ss >> this->cutoff;
+            have_cutoff = true;
+        } else if (name == "seed") {
+            ss >> this->seed;
+            have_seed = true;
+        } else {
+            continue;
+        }
+        if (ss.fail()) {
+            stringstream ee;
+            ee << "Failed to read " << conn_node->name() << "'s " << name
+               << " attr '" << a->value() << "' from model.xml";
+            throw runtime_error (ee.str());
+        }
+    }
+    if (!have_seed || !have_scale) {
+        stringstream ee;
+        ee << "Failed to get " << conn_node->name() << "'s seed or scale attr from model.xml";
+        throw runtime_error (ee.str());
+    }
+    if (func == "gaussian") {
+        this->function = Gaussian;
+    } else if (func == "exponential") {
+        this->function = Exponential;
+    } else {
+        stringstream ee;
+        ee << conn_node->name() << " function '" << func
+           << "' is not known; use gaussian or exponential.";
+        throw runtime_error (ee.str());
+    }
+    if (!(this->scale > 0) || this->peak < 0 || this->peak > 1
+        || (have_cutoff && !(this->cutoff > 0))) {
+        stringstream ee;
+        ee << conn_node->name() << " needs a scale and cutoff above 0 and a probability"
+           << " from 0 to 1.";
+        throw runtime_error (ee.str());
+    }
+    if (!have_cutoff) {
+        double l = -log (DISTANCE_CUTOFF_FRACTION);
+        this->cutoff = (this->function == Gaussian) ? this->scale * sqrt (2.0 * l) : this->scale * l;
+    }
+    this->sampler = RowSampler (this->seed, 0);
+}
+
+void
+DistanceConnectivity::setLayouts (xml_node<>* src_layout, unsigned int srcN,
+                                  xml_node<>* dst_layout, unsigned int dstN,
+                                  const string& model_root, unsigned int threads)
+{
+    NeuronLayout src, dst;
+    src.threads = threads;
+    dst.threads = threads;
+    if (!src_layout || !dst_layout
+        || !src.load (src_layout, srcN, model_root)
+        || !dst.load (dst_layout, dstN, model_root)) {
+        throw runtime_error ("A DistanceBasedConnection needs its source and destination"
+                             " populations to have a linear, grid or random Layout.");
+    }
+    this->srcNum = srcN;
+    this->dstNum = dstN;
+    this->srcPositions.swap (src.positions);
+
+    Trace::Scope ts ("DistanceConnectivity::setLayouts");
+    ts.arg ("dst_num", dstN);
+
+    // The bounding box of the destinations.
+    const vector<float>& p = dst.positions;
+    double lo[3] = { 0, 0, 0 }, hi[3] = { 0, 0, 0 };
+    for (unsigned int j = 0; j < dstN; ++j) {
+        for (int a = 0; a < 3; ++a) {
+            double v = p[3*j+a];
+            if (j == 0 || v < lo[a]) {
+                lo[a] = v;
+            }
+            if (j == 0 || v > hi[a]) {
+                hi[a] = v;
+            }
+        }
+    }
+
+    // Cells no narrower than the cutoff, so that only the neighbours
+    // of a source's cell need be visited; but wider if the grid would
+    // otherwise have many more cells than neurons.
+    double max_cells = 2.0 * static_cast<double>(dstN) + 1.0;
+    this->cellSize = this->cutoff;
+    double ncells = 0;
+    do {
+        ncells = 1;
+        for (int a = 0; a < 3; ++a) {
+            this->origin[a] = lo[a];
+            this->cells[a] = static_cast<long long>(floor ((hi[a] - lo[a]) / this->cellSize)) + 1;
+            ncells *= static_cast<double>(this->cells[a]);
+        }
+        if (ncells > max_cells) {
+            this->cellSize *= 2;
+        }
+    } while (ncells > max_cells);
+
+    // A counting sort of the destinations by cell.
+    size_t nc = static_cast<size_t>(ncells);
+    vector<unsigned int> cellOf (dstN);
+    this->cellStart.assign (nc + 1, 0);
+    for (unsigned int j = 0; j < dstN; ++j) {
+        long long c[3];
+        for (int a = 0; a < 3; ++a) {
+            c[a] = static_cast<long long>(floor ((p[3*j+a] - this->origin[a]) / this->cellSize));
+            c[a] = c[a] < this->cells[a] ? c[a] : this->cells[a] - 1;
+        }
+        cellOf[j] = static_cast<unsigned int>((c[2] * this->cells[1] + c[1]) * this->cells[0] + c[0]);
+        ++this->cellStart[cellOf[j] + 1];
+    }
+    for (size_t c = 0; c < nc; ++c) {
+        this->cellStart[c+1] += this->cellStart[c];
+    }
+    this->cellNeurons.resize (dstN);
+    this->cellPositions.resize (3 * static_cast<size_t>(dstN));
+    vector<unsigned int> next (this->cellStart.begin(), this->cellStart.end() - 1);
+    for (unsigned int j = 0; j < dstN; ++j) {
+        unsigned int i = next[cellOf[j]]++;
+        this->cellNeurons[i] = static_cast<int>(j);
+        for (int a = 0; a < 3; ++a) {
+            this->cellPositions[3*i+a] = p[3*j+a];
+        }
+    }
+    this->memory.set (static_cast<double>(this->srcPositions.capacity() * sizeof(float)
+                                          + this->cellStart.capacity() * sizeof(unsigned int)
+                                          + this->cellNeurons.capacity() * sizeof(int)
+                                          + this->cellPositions.capacity() * sizeof(float)));
+}
+
+double
+DistanceConnectivity::probability (double d2) const
+{
+    if (this->function == Gaussian) {
+        return this->peak * exp (-d2 / (2.0 * this->scale * this->scale));
+    }
+    return this->peak * exp (-sqrt (d2) / this->scale);
+}
+
+double
+DistanceConnectivity::visitRow (unsigned int srcIndex, vector<int>* dsts) const
+{
+    const double x = this->srcPositions[3*srcIndex];
+    const double y = this->srcPositions[3*srcIndex+1];
+    const double z = this->srcPositions[3*srcIndex+2];
+    const double cutoff2 = this->cutoff * this->cutoff;
+    long long c[3];
+    c[0] = static_cast<long long>(floor ((x - this->origin[0]) / this->cellSize));
+    c[1] = static_cast<long long>(floor ((y - this->origin[1]) / this->cellSize));
+    c[2] = static_cast<long long>(floor ((z - this->origin[2]) / this->cellSize));
+
+    double sum = 0;
+    for (long long cz = max (c[2] - 1, 0LL); cz <= min (c[2] + 1, this->cells[2] - 1); ++cz) {
+        for (long long cy = max (c[1] - 1, 0LL); cy <= min (c[1] + 1, this->cells[1] - 1); ++cy) {
+            long long row = (cz * this->cells[1] + cy) * this->cells[0];
+            long long cx0 = max (c[0] - 1, 0LL), cx1 = min (c[0] + 1, this->cells[0] - 1);
+            if (cx0 > cx1) {
+                continue;
+            }
+            // The cells along x are contiguous in cellNeurons.
+            unsigned int first = this->cellStart[row + cx0];
+            unsigned int last = this->cellStart[row + cx1 + 1];
+            for (unsigned int i = first; i < last; ++i) {
+                double ex = x - this->cellPositions[3*i];
+                double ey = y - this->cellPositions[3*i+1];
+                double ez = z - this->cellPositions[3*i+2];
+                double d2 = ex*ex + ey*ey + ez*ez;
+                if (d2 > cutoff2) {
+                    continue;
+                }
+                double pr = this->probability (d2);
+                sum += pr;
+                // The draw is indexed by the destination, so it doesn't
+                // depend on the order in which the grid is visited.
+                int j = this->cellNeurons[i];
+                if (dsts && this->sampler.uniform (srcIndex, static_cast<unsigned int>(j), 0) < pr) {
+                    dsts->push_back (j);
+                }
+            }
+        }
+    }
+    return sum;
+}
+
+void
+DistanceConnectivity::row (unsigned int srcIndex, vector<int>& dsts) const
+{
+    dsts.clear();
+    this->visitRow (srcIndex, &dsts);
+    sort (dsts.begin(), dsts.end());
+}
+
+double
+DistanceConnectivity::expectedConnections (unsigned int sample_rows) const
+{
+    if (this->srcNum == 0 || sample_rows == 0) {
+        return 0;
+    }
+    unsigned int step = this->srcNum / sample_rows;
+    step = step > 0 ? step : 1;
+    double sum = 0;
+    unsigned int n = 0;
+    for (unsigned int s = 0; s < this->srcNum; s += step, ++n) {
+        sum += this->visitRow (s, (vector<int>*)0);
+    }
+    return sum * static_cast<double>(this->srcNum) / static_cast<double>(n);
+}
+
+void
+DistanceConnectivity::clear (void)
+{
+    vector<float>().swap (this->srcPositions);
+    vector<unsigned int>().swap (this->cellStart);
+    vector<int>().swap (this->cellNeurons);
+    vector<float>().swap (this->cellPositions);
+    this->memory.set (0);
+}
@@ -0,0 +1,139 @@
+/*!
+ * Distance-dependent connectivity between laid out populations.
+ */
+
+#ifndef _DISTANCECONNECTIVITY_H_
+#define _DISTANCECONNECTIVITY_H_
+
+#include <string>
+#include <vector>
+#include "rapidxml.hpp"
+#include "rowsampler.h"
+#include "memoryuse.h"
+
+namespace spineml
+{
+    /*!
+     * Connects each pair of neurons with a probability which falls
+     * with the distance between them, given by a
+     * DistanceBasedConnection:
+     *
+     * \verbatim
+     *    <DistanceBasedConnection function="gaussian" probability="0.5"
+     *                             scale="20" cutoff="60" seed="123">
+     *        <Delay Dimension="ms">
+     *            <FixedValue value="1"/>
+     *        </Delay>
+     *    </DistanceBasedConnection>
+     * \endverbatim
+     *
+     * For neurons a distance d apart, the probability of a connection
+     * is probability * exp(-d^2 / (2 scale^2)) for the gaussian
+     * function and probability * exp(-d / scale) for the exponential
+     * one; probability defaults to 1. Beyond cutoff there are no
+     * connections. cutoff defaults to the distance at which the
+     * probability has fallen to a thousandth of its peak (3.7 scale
+     * for a gaussian, 6.9 scale for an exponential).
+     *
+     * The positions come from the Layouts of the two populations. The
+     * destination neurons are binned into a uniform grid of cells at
+     * least cutoff wide, so that a source neuron's row visits only
+     * the destinations in the cells around it. The draw for each
+     * (src, dst) pair comes from a RowSampler, so a row depends only
+     * on the seed and the positions, and rows can be generated in
+     * any order, on any number of threads.
+     */
+    class DistanceConnectivity
+    {
+    public:
+        DistanceConnectivity();
+
+        /*!
+         * Read the function and its parameters from @param
+         * conn_node, a DistanceBasedConnection. Throws if the seed or
+         * scale is missing, or if an attribute can't be used.
+         */
+        void read (rapidxml::xml_node<>* conn_node);
+
+        /*!
+         * Get the positions of the source and destination neurons
+         * from the Layouts @param src_layout (of @param srcN neurons)
+         * and @param dst_layout (of @param dstN), each of which is
+         * generated or, if it has already been expanded, read from
+         * its binary file in @param model_root. Then bin the
+         * destinations. Throws if either population has no usable
+         * layout.
+         */
+        void setLayouts (rapidxml::xml_node<>* src_layout, unsigned int srcN,
+                         rapidxml::xml_node<>* dst_layout, unsigned int dstN,
+                         const std::string& model_root, unsigned int threads = 1);
+
+        /*!
+         * Set @param dsts to the destinations, in ascending order, to
+         * which source @param srcIndex connects. Safe to call from
+         * several threads at once.
+         */
+        void row (unsigned int srcIndex, std::vector<int>& dsts) const;
+
+        /*!
+         * The expected number of connections, from the probabilities
+         * of at most @param sample_rows rows, evenly spread over the
+         * sources.
+         */
+        double expectedConnections (unsigned int sample_rows) const;
+
+        //! Free the positions and the grid.
+        void clear (void);
+
+        unsigned int srcNum;
+        unsigned int dstNum;
+
+    private:
+        enum Function {
+            Gaussian,
+            Exponential
+        };
+
+        //! The connection probability for neurons at a squared distance @param d2.
+        double probability (double d2) const;
+
+        /*!
+         * Visit every destination within cutoff of source @param
+         * srcIndex and return the sum of their probabilities. If
+         * @param dsts is non-null, draw each connection and add
+         * those made to it, in no particular order.
+         */
+        double visitRow (unsigned int srcIndex, std::vector<int>* dsts) const;
+
+        Function function;
+        double peak;
+        double scale;
+        double cutoff;
+        int seed;
+        spineml::RowSampler sampler;
+
+        //! x, y, z of each source neuron.
+        std::vector<float> srcPositions;
+
+        /*!
+         * The grid: cells of side cellSize from origin, numbered with
+         * x fastest. The destinations in cell c are cellNeurons[i]
+         * for i from cellStart[c] to cellStart[c+1], and their
+         * positions are in cellPositions, in the same order.
+         */
+        //@{
+        double origin[3];
+        double cellSize;
+        long long cells[3];
+        std::vector<unsigned int> cellStart;
+        std::vector<int> cellNeurons;
+        std::vector<float> cellPositions;
+        //@}
+
+        //! The memory held in the positions and the grid.
+        spineml::MemoryUse::Hold memory;
+    };
+
+} // namespace spineml
+
+#endif // _DISTANCECONNECTIVITY_H_
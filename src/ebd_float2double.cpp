@@ -16,6 +16,8 @@
 #include <exception>
 #include <iostream>
 #include <string>
+#include <stdexcept>
+#include <unistd.h>
 #include "modelpreflight.h"
 #include "util.h"
 
@@ -35,6 +37,8 @@ struct CmdOptions {
     char * model_path;
     //! To hold a flag to say whether we go backwards - from double to float. -b option
     int backwards;
+    //! To hold the number of threads to convert files on. 0 means one per processor.
+    int threads;
 };
 
 /*!
@@ -44,6 +48,7 @@ void zeroCmdOptions (CmdOptions* copts)
 {
     copts->model_path = NULL;
     copts->backwards = 0;
+    copts->threads = 0;
 }
 
 /*!
@@ -68,6 +73,10 @@ int main (int argc, char * argv[])
          POPT_ARG_NONE, &(cmdOptions.backwards), 0,
          "If set, convert backwards from double to float, not forwards from float to double."},
 
+        {"threads", '\0',
+         POPT_ARG_INT, &(cmdOptions.threads), 0,
+         "Check and convert files on this many threads. Default: 0, one per processor."},
+
         POPT_AUTOALIAS
         POPT_TABLEEND
     };
@@ -88,6 +97,20 @@ int main (int argc, char * argv[])
         Util::stripUnixPath (model_fname);
 
         spineml::ModelPreflight model (model_dir, model_fname);
+        if (cmdOptions.threads == 0) {
+            long nproc = sysconf (_SC_NPROCESSORS_ONLN);
+            model.threads = nproc > 0 ? static_cast<unsigned int>(nproc) : 1;
+        } else if (cmdOptions.threads > 0) {
+            model.threads = static_cast<unsigned int>(cmdOptions.threads);
+        } else {
+            throw runtime_error ("The number of threads can't be negative.");
+        }
+#ifndef _OPENMP
+        if (cmdOptions.threads > 1) {
+            cout << "Float2Double: WARNING: built without OpenMP; --threads " << cmdOptions.threads
+                 << " runs on one thread.\n";
+        }
+#endif
         if (cmdOptions.backwards) {
             model.binaryDataDoubleToFloat();
         } else {
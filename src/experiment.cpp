@@ -10,6 +10,7 @@
 #include <iostream>
 #include <fstream>
 #include <utility>
+#include <unistd.h>
 #include "rapidxml_print.hpp"
 #include "rapidxml.hpp"
 #include "allocandread.h"
@@ -20,13 +21,17 @@
 #include "normaldistribution.h"
 #include "timepointvalue.h"
 #include "util.h"
+#include "bufferedwriter.h"
+#include "metrics.h"
 
 using namespace std;
 using namespace spineml;
 using namespace rapidxml;
 
 Experiment::Experiment()
-    : filepath("model/experiment.xml")
+    : indent (true)
+    , dryRun (false)
+    , filepath("model/experiment.xml")
     , simDuration (0)
     , simFixedDt (0)
     , simType ("Unknown")
@@ -36,7 +41,9 @@ Experiment::Experiment()
 }
 
 Experiment::Experiment(const std::string& path)
-    : filepath(path)
+    : indent (true)
+    , dryRun (false)
+    , filepath(path)
     , simDuration (0)
     , simFixedDt (0)
     , simType ("Unknown")
@@ -141,16 +148,24 @@ Experiment::write (const xml_document<>& the_doc)
     }
 #endif
 
-    // Write experiment.xml:
-    ofstream f;
-    f.open (this->filepath.c_str(), ios::out|ios::trunc);
-    if (!f.is_open()) {
-        stringstream ee;
-        ee << "Failed to open '" << filepath << "' for writing";
-        throw runtime_error (ee.str());
+    if (this->dryRun) {
+        return;
     }
-    f << the_doc;
-    f.close();
+
+    // Write experiment.xml via a temporary file:
+    string tmppath = Util::tempPathFor (this->filepath);
+    Metrics::Scope ms (Metrics::Phase, "xml_write");
+    try {
+        BufferedWriter f (tmppath);
+        f.writeXml (the_doc, this->indent);
+        ms.count (1, f.size());
+        f.sync();
+        f.close();
+    } catch (const std::exception& e) {
+        unlink (tmppath.c_str());
+        throw;
+    }
+    Util::replaceFile (tmppath, this->filepath);
 }
 
 void
@@ -772,7 +787,9 @@ Experiment::insertModelUpdateFixedProb (ModelPreflight& model, xml_node<>* fp_no
     xml_attribute<>* newprob_attr = model.allocate_attribute ("probability", elements[3]);
     fp_node->append_attribute (newprob_attr);
 
-    model.write();
+    if (!this->dryRun) {
+        model.write();
+    }
 #if 0
     // At end, if required, write out the expt file xml.
     this->write (doc);
@@ -195,6 +195,12 @@ namespace spineml
         //! A vector of the delay changes which have been specified by the user.
         std::vector<DelayChange> delayChanges;
 
+        //! If false, write experiment.xml without indentation.
+        bool indent;
+
+        //! If true, check change requests but don't write experiment.xml or model.xml.
+        bool dryRun;
+
     private:
         //! write The XML document provided in @param the_doc out to
         //! file.
@@ -0,0 +1,34 @@
+/*
+ * Implementation of LayoutJob.
+ */
+
+#include <string>
+#include <vector>
+#include "layoutjob.h"
+#include "trace.h"
+
+using namespace std;
+using namespace rapidxml;
+using namespace spineml;
+
+LayoutJob::LayoutJob (xml_node<>* n, const NeuronLayout& l,
+                      const string& model_root, const string& binary_file_name)
+    : node (n)
+    , layout (l)
+    , modelRoot (model_root)
+    , binaryFileName (binary_file_name)
+{
+}
+
+void
+LayoutJob::run (void)
+{
+    Trace::Scope ts ("LayoutJob");
+    ts.arg ("file", this->binaryFileName);
+    this->layout.generate();
+    if (this->writeFiles) {
+        this->layout.writeBinary (this->modelRoot, this->binaryFileName);
+    }
+    this->edit = this->layout.xmlEdit (this->node, this->binaryFileName);
+    vector<float>().swap (this->layout.positions);
+}
@@ -0,0 +1,49 @@
+/*!
+ * A PreflightJob which expands a population's Layout into a binary
+ * file of neuron positions.
+ */
+
+#ifndef _LAYOUTJOB_H_
+#define _LAYOUTJOB_H_
+
+#include <string>
+#include "rapidxml.hpp"
+#include "neuronlayout.h"
+#include "preflightjob.h"
+
+namespace spineml
+{
+    /*!
+     * Generates the positions of a NeuronLayout and writes them to a
+     * binary file. The edit adds a BinaryFile to the Layout element.
+     */
+    class LayoutJob : public PreflightJob
+    {
+    public:
+        /*!
+         * @param node The Layout element.
+         *
+         * @param layout A NeuronLayout which has read @param node.
+         *
+         * @param model_root The model directory, with trailing '/'.
+         *
+         * @param binary_file_name The pre-assigned name for the
+         * binary positions file.
+         */
+        LayoutJob (rapidxml::xml_node<>* node, const spineml::NeuronLayout& layout,
+                   const std::string& model_root, const std::string& binary_file_name);
+
+    protected:
+        void run (void);
+
+    private:
+        rapidxml::xml_node<>* node;
+        //! The layout; its positions are freed once written.
+        spineml::NeuronLayout layout;
+        std::string modelRoot;
+        std::string binaryFileName;
+    };
+
+} // namespace spineml
+
+#endif // _LAYOUTJOB_H_
@@ -0,0 +1,237 @@
+/*
+ * Implementation of MemoryUse.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <new>
+#include "memoryuse.h"
+
+using namespace std;
+using namespace spineml;
+
+/*!
+ * Bytes in front of each block handed out by domAlloc, to hold its
+ * size. 16 keeps the block as well aligned as malloc's.
+ */
+#define DOM_BLOCK_HEADER 16
+
+double MemoryUse::budgetBytes = 0;
+unsigned int MemoryUse::numRefusals = 0;
+double MemoryUse::currentBytes[MemoryUse::NumSubsystems] = { 0, 0, 0, 0 };
+double MemoryUse::peakBytes[MemoryUse::NumSubsystems] = { 0, 0, 0, 0 };
+double MemoryUse::total = 0;
+double MemoryUse::peakTotal = 0;
+
+MemoryUse::Hold::Hold (MemoryUse::Subsystem s)
+    : subsystem (s)
+    , held (0)
+{
+}
+
+MemoryUse::Hold::Hold (const Hold& other)
+    : subsystem (other.subsystem)
+    , held (0)
+{
+}
+
+MemoryUse::Hold&
+MemoryUse::Hold::operator= (const Hold& other)
+{
+    // Keep whatever this Hold already accounts for.
+    return *this;
+}
+
+MemoryUse::Hold::~Hold()
+{
+    this->set (0);
+}
+
+void
+MemoryUse::Hold::set (double b)
+{
+    if (b != this->held) {
+        MemoryUse::add (this->subsystem, b - this->held);
+        this->held = b;
+    }
+}
+
+bool
+MemoryUse::Hold::claim (double b)
+{
+    bool ok = true;
+#pragma omp critical (spineml_memoryuse)
+    {
+        if (MemoryUse::budgetBytes > 0
+            && MemoryUse::total + (b - this->held) > MemoryUse::budgetBytes) {
+            ok = false;
+            MemoryUse::numRefusals++;
+        } else {
+            double d = b - this->held;
+            MemoryUse::currentBytes[this->subsystem] += d;
+            MemoryUse::total += d;
+            if (MemoryUse::currentBytes[this->subsystem] > MemoryUse::peakBytes[this->subsystem]) {
+                MemoryUse::peakBytes[this->subsystem] = MemoryUse::currentBytes[this->subsystem];
+            }
+            if (MemoryUse::total > MemoryUse::peakTotal) {
+                MemoryUse::peakTotal = MemoryUse::total;
+            }
+        }
+    }
+    if (ok) {
+        this->held = b;
+    }
+    return ok;
+}
+
+void
+MemoryUse::setBudget (double bytes)
+{
+    MemoryUse::budgetBytes = bytes;
+}
+
+void
+MemoryUse::add (Subsystem s, double b)
+{
+#pragma omp critical (spineml_memoryuse)
+    {
+        MemoryUse::currentBytes[s] += b;
+        MemoryUse::total += b;
+        if (MemoryUse::currentBytes[s] > MemoryUse::peakBytes[s]) {
+            MemoryUse::peakBytes[s] = MemoryUse::currentBytes[s];
+        }
+        if (MemoryUse::total > MemoryUse::peakTotal) {
+            MemoryUse::peakTotal = MemoryUse::total;
+        }
+    }
+}
+
+double
+MemoryUse::current (Subsystem s)
+{
+    double b = 0;
+#pragma omp critical (spineml_memoryuse)
+    {
+        b = MemoryUse::currentBytes[s];
+    }
+    return b;
+}
+
+double
+MemoryUse::peak (Subsystem s)
+{
+    double b = 0;
+#pragma omp critical (spineml_memoryuse)
+    {
+        b = MemoryUse::peakBytes[s];
+    }
+    return b;
+}
+
+double
+MemoryUse::peak (void)
+{
+    double b = 0;
+#pragma omp critical (spineml_memoryuse)
+    {
+        b = MemoryUse::peakTotal;
+    }
+    return b;
+}
+
+double
+MemoryUse::processPeak (void)
+{
+    // VmHWM is the high-water mark of the resident set, in kB.
+    ifstream f ("/proc/self/status");
+    string line;
+    while (getline (f, line)) {
+        if (line.compare (0, 6, "VmHWM:") == 0) {
+            stringstream ss (line.substr (6));
+            double kb = 0;
+            ss >> kb;
+            return kb * 1024;
+        }
+    }
+    return 0;
+}
+
+const char*
+MemoryUse::name (Subsystem s)
+{
+    switch (s) {
+    case ModelText:
+        return "model_text";
+    case Dom:
+        return "dom";
+    case ConnectionLists:
+        return "connection_lists";
+    case Properties:
+        return "properties";
+    default:
+        return "unknown";
+    }
+}
+
+void
+MemoryUse::writeReport (ostream& os)
+{
+    ios::fmtflags flags = os.flags();
+    streamsize precision = os.precision();
+    os << fixed << setprecision(1)
+       << "Preflight: peak memory " << MemoryUse::peak() / 1048576.0 << " MB (";
+    for (int s = 0; s < NumSubsystems; ++s) {
+        os << (s ? ", " : "") << MemoryUse::name (static_cast<Subsystem>(s)) << " "
+           << MemoryUse::peak (static_cast<Subsystem>(s)) / 1048576.0 << " MB";
+    }
+    os << "); process peak " << MemoryUse::processPeak() / 1048576.0 << " MB\n";
+    if (MemoryUse::budgetBytes > 0) {
+        os << "Preflight: memory budget " << MemoryUse::budgetBytes / 1048576.0 << " MB; "
+           << MemoryUse::numRefusals << " connection list(s) streamed to keep within it\n";
+    }
+    os.flags (flags);
+    os.precision (precision);
+}
+
+void
+MemoryUse::writeJson (ostream& os)
+{
+    os << fixed << setprecision(0) << "{ \"peak_bytes\": " << MemoryUse::peak()
+       << ", \"process_peak_bytes\": " << MemoryUse::processPeak()
+       << ", \"budget_bytes\": " << MemoryUse::budgetBytes
+       << ", \"over_budget\": " << MemoryUse::numRefusals;
+    for (int s = 0; s < NumSubsystems; ++s) {
+        os << ", \"" << MemoryUse::name (static_cast<Subsystem>(s)) << "_peak_bytes\": "
+           << MemoryUse::peak (static_cast<Subsystem>(s));
+    }
+    os << " }";
+}
+
+void*
+MemoryUse::domAlloc (size_t sz)
+{
+    char* p = static_cast<char*>(malloc (sz + DOM_BLOCK_HEADER));
+    if (!p) {
+        throw bad_alloc();
+    }
+    memcpy (p, &sz, sizeof(size_t));
+    MemoryUse::add (Dom, static_cast<double>(sz));
+    return p + DOM_BLOCK_HEADER;
+}
+
+void
+MemoryUse::domFree (void* p)
+{
+    if (!p) {
+        return;
+    }
+    char* block = static_cast<char*>(p) - DOM_BLOCK_HEADER;
+    size_t sz = 0;
+    memcpy (&sz, block, sizeof(size_t));
+    MemoryUse::add (Dom, -static_cast<double>(sz));
+    free (block);
+}
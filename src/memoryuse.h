@@ -0,0 +1,134 @@
+/*!
+ * Accounting of the memory held by each part of a preflight, and an
+ * optional budget for it.
+ */
+
+#ifndef _MEMORYUSE_H_
+#define _MEMORYUSE_H_
+
+#include <cstddef>
+#include <ostream>
+
+namespace spineml
+{
+    /*!
+     * Keeps a running total, and the high-water mark, of the bytes
+     * held by each of the larger consumers of memory during
+     * preflight: the text of model.xml, the memory pool behind its
+     * parsed DOM, the connectivity vectors of ConnectionLists and the
+     * values held for state variable properties. The counts are of
+     * the memory those structures have allocated (vector capacities,
+     * pool blocks), not of the whole process.
+     *
+     * A budget can be set. Code about to allocate a lot (a large
+     * generated connection) asks claim() first and, if the claim
+     * would exceed the budget, takes a path which uses less memory
+     * instead.
+     *
+     * All the members are static, as the memory is held by objects
+     * throughout the program; MemoryUse::Hold is the way to account
+     * for it.
+     */
+    class MemoryUse
+    {
+    public:
+        //! The parts of the program whose memory is counted.
+        enum Subsystem {
+            ModelText,
+            Dom,
+            ConnectionLists,
+            Properties,
+            NumSubsystems
+        };
+
+        /*!
+         * The bytes held by one object in one Subsystem. set() the
+         * current size as it changes; whatever is held is given back
+         * when the Hold is destroyed. A copy starts out holding
+         * nothing, so that objects holding a Hold can be copied
+         * without their memory being counted twice or given back
+         * twice.
+         */
+        class Hold
+        {
+        public:
+            explicit Hold (MemoryUse::Subsystem s);
+            Hold (const Hold& other);
+            Hold& operator= (const Hold& other);
+            ~Hold();
+
+            //! This object now holds @param b bytes.
+            void set (double b);
+
+            /*!
+             * Hold @param b bytes, if the total would then fit in the
+             * budget. Returns false, holding what was held before, if
+             * it would not.
+             */
+            bool claim (double b);
+
+            //! The bytes held.
+            double bytes (void) const { return this->held; }
+
+        private:
+            MemoryUse::Subsystem subsystem;
+            double held;
+        };
+
+        /*!
+         * Set the budget, in bytes, for the total over all the
+         * subsystems. 0 means no budget.
+         */
+        static void setBudget (double bytes);
+
+        //! The budget in bytes, or 0 if there is none.
+        static double budget (void) { return MemoryUse::budgetBytes; }
+
+        //! The bytes now held in @param s.
+        static double current (Subsystem s);
+
+        //! The most bytes held in @param s at any one time.
+        static double peak (Subsystem s);
+
+        //! The most bytes held in all the subsystems at any one time.
+        static double peak (void);
+
+        //! The number of claims turned down because of the budget.
+        static unsigned int refusals (void) { return MemoryUse::numRefusals; }
+
+        //! The peak resident set size of the process, from /proc, or 0.
+        static double processPeak (void);
+
+        //! A name for @param s, as used in the reports.
+        static const char* name (Subsystem s);
+
+        //! Write a short report of the high-water marks to @param os.
+        static void writeReport (std::ostream& os);
+
+        //! Write the high-water marks to @param os as a JSON object.
+        static void writeJson (std::ostream& os);
+
+        /*!
+         * An allocator for rapidxml::memory_pool::set_allocator()
+         * which counts the pool's blocks in the Dom subsystem.
+         */
+        static void* domAlloc (std::size_t sz);
+
+        //! The matching free function for domAlloc.
+        static void domFree (void* p);
+
+    private:
+        //! Add @param b (which may be negative) to @param s.
+        static void add (Subsystem s, double b);
+
+        static double budgetBytes;
+        static unsigned int numRefusals;
+        static double currentBytes[NumSubsystems];
+        static double peakBytes[NumSubsystems];
+        static double total;
+        static double peakTotal;
+    };
+
+} // namespace spineml
+
+#endif // _MEMORYUSE_H_
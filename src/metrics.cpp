@@ -0,0 +1,156 @@
+/*
+ * Implementation of Metrics.
+ */
+
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <time.h>
+#include "metrics.h"
+#include "util.h"
+#include "memoryuse.h"
+
+using namespace std;
+using namespace spineml;
+
+bool Metrics::on = false;
+double Metrics::startWall = 0;
+double Metrics::startCpu = 0;
+vector<string> Metrics::phaseNames;
+map<string, Metrics::Stats> Metrics::phases;
+vector<string> Metrics::projectionNames;
+map<string, Metrics::Stats> Metrics::projections;
+
+Metrics::Scope::Scope (Metrics::Table t, const string& n)
+    : table (t)
+    , active (Metrics::on)
+    , wall0 (0)
+    , cpu0 (0)
+    , items (0)
+    , bytes (0)
+{
+    if (this->active) {
+        this->name = n;
+        this->wall0 = Util::monotonicSeconds();
+        this->cpu0 = Metrics::threadCpuSeconds();
+    }
+}
+
+Metrics::Scope::~Scope()
+{
+    if (this->active) {
+        Metrics::add (this->table, this->name,
+                      Util::monotonicSeconds() - this->wall0,
+                      Metrics::threadCpuSeconds() - this->cpu0,
+                      this->items, this->bytes);
+    }
+}
+
+void
+Metrics::Scope::count (double n, double b)
+{
+    this->items += n;
+    this->bytes += b;
+}
+
+void
+Metrics::enable (void)
+{
+    Metrics::on = true;
+    Metrics::startWall = Util::monotonicSeconds();
+    Metrics::startCpu = Metrics::processCpuSeconds();
+}
+
+void
+Metrics::add (Table table, const string& name, double wall, double cpu,
+              double items, double bytes)
+{
+#pragma omp critical (spineml_metrics)
+    {
+        vector<string>& names = (table == Phase) ? Metrics::phaseNames : Metrics::projectionNames;
+        map<string, Stats>& stats = (table == Phase) ? Metrics::phases : Metrics::projections;
+        map<string, Stats>::iterator si = stats.find (name);
+        if (si == stats.end()) {
+            names.push_back (name);
+            si = stats.insert (make_pair (name, Stats())).first;
+        }
+        si->second.calls++;
+        si->second.wall += wall;
+        si->second.cpu += cpu;
+        si->second.items += items;
+        si->second.bytes += bytes;
+    }
+}
+
+double
+Metrics::threadCpuSeconds (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+}
+
+double
+Metrics::processCpuSeconds (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+}
+
+void
+Metrics::write (const string& path)
+{
+    ofstream f (path.c_str(), ios::out|ios::trunc);
+    if (!f.is_open()) {
+        stringstream ee;
+        ee << "Failed to open metrics file '" << path << "' for writing.";
+        throw runtime_error (ee.str());
+    }
+
+    f << fixed << setprecision(6)
+      << "{\n"
+      << "  \"wall_seconds\": " << Util::monotonicSeconds() - Metrics::startWall << ",\n"
+      << "  \"cpu_seconds\": " << Metrics::processCpuSeconds() - Metrics::startCpu << ",\n"
+      << "  \"phases\": ";
+    Metrics::writeTable (f, Metrics::phaseNames, Metrics::phases, "items");
+    f << ",\n  \"projections\": ";
+    Metrics::writeTable (f, Metrics::projectionNames, Metrics::projections, "connections");
+    f << ",\n  \"memory\": ";
+    MemoryUse::writeJson (f);
+    f << "\n}\n";
+
+    f.close();
+    if (f.fail()) {
+        stringstream ee;
+        ee << "Failed to write metrics file '" << path << "'.";
+        throw runtime_error (ee.str());
+    }
+}
+
+void
+Metrics::writeTable (ostream& os, const vector<string>& names,
+                     const map<string, Stats>& stats, const char* itemsName)
+{
+    os << "[";
+    vector<string>::const_iterator ni = names.begin();
+    while (ni != names.end()) {
+        const Stats& s = stats.find (*ni)->second;
+        os << (ni == names.begin() ? "\n" : ",\n")
+           << "    { \"name\": " << Util::jsonString (*ni)
+           << ", \"calls\": " << s.calls
+           << ", \"wall_seconds\": " << setprecision(6) << s.wall
+           << ", \"cpu_seconds\": " << s.cpu
+           << ", \"" << itemsName << "\": " << setprecision(0) << s.items
+           << ", \"bytes\": " << s.bytes
+           << ", \"" << itemsName << "_per_second\": " << setprecision(1)
+           << (s.wall > 0 ? s.items / s.wall : 0)
+           << ", \"bytes_per_second\": " << (s.wall > 0 ? s.bytes / s.wall : 0) << " }";
+        ++ni;
+    }
+    os << (names.empty() ? "]" : "\n  ]");
+}
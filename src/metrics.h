@@ -0,0 +1,116 @@
+/*!
+ * Per-phase timing and throughput of a preflight run.
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+
+namespace spineml
+{
+    /*!
+     * Collects wall time, CPU time, items produced and bytes written
+     * for each phase of a preflight (parse, component_load,
+     * connectivity, delays, properties, binary_write, xml_write) and
+     * for the connection list of each projection synapse or generic
+     * input, and writes them out as JSON.
+     *
+     * Code is instrumented by making a Metrics::Scope on the stack;
+     * the time between its construction and destruction is added to
+     * the named phase. Until enable() is called, a Scope does
+     * nothing but test a flag. Scopes on different threads may
+     * overlap, so with several threads the wall times of a phase add
+     * up to more than the elapsed time.
+     *
+     * All the members are static, as the phases are spread through
+     * classes which otherwise have no need to know about each other.
+     */
+    class Metrics
+    {
+    public:
+        //! Which table a Scope adds to.
+        enum Table {
+            Phase,
+            Projection
+        };
+
+        /*!
+         * Times a section of code, adding it to the entry @param name
+         * in @param table when it goes out of scope, along with the
+         * items and bytes given to count().
+         */
+        class Scope
+        {
+        public:
+            Scope (Metrics::Table table, const std::string& name);
+            ~Scope();
+
+            //! Record @param n items produced and @param b bytes written.
+            void count (double n, double b = 0);
+
+        private:
+            Metrics::Table table;
+            std::string name;
+            bool active;
+            double wall0;
+            double cpu0;
+            double items;
+            double bytes;
+        };
+
+        //! Start collecting. The elapsed time of the run is measured from here.
+        static void enable (void);
+
+        //! true if enable() has been called.
+        static bool enabled (void) { return Metrics::on; }
+
+        /*!
+         * Write the collected metrics to @param path as JSON. Throws
+         * if the file can't be written.
+         */
+        static void write (const std::string& path);
+
+    private:
+        //! The totals for one phase or projection.
+        struct Stats {
+            Stats() : calls (0), wall (0), cpu (0), items (0), bytes (0) {}
+            unsigned int calls;
+            double wall;
+            double cpu;
+            double items;
+            double bytes;
+        };
+
+        //! Add a finished Scope's numbers to @param name in @param table.
+        static void add (Table table, const std::string& name, double wall, double cpu,
+                         double items, double bytes);
+
+        //! CPU time used by the calling thread, in seconds.
+        static double threadCpuSeconds (void);
+
+        //! CPU time used by the whole process, in seconds.
+        static double processCpuSeconds (void);
+
+        //! Write the entries of @param names from @param stats as a JSON array.
+        static void writeTable (std::ostream& os, const std::vector<std::string>& names,
+                                const std::map<std::string, Stats>& stats,
+                                const char* itemsName);
+
+        static bool on;
+        static double startWall;
+        static double startCpu;
+
+        //! Names in the order they were first seen, and their totals.
+        static std::vector<std::string> phaseNames;
+        static std::map<std::string, Stats> phases;
+        static std::vector<std::string> projectionNames;
+        static std::map<std::string, Stats> projections;
+    };
+
+} // namespace spineml
+
+#endif // _METRICS_H_
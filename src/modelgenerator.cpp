@@ -0,0 +1,248 @@
+/*
+ * Implementation of ModelGenerator.
+ */
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <cmath>
+#include <cerrno>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "modelgenerator.h"
+
+using namespace std;
+using namespace spineml;
+
+ModelGenerator::ModelGenerator()
+    : populations (2)
+    , size (1000)
+    , probability (0.1f)
+    , delayType (spineml::Dist_Normal)
+    , stateVariables (2)
+    , seed (123)
+{
+}
+
+double
+ModelGenerator::expectedConnections (void) const
+{
+    return static_cast<double>(this->populations) * this->size * this->size * this->probability;
+}
+
+void
+ModelGenerator::setSizeForConnections (double connections)
+{
+    double perProjection = connections / (this->populations > 0 ? this->populations : 1);
+    double n = ceil (sqrt (perProjection / this->probability));
+    this->size = n < 1 ? 1 : static_cast<unsigned int>(n);
+}
+
+void
+ModelGenerator::setDelayType (const string& name)
+{
+    if (name == "fixed") {
+        this->delayType = spineml::Dist_FixedValue;
+    } else if (name == "normal") {
+        this->delayType = spineml::Dist_Normal;
+    } else if (name == "uniform") {
+        this->delayType = spineml::Dist_Uniform;
+    } else {
+        stringstream ee;
+        ee << "Unknown delay distribution '" << name
+           << "'; expected fixed, normal or uniform.";
+        throw runtime_error (ee.str());
+    }
+}
+
+string
+ModelGenerator::population_name (unsigned int i) const
+{
+    stringstream ss;
+    ss << "P" << i;
+    return ss.str();
+}
+
+void
+ModelGenerator::write (const string& dir) const
+{
+    if (this->populations == 0 || this->size == 0) {
+        throw runtime_error ("ModelGenerator: need at least one population of at least one neuron.");
+    }
+    if (mkdir (dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        stringstream ee;
+        ee << "ModelGenerator: Failed to create directory '" << dir << "'.";
+        throw runtime_error (ee.str());
+    }
+    string d = dir;
+    if (d.empty() || d[d.size()-1] != '/') {
+        d += "/";
+    }
+
+    vector<string> sv;
+    for (unsigned int k = 0; k < this->stateVariables; ++k) {
+        stringstream ss;
+        ss << "v" << k;
+        sv.push_back (ss.str());
+    }
+    this->write_component (d + "SynthNeuron.xml", "SynthNeuron", "neuron_body", sv);
+    this->write_component (d + "SynthWeight.xml", "SynthWeight", "weight_update",
+                           vector<string>(1, "w"));
+    this->write_component (d + "SynthPostsynapse.xml", "SynthPostsynapse", "postsynapse",
+                           vector<string>(1, "g"));
+    this->write_model (d + "model.xml");
+    this->write_experiment (d + "experiment.xml");
+}
+
+void
+ModelGenerator::write_model (const string& path) const
+{
+    ofstream f (path.c_str(), ios::out|ios::trunc);
+    if (!f.is_open()) {
+        stringstream ee;
+        ee << "ModelGenerator: Failed to open '" << path << "' for writing.";
+        throw runtime_error (ee.str());
+    }
+
+    f << "<?xml version=\"1.0\"?>\n"
+      << "<LL:SpineML xmlns=\"http://www.shef.ac.uk/SpineMLNetworkLayer\""
+      << " xmlns:LL=\"http://www.shef.ac.uk/SpineMLLowLevelNetworkLayer\""
+      << " xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\""
+      << " xsi:schemaLocation=\"http://www.shef.ac.uk/SpineMLLowLevelNetworkLayer"
+      << " SpineMLLowLevelNetworkLayer.xsd\" name=\"Synthetic\">\n";
+
+    int s = this->seed;
+    for (unsigned int i = 0; i < this->populations; ++i) {
+        string name = this->population_name (i);
+        string dst = this->population_name ((i + 1) % this->populations);
+
+        f << "    <LL:Population>\n"
+          << "        <LL:Neuron name=\"" << name << "\" size=\"" << this->size
+          << "\" url=\"SynthNeuron.xml\">\n";
+        for (unsigned int k = 0; k < this->stateVariables; ++k) {
+            f << "            <Property name=\"v" << k << "\" dimension=\"?\">\n";
+            switch (k % 3) {
+            case 0:
+                f << "                <NormalDistribution mean=\"" << k
+                  << "\" variance=\"1\" seed=\"" << s++ << "\"/>\n";
+                break;
+            case 1:
+                f << "                <UniformDistribution minimum=\"0\" maximum=\"" << k
+                  << "\" seed=\"" << s++ << "\"/>\n";
+                break;
+            default:
+                f << "                <FixedValue value=\"" << k << "\"/>\n";
+                break;
+            }
+            f << "            </Property>\n";
+        }
+        f << "        </LL:Neuron>\n"
+          << "        <Layout url=\"none.xml\" seed=\"123\" minimum_distance=\"0\"/>\n"
+          << "        <LL:Projection dst_population=\"" << dst << "\">\n"
+          << "            <LL:Synapse>\n"
+          << "                <FixedProbabilityConnection probability=\"" << this->probability
+          << "\" seed=\"" << s++ << "\">\n"
+          << "                    <Delay Dimension=\"ms\">\n";
+        switch (this->delayType) {
+        case spineml::Dist_Normal:
+            f << "                        <NormalDistribution mean=\"2\" variance=\"0.5\" seed=\""
+              << s++ << "\"/>\n";
+            break;
+        case spineml::Dist_Uniform:
+            f << "                        <UniformDistribution minimum=\"1\" maximum=\"4\" seed=\""
+              << s++ << "\"/>\n";
+            break;
+        default:
+            f << "                        <FixedValue value=\"1\"/>\n";
+            break;
+        }
+        f << "                    </Delay>\n"
+          << "                </FixedProbabilityConnection>\n"
+          << "                <LL:WeightUpdate name=\"" << name << " to " << dst
+          << " Synapse 0 weight_update\" url=\"SynthWeight.xml\""
+          << " input_src_port=\"spike\" input_dst_port=\"spike\">\n"
+          << "                    <Property name=\"w\" dimension=\"?\">\n"
+          << "                        <UniformDistribution minimum=\"0\" maximum=\"1\" seed=\""
+          << s++ << "\"/>\n"
+          << "                    </Property>\n"
+          << "                </LL:WeightUpdate>\n"
+          << "                <LL:PostSynapse name=\"" << name << " to " << dst
+          << " Synapse 0 postsynapse\" url=\"SynthPostsynapse.xml\""
+          << " input_src_port=\"o\" input_dst_port=\"i\""
+          << " output_src_port=\"o\" output_dst_port=\"I\">\n"
+          << "                    <Property name=\"g\" dimension=\"?\">\n"
+          << "                        <FixedValue value=\"0.5\"/>\n"
+          << "                    </Property>\n"
+          << "                </LL:PostSynapse>\n"
+          << "            </LL:Synapse>\n"
+          << "        </LL:Projection>\n"
+          << "    </LL:Population>\n";
+    }
+    f << "</LL:SpineML>\n";
+
+    f.close();
+    if (f.fail()) {
+        stringstream ee;
+        ee << "ModelGenerator: Failed to write '" << path << "'.";
+        throw runtime_error (ee.str());
+    }
+}
+
+void
+ModelGenerator::write_experiment (const string& path) const
+{
+    ofstream f (path.c_str(), ios::out|ios::trunc);
+    if (!f.is_open()) {
+        stringstream ee;
+        ee << "ModelGenerator: Failed to open '" << path << "' for writing.";
+        throw runtime_error (ee.str());
+    }
+    f << "<?xml version=\"1.0\"?>\n"
+      << "<SpineML xmlns=\"http://www.shef.ac.uk/SpineMLExperimentLayer\">\n"
+      << "    <Experiment name=\"Experiment\" description=\"Synthetic benchmark model\">\n"
+      << "        <Model network_layer_url=\"model.xml\"/>\n"
+      << "        <Simulation duration=\"1\" preferred_simulator=\"BRAHMS\">\n"
+      << "            <EulerIntegration dt=\"0.1\"/>\n"
+      << "        </Simulation>\n"
+      << "    </Experiment>\n"
+      << "</SpineML>\n";
+    f.close();
+    if (f.fail()) {
+        stringstream ee;
+        ee << "ModelGenerator: Failed to write '" << path << "'.";
+        throw runtime_error (ee.str());
+    }
+}
+
+void
+ModelGenerator::write_component (const string& path, const string& name, const string& type,
+                                 const vector<string>& statevars) const
+{
+    ofstream f (path.c_str(), ios::out|ios::trunc);
+    if (!f.is_open()) {
+        stringstream ee;
+        ee << "ModelGenerator: Failed to open '" << path << "' for writing.";
+        throw runtime_error (ee.str());
+    }
+    f << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      << "<SpineML xmlns=\"http://www.shef.ac.uk/SpineMLComponentLayer\">\n"
+      << " <ComponentClass name=\"" << name << "\" type=\"" << type << "\">\n"
+      << "  <Dynamics initial_regime=\"R\">\n"
+      << "   <Regime name=\"R\"/>\n";
+    vector<string>::const_iterator i = statevars.begin();
+    while (i != statevars.end()) {
+        f << "   <StateVariable name=\"" << *i << "\" dimension=\"?\"/>\n";
+        ++i;
+    }
+    f << "  </Dynamics>\n"
+      << " </ComponentClass>\n"
+      << "</SpineML>\n";
+    f.close();
+    if (f.fail()) {
+        stringstream ee;
+        ee << "ModelGenerator: Failed to write '" << path << "'.";
+        throw runtime_error (ee.str());
+    }
+}
@@ -0,0 +1,94 @@
+/*!
+ * Write synthetic SpineML models, for benchmarking.
+ */
+
+#ifndef _MODELGENERATOR_H_
+#define _MODELGENERATOR_H_
+
+#include <string>
+#include <vector>
+#include "connection_list.h"
+
+namespace spineml
+{
+    /*!
+     * Writes a model.xml, experiment.xml and the component XML files
+     * for a model of the given shape: a ring of populations, each of
+     * the same size and each projecting to the next with a
+     * FixedProbabilityConnection (a single population projects to
+     * itself). Every neuron state variable gets an initial value
+     * Property, cycling through NormalDistribution,
+     * UniformDistribution and FixedValue, and each synapse has a
+     * UniformDistribution weight and a FixedValue postsynapse state
+     * variable, so a preflight exercises the connectivity, delay and
+     * property code.
+     *
+     * The same settings always give the same files.
+     */
+    class ModelGenerator
+    {
+    public:
+        ModelGenerator();
+
+        /*!
+         * Write the model into @param dir, which is created if it
+         * doesn't exist. Throws on failure.
+         */
+        void write (const std::string& dir) const;
+
+        //! The expected number of connections in the model.
+        double expectedConnections (void) const;
+
+        /*!
+         * Set @see size so that the model has about @param
+         * connections connections, given @see populations and @see
+         * probability.
+         */
+        void setSizeForConnections (double connections);
+
+        /*!
+         * Set @see delayType from "fixed", "normal" or "uniform".
+         * Throws for anything else.
+         */
+        void setDelayType (const std::string& name);
+
+        //! The number of populations in the ring.
+        unsigned int populations;
+
+        //! The number of neurons in each population.
+        unsigned int size;
+
+        //! The connection probability of each projection.
+        float probability;
+
+        //! The distribution of the connection delays.
+        spineml::Distribution delayType;
+
+        //! The number of state variables of the neuron component.
+        unsigned int stateVariables;
+
+        //! The first of the seeds written into the model.
+        int seed;
+
+    private:
+        //! The name of population @param i.
+        std::string population_name (unsigned int i) const;
+
+        //! Write model.xml to @param path.
+        void write_model (const std::string& path) const;
+
+        //! Write experiment.xml to @param path.
+        void write_experiment (const std::string& path) const;
+
+        /*!
+         * Write a component called @param name of @param type, with
+         * @param statevars state variables, to @param path.
+         */
+        void write_component (const std::string& path, const std::string& name,
+                              const std::string& type,
+                              const std::vector<std::string>& statevars) const;
+    };
+
+} // namespace spineml
+
+#endif // _MODELGENERATOR_H_
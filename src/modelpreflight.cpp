@@ -10,30 +10,63 @@
 #include <sstream>
 #include <fstream>
 #include <stdexcept>
+#include <unistd.h>
 #include "rapidxml_print.hpp"
 #include "rapidxml.hpp"
 #include "util.h"
+#include "bufferedwriter.h"
 #include "modelpreflight.h"
 #include "connection_list.h"
 #include "fixedvalue.h"
 #include "uniformdistribution.h"
 #include "normaldistribution.h"
 #include "valuelist.h"
+#include "connectionjob.h"
+#include "propertyjob.h"
+#include "layoutjob.h"
+#include "transcodejob.h"
+#include "neuronlayout.h"
+#include "distanceconnectivity.h"
+#include "binarytranscoder.h"
+#include "metrics.h"
+#include "trace.h"
 
 using namespace std;
 using namespace rapidxml;
 using namespace spineml;
 
 ModelPreflight::ModelPreflight(const std::string& fdir, const std::string& fname)
-    : root_node (static_cast<xml_node<>*>(0))
+    : modelTextMemory (MemoryUse::ModelText)
+    , root_node (static_cast<xml_node<>*>(0))
     , binfilenum (0)
     , explicitData_binfilenum (0)
+    , layout_binfilenum (0)
+    , planning (false)
     , backup (false)
+    , indent (true)
+    , threads (1)
+    , dryRun (false)
+    , stableNames (false)
+    , separateDelays (false)
+    , coupledSampling (false)
+    , samplingCache ("")
+    , noAutapses (false)
 {
     this->modeldir = fdir;
     this->modelfile = fname;
     string filepath = this->modeldir + this->modelfile;
+    Metrics::Scope ms (Metrics::Phase, "parse");
     this->modeldata.read (filepath);
+    ms.count (0, this->modeldata.getsize());
+    this->modelTextMemory.set (this->modeldata.getsize());
+    // Count the blocks of the DOM's memory pool.
+    this->doc.set_allocator (MemoryUse::domAlloc, MemoryUse::domFree);
+}
+
+ModelPreflight::~ModelPreflight()
+{
+    this->clear_jobs();
+    this->discard_binary_changes();
 }
 
 rapidxml::xml_attribute<>*
@@ -49,28 +82,58 @@ ModelPreflight::write (void)
 {
     string filepath = this->modeldir + this->modelfile;
 
-    // If requested, backup model.xml:
+    // Write the new model.xml to a temporary file alongside it, so
+    // that an interrupted run never leaves a partial model.xml.
+    string tmppath = Util::tempPathFor (filepath);
+    Metrics::Scope ms (Metrics::Phase, "xml_write");
+    try {
+        BufferedWriter f (tmppath);
+        f.writeXml (this->doc, this->indent);
+        ms.count (1, f.size());
+        f.sync();
+        f.close();
+    } catch (const std::exception& e) {
+        unlink (tmppath.c_str());
+        throw;
+    }
+
+    // If requested, keep the old model.xml as model.xml.bu:
     if (this->backup == true) {
-        stringstream cmd;
-        cmd << "cp " << filepath << " " << filepath << ".bu";
-        int rtn = system (cmd.str().c_str());
-        if (rtn) {
-            stringstream ee;
-            ee << "ModelPreflight::write: Call to cp failed with return code: "
-               << rtn << endl;
-        }
+        Util::keepPreviousVersion (filepath, filepath + ".bu");
     }
 
-    // Write model.xml:
-    ofstream f;
-    f.open (filepath.c_str(), ios::out|ios::trunc);
-    if (!f.is_open()) {
-        stringstream ee;
-        ee << "Failed to open '" << filepath << "' for writing";
-        throw runtime_error (ee.str());
+    Util::replaceFile (tmppath, filepath);
+    this->commit_binary_changes();
+}
+
+void
+ModelPreflight::commit_binary_changes (void)
+{
+    vector<pair<string, string> >::const_iterator ri = this->pendingReplacements.begin();
+    while (ri != this->pendingReplacements.end()) {
+        Util::replaceFile (ri->first, ri->second);
+        ++ri;
+    }
+    this->pendingReplacements.clear();
+    vector<string>::const_iterator di = this->pendingRemovals.begin();
+    while (di != this->pendingRemovals.end()) {
+        cout << "Preflight: Removing the delay file " << *di << endl;
+        unlink (di->c_str());
+        ++di;
     }
-    f << this->doc;
-    f.close();
+    this->pendingRemovals.clear();
+}
+
+void
+ModelPreflight::discard_binary_changes (void)
+{
+    vector<pair<string, string> >::const_iterator ri = this->pendingReplacements.begin();
+    while (ri != this->pendingReplacements.end()) {
+        unlink (ri->first.c_str());
+        ++ri;
+    }
+    this->pendingReplacements.clear();
+    this->pendingRemovals.clear();
 }
 
 void
@@ -82,6 +145,8 @@ ModelPreflight::init (void)
         // surprising behaviour of having both values and data nodes, and
         // having data nodes take precedence over values when printing
         // >>> note that this will skip parsing of CDATA nodes <<<
+        Metrics::Scope ms (Metrics::Phase, "parse");
+        ms.count (1);
         this->doc.parse<parse_declaration_node | parse_no_data_nodes>(this->modeldata.data());
 
         // Get the root node.
@@ -100,36 +165,133 @@ void
 ModelPreflight::preflight (void)
 {
     this->init();
-    // Search each population for stuff.
-    this->first_pop_node = this->root_node->first_node(LVL"Population");
-    xml_node<>* pop_node = this->first_pop_node;
-    for (pop_node = this->root_node->first_node(LVL"Population");
-         pop_node;
-         pop_node = pop_node->next_sibling(LVL"Population")) {
-        this->preflight_population (pop_node);
-    }
+    this->prefetch_components();
+    this->preflight_populations();
+    this->components.save();
 }
 
 void
 ModelPreflight::preflight (const std::vector<DelayChange>& exptDelayChanges)
 {
     this->init();
+    this->prefetch_components();
     this->delayChanges = exptDelayChanges;
+    this->preflight_populations();
+    this->components.save();
+}
+
+void
+ModelPreflight::preflight_populations (void)
+{
+    // With more than one thread, or for a dry run, the traversal
+    // only plans the work, which is then done by run_jobs().
+    this->clear_jobs();
+    this->journal.clear();
+    this->planning = (this->threads > 1 || this->dryRun);
+
     // Search each population for stuff.
     this->first_pop_node = this->root_node->first_node(LVL"Population");
     xml_node<>* pop_node = this->first_pop_node;
-    for (pop_node = this->root_node->first_node(LVL"Population");
-         pop_node;
-         pop_node = pop_node->next_sibling(LVL"Population")) {
-        this->preflight_population (pop_node);
+    try {
+        for (pop_node = this->root_node->first_node(LVL"Population");
+             pop_node;
+             pop_node = pop_node->next_sibling(LVL"Population")) {
+            this->preflight_population (pop_node);
+        }
+    } catch (const std::exception& e) {
+        this->planning = false;
+        this->clear_jobs();
+        throw;
+    }
+
+    if (this->planning) {
+        this->planning = false;
+        this->run_jobs();
     }
 }
 
+void
+ModelPreflight::run_jobs (void)
+{
+    try {
+        this->run_job_stage (this->jobs);
+
+        // The connection lists are now in the document, so the
+        // WeightUpdate property sizes can be found.
+        vector<PreflightJob*> stage;
+        vector<PropertyJob*>::iterator wi = this->weightJobs.begin();
+        while (wi != this->weightJobs.end()) {
+            (*wi)->setSize (this->get_num_connections ((*wi)->synapse, (*wi)->srcNum, (*wi)->dstNum));
+            stage.push_back (*wi);
+            ++wi;
+        }
+        this->run_job_stage (stage);
+    } catch (const std::exception& e) {
+        this->clear_jobs();
+        throw;
+    }
+    this->clear_jobs();
+
+    if (this->dryRun) {
+        cout << "PreFlight: dry run; these changes would be made to "
+             << this->modelfile << ":\n";
+        this->journal.print (cout);
+    }
+}
+
+void
+ModelPreflight::run_job_stage (vector<PreflightJob*>& stage)
+{
+    int n = static_cast<int>(stage.size());
+#pragma omp parallel for schedule(dynamic) num_threads(this->threads)
+    for (int i = 0; i < n; ++i) {
+        stage[i]->execute();
+    }
+
+    for (int i = 0; i < n; ++i) {
+        if (stage[i]->failed) {
+            throw runtime_error (stage[i]->error);
+        }
+    }
+
+    // The document is only modified here, on this thread, in the
+    // order in which the jobs were planned.
+    for (int i = 0; i < n; ++i) {
+        this->journal.add (stage[i]->edit);
+    }
+    this->journal.commit();
+}
+
+void
+ModelPreflight::add_job (PreflightJob* job)
+{
+    job->writeFiles = !this->dryRun;
+    this->jobs.push_back (job);
+}
+
+void
+ModelPreflight::clear_jobs (void)
+{
+    vector<PreflightJob*>::iterator ji = this->jobs.begin();
+    while (ji != this->jobs.end()) {
+        delete *ji;
+        ++ji;
+    }
+    this->jobs.clear();
+    vector<PropertyJob*>::iterator wi = this->weightJobs.begin();
+    while (wi != this->weightJobs.end()) {
+        delete *wi;
+        ++wi;
+    }
+    this->weightJobs.clear();
+}
+
 set<string>
 ModelPreflight::get_component_set (void)
 {
     set<string> component_list;
     this->init();
+    this->prefetch_components();
     // Search each population for stuff.
     this->first_pop_node = this->root_node->first_node(LVL"Population");
     xml_node<>* pop_node = this->first_pop_node;
@@ -141,9 +303,55 @@ ModelPreflight::get_component_set (void)
             component_list.insert(pname);
         }
     }
+    this->components.save();
     return component_list;
 }
 
+void
+ModelPreflight::prefetch_components (void)
+{
+    set<string> names;
+    for (xml_node<>* pop_node = this->root_node->first_node(LVL"Population");
+         pop_node;
+         pop_node = pop_node->next_sibling(LVL"Population")) {
+        this->add_component_url (pop_node->first_node(LVL"Neuron"), names);
+        for (xml_node<>* proj_node = pop_node->first_node(LVL"Projection");
+             proj_node;
+             proj_node = proj_node->next_sibling(LVL"Projection")) {
+            for (xml_node<>* syn_node = proj_node->first_node(LVL"Synapse");
+                 syn_node;
+                 syn_node = syn_node->next_sibling(LVL"Synapse")) {
+                this->add_component_url (syn_node->first_node(LVL"WeightUpdate"), names);
+                this->add_component_url (syn_node->first_node(LVL"PostSynapse"), names);
+            }
+        }
+    }
+    this->components.prefetch (this->modeldir, names);
+}
+
+void
+ModelPreflight::add_component_url (xml_node<>* component_node, set<string>& names)
+{
+    if (!component_node) {
+        return;
+    }
+    xml_attribute<>* url_attr = component_node->first_attribute ("url");
+    if (!url_attr) {
+        return;
+    }
+    string cmpt_name = url_attr->value();
+    Util::stripFileSuffix (cmpt_name);
+    if (!cmpt_name.empty() && cmpt_name != "SpikeSource") {
+        names.insert (cmpt_name);
+    }
+}
+
+void
+ModelPreflight::setComponentCacheFile (const std::string& path)
+{
+    this->components.setCacheFile (path);
+}
+
 int
 ModelPreflight::find_num_neurons (const string& dst_population)
 {
@@ -178,6 +386,21 @@ ModelPreflight::find_num_neurons (const string& dst_population)
     return numNeurons;
 }
 
+xml_node<>*
+ModelPreflight::find_layout (const string& pop_name)
+{
+    for (xml_node<>* pop_node = this->first_pop_node;
+         pop_node;
+         pop_node = pop_node->next_sibling(LVL"Population")) {
+        xml_node<>* neuron_node = pop_node->first_node(LVL"Neuron");
+        if (neuron_node && ModelPreflight::attribute_value (neuron_node, "name") == pop_name) {
+            // First population with the name, as in find_num_neurons
+            return pop_node->first_node ("Layout");
+        }
+    }
+    return (xml_node<>*)0;
+}
+
 string
 ModelPreflight::get_population_component_name (xml_node<>* pop_node)
 {
@@ -192,6 +415,7 @@ ModelPreflight::get_population_component_name (xml_node<>* pop_node)
 void
 ModelPreflight::preflight_population (xml_node<>* pop_node)
 {
+    Trace::Scope ts ("preflight_population");
     // Within each population: Find the "population name"; this is
     // actually given by the LL:Neuron name attribute; also have a
     // size attr. Then search out projections.
@@ -222,10 +446,17 @@ ModelPreflight::preflight_population (xml_node<>* pop_node)
         pop_num_ss << pop_num;
         pop_num_ss >> pop_number;
     } // else failed to get src num
+    ts.arg ("population", pop_name);
+    ts.arg ("size", pop_number);
 
     // Output some info to stdout
     cout << "Preflight: processing population: '" << pop_name << "' (size " << pop_num << ")\n";
 
+    xml_node<>* layout_node = pop_node->first_node("Layout");
+    if (layout_node) {
+        this->preflight_layout (layout_node, pop_name, pop_number);
+    }
+
     // Now find all Projections out from the neuron and expand any
     // connections into explicit lists, as
     // necessary. preflight_projection() also expands state variable
@@ -264,6 +495,24 @@ ModelPreflight::preflight_population (xml_node<>* pop_node)
     }
 }
 
+void
+ModelPreflight::preflight_layout (xml_node<>* layout_node,
+                                  const string& pop_name, unsigned int pop_size)
+{
+    NeuronLayout layout;
+    if (!layout.read (layout_node, pop_size)) {
+        return;
+    }
+    layout.threads = this->threads;
+    if (this->planning) {
+        this->add_job (new LayoutJob (layout_node, layout, this->modeldir,
+                                      this->nextLayoutPath (pop_name)));
+        return;
+    }
+    layout.generate();
+    layout.write (layout_node, this->modeldir, this->nextLayoutPath (pop_name));
+}
+
 void
 ModelPreflight::try_replace_statevar_property (xml_node<>* prop_node,
                                                unsigned int pop_size,
@@ -278,7 +527,7 @@ ModelPreflight::try_replace_statevar_property (xml_node<>* prop_node,
         throw runtime_error ("Failed to get property name");
     }
 
-    if (this->components.at(component_name).containsStateVariable (prop_name)) {
+    if (this->components.at(component_name)->containsStateVariable (prop_name)) {
         // This property is a state variable and not a parameter
         this->replace_statevar_property (prop_node, pop_size);
     }
@@ -288,6 +537,11 @@ void
 ModelPreflight::replace_statevar_property (xml_node<>* prop_node,
                                            unsigned int pop_size)
 {
+    if (this->planning) {
+        this->plan_statevar_property (prop_node, pop_size);
+        return;
+    }
+
     // Depending on what we find in the property, call differing
     // replace methods:
     xml_node<>* fixedvalue_node = prop_node->first_node("FixedValue");
@@ -298,28 +552,28 @@ ModelPreflight::replace_statevar_property (xml_node<>* prop_node,
     if (udist_node) {
         spineml::UniformDistribution ud (udist_node, pop_size);
         if (!ud.writeAsBinaryValueList (udist_node, this->modeldir,
-                                        this->nextExplicitDataPath())) {
+                                        this->nextExplicitDataPath (prop_node))) {
             this->explicitData_binfilenum--;
         }
 
     } else if (ndist_node) {
         spineml::NormalDistribution nd (ndist_node, pop_size);
         if (!nd.writeAsBinaryValueList (ndist_node, this->modeldir,
-                                        this->nextExplicitDataPath())) {
+                                        this->nextExplicitDataPath (prop_node))) {
             this->explicitData_binfilenum--;
         }
 
     } else if (vallist_node) {
         spineml::ValueList vl (vallist_node, pop_size);
         if (!vl.writeAsBinaryValueList (vallist_node, this->modeldir,
-                                        this->nextExplicitDataPath())) {
+                                        this->nextExplicitDataPath (prop_node))) {
             this->explicitData_binfilenum--;
         }
 
     } else if (fixedvalue_node) {
         spineml::FixedValue fv (fixedvalue_node, pop_size);
         if (!fv.writeAsBinaryValueList (fixedvalue_node, this->modeldir,
-                                        this->nextExplicitDataPath())) {
+                                        this->nextExplicitDataPath (prop_node))) {
             // if writeAsBinaryValueList returned false, the explicit
             // data binary path was not used, so decrement it again.
             this->explicitData_binfilenum--;
@@ -339,7 +593,7 @@ ModelPreflight::replace_statevar_property (xml_node<>* prop_node,
         fv.setValue (0.0);
         fv.setNumInPopulation (pop_size);
         if (!fv.writeAsBinaryValueList (fixedvalue_node, this->modeldir,
-                                        this->nextExplicitDataPath())) {
+                                        this->nextExplicitDataPath (prop_node))) {
             // if writeAsBinaryValueList returned false, the explicit
             // data binary path was not used, so decrement it again.
             this->explicitData_binfilenum--;
@@ -347,9 +601,54 @@ ModelPreflight::replace_statevar_property (xml_node<>* prop_node,
     }
 }
 
+void
+ModelPreflight::plan_statevar_property (xml_node<>* prop_node,
+                                        unsigned int pop_size)
+{
+    // The same choice of content as replace_statevar_property.
+    xml_node<>* content_node = (xml_node<>*)0;
+    PropertyContent* content = (PropertyContent*)0;
+    if ((content_node = prop_node->first_node("UniformDistribution"))) {
+        content = new UniformDistribution (content_node, pop_size);
+    } else if ((content_node = prop_node->first_node("NormalDistribution"))) {
+        content = new NormalDistribution (content_node, pop_size);
+    } else if ((content_node = prop_node->first_node("ValueList"))) {
+        content = new ValueList (content_node, pop_size);
+    } else if ((content_node = prop_node->first_node("FixedValue"))) {
+        content = new FixedValue (content_node, pop_size);
+    } else {
+        // An empty property is treated as FixedValue 0.
+        content_node = doc.allocate_node (node_element, "FixedValue");
+        prop_node->prepend_node (content_node);
+        FixedValue* fv = new FixedValue;
+        fv->setValue (0.0);
+        fv->setNumInPopulation (pop_size);
+        content = fv;
+    }
+
+    if (content->isAlreadyBinary()) {
+        // Nothing to write, and no file name used.
+        delete content;
+        return;
+    }
+
+    this->add_job (new PropertyJob (content, content_node, this->modeldir,
+                                    this->nextExplicitDataPath (prop_node)));
+}
+
 string
-ModelPreflight::nextExplicitDataPath (void)
+ModelPreflight::nextExplicitDataPath (xml_node<>* prop_node)
 {
+    if (this->stableNames) {
+        // The count is kept anyway; callers decrement it when the
+        // path goes unused.
+        this->explicitData_binfilenum++;
+        vector<string> identity;
+        identity.push_back (ModelPreflight::attribute_value (prop_node->parent(), "name"));
+        identity.push_back (ModelPreflight::attribute_value (prop_node, "name"));
+        return Util::stableFileName ("pf_explicitData_", identity);
+    }
+
     string binfilepath ("pf_explicitData");
     stringstream numss;
     numss << this->explicitData_binfilenum++;
@@ -387,6 +686,7 @@ ModelPreflight::preflight_input (xml_node<>* input_node,
                                  const string& dest_name,
                                  const string& dest_num)
 {
+    Trace::Scope ts ("preflight_input");
     string src_name("");
     xml_attribute<>* src_name_attr;
     if ((src_name_attr = input_node->first_attribute ("src"))) {
@@ -409,10 +709,12 @@ ModelPreflight::preflight_input (xml_node<>* input_node,
          << " to " << dest_name << "/" << dst_port << endl;
     float fixedDelay = this->searchDelayChanges (src_name, src_port, dest_name, dst_port);
 
-    // Now just replace any FixedProbability or ConnectionList nodes.
+    // Now just replace any FixedProbability, FixedNumber, DistanceBased or ConnectionList nodes.
     xml_node<>* fixedprob_connection = input_node->first_node("FixedProbabilityConnection");
+    xml_node<>* fixednum_connection = ModelPreflight::find_fixednumber (input_node);
+    xml_node<>* distance_connection = input_node->first_node("DistanceBasedConnection");
     xml_node<>* connection_list = input_node->first_node("ConnectionList");
-    if (fixedprob_connection) {
+    if (fixedprob_connection || fixednum_connection || distance_connection) {
         // Find the number of neurons in the destination population
         int srcNum_ = this->find_num_neurons (src_name);
         string src_num("");
@@ -426,7 +728,16 @@ ModelPreflight::preflight_input (xml_node<>* input_node,
                << src_name << "'";
             throw runtime_error (ee.str());
         }
-        this->replace_fixedprob_connection (fixedprob_connection, src_num, dest_num, fixedDelay);
+        if (fixedprob_connection) {
+            this->replace_fixedprob_connection (fixedprob_connection, src_num, dest_num, fixedDelay,
+                                                src_name == dest_name);
+        } else if (fixednum_connection) {
+            this->replace_fixednumber_connection (fixednum_connection, src_num, dest_num, fixedDelay,
+                                                  src_name == dest_name);
+        } else {
+            this->replace_distance_connection (distance_connection, src_name, src_num,
+                                               dest_name, dest_num, fixedDelay);
+        }
     } else if (connection_list) {
         // Check if it's already binary, if not, expand.
         this->connection_list_to_binary (connection_list, fixedDelay);
@@ -477,14 +788,20 @@ ModelPreflight::preflight_synapse (xml_node<>* syn_node,
         synss << src_syn_num;
         synss >> synapse_num;
     }
+    Trace::Scope ts ("preflight_synapse");
+    ts.arg ("src", src_name);
+    ts.arg ("dst", dst_population);
+    ts.arg ("synapse", src_syn_num);
     // Does this synapse match any of the DelayChanges? If it does,
     // then 0 <= delay <= inf is returned. Otherwise, -1 is returned.
     float fixedDelay = this->searchDelayChanges (src_name, dst_population, synapse_num);
 
-    // For each synapse... Is there a FixedProbability?
+    // For each synapse... Is there a FixedProbability, a FixedNumber or a DistanceBased?
     xml_node<>* fixedprob_connection = syn_node->first_node("FixedProbabilityConnection");
+    xml_node<>* fixednum_connection = ModelPreflight::find_fixednumber (syn_node);
+    xml_node<>* distance_connection = syn_node->first_node("DistanceBasedConnection");
     xml_node<>* connection_list = syn_node->first_node("ConnectionList");
-    if (fixedprob_connection) {
+    if (fixedprob_connection || fixednum_connection || distance_connection) {
         // Find the number of neurons in the destination population
         int dstNum_ = this->find_num_neurons (dst_population);
         string dst_num("");
@@ -498,7 +815,16 @@ ModelPreflight::preflight_synapse (xml_node<>* syn_node,
                << dst_population << "'";
             throw runtime_error (ee.str());
         }
-        this->replace_fixedprob_connection (fixedprob_connection, src_num, dst_num, fixedDelay);
+        if (fixedprob_connection) {
+            this->replace_fixedprob_connection (fixedprob_connection, src_num, dst_num, fixedDelay,
+                                                  src_name == dst_population);
+        } else if (fixednum_connection) {
+            this->replace_fixednumber_connection (fixednum_connection, src_num, dst_num, fixedDelay,
+                                                src_name == dst_population);
+        } else {
+            this->replace_distance_connection (distance_connection, src_name, src_num,
+                                               dst_population, dst_num, fixedDelay);
+        }
     } else if (connection_list) {
         // Check if it's already binary, if not, expand.
         this->connection_list_to_binary (connection_list, fixedDelay);
@@ -546,7 +872,16 @@ ModelPreflight::preflight_synapse (xml_node<>* syn_node,
                 ss >> srcNum;
             }
             unsigned int num_connections = this->get_num_connections (syn_node, srcNum, dstNum);
+            size_t njobs = this->jobs.size();
             this->try_replace_statevar_property (prop_node, num_connections, wu_cmpt_name);
+            if (this->jobs.size() > njobs) {
+                // Planning, and this synapse's connection list may
+                // not have been generated yet. Its size is found later.
+                PropertyJob* pj = static_cast<PropertyJob*>(this->jobs.back());
+                this->jobs.pop_back();
+                pj->setSizeFrom (syn_node, srcNum, dstNum);
+                this->weightJobs.push_back (pj);
+            }
         }
     }
 }
@@ -612,8 +947,7 @@ ModelPreflight::get_component_name (xml_node<>* component_node)
     // necessary.
     if (!this->components.count (cmpt_name)) {
         try {
-            spineml::Component c (modeldir, cmpt_name);
-            this->components.insert (make_pair (cmpt_name, c));
+            this->components.load (modeldir, cmpt_name);
         } catch (const std::exception& e) {
             stringstream ee;
             ee << "Failed to read component " << cmpt_name << ": " << e.what() << ".\n";
@@ -629,22 +963,157 @@ ModelPreflight::connection_list_to_binary (xml_node<>* connlist_node,
                                            float fixedValDelayChange)
 {
     xml_node<>* binaryfile = connlist_node->first_node("BinaryFile");
-    if (binaryfile && fixedValDelayChange < 0.0) {
-        // No further work to do; this ConnectionList is already a
-        // binary list and there's no override.
+    if (binaryfile) {
+        // This ConnectionList is already a binary list, so there's
+        // nothing to do unless there's an override.
+        if (fixedValDelayChange >= 0.0) {
+            this->binary_connection_delay_change (connlist_node, binaryfile,
+                                                  fixedValDelayChange);
+        }
         return;
     }
 
     // Ok, no binary file, so convert.
     spineml::ConnectionList cl;
+    cl.separateDelays = this->separateDelays;
 
     // First see if we have a Delay element, and what
     // that delay is, so that we can assign delays to the Connections.
     bool have_delay_element = this->setup_connection_delays (connlist_node, cl,
                                                              fixedValDelayChange);
 
+    if (this->planning) {
+        ConnectionJob* job = new ConnectionJob (connlist_node, cl, this->modeldir,
+                                                this->nextConnectionPath (connlist_node));
+        job->setExplicitList (have_delay_element,
+                              have_delay_element || fixedValDelayChange >= 0);
+        this->add_job (job);
+        return;
+    }
+
+    Metrics::Scope ps (Metrics::Projection,
+                       Metrics::enabled() ? ModelPreflight::connection_label (connlist_node) : "");
+
     // Read XML to get each connection and insert this into
     // the ConnectionList object.
+    ModelPreflight::read_connection_list (connlist_node, cl, have_delay_element);
+
+    // If the ConnectionList contained a Delay element, we have to
+    // generate the delays before writing the connection out.
+    if (have_delay_element || fixedValDelayChange >= 0) {
+        cl.generateDelays();
+    }
+
+    // Lastly, write these out:
+    this->write_connection_out (connlist_node, cl);
+    ps.count (cl.connectivityC2D.size(), cl.binaryFileSize (cl.connectivityC2D.size()));
+}
+
+XmlEdit
+ModelPreflight::binary_delay_change_edit (xml_node<>* connlist_node,
+                                          xml_node<>* binaryfile_node,
+                                          float fixedValDelayChange)
+{
+    // As ConnectionList::xmlEdit writes it for a fixed delay, but
+    // keeping the attributes of the BinaryFile other than those which
+    // describe the delay column.
+    XmlEdit edit (connlist_node, "ConnectionList");
+    int delay_el = edit.addElement ("Delay");
+    edit.addAttribute (delay_el, "dimension", "ms");
+    int fv_el = edit.addElement ("FixedValue", delay_el);
+    stringstream valss;
+    valss << fixedValDelayChange;
+    edit.addAttribute (fv_el, "value", valss.str());
+    int binfile_el = edit.addElement ("BinaryFile");
+    bool have_flag = false;
+    for (xml_attribute<>* a = binaryfile_node->first_attribute(); a; a = a->next_attribute()) {
+        string name (a->name());
+        if (name == "explicit_delay_flag") {
+            edit.addAttribute (binfile_el, name, "0");
+            have_flag = true;
+        } else if (name != "value_bits" && name != "delay_file_name") {
+            edit.addAttribute (binfile_el, name, a->value());
+        }
+    }
+    if (!have_flag) {
+        edit.addAttribute (binfile_el, "explicit_delay_flag", "0");
+    }
+    return edit;
+}
+
+void
+ModelPreflight::binary_connection_delay_change (xml_node<>* connlist_node,
+                                                xml_node<>* binaryfile_node,
+                                                float fixedValDelayChange)
+{
+    xml_attribute<>* fname_attr = binaryfile_node->first_attribute ("file_name");
+    xml_attribute<>* nconn_attr = binaryfile_node->first_attribute ("num_connections");
+    if (!fname_attr || !nconn_attr) {
+        throw runtime_error ("A binary ConnectionList's BinaryFile has no file_name "
+                             "or num_connections.");
+    }
+    unsigned long long num_connections = 0;
+    {
+        stringstream ss;
+        ss << nconn_attr->value();
+        ss >> num_connections;
+    }
+    BinaryTranscoder::Layout layout = BinaryTranscoder::layoutOf (binaryfile_node);
+
+    XmlEdit edit = ModelPreflight::binary_delay_change_edit (connlist_node, binaryfile_node,
+                                                             fixedValDelayChange);
+
+    // Nothing the model refers to is changed until write() has
+    // replaced model.xml, so that a failure before then leaves the
+    // old model and its data consistent.
+    string path = this->modeldir + fname_attr->value();
+    xml_attribute<>* dfname_attr = binaryfile_node->first_attribute ("delay_file_name");
+    if (dfname_attr) {
+        // The connectivity file is left just as it is.
+        string dpath = this->modeldir + dfname_attr->value();
+        cout << "Preflight: The delay file " << dpath
+             << (this->dryRun ? " would be removed" : " will be removed")
+             << " for the delay change to " << fixedValDelayChange << " ms\n";
+        if (!this->dryRun) {
+            this->pendingRemovals.push_back (dpath);
+        }
+    } else if (layout.delays) {
+        cout << "Preflight: " << (this->dryRun ? "Would remove" : "Removing")
+             << " the delays from binary connection list " << path
+             << " for the delay change to " << fixedValDelayChange << " ms\n";
+        BinaryTranscoder::Layout nodelays = layout;
+        nodelays.delays = false;
+        string tmppath = Util::tempPathFor (path);
+        if (!this->dryRun) {
+            this->pendingReplacements.push_back (make_pair (tmppath, path));
+        }
+        if (this->planning) {
+            this->add_job (new TranscodeJob (path, layout, tmppath, nodelays,
+                                             num_connections, edit));
+            return;
+        }
+        BinaryTranscoder::transcode (path, layout, tmppath, nodelays,
+                                     num_connections, this->threads);
+    } else {
+        cout << "Preflight: " << (this->dryRun ? "Would set" : "Setting")
+             << " the delay of binary connection list " << path
+             << " to " << fixedValDelayChange << " ms\n";
+    }
+
+    // Alongside any planned jobs' edits, so that a dry run lists it.
+    if (this->planning) {
+        this->journal.add (edit);
+    } else {
+        edit.apply();
+    }
+}
+
+void
+ModelPreflight::read_connection_list (xml_node<>* connlist_node,
+                                      ConnectionList& cl,
+                                      bool have_delay_element)
+{
+    Metrics::Scope ms (Metrics::Phase, "connectivity");
     int c_idx = 0; // Connection index
     int src, dst; float delay;
     xml_attribute<>* src_attr;
@@ -700,21 +1169,15 @@ ModelPreflight::connection_list_to_binary (xml_node<>* connlist_node,
             cl.connectivityC2Delay.push_back (delay);
         }
     }
-
-    // If the ConnectionList contained a Delay element, we have to
-    // generate the delays before writing the connection out.
-    if (have_delay_element || fixedValDelayChange >= 0) {
-        cl.generateDelays();
-    }
-
-    // Lastly, write these out:
-    this->write_connection_out (connlist_node, cl);
+    ms.count (c_idx);
+    cl.account();
 }
 
 void
 ModelPreflight::replace_fixedprob_connection (xml_node<>* fixedprob_node,
                                               const string& src_num, const string& dst_num,
-                                              float fixedValDelayChange)
+                                              float fixedValDelayChange,
+                                              bool recurrent)
 {
     // Get the FixedProbability probability and seed from this bit of the model.xml:
     // <FixedProbabilityConnection probability="0.11" seed="123">
@@ -749,6 +1212,12 @@ ModelPreflight::replace_fixedprob_connection (xml_node<>* fixedprob_node,
     }
 
     spineml::ConnectionList cl;
+    cl.separateDelays = this->separateDelays;
+    cl.coupledSampling = this->coupledSampling;
+    cl.noAutapses = this->noAutapses && recurrent;
+    if (!this->dryRun) {
+        cl.samplingCache = this->samplingCache;
+    }
     this->setup_connection_delays (fixedprob_node, cl, fixedValDelayChange);
 
     unsigned int srcNum = 0;
@@ -764,10 +1233,152 @@ ModelPreflight::replace_fixedprob_connection (xml_node<>* fixedprob_node,
         ss >> dstNum;
     }
 
+    if (this->planning) {
+        ConnectionJob* job = new ConnectionJob (fixedprob_node, cl, this->modeldir,
+                                                this->nextConnectionPath (fixedprob_node));
+        job->setFixedProbability (seed, probabilityValue, srcNum, dstNum);
+        this->add_job (job);
+        return;
+    }
+
+    Metrics::Scope ps (Metrics::Projection,
+                       Metrics::enabled() ? ModelPreflight::connection_label (fixedprob_node) : "");
+    if (!cl.memory.claim (cl.fixedProbabilityMemory (probabilityValue, srcNum, dstNum))) {
+        // Holding this connection list would go over the memory
+        // budget, so write it out a row at a time instead.
+        cout << "Preflight: " << ModelPreflight::connection_label (fixedprob_node)
+             << " would exceed the memory budget; streaming it to file.\n";
+        string binfile = this->nextConnectionPath (fixedprob_node);
+        unsigned int n = cl.streamFixedProbability (seed, probabilityValue, srcNum, dstNum,
+                                                    this->modeldir + binfile);
+        cl.writeXml (fixedprob_node, this->modeldir, binfile, n);
+        ps.count (n, cl.binaryFileSize (n));
+        return;
+    }
     cl.generateFixedProbability (seed, probabilityValue, srcNum, dstNum);
     cl.generateDelays();
 
     this->write_connection_out (fixedprob_node, cl);
+    ps.count (cl.connectivityC2D.size(), cl.binaryFileSize (cl.connectivityC2D.size()));
+}
+
+void
+ModelPreflight::replace_fixednumber_connection (xml_node<>* fixednum_node,
+                                                const string& src_num, const string& dst_num,
+                                                float fixedValDelayChange,
+                                                bool recurrent)
+{
+    bool pre = (string(fixednum_node->name()) == "FixedNumberPreConnection");
+    string fn_number = ModelPreflight::attribute_value (fixednum_node, "number");
+    if (fn_number.empty()) {
+        stringstream ee;
+        ee << "Failed to get " << fixednum_node->name() << "'s number attr from model.xml";
+        throw runtime_error (ee.str());
+    }
+    string fn_seed = ModelPreflight::attribute_value (fixednum_node, "seed");
+    if (fn_seed.empty()) {
+        stringstream ee;
+        ee << "Failed to get " << fixednum_node->name() << "'s seed attr from model.xml";
+        throw runtime_error (ee.str());
+    }
+    unsigned int number = 0;
+    int seed = 0;
+    unsigned int srcNum = 0;
+    unsigned int dstNum = 0;
+    {
+        stringstream ss;
+        ss << fn_number << " " << fn_seed << " " << src_num << " " << dst_num;
+        ss >> number >> seed >> srcNum >> dstNum;
+    }
+
+    spineml::ConnectionList cl;
+    cl.separateDelays = this->separateDelays;
+    cl.threads = this->threads;
+    cl.noAutapses = this->noAutapses && recurrent;
+    this->setup_connection_delays (fixednum_node, cl, fixedValDelayChange);
+
+    if (this->planning) {
+        ConnectionJob* job = new ConnectionJob (fixednum_node, cl, this->modeldir,
+                                                this->nextConnectionPath (fixednum_node));
+        job->setFixedNumber (seed, number, pre, srcNum, dstNum);
+        this->add_job (job);
+        return;
+    }
+
+    Metrics::Scope ps (Metrics::Projection,
+                       Metrics::enabled() ? ModelPreflight::connection_label (fixednum_node) : "");
+    if (!cl.memory.claim (cl.fixedNumberMemory (number, pre, srcNum, dstNum))) {
+        // As for a fixed probability connection.
+        cout << "Preflight: " << ModelPreflight::connection_label (fixednum_node)
+             << " would exceed the memory budget; streaming it to file.\n";
+        string binfile = this->nextConnectionPath (fixednum_node);
+        unsigned int n = cl.streamFixedNumber (seed, number, pre, srcNum, dstNum,
+                                               this->modeldir + binfile);
+        cl.writeXml (fixednum_node, this->modeldir, binfile, n);
+        ps.count (n, cl.binaryFileSize (n));
+        return;
+    }
+    cl.generateFixedNumber (seed, number, pre, srcNum, dstNum);
+    cl.generateDelays();
+
+    this->write_connection_out (fixednum_node, cl);
+    ps.count (cl.connectivityC2D.size(), cl.binaryFileSize (cl.connectivityC2D.size()));
+}
+
+void
+ModelPreflight::replace_distance_connection (xml_node<>* distance_node,
+                                             const string& src_name, const string& src_num,
+                                             const string& dst_name, const string& dst_num,
+                                             float fixedValDelayChange)
+{
+    spineml::DistanceConnectivity dc;
+    dc.read (distance_node);
+    unsigned int srcNum = 0;
+    unsigned int dstNum = 0;
+    {
+        stringstream ss;
+        ss << src_num << " " << dst_num;
+        ss >> srcNum >> dstNum;
+    }
+    xml_node<>* src_layout = this->find_layout (src_name);
+    xml_node<>* dst_layout = this->find_layout (dst_name);
+
+    spineml::ConnectionList cl;
+    cl.separateDelays = this->separateDelays;
+    cl.threads = this->threads;
+    cl.noAutapses = this->noAutapses && src_name == dst_name;
+    this->setup_connection_delays (distance_node, cl, fixedValDelayChange);
+
+    if (this->planning) {
+        ConnectionJob* job = new ConnectionJob (distance_node, cl, this->modeldir,
+                                                this->nextConnectionPath (distance_node));
+        job->setDistanceBased (dc, src_layout, srcNum, dst_layout, dstNum);
+        this->add_job (job);
+        return;
+    }
+
+    Metrics::Scope ps (Metrics::Projection,
+                       Metrics::enabled() ? ModelPreflight::connection_label (distance_node) : "");
+    // The source population's Layout has been expanded by now, and
+    // perhaps the destination's; either is read back from its file.
+    dc.setLayouts (src_layout, srcNum, dst_layout, dstNum, this->modeldir, this->threads);
+    if (!cl.memory.claim (cl.distanceBasedMemory (dc))) {
+        // As for a fixed probability connection.
+        cout << "Preflight: " << ModelPreflight::connection_label (distance_node)
+             << " would exceed the memory budget; streaming it to file.\n";
+        string binfile = this->nextConnectionPath (distance_node);
+        unsigned int n = cl.streamDistanceBased (dc, this->modeldir + binfile);
+        dc.clear();
+        cl.writeXml (distance_node, this->modeldir, binfile, n);
+        ps.count (n, cl.binaryFileSize (n));
+        return;
+    }
+    cl.generateDistanceBased (dc);
+    dc.clear();
+    cl.generateDelays();
+
+    this->write_connection_out (distance_node, cl);
+    ps.count (cl.connectivityC2D.size(), cl.binaryFileSize (cl.connectivityC2D.size()));
 }
 
 bool
@@ -871,15 +1482,107 @@ ModelPreflight::setup_connection_delays (xml_node<>* parent_node,
     return have_delay_element;
 }
 
+string
+ModelPreflight::nextLayoutPath (const string& pop_name)
+{
+    if (this->stableNames) {
+        this->layout_binfilenum++;
+        return Util::stableFileName ("pf_layout_", vector<string>(1, pop_name));
+    }
+
+    stringstream ss;
+    ss << "pf_layout" << this->layout_binfilenum++ << ".bin";
+    return ss.str();
+}
+
 void
 ModelPreflight::write_connection_out (xml_node<>* parent_node, ConnectionList& cl)
 {
+    cl.write (parent_node, this->modeldir, this->nextConnectionPath (parent_node));
+}
+
+string
+ModelPreflight::nextConnectionPath (xml_node<>* conn_node)
+{
+    if (this->stableNames) {
+        this->binfilenum++;
+        return Util::stableFileName ("pf_connection_",
+                                     ModelPreflight::connection_identity (conn_node));
+    }
+
     string binfilepath ("pf_connection");
     stringstream numss;
     numss << this->binfilenum++;
     binfilepath += numss.str();
     binfilepath += ".bin";
-    cl.write (parent_node, this->modeldir, binfilepath);
+    return binfilepath;
+}
+
+vector<string>
+ModelPreflight::connection_identity (xml_node<>* conn_node)
+{
+    // The same parts, in the same order, as the experiment layer
+    // uses to identify a synapse or input for a delay change.
+    vector<string> identity;
+    xml_node<>* owner = conn_node->parent();
+    if (!owner) {
+        return identity;
+    }
+    string owner_name (owner->name());
+    if (owner_name == LVL"Synapse") {
+        // The source population is the Neuron alongside the Projection.
+        xml_node<>* proj_node = owner->parent();
+        xml_node<>* pop_node = proj_node ? proj_node->parent() : 0;
+        xml_node<>* src_node = pop_node ? pop_node->first_node (LVL"Neuron") : 0;
+        unsigned int synapse_num = 0;
+        for (xml_node<>* n = owner->previous_sibling (LVL"Synapse"); n;
+             n = n->previous_sibling (LVL"Synapse")) {
+            ++synapse_num;
+        }
+        stringstream synss;
+        synss << synapse_num;
+        identity.push_back (ModelPreflight::attribute_value (src_node, "name"));
+        identity.push_back (ModelPreflight::attribute_value (proj_node, "dst_population"));
+        identity.push_back (synss.str());
+
+    } else if (owner_name == LVL"Input") {
+        identity.push_back (ModelPreflight::attribute_value (owner, "src"));
+        identity.push_back (ModelPreflight::attribute_value (owner, "src_port"));
+        identity.push_back (ModelPreflight::attribute_value (owner->parent(), "name"));
+        identity.push_back (ModelPreflight::attribute_value (owner, "dst_port"));
+    }
+    return identity;
+}
+
+string
+ModelPreflight::connection_label (xml_node<>* conn_node)
+{
+    return ModelPreflight::connection_label (ModelPreflight::connection_identity (conn_node));
+}
+
+string
+ModelPreflight::connection_label (const vector<string>& identity)
+{
+    if (identity.size() == 3) {
+        return identity[0] + " to " + identity[1] + " synapse " + identity[2];
+    } else if (identity.size() == 4) {
+        return identity[0] + "/" + identity[1] + " to " + identity[2] + "/" + identity[3];
+    }
+    return string("");
+}
+
+string
+ModelPreflight::attribute_value (xml_node<>* node, const char* attr_name)
+{
+    xml_attribute<>* attr = node ? node->first_attribute (attr_name) : 0;
+    return attr ? string (attr->value()) : string("");
+}
+
+xml_node<>*
+ModelPreflight::find_fixednumber (xml_node<>* owner)
+{
+    xml_node<>* n = owner->first_node ("FixedNumberPreConnection");
+    return n ? n : owner->first_node ("FixedNumberPostConnection");
 }
 
 #define STRLEN_PROPERTY 8
@@ -1094,11 +1797,19 @@ ModelPreflight::findLLWeightUpdate (rapidxml::xml_node<>* current_node,
 
 #ifdef EXPLICIT_BINARY_DATA_CONVERSION
 #include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
 
 void
 ModelPreflight::binaryDataFloatToDouble (bool forwards)
 {
-    // Iterate through model. For each binaryDatafile thing, convert.
+    // Find the explicit data files in the model, then convert them all.
     this->init();
     this->binaryDataF2D = forwards;
     if (this->binaryDataF2D) {
@@ -1106,11 +1817,66 @@ ModelPreflight::binaryDataFloatToDouble (bool forwards)
     } else {
         cout << "PreFlight: Double to float conversion requested" << endl;
     }
-    // On run 1, this checks that all binary files have correct size.
-    this->findExplicitData (static_cast<xml_node<>*>(0), 1);
+    vector<BinaryDataFile> files;
+    this->findExplicitData (static_cast<xml_node<>*>(0), files);
+    int n = static_cast<int>(files.size());
+
+    // Check that all binary files have the correct size before any
+    // is modified.
+#pragma omp parallel for schedule(dynamic) num_threads(this->threads)
+    for (int i = 0; i < n; ++i) {
+        try {
+            this->binaryDataVerify (files[i]);
+        } catch (const std::exception& e) {
+            files[i].failed = true;
+            files[i].error = e.what();
+        }
+    }
+    for (int i = 0; i < n; ++i) {
+        cout << "PreFlight: Verify file " << files[i].bf_fname << " which has  "
+             << files[i].num_elements << " elements\n";
+        if (files[i].failed) {
+            throw runtime_error (files[i].error);
+        }
+    }
     cout << "PreFlight: binaryDataFiles can be converted; proceeding!\n";
-    // On run 2, the binary files are modified.
-    this->findExplicitData (static_cast<xml_node<>*>(0), 2);
+
+    // Write the converted files alongside the originals. If any
+    // fails, remove them all, leaving the model as it was.
+#pragma omp parallel for schedule(dynamic) num_threads(this->threads)
+    for (int i = 0; i < n; ++i) {
+        try {
+            this->binaryDataModify (files[i]);
+        } catch (const std::exception& e) {
+            files[i].failed = true;
+            files[i].error = e.what();
+        }
+    }
+    for (int i = 0; i < n; ++i) {
+        if (files[i].failed) {
+            for (int j = 0; j < n; ++j) {
+                unlink ((files[j].fname + ".out").c_str());
+            }
+            throw runtime_error (files[i].error);
+        }
+    }
+
+    // Now swap them in. Each swap is a rename, so this can't be undone
+    // part way through; a failure leaves the files before it converted
+    // and removes the converted copies of the rest.
+    int i = 0;
+    try {
+        for (; i < n; ++i) {
+            cout << "PreFlight: Modify file " << files[i].bf_fname << " which has  "
+                 << files[i].num_elements << " elements\n";
+            this->binaryDataReplace (files[i]);
+        }
+    } catch (const std::exception& e) {
+        for (int j = i; j < n; ++j) {
+            unlink ((files[j].fname + ".out").c_str());
+        }
+        throw;
+    }
 }
 
 void
@@ -1120,13 +1886,11 @@ ModelPreflight::binaryDataDoubleToFloat (void)
 }
 
 #define STRLEN_BINARYFILE 10
-xml_node<>*
-ModelPreflight::findExplicitData (xml_node<>* current_node, const unsigned int& run)
+void
+ModelPreflight::findExplicitData (xml_node<>* current_node, vector<BinaryDataFile>& files)
 {
-    xml_node<>* rtn = static_cast<xml_node<>*>(0);
-
-    if (current_node == rtn /* i.e. static_cast<xml_node<>*>(0) */) {
-        if (this->root_node == rtn) {
+    if (current_node == static_cast<xml_node<>*>(0)) {
+        if (this->root_node == static_cast<xml_node<>*>(0)) {
             throw runtime_error ("findExplicitData: root_node is not allocated.");
         }
         current_node = this->root_node;
@@ -1145,15 +1909,16 @@ ModelPreflight::findExplicitData (xml_node<>* current_node, const unsigned int&
         }
 
         if (bf_fname.substr(0,12) == "explicitData") {
-            // Modify!
-            if (run == 1) {
-                this->binaryDataVerify (current_node);
-            } else if (run == 2) {
-                this->binaryDataModify (current_node);
-            } else {
-                throw runtime_error ("unexpected run number.");
+            BinaryDataFile bdf;
+            bdf.bf_fname = bf_fname;
+            bdf.fname = this->modeldir + bf_fname;
+            xml_attribute<>* nelemattr = current_node->first_attribute ("num_elements");
+            if (nelemattr) {
+                stringstream ss;
+                ss << nelemattr->value();
+                ss >> bdf.num_elements;
             }
-            rtn = current_node;
+            files.push_back (bdf);
         }
 
     } else {
@@ -1162,49 +1927,23 @@ ModelPreflight::findExplicitData (xml_node<>* current_node, const unsigned int&
         for (next_node = current_node->first_node();
              next_node;
              next_node = next_node->next_sibling()) {
-
-            if ((rtn = this->findExplicitData (next_node, run)) != static_cast<xml_node<>*>(0)) {
-                // next_node was a BinaryFile of interest!
-            }
+            this->findExplicitData (next_node, files);
         }
     }
-
-    return rtn;
 }
 
 void
-ModelPreflight::binaryDataVerify (xml_node<>* binaryfile_node)
+ModelPreflight::binaryDataVerify (const BinaryDataFile& bdf)
 {
-    xml_attribute<>* nattr = binaryfile_node->first_attribute ("file_name");
-    string bf_fname("");
-    if (nattr) {
-        bf_fname = nattr->value();
-    }
-    xml_attribute<>* nelemattr = binaryfile_node->first_attribute ("num_elements");
-    stringstream ss;
-    unsigned int num_elements = 0;
-    if (nelemattr) {
-        ss << nelemattr->value();
-        ss >> num_elements;
-    }
-
-    cout << "PreFlight: Verify file " << bf_fname << " which has  " << num_elements << " elements\n";
-
-    string fname = this->modeldir + bf_fname;
-    ifstream f;
-    f.open (fname.c_str(), ios::in);
-    if (!f.is_open()) {
+    struct stat st;
+    if (stat (bdf.fname.c_str(), &st) != 0) {
         stringstream ee;
-        ee << "binaryDataVerify: Failed to open file " << fname << " for reading";
+        ee << "binaryDataVerify: Failed to stat file " << bdf.fname << ": " << strerror (errno);
+        throw runtime_error (ee.str());
     }
-    // Get size;
-    f.seekg (0, ios::end);
-    unsigned int nbytes = f.tellg();
-    f.close();
+    unsigned long long nbytes = static_cast<unsigned long long>(st.st_size);
+    unsigned long long num_elements = bdf.num_elements;
 
-    //cout << "num_elements=" << num_elements
-    //     << " nbytes=" << nbytes << " nbytes/8=" << nbytes/8
-    //     << " nbytes/12=" << nbytes/12 << endl;
     if (nbytes/8 == num_elements) {
         // We're in int,float format.
         if (this->binaryDataF2D == true) {
@@ -1226,93 +1965,151 @@ ModelPreflight::binaryDataVerify (xml_node<>* binaryfile_node)
     }
 }
 
-void
-ModelPreflight::binaryDataModify (xml_node<>* binaryfile_node)
+/*!
+ * Convert @param n index,float records at @param in into
+ * index,double records at @param out. The records are packed, so
+ * they're unaligned; two floats at a time are widened with cvtps2pd
+ * where SSE2 is available.
+ */
+static void
+indexedFloatToDouble (const char* in, char* out, size_t n)
 {
-    xml_attribute<>* nattr = binaryfile_node->first_attribute ("file_name");
-    string bf_fname("");
-    if (nattr) {
-        bf_fname = nattr->value();
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 1 < n; i += 2) {
+        // in: i0 f0 i1 f1 -> f0 f1 in the low half, then widen.
+        __m128i r = _mm_loadu_si128 (reinterpret_cast<const __m128i*>(in + i*8));
+        __m128 f = _mm_castsi128_ps (_mm_shuffle_epi32 (r, _MM_SHUFFLE(3,1,3,1)));
+        double d[2];
+        _mm_storeu_pd (d, _mm_cvtps_pd (f));
+        memcpy (out + i*12, in + i*8, 4);
+        memcpy (out + i*12 + 4, &d[0], 8);
+        memcpy (out + i*12 + 12, in + i*8 + 8, 4);
+        memcpy (out + i*12 + 16, &d[1], 8);
     }
-    xml_attribute<>* nelemattr = binaryfile_node->first_attribute ("num_elements");
-    stringstream ss;
-    unsigned int num_elements = 0;
-    if (nelemattr) {
-        ss << nelemattr->value();
-        ss >> num_elements;
+#endif
+    for (; i < n; ++i) {
+        float value;
+        memcpy (&value, in + i*8 + 4, 4);
+        double dvalue = static_cast<double>(value);
+        memcpy (out + i*12, in + i*8, 4);
+        memcpy (out + i*12 + 4, &dvalue, 8);
     }
+}
 
-    cout << "PreFlight: Modify file " << bf_fname << " which has  " << num_elements << " elements\n";
+/*!
+ * Convert @param n index,double records at @param in into
+ * index,float records at @param out, with cvtpd2ps where SSE2 is
+ * available.
+ */
+static void
+indexedDoubleToFloat (const char* in, char* out, size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 1 < n; i += 2) {
+        double d[2];
+        memcpy (&d[0], in + i*12 + 4, 8);
+        memcpy (&d[1], in + i*12 + 16, 8);
+        float f[4];
+        _mm_storeu_ps (f, _mm_cvtpd_ps (_mm_loadu_pd (d)));
+        memcpy (out + i*8, in + i*12, 4);
+        memcpy (out + i*8 + 4, &f[0], 4);
+        memcpy (out + i*8 + 8, in + i*12 + 12, 4);
+        memcpy (out + i*8 + 12, &f[1], 4);
+    }
+#endif
+    for (; i < n; ++i) {
+        double dvalue;
+        memcpy (&dvalue, in + i*12 + 4, 8);
+        float value = static_cast<float>(dvalue);
+        memcpy (out + i*8, in + i*12, 4);
+        memcpy (out + i*8 + 4, &value, 4);
+    }
+}
 
-    // When this code runs, the verify function should already have run.
-    string fname = this->modeldir + bf_fname;
-    ifstream f;
-    f.open (fname.c_str(), ios::in);
-    if (!f.is_open()) {
+//! Records converted between checks for the end of the mapped input.
+#define BINARY_DATA_BLOCK 65536
+
+void
+ModelPreflight::binaryDataModify (const BinaryDataFile& bdf)
+{
+    // When this code runs, the verify function should already have
+    // run, so the input holds exactly num_elements records.
+    const size_t num_elements = bdf.num_elements;
+    const size_t inrec = this->binaryDataF2D ? 8 : 12;
+    const size_t outrec = this->binaryDataF2D ? 12 : 8;
+    const size_t inbytes = num_elements * inrec;
+    const size_t outbytes = num_elements * outrec;
+
+    const string& fname = bdf.fname;
+    int ifd = open (fname.c_str(), O_RDONLY);
+    if (ifd < 0) {
         stringstream ee;
         ee << "binaryDataModify: Failed to open file " << fname << " for reading";
+        throw runtime_error (ee.str());
     }
     string tmpfname = fname + ".out";
-    ofstream o;
-    o.open (tmpfname.c_str(), ios::out|ios::trunc);
-    if (!o.is_open()) {
+    int ofd = open (tmpfname.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if (ofd < 0) {
+        close (ifd);
         stringstream ee;
         ee << "binaryDataModify: Failed to open file " << tmpfname << " for writing";
+        throw runtime_error (ee.str());
     }
 
-    int index; float value; double dvalue;
-    if (this->binaryDataF2D == true) {
-        // Float to double conversion
-        try {
-            while (!f.eof()) {
-                f.read (reinterpret_cast<char*>(&index), sizeof index);
-                if (f.eof()) {
-                    // Finished reading.
-                    break;
-                }
-                o.write (reinterpret_cast<char*>(&index), sizeof index);
-                f.read (reinterpret_cast<char*>(&value), sizeof value);
-                if (f.eof()) {
-                    cout << "PreFlight: Finished reading in unexpected location\n";
-                    break;
-                }
-                dvalue = static_cast<double>(value);
-                o.write (reinterpret_cast<char*>(&dvalue), sizeof dvalue);
+    if (num_elements > 0) {
+        char* in = static_cast<char*>(mmap (0, inbytes, PROT_READ, MAP_SHARED, ifd, 0));
+        char* out = static_cast<char*>(MAP_FAILED);
+        if (in != MAP_FAILED && ftruncate (ofd, outbytes) == 0) {
+            out = static_cast<char*>(mmap (0, outbytes, PROT_READ|PROT_WRITE, MAP_SHARED, ofd, 0));
+        }
+        if (in == MAP_FAILED || out == MAP_FAILED) {
+            if (in != MAP_FAILED) {
+                munmap (in, inbytes);
             }
-        } catch (const std::exception& e) {
-            throw runtime_error ("Exception copying");
+            close (ifd);
+            close (ofd);
+            unlink (tmpfname.c_str());
+            stringstream ee;
+            ee << "binaryDataModify: Failed to map " << fname << " or " << tmpfname
+               << ": " << strerror (errno);
+            throw runtime_error (ee.str());
         }
-    } else {
-        // Double to float conversion
-        try {
-            while (!f.eof()) {
-                f.read (reinterpret_cast<char*>(&index), sizeof index);
-                if (f.eof()) {
-                    // Finished reading
-                    break;
-                }
-                o.write (reinterpret_cast<char*>(&index), sizeof index);
-                f.read (reinterpret_cast<char*>(&dvalue), sizeof dvalue);
-                if (f.eof()) {
-                    cout << "PreFlight: Finished reading in unexpected location\n";
-                    break;
-                }
-                value = static_cast<float>(dvalue);
-                o.write (reinterpret_cast<char*>(&value), sizeof value);
+        madvise (in, inbytes, MADV_SEQUENTIAL);
+
+        for (size_t i = 0; i < num_elements; i += BINARY_DATA_BLOCK) {
+            size_t n = num_elements - i < BINARY_DATA_BLOCK ? num_elements - i : BINARY_DATA_BLOCK;
+            if (this->binaryDataF2D == true) {
+                indexedFloatToDouble (in + i*inrec, out + i*outrec, n);
+            } else {
+                indexedDoubleToFloat (in + i*inrec, out + i*outrec, n);
             }
-        } catch (const std::exception& e) {
-            throw runtime_error ("Exception copying");
         }
+        munmap (in, inbytes);
+        munmap (out, outbytes);
+    }
+    close (ifd);
+
+    // The new file must be on disk before it replaces the old one.
+    if (fsync (ofd) != 0) {
+        close (ofd);
+        unlink (tmpfname.c_str());
+        stringstream ee;
+        ee << "binaryDataModify: Failed to write " << tmpfname << ": " << strerror (errno);
+        throw runtime_error (ee.str());
     }
-    o.close();
-    f.close();
+    close (ofd);
+}
 
-    // Rename files
-    string bufname = fname + ".bu";
-    // Move existing file to file.bu
-    rename (fname.c_str(), bufname.c_str());
-    // Move new file.out to file
-    rename (tmpfname.c_str(), fname.c_str());
+void
+ModelPreflight::binaryDataReplace (const BinaryDataFile& bdf)
+{
+    // Keep the original as file.bu, then replace file with file.out
+    // in one rename, so file always holds either the old or the new
+    // data.
+    Util::keepPreviousVersion (bdf.fname, bdf.fname + ".bu");
+    Util::replaceFile (bdf.fname + ".out", bdf.fname);
 }
 
 #endif // EXPLICIT_BINARY_DATA_CONVERSION
@@ -11,11 +11,16 @@
 #include <string>
 #include <map>
 #include <set>
+#include <vector>
 #include "rapidxml.hpp"
 #include "allocandread.h"
-#include "component.h"
+#include "componentcache.h"
 #include "connection_list.h"
 #include "delaychange.h"
+#include "memoryuse.h"
+#include "preflightjob.h"
+#include "propertyjob.h"
+#include "xmleditjournal.h"
 
 /*!
  * It may be that we need to run this for HL and LL models, in which
@@ -53,6 +58,13 @@ namespace spineml
          */
         ModelPreflight(const std::string& fdir, const std::string& fname);
 
+        /*!
+         * Frees any jobs left over from a failed parallel preflight,
+         * and removes any rewritten binary files which write() never
+         * put in place.
+         */
+        ~ModelPreflight();
+
         /*!
          * Some initialisation - parse the doc and find the root node.
          */
@@ -82,6 +94,13 @@ namespace spineml
          */
         std::set<std::string> get_component_set (void);
 
+        /*!
+         * Use @param path as the persistent component cache file
+         * instead of the default. "none" disables the cache. @see
+         * ComponentCache
+         */
+        void setComponentCacheFile (const std::string& path);
+
         /*!
          * Find a property called @param propertyName in, for example,
          * a Neuron population named @param containerName Return
@@ -178,7 +197,10 @@ namespace spineml
 
         /*!
          * Backup the existing model.xml file, then overwrite it with
-         * the current content of @see doc
+         * the current content of @see doc. Once it has been replaced,
+         * the binary files rewritten for a delay change take the
+         * place of the originals, and delay files which are no longer
+         * referred to are removed.
          */
         void write (void);
 
@@ -189,6 +211,69 @@ namespace spineml
         rapidxml::xml_attribute<>*
         allocate_attribute (const std::string& attr_name, const std::string& attr_value);
 
+        /*!
+         * Configure connection delays in @param cl using the delays
+         * specified in @param parent_node. This reads the <Delay>
+         * element from the XML into the ConnectionList object.
+         *
+         * @param fixedValDelayChange If this is a connection which
+         * has had its delay overridden in the experiment layer, then
+         * the new delay is passed in as this argument.
+         *
+         * @return true if a Delay element was found, false if the
+         * Delay element was not found.
+         *
+         * Throws exceptions on errors. Also used by StreamingPreflight.
+         */
+        static bool setup_connection_delays (rapidxml::xml_node<> *parent_node,
+                                             spineml::ConnectionList& cl,
+                                             float fixedValDelayChange = -1);
+
+        /*!
+         * Read the Connection elements of the ConnectionList @param
+         * connlist_node into @param cl. @param have_delay_element is
+         * the return value of setup_connection_delays; without a
+         * Delay element, each Connection must have a delay
+         * attribute. Only reads the XML. Throws on malformed XML.
+         */
+        static void read_connection_list (rapidxml::xml_node<> *connlist_node,
+                                          spineml::ConnectionList& cl,
+                                          bool have_delay_element);
+
+        /*!
+         * The value of the attribute @param attr_name of @param node,
+         * or "" if either is missing.
+         */
+        static std::string attribute_value (rapidxml::xml_node<>* node, const char* attr_name);
+
+        /*!
+         * The FixedNumberPreConnection or FixedNumberPostConnection
+         * child of @param owner (a synapse or an input), or null.
+         */
+        static rapidxml::xml_node<>* find_fixednumber (rapidxml::xml_node<>* owner);
+
+        /*!
+         * A readable name for the Synapse or Input containing @param
+         * conn_node, like "A to B synapse 0" or "A/out to B/in".
+         */
+        static std::string connection_label (rapidxml::xml_node<>* conn_node);
+
+        //! The same, from the parts returned by connection_identity().
+        static std::string connection_label (const std::vector<std::string>& identity);
+
+        /*!
+         * The edit which applies the delay change @param
+         * fixedValDelayChange to the ConnectionList @param
+         * connlist_node, whose connections are in the file of @param
+         * binaryfile_node. The Delay becomes a FixedValue and the
+         * BinaryFile keeps its attributes, less those describing the
+         * delays. Only makes the edit; the binary files are left to
+         * the caller. Also used by StreamingPreflight.
+         */
+        static spineml::XmlEdit binary_delay_change_edit (rapidxml::xml_node<> *connlist_node,
+                                                          rapidxml::xml_node<> *binaryfile_node,
+                                                          float fixedValDelayChange);
+
 #ifdef EXPLICIT_BINARY_DATA_CONVERSION
     public:
         /*!
@@ -199,6 +284,12 @@ namespace spineml
          *
          * SpineCreator commit 19a3a42 converted this to int,double,
          * to match up with BRAHMS.
+         *
+         * Every file is verified and converted alongside its original
+         * before any is replaced, so a failure up to then leaves the
+         * model as it was. A failure while the converted files are
+         * being swapped in leaves the files before it converted and
+         * the rest as they were.
          */
         void binaryDataFloatToDouble (bool forwards = true);
 
@@ -214,12 +305,46 @@ namespace spineml
          */
         bool binaryDataF2D;
 
-        rapidxml::xml_node<>* findExplicitData (rapidxml::xml_node<>* current_node,
-                                                const unsigned int& run);
+        /*!
+         * An explicit data file found in the model, and the outcome
+         * of checking or converting it on a worker thread.
+         */
+        struct BinaryDataFile {
+            BinaryDataFile() : num_elements (0), failed (false) {}
+            //! The file_name attribute of the BinaryFile element.
+            std::string bf_fname;
+            //! The path to the file.
+            std::string fname;
+            //! The num_elements attribute of the BinaryFile element.
+            unsigned long long num_elements;
+            bool failed;
+            std::string error;
+        };
 
-        void binaryDataVerify (rapidxml::xml_node<>* binaryfile_node);
+        /*!
+         * Add the explicit data files referenced at or below
+         * current_node (the root node if null) to files.
+         */
+        void findExplicitData (rapidxml::xml_node<>* current_node,
+                               std::vector<BinaryDataFile>& files);
 
-        void binaryDataModify (rapidxml::xml_node<>* binaryfile_node);
+        /*!
+         * Check from its size that the file for bdf holds
+         * num_elements records in the format we're converting from.
+         */
+        void binaryDataVerify (const BinaryDataFile& bdf);
+
+        /*!
+         * Convert the file for bdf via memory maps into file.out,
+         * leaving the original untouched.
+         */
+        void binaryDataModify (const BinaryDataFile& bdf);
+
+        /*!
+         * Replace the file for bdf with file.out in a single rename,
+         * keeping the original as file.bu.
+         */
+        void binaryDataReplace (const BinaryDataFile& bdf);
 #endif // EXPLICIT_BINARY_DATA_CONVERSION
 
     private:
@@ -248,6 +373,12 @@ namespace spineml
          */
         int find_num_neurons (const std::string& dst_population);
 
+        /*!
+         * The Layout of the population named @param pop_name, or
+         * null if it has none.
+         */
+        rapidxml::xml_node<>* find_layout (const std::string& pop_name);
+
         /*!
          * Given the population node, just get the name of the
          * component used by that population.
@@ -262,6 +393,15 @@ namespace spineml
          */
         void preflight_population (rapidxml::xml_node<>* pop_node);
 
+        /*!
+         * Expand the Layout @param layout_node of the population
+         * @param pop_name, of @param pop_size neurons, into a binary
+         * file of positions, if it is one of the layouts which
+         * NeuronLayout generates.
+         */
+        void preflight_layout (rapidxml::xml_node<>* layout_node,
+                               const std::string& pop_name, unsigned int pop_size);
+
         /*!
          * Process the passed-in projection, making any changes necessary.
          *
@@ -420,11 +560,68 @@ namespace spineml
          * @param fixedValDelayChange If this is a connection which
          * has had its delay overridden in the experiment layer, then
          * the new delay is passed in as this argument.
+         *
+         * @param recurrent True if the source and destination are the
+         * same population, in which case no autapses are made if
+         * noAutapses is set.
          */
         void replace_fixedprob_connection (rapidxml::xml_node<>* fixedprob_node,
                                            const std::string& src_num,
                                            const std::string& dst_num,
-                                           float fixedValDelayChange = -1.0);
+                                           float fixedValDelayChange = -1.0,
+                                           bool recurrent = false);
+
+        /*!
+         * Replace a fixed number connection with a binary
+         * ConnectionList, in the same way as
+         * replace_fixedprob_connection. @param fixednum_node is one
+         * of:
+         *
+         * \verbatim
+         *          <FixedNumberPreConnection number="10" seed="123">
+         *              <Delay Dimension="ms">
+         *                  <FixedValue value="0.2"/>
+         *              </Delay>
+         *          </FixedNumberPreConnection>
+         *          <FixedNumberPostConnection number="10" seed="123">
+         *              ...
+         *          </FixedNumberPostConnection>
+         * \endverbatim
+         *
+         * With FixedNumberPre, each neuron of the destination
+         * population is connected from number distinct neurons of the
+         * source population; with FixedNumberPost, each source neuron
+         * connects to number distinct destination neurons. See
+         * ConnectionList::generateFixedNumber.
+         */
+        void replace_fixednumber_connection (rapidxml::xml_node<>* fixednum_node,
+                                             const std::string& src_num,
+                                             const std::string& dst_num,
+                                             float fixedValDelayChange = -1.0,
+                                             bool recurrent = false);
+
+        /*!
+         * Replace a DistanceBasedConnection, from the population
+         * @param src_name to @param dst_name, with a connection list:
+         *
+         * \verbatim
+         *          <DistanceBasedConnection function="gaussian" probability="0.5"
+         *                                   scale="20" seed="123">
+         *              <Delay Dimension="ms">
+         *                  <FixedValue value="0.2"/>
+         *              </Delay>
+         *          </DistanceBasedConnection>
+         * \endverbatim
+         *
+         * Both populations need Layouts, from which the positions of
+         * their neurons are taken. See DistanceConnectivity.
+         */
+        void replace_distance_connection (rapidxml::xml_node<>* distance_node,
+                                          const std::string& src_name,
+                                          const std::string& src_num,
+                                          const std::string& dst_name,
+                                          const std::string& dst_num,
+                                          float fixedValDelayChange = -1.0);
 
         /*!
          * Do the work of replacing an XML-only ConnectionList connection with a
@@ -460,22 +657,20 @@ namespace spineml
                                         float fixedValDelayChange = -1);
 
         /*!
-         * Configure connection delays in @param cl using the delays
-         * specified in @param parent_node. This reads the <Delay>
-         * element from the XML into the ConnectionList object.
-         *
-         * @param fixedValDelayChange If this is a connection which
-         * has had its delay overridden in the experiment layer, then
-         * the new delay is passed in as this argument.
-         *
-         * @return true if a Delay element was found, false if the
-         * Delay element was not found.
-         *
-         * Throws exceptions on errors.
+         * Apply the delay change @param fixedValDelayChange to the
+         * ConnectionList @param connlist_node, which already refers
+         * to @param binaryfile_node. The Delay element becomes a
+         * FixedValue and, if the binary file has a delay column, the
+         * file is rewritten without it (by a TranscodeJob when
+         * planning). The connections themselves are copied from the
+         * old file, never read into memory. If the delays are in a
+         * separate file, that file is removed and the connection file
+         * is not touched at all. The new file only replaces the old
+         * one, and the delay file is only removed, by write().
          */
-        bool setup_connection_delays (rapidxml::xml_node<> *parent_node,
-                                      spineml::ConnectionList& cl,
-                                      float fixedValDelayChange = -1);
+        void binary_connection_delay_change (rapidxml::xml_node<> *connlist_node,
+                                             rapidxml::xml_node<> *binaryfile_node,
+                                             float fixedValDelayChange);
 
         /*!
          * Write out the pf_connectionN.bin file out. The @param
@@ -558,11 +753,109 @@ namespace spineml
         std::string get_component_name (rapidxml::xml_node<>* component_node);
 
         /*!
-         * Generate the next file path for an explicit data file.
+         * Collect the component names from the url attributes of all
+         * the Neuron, WeightUpdate and PostSynapse nodes in the
+         * model and load them all in one go, concurrently, before
+         * the model is traversed. get_component_name() then finds
+         * each component ready, rather than stopping to read and
+         * parse its file.
+         */
+        void prefetch_components (void);
+
+        /*!
+         * Add the component name given by the url attribute of
+         * @param component_node (which may be null) to @param names.
+         */
+        void add_component_url (rapidxml::xml_node<>* component_node,
+                                std::set<std::string>& names);
+
+        /*!
+         * Generate the next file path for an explicit data file, for
+         * the Property @param prop_node. With @see stableNames, the
+         * path is made from the names of the property and the element
+         * which contains it, rather than a running number.
          *
          * @return explicit binary data file path.
          */
-        std::string nextExplicitDataPath (void);
+        std::string nextExplicitDataPath (rapidxml::xml_node<>* prop_node);
+
+        /*!
+         * Generate the next file path for the positions of the
+         * population @param pop_name: pf_layoutN.bin, or with @see
+         * stableNames, a name made from the population name.
+         */
+        std::string nextLayoutPath (const std::string& pop_name);
+
+        /*!
+         * Generate the next file path for a connection list file, for
+         * the connectivity element @param conn_node. With @see
+         * stableNames, the path is made from the source, destination
+         * and synapse number (or ports, for a generic input) of the
+         * Synapse or Input which contains conn_node.
+         *
+         * @return binary connection list file path.
+         */
+        std::string nextConnectionPath (rapidxml::xml_node<>* conn_node);
+
+        /*!
+         * The parts which identify the Synapse (src population, dst
+         * population, synapse number) or generic Input (src,
+         * src_port, dst, dst_port) containing @param conn_node, for a
+         * stable connection file name.
+         */
+        static std::vector<std::string> connection_identity (rapidxml::xml_node<>* conn_node);
+
+        /*!
+         * Preflight all the populations, either directly or, if
+         * @see threads is more than 1 or @see dryRun is set, by
+         * planning jobs and then running them with run_jobs().
+         */
+        void preflight_populations (void);
+
+        /*!
+         * In planning mode, the parallel equivalent of
+         * replace_statevar_property: make a PropertyJob for the
+         * property's content, with the next explicit data file name,
+         * instead of writing it.
+         */
+        void plan_statevar_property (rapidxml::xml_node<>* prop_node, unsigned int pop_size);
+
+        /*!
+         * Run the planned jobs on @see threads threads. Jobs in
+         * @see jobs are independent of one another. Those in @see
+         * weightJobs need their sizes from connection lists in
+         * @see jobs, so they run after those have been committed.
+         */
+        void run_jobs (void);
+
+        /*!
+         * Execute the jobs in @param stage concurrently, then, if all
+         * succeeded, add their edits to @see journal and commit
+         * them. Throws the error of the first failed job.
+         */
+        void run_job_stage (std::vector<spineml::PreflightJob*>& stage);
+
+        /*!
+         * Add the planned @param job to @see jobs.
+         */
+        void add_job (spineml::PreflightJob* job);
+
+        /*!
+         * Delete all planned jobs.
+         */
+        void clear_jobs (void);
+
+        /*!
+         * Put the rewritten binary files in @see pendingReplacements
+         * in place and remove the files in @see pendingRemovals.
+         */
+        void commit_binary_changes (void);
+
+        /*!
+         * Remove the rewritten binary files in @see
+         * pendingReplacements, leaving the originals.
+         */
+        void discard_binary_changes (void);
 
         /*!
          * Determine the number of connections from a synapse given
@@ -599,6 +892,11 @@ namespace spineml
          */
         spineml::AllocAndRead modeldata;
 
+        /*!
+         * The size of modeldata, counted in MemoryUse::ModelText.
+         */
+        spineml::MemoryUse::Hold modelTextMemory;
+
         /*!
          * Main xml_document object.
          */
@@ -626,11 +924,17 @@ namespace spineml
          */
         unsigned int explicitData_binfilenum;
 
+        /*!
+         * The number for the next binary file name for neuron
+         * positions, e.g. '1' for "pf_layout1.bin"
+         */
+        unsigned int layout_binfilenum;
+
         /*!
          * A store of the properties which are state variables for
          * each component.
          */
-        std::map<std::string, spineml::Component> components;
+        spineml::ComponentCache components;
 
         /*!
          * A set of the user-specified experiment-layer delay changes
@@ -640,11 +944,104 @@ namespace spineml
          */
         std::vector<DelayChange> delayChanges;
 
+        /*!
+         * True while the traversal is planning jobs for a parallel
+         * preflight, rather than doing the work itself.
+         */
+        bool planning;
+
+        /*!
+         * The planned jobs which can all run at once, in traversal
+         * order. Output file names are assigned as they are
+         * planned, in the same order as a serial preflight would
+         * assign them, so the output doesn't depend on the number
+         * of threads.
+         */
+        std::vector<spineml::PreflightJob*> jobs;
+
+        /*!
+         * The planned WeightUpdate property jobs, whose sizes depend
+         * on the connection jobs.
+         */
+        std::vector<spineml::PropertyJob*> weightJobs;
+
+        /*!
+         * The changes made to the document by the jobs, in the
+         * order they were applied.
+         */
+        spineml::XmlEditJournal journal;
+
+        /*!
+         * Binary files rewritten alongside the ones the model refers
+         * to, as (new file, file it replaces), and files to be
+         * removed, held back until model.xml has been written.
+         */
+        //@{
+        std::vector<std::pair<std::string, std::string> > pendingReplacements;
+        std::vector<std::string> pendingRemovals;
+        //@}
+
     public:
         /*!
          * If true, then make a backup of model.xml
          */
         bool backup;
+
+        /*!
+         * If false, write model.xml without indentation.
+         */
+        bool indent;
+
+        /*!
+         * The number of threads for preflight(). With 1 (the
+         * default), the model is preflighted serially as it is
+         * traversed.
+         */
+        unsigned int threads;
+
+        /*!
+         * If true, preflight() writes no binary files, and prints
+         * the changes it would make to the model instead. Don't
+         * call write() afterwards.
+         */
+        bool dryRun;
+
+        /*!
+         * If true, binary files are named from the identity of what
+         * they hold (see Util::stableFileName) instead of being
+         * numbered in the order they are written. A part of the model
+         * which is unchanged keeps the same file name from one run
+         * to the next.
+         */
+        bool stableNames;
+
+        /*!
+         * If true, explicit connection delays are written to a file
+         * of their own, named by a delay_file_name attribute of the
+         * BinaryFile, so that a later change to the delays leaves the
+         * connectivity file as it is. See
+         * ConnectionList::separateDelays.
+         */
+        bool separateDelays;
+
+        /*!
+         * If true, FixedProbabilityConnections are expanded with a
+         * CoupledSampler. See ConnectionList::coupledSampling.
+         */
+        bool coupledSampling;
+
+        /*!
+         * The directory for the CoupledSampler caches, or empty for
+         * none. Not used for a dry run.
+         */
+        std::string samplingCache;
+
+        /*!
+         * If true, fixed probability and fixed number connections
+         * from a population to itself make no autapses. See
+         * ConnectionList::noAutapses.
+         */
+        bool noAutapses;
     };
 
 } // namespace spineml
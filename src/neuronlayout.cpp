@@ -0,0 +1,373 @@
+/*
+ * Implementation of NeuronLayout.
+ */
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cmath>
+#include "rapidxml.hpp"
+#include "neuronlayout.h"
+#include "rowsampler.h"
+#include "metrics.h"
+#include "trace.h"
+#include "util.h"
+
+using namespace std;
+using namespace rapidxml;
+using namespace spineml;
+
+/*!
+ * The number of random positions tried for each neuron of a layout
+ * with a minimum distance before giving up.
+ */
+#define NEURONLAYOUT_MAX_ATTEMPTS 10000
+
+/*!
+ * The bucket of the spatial hash for the cell (@param cx, @param cy,
+ * @param cz), in a table of @param mask + 1 buckets.
+ */
+static inline size_t
+cellBucket (long long cx, long long cy, long long cz, size_t mask)
+{
+    unsigned long long h = static_cast<unsigned long long>(cx) * 0x9E3779B97F4A7C15ULL
+        + static_cast<unsigned long long>(cy) * 0xC2B2AE3D27D4EB4FULL
+        + static_cast<unsigned long long>(cz) * 0x165667B19E3779F9ULL;
+    h = (h ^ (h >> 32)) * 0xD6E8FEB86659FD93ULL;
+    return static_cast<size_t>(h ^ (h >> 32)) & mask;
+}
+
+/*!
+ * A neuron placed by NeuronLayout::generateSpaced, with the next
+ * neuron in the same bucket of the spatial hash, so that each neuron
+ * checked costs one read.
+ */
+struct PlacedNeuron {
+    float x, y, z;
+    int next;
+};
+
+NeuronLayout::NeuronLayout()
+    : threads (1)
+    , kind (Linear)
+    , num (0)
+    , seed (0)
+    , minimumDistance (0)
+    , spacing (1)
+    , columns (0)
+    , rows (0)
+    , width (1)
+    , height (1)
+    , depth (0)
+    , memory (MemoryUse::Properties)
+{
+}
+
+bool
+NeuronLayout::read (xml_node<>* layout_node, unsigned int n)
+{
+    if (layout_node->first_node ("BinaryFile")) {
+        // Already expanded.
+        return false;
+    }
+    xml_attribute<>* url_attr = layout_node->first_attribute ("url");
+    if (!url_attr) {
+        return false;
+    }
+    string layout_name = url_attr->value();
+    Util::stripFileSuffix (layout_name);
+    if (layout_name == "linear") {
+        this->kind = Linear;
+    } else if (layout_name == "grid") {
+        this->kind = Grid;
+    } else if (layout_name == "random") {
+        this->kind = Random;
+    } else {
+        return false;
+    }
+    this->num = n;
+
+    xml_attribute<>* seed_attr = layout_node->first_attribute ("seed");
+    if (seed_attr) {
+        stringstream ss;
+        ss << seed_attr->value();
+        ss >> this->seed;
+    }
+    xml_attribute<>* md_attr = layout_node->first_attribute ("minimum_distance");
+    if (md_attr) {
+        stringstream ss;
+        ss << md_attr->value();
+        ss >> this->minimumDistance;
+    }
+
+    for (xml_node<>* prop_node = layout_node->first_node ("Property");
+         prop_node;
+         prop_node = prop_node->next_sibling ("Property")) {
+        xml_attribute<>* name_attr = prop_node->first_attribute ("name");
+        xml_node<>* fv_node = prop_node->first_node ("FixedValue");
+        xml_attribute<>* value_attr = fv_node ? fv_node->first_attribute ("value") : 0;
+        string prop_name = name_attr ? name_attr->value() : "";
+        if (!value_attr) {
+            stringstream ee;
+            ee << "The " << layout_name << " layout's property '" << prop_name
+               << "' should have a FixedValue.";
+            throw runtime_error (ee.str());
+        }
+        stringstream ss;
+        ss << value_attr->value();
+        bool known = true;
+        if (prop_name == "spacing" && this->kind != Random) {
+            ss >> this->spacing;
+        } else if (prop_name == "columns" && this->kind == Grid) {
+            ss >> this->columns;
+        } else if (prop_name == "rows" && this->kind == Grid) {
+            ss >> this->rows;
+        } else if (prop_name == "width" && this->kind == Random) {
+            ss >> this->width;
+        } else if (prop_name == "height" && this->kind == Random) {
+            ss >> this->height;
+        } else if (prop_name == "depth" && this->kind == Random) {
+            ss >> this->depth;
+        } else {
+            known = false;
+        }
+        if (!known || ss.fail()) {
+            stringstream ee;
+            ee << "The " << layout_name << " layout can't use the property '"
+               << prop_name << "' with value '" << value_attr->value() << "'.";
+            throw runtime_error (ee.str());
+        }
+    }
+    return true;
+}
+
+bool
+NeuronLayout::load (xml_node<>* layout_node, unsigned int n, const string& model_root)
+{
+    xml_node<>* binfile_node = layout_node->first_node ("BinaryFile");
+    if (!binfile_node) {
+        if (!this->read (layout_node, n)) {
+            return false;
+        }
+        this->generate();
+        return true;
+    }
+
+    xml_attribute<>* fn_attr = binfile_node->first_attribute ("file_name");
+    string path = model_root + (fn_attr ? fn_attr->value() : "");
+    this->num = n;
+    this->positions.assign (3 * static_cast<size_t>(n), 0.0f);
+    this->memory.set (static_cast<double>(this->positions.capacity() * sizeof(float)));
+    ifstream f (path.c_str(), ios::in|ios::binary);
+    if (!f.is_open()) {
+        stringstream ee;
+        ee << __FUNCTION__ << " Failed to open layout file '" << path << "'.";
+        throw runtime_error (ee.str());
+    }
+    if (!this->positions.empty()) {
+        f.read (reinterpret_cast<char*>(&this->positions[0]),
+                this->positions.size() * sizeof(float));
+    }
+    // There should be exactly n positions.
+    if (!f || f.peek() != char_traits<char>::eof()) {
+        stringstream ee;
+        ee << __FUNCTION__ << " Layout file '" << path << "' doesn't hold the positions of "
+           << n << " neurons.";
+        throw runtime_error (ee.str());
+    }
+    return true;
+}
+
+void
+NeuronLayout::generate (void)
+{
+    Metrics::Scope ms (Metrics::Phase, "layouts");
+    Trace::Scope ts ("NeuronLayout::generate");
+    ts.arg ("neurons", this->num);
+
+    this->positions.assign (3 * static_cast<size_t>(this->num), 0.0f);
+    this->memory.set (static_cast<double>(this->positions.capacity() * sizeof(float)));
+    int n = static_cast<int>(this->num);
+    float* p = this->positions.empty() ? (float*)0 : &this->positions[0];
+
+    if (this->kind == Random) {
+        if (this->minimumDistance > 0) {
+            this->generateSpaced();
+        } else {
+            RowSampler sampler (this->seed, 0);
+            const double w = this->width, h = this->height, d = this->depth;
+#pragma omp parallel for num_threads(this->threads)
+            for (int i = 0; i < n; ++i) {
+                unsigned int ui = static_cast<unsigned int>(i);
+                p[3*i]   = static_cast<float>(sampler.uniform (ui, 0, 0) * w);
+                p[3*i+1] = static_cast<float>(sampler.uniform (ui, 0, 1) * h);
+                p[3*i+2] = static_cast<float>(sampler.uniform (ui, 0, 2) * d);
+            }
+        }
+        ms.count (this->num);
+        return;
+    }
+
+    if (this->num > 1 && this->spacing < this->minimumDistance) {
+        stringstream ee;
+        ee << "A layout spacing of " << this->spacing
+           << " is less than its minimum_distance of " << this->minimumDistance << ".";
+        throw runtime_error (ee.str());
+    }
+    // Linear is a grid of one row which is as long as it needs to be.
+    unsigned int cols = this->columns;
+    unsigned int rws = this->rows;
+    if (this->kind == Linear) {
+        cols = this->num > 0 ? this->num : 1;
+        rws = 1;
+    } else {
+        if (cols == 0) {
+            cols = static_cast<unsigned int>(ceil (sqrt (static_cast<double>(this->num))));
+            cols = cols > 0 ? cols : 1;
+        }
+        if (rws == 0) {
+            rws = (this->num + cols - 1) / cols;
+            rws = rws > 0 ? rws : 1;
+        }
+    }
+    const unsigned int layer = cols * rws;
+    const double s = this->spacing;
+#pragma omp parallel for num_threads(this->threads)
+    for (int i = 0; i < n; ++i) {
+        unsigned int ui = static_cast<unsigned int>(i);
+        p[3*i]   = static_cast<float>((ui % cols) * s);
+        p[3*i+1] = static_cast<float>(((ui / cols) % rws) * s);
+        p[3*i+2] = static_cast<float>((ui / layer) * s);
+    }
+    ms.count (this->num);
+}
+
+void
+NeuronLayout::generateSpaced (void)
+{
+    // Each neuron is tried at random positions until one is at least
+    // minimumDistance from every neuron placed so far. The space is
+    // divided into cubes of side minimumDistance, kept in a hash
+    // table, so that only the neurons in the 27 cubes around a
+    // candidate (9 squares, for a flat box) need be checked.
+    RowSampler sampler (this->seed, 0);
+    const double md = this->minimumDistance;
+    const double md2 = md * md;
+    const bool flat = (this->depth <= 0);
+    size_t nbuckets = 1;
+    while (nbuckets < 2 * static_cast<size_t>(this->num)) {
+        nbuckets <<= 1;
+    }
+    const size_t mask = nbuckets - 1;
+    vector<int> head (nbuckets, -1);
+    vector<PlacedNeuron> placedNeurons (this->num);
+    float* p = this->positions.empty() ? (float*)0 : &this->positions[0];
+
+    for (unsigned int i = 0; i < this->num; ++i) {
+        bool placed = false;
+        for (unsigned int k = 0; k < NEURONLAYOUT_MAX_ATTEMPTS && !placed; ++k) {
+            float x = static_cast<float>(sampler.uniform (i, k, 0) * this->width);
+            float y = static_cast<float>(sampler.uniform (i, k, 1) * this->height);
+            float z = flat ? 0.0f : static_cast<float>(sampler.uniform (i, k, 2) * this->depth);
+            long long cx = static_cast<long long>(floor (x / md));
+            long long cy = static_cast<long long>(floor (y / md));
+            long long cz = static_cast<long long>(floor (z / md));
+            bool clear = true;
+            for (int dz = (flat ? 0 : -1); clear && dz <= (flat ? 0 : 1); ++dz) {
+                for (int dy = -1; clear && dy <= 1; ++dy) {
+                    for (int dx = -1; clear && dx <= 1; ++dx) {
+                        size_t b = cellBucket (cx+dx, cy+dy, cz+dz, mask);
+                        // A bucket may also hold neurons from other
+                        // cells, which are further away; checking
+                        // them too does no harm.
+                        for (int j = head[b]; j >= 0; j = placedNeurons[j].next) {
+                            const PlacedNeuron& o = placedNeurons[j];
+                            double ex = x - o.x, ey = y - o.y, ez = z - o.z;
+                            if (ex*ex + ey*ey + ez*ez < md2) {
+                                clear = false;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+            if (clear) {
+                p[3*i] = x;
+                p[3*i+1] = y;
+                p[3*i+2] = z;
+                size_t b = cellBucket (cx, cy, cz, mask);
+                PlacedNeuron& o = placedNeurons[i];
+                o.x = x;
+                o.y = y;
+                o.z = z;
+                o.next = head[b];
+                head[b] = static_cast<int>(i);
+                placed = true;
+            }
+        }
+        if (!placed) {
+            stringstream ee;
+            ee << "Failed to place neuron " << i << " of " << this->num << " at least "
+               << md << " from the others in a random layout of size " << this->width
+               << " x " << this->height << " x " << this->depth << " after "
+               << NEURONLAYOUT_MAX_ATTEMPTS << " attempts. Is the box too small?";
+            throw runtime_error (ee.str());
+        }
+    }
+}
+
+void
+NeuronLayout::writeBinary (const string& model_root, const string& binary_file_name) const
+{
+    Metrics::Scope ms (Metrics::Phase, "layouts");
+    Trace::Scope ts ("NeuronLayout::writeBinary");
+    ts.arg ("file", binary_file_name);
+    string path = model_root + binary_file_name;
+    ofstream f;
+    f.open (path.c_str(), ios::out|ios::trunc|ios::binary);
+    if (!f.is_open()) {
+        stringstream ee;
+        ee << __FUNCTION__ << " Failed to open file '" << path << "' for writing.";
+        throw runtime_error (ee.str());
+    }
+    if (!this->positions.empty()) {
+        f.write (reinterpret_cast<const char*>(&this->positions[0]),
+                 this->positions.size() * sizeof(float));
+    }
+    if (!f) {
+        stringstream ee;
+        ee << __FUNCTION__ << " Failed to write file '" << path << "'.";
+        throw runtime_error (ee.str());
+    }
+    f.close();
+    ms.count (0, NeuronLayout::binaryFileSize (this->num));
+}
+
+XmlEdit
+NeuronLayout::xmlEdit (xml_node<>* layout_node, const string& binary_file_name) const
+{
+    // The Layout keeps its url, seed and properties.
+    XmlEdit edit (layout_node);
+    int binfile_el = edit.addElement ("BinaryFile");
+    edit.addAttribute (binfile_el, "file_name", binary_file_name);
+    stringstream num_elem_ss;
+    num_elem_ss << this->num;
+    edit.addAttribute (binfile_el, "num_elements", num_elem_ss.str());
+    return edit;
+}
+
+void
+NeuronLayout::write (xml_node<>* layout_node, const string& model_root,
+                     const string& binary_file_name)
+{
+    this->writeBinary (model_root, binary_file_name);
+    this->xmlEdit (layout_node, binary_file_name).apply();
+}
+
+double
+NeuronLayout::binaryFileSize (unsigned int n)
+{
+    return 3.0 * sizeof(float) * static_cast<double>(n);
+}
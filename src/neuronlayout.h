@@ -0,0 +1,148 @@
+/*!
+ * Expansion of a population's Layout into neuron positions.
+ */
+
+#ifndef _NEURONLAYOUT_H_
+#define _NEURONLAYOUT_H_
+
+#include <string>
+#include <vector>
+#include "rapidxml.hpp"
+#include "xmledit.h"
+#include "memoryuse.h"
+
+namespace spineml
+{
+    /*!
+     * The positions of the neurons of a population, generated from
+     * its Layout element:
+     *
+     * \verbatim
+     *    <Layout url="grid.xml" seed="123" minimum_distance="0">
+     *        <Property name="spacing" dimension="um">
+     *            <FixedValue value="20"/>
+     *        </Property>
+     *    </Layout>
+     * \endverbatim
+     *
+     * The layout is named by the url, less its suffix, as a component
+     * is. Preflight generates these layouts itself:
+     *
+     *   linear   neuron i at x = i * spacing.
+     *   grid     columns along x, rows along y, then layers along z,
+     *            each spacing apart. columns defaults to the smallest
+     *            square which holds the population and rows to as
+     *            many as the columns need.
+     *   random   uniformly at random in the box from the origin to
+     *            (width, height, depth), which defaults to the unit
+     *            square (depth 0). No two neurons are closer than
+     *            minimum_distance.
+     *
+     * Properties default to 1 where not given. Any other layout
+     * (none.xml, for one) is left alone.
+     *
+     * The positions are written as x, y, z floats for each neuron in
+     * turn, and the Layout gains a BinaryFile element naming the file.
+     */
+    class NeuronLayout
+    {
+    public:
+        NeuronLayout();
+
+        /*!
+         * Read the layout of a population of @param n neurons from
+         * @param layout_node. Returns false if the layout isn't one
+         * which preflight generates, or if it already has a
+         * BinaryFile. Throws if a property or attribute can't be
+         * used.
+         */
+        bool read (rapidxml::xml_node<>* layout_node, unsigned int n);
+
+        /*!
+         * Fill @see positions for the population of @param n neurons
+         * laid out by @param layout_node: read them from its
+         * BinaryFile, in @param model_root, if it has already been
+         * expanded, or else read() and generate() them. Returns false
+         * if the layout is neither expanded nor one which preflight
+         * generates. Throws if the binary file doesn't hold n
+         * positions.
+         */
+        bool load (rapidxml::xml_node<>* layout_node, unsigned int n,
+                   const std::string& model_root);
+
+        /*!
+         * Fill @see positions. Each neuron's position depends only on
+         * the seed and its index, except that a random layout with a
+         * minimum_distance places the neurons in order, each clear of
+         * those before it; the result is the same for any number of
+         * threads. Throws if a grid's spacing is below the
+         * minimum_distance, or if a random layout can't fit the
+         * neurons into its box.
+         */
+        void generate (void);
+
+        /*!
+         * Write @see positions to @param model_root + @param
+         * binary_file_name. Doesn't touch the XML.
+         */
+        void writeBinary (const std::string& model_root,
+                          const std::string& binary_file_name) const;
+
+        /*!
+         * The change which adds a BinaryFile for @param
+         * binary_file_name to @param layout_node.
+         */
+        spineml::XmlEdit xmlEdit (rapidxml::xml_node<>* layout_node,
+                                  const std::string& binary_file_name) const;
+
+        /*!
+         * Write the binary file and make the change given by
+         * xmlEdit.
+         */
+        void write (rapidxml::xml_node<>* layout_node,
+                    const std::string& model_root,
+                    const std::string& binary_file_name);
+
+        //! The size of the binary file for @param n neurons, in bytes.
+        static double binaryFileSize (unsigned int n);
+
+        //! x, y and z for each neuron in turn.
+        std::vector<float> positions;
+
+        //! The number of threads on which positions may be generated.
+        unsigned int threads;
+
+    private:
+        //! The layouts which preflight generates.
+        enum Kind {
+            Linear,
+            Grid,
+            Random
+        };
+
+        //! Place the neurons of a random layout with a minimum distance.
+        void generateSpaced (void);
+
+        Kind kind;
+        unsigned int num;
+        int seed;
+        double minimumDistance;
+
+        //! For linear and grid
+        double spacing;
+        //! For grid. 0 for the default.
+        unsigned int columns;
+        unsigned int rows;
+
+        //! For random, the size of the box.
+        double width;
+        double height;
+        double depth;
+
+        //! The memory held in positions.
+        spineml::MemoryUse::Hold memory;
+    };
+
+} // namespace spineml
+
+#endif // _NEURONLAYOUT_H_
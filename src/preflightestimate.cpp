@@ -0,0 +1,615 @@
+/*
+ * Implementation of PreflightEstimate.
+ */
+
+#include <string>
+#include <vector>
+#include <set>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+#include <unistd.h>
+#include "rapidxml.hpp"
+#include "util.h"
+#include "modelpreflight.h"
+#include "preflightestimate.h"
+#include "connection_list.h"
+#include "neuronlayout.h"
+#include "distanceconnectivity.h"
+
+using namespace std;
+using namespace rapidxml;
+using namespace spineml;
+
+/*!
+ * The size of a binary value list element (index and value) and of a
+ * binary connection (src and dst), without and with a delay.
+ */
+#define ESTIMATE_VL_BYTES (sizeof(unsigned int) + sizeof(double))
+#define ESTIMATE_CONN_BYTES (2 * sizeof(int))
+#define ESTIMATE_CONN_DELAY_BYTES (2 * sizeof(int) + sizeof(float))
+
+/*!
+ * The number of source neurons whose rows are summed to estimate a
+ * distance-based connection.
+ */
+#define ESTIMATE_DISTANCE_ROWS 1000
+
+/*!
+ * The memory used by one element of a ValueList read from the XML
+ * (a std::map<int, double> node).
+ */
+#define ESTIMATE_VALUELIST_NODE_BYTES 48
+
+PreflightEstimate::PreflightEstimate (const string& fdir, const string& fname)
+    : threads (1)
+    , modeldir (fdir)
+    , modelfile (fname)
+    , modelBytes (0)
+    , modelPeakBytes (0)
+    , xmlSeconds (0)
+{
+    this->rates.candidate = 0;
+    this->rates.delay = 0;
+    this->rates.smallWrite = 0;
+    this->rates.parseNumber = 0;
+    this->rates.copyByte = 0;
+}
+
+void
+PreflightEstimate::setComponentCacheFile (const string& path)
+{
+    this->components.setCacheFile (path);
+}
+
+void
+PreflightEstimate::estimate (const vector<DelayChange>& exptDelayChanges)
+{
+    this->delayChanges = exptDelayChanges;
+    this->items.clear();
+
+    // model.xml is parsed just as ModelPreflight parses it, and then
+    // printed again, which takes about as long.
+    double t0 = Util::monotonicSeconds();
+    this->modeldata.read (this->modeldir + this->modelfile);
+    this->doc.parse<parse_declaration_node | parse_no_data_nodes>(this->modeldata.data());
+    this->xmlSeconds = 2.0 * (Util::monotonicSeconds() - t0);
+
+    xml_node<>* root_node = this->doc.first_node (LVL"SpineML");
+    if (!root_node) {
+        stringstream ee;
+        ee << "No root node " << LVL << "SpineML!";
+        throw runtime_error (ee.str());
+    }
+
+    double nodes = 0, attrs = 0;
+    this->count_nodes (root_node, nodes, attrs);
+    this->modelBytes = static_cast<double>(this->modeldata.getsize());
+    this->modelPeakBytes = this->modelBytes
+        + nodes * sizeof(xml_node<>) + attrs * sizeof(xml_attribute<>);
+
+    // Population sizes and the components used.
+    set<string> names;
+    for (xml_node<>* pop_node = root_node->first_node(LVL"Population");
+         pop_node;
+         pop_node = pop_node->next_sibling(LVL"Population")) {
+        xml_node<>* neuron_node = pop_node->first_node(LVL"Neuron");
+        if (!neuron_node) {
+            continue;
+        }
+        xml_attribute<>* name_attr = neuron_node->first_attribute ("name");
+        xml_attribute<>* size_attr = neuron_node->first_attribute ("size");
+        if (name_attr && size_attr) {
+            this->popSizes[name_attr->value()] = strtoul (size_attr->value(), 0, 10);
+            xml_node<>* layout_node = pop_node->first_node ("Layout");
+            if (layout_node) {
+                this->popLayouts.insert (make_pair (string(name_attr->value()), layout_node));
+            }
+        }
+        names.insert (this->component_name (neuron_node));
+        for (xml_node<>* proj_node = pop_node->first_node(LVL"Projection");
+             proj_node;
+             proj_node = proj_node->next_sibling(LVL"Projection")) {
+            for (xml_node<>* syn_node = proj_node->first_node(LVL"Synapse");
+                 syn_node;
+                 syn_node = syn_node->next_sibling(LVL"Synapse")) {
+                names.insert (this->component_name (syn_node->first_node(LVL"WeightUpdate")));
+                names.insert (this->component_name (syn_node->first_node(LVL"PostSynapse")));
+            }
+        }
+    }
+    names.erase ("");
+    names.erase ("SpikeSource");
+    this->components.prefetch (this->modeldir, names);
+
+    this->calibrate();
+
+    for (xml_node<>* pop_node = root_node->first_node(LVL"Population");
+         pop_node;
+         pop_node = pop_node->next_sibling(LVL"Population")) {
+        this->estimate_population (pop_node);
+    }
+
+    this->components.save();
+}
+
+void
+PreflightEstimate::calibrate (void)
+{
+    // A small fixed probability connection with normally distributed
+    // delays; the same code as the real thing.
+    const unsigned int n = 1000;
+    ConnectionList cl;
+    cl.delayDistributionType = spineml::Dist_Normal;
+    cl.delayMean = 1.0;
+    cl.delayVariance = 0.1;
+    double t0 = Util::monotonicSeconds();
+    cl.generateFixedProbability (1, 0.1f, n, n);
+    double t1 = Util::monotonicSeconds();
+    cl.generateDelays();
+    double t2 = Util::monotonicSeconds();
+    this->rates.candidate = (t1 - t0) / (static_cast<double>(n) * n);
+    this->rates.delay = (t2 - t1) / max (static_cast<double>(cl.connectivityC2D.size()), 1.0);
+
+    // Binary files are written a few bytes at a time through an
+    // ofstream. A scratch file next to model.xml includes the cost
+    // of the filesystem the binary files will go to.
+    const unsigned int nw = 1000000;
+    string scratch = Util::tempPathFor (this->modeldir + this->modelfile) + ".estimate";
+    int v = 0;
+    {
+        ofstream f (scratch.c_str(), ios::out|ios::trunc);
+        if (!f.is_open()) {
+            f.open ("/dev/null");
+        }
+        t0 = Util::monotonicSeconds();
+        for (unsigned int i = 0; i < nw; ++i) {
+            f.write (reinterpret_cast<const char*>(&v), sizeof(int));
+        }
+        f.close();
+        this->rates.smallWrite = (Util::monotonicSeconds() - t0) / nw;
+    }
+    unlink (scratch.c_str());
+
+    // Inline connections and values are read with stringstreams.
+    const unsigned int np = 100000;
+    t0 = Util::monotonicSeconds();
+    for (unsigned int i = 0; i < np; ++i) {
+        stringstream ss;
+        ss << "12345";
+        ss >> v;
+    }
+    this->rates.parseNumber = (Util::monotonicSeconds() - t0) / np;
+
+    // When a vector of connections grows, it's copied to new memory.
+    vector<int> grown (1 << 22, 1);
+    t0 = Util::monotonicSeconds();
+    vector<int> copy (grown);
+    this->rates.copyByte = (Util::monotonicSeconds() - t0) / (copy.size() * sizeof(int));
+}
+
+void
+PreflightEstimate::estimate_population (xml_node<>* pop_node)
+{
+    xml_node<>* neuron_node = pop_node->first_node(LVL"Neuron");
+    if (!neuron_node) {
+        return;
+    }
+    string pop_name = ModelPreflight::attribute_value (neuron_node, "name");
+    unsigned int pop_size = this->popSizes[pop_name];
+
+    Item item;
+    item.kind = "population";
+    item.name = pop_name;
+    this->estimate_properties (neuron_node, pop_size, item);
+    // A generated layout is one file of positions.
+    xml_node<>* layout_node = pop_node->first_node ("Layout");
+    NeuronLayout layout;
+    if (layout_node && layout.read (layout_node, pop_size)) {
+        double bytes = NeuronLayout::binaryFileSize (pop_size);
+        item.files += 1;
+        item.bytes += bytes;
+        item.seconds += pop_size * 3.0 * this->rates.smallWrite;
+        item.peakBytes = max (item.peakBytes, bytes);
+    }
+    this->items.push_back (item);
+
+    for (xml_node<>* proj_node = pop_node->first_node(LVL"Projection");
+         proj_node;
+         proj_node = proj_node->next_sibling(LVL"Projection")) {
+        string dst_population = ModelPreflight::attribute_value (proj_node, "dst_population");
+        unsigned int synapse_num = 0;
+        for (xml_node<>* syn_node = proj_node->first_node(LVL"Synapse");
+             syn_node;
+             syn_node = syn_node->next_sibling(LVL"Synapse"), ++synapse_num) {
+            this->estimate_synapse (syn_node, pop_name, pop_size, dst_population, synapse_num);
+        }
+    }
+
+    for (xml_node<>* input_node = neuron_node->first_node(LVL"Input");
+         input_node;
+         input_node = input_node->next_sibling(LVL"Input")) {
+        this->estimate_input (input_node, pop_name, pop_size);
+    }
+}
+
+void
+PreflightEstimate::estimate_synapse (xml_node<>* syn_node, const string& src_name,
+                                     unsigned int srcNum, const string& dst_name,
+                                     unsigned int synapse_num)
+{
+    map<string, unsigned int>::const_iterator di = this->popSizes.find (dst_name);
+    if (di == this->popSizes.end()) {
+        stringstream ee;
+        ee << "Failed to find the number of neurons in the destination population '"
+           << dst_name << "'";
+        throw runtime_error (ee.str());
+    }
+    unsigned int dstNum = di->second;
+
+    stringstream synss;
+    synss << synapse_num;
+    Item item;
+    item.kind = "projection";
+    item.name = src_name + " to " + dst_name + " synapse " + synss.str();
+
+    float fixedDelay = this->searchDelayChanges (src_name, dst_name, synss.str());
+    this->estimate_connectivity (syn_node, src_name, srcNum, dst_name, dstNum, fixedDelay, item);
+
+    this->estimate_properties (syn_node->first_node(LVL"PostSynapse"), dstNum, item);
+    this->estimate_properties (syn_node->first_node(LVL"WeightUpdate"), item.connections, item);
+
+    this->items.push_back (item);
+}
+
+void
+PreflightEstimate::estimate_input (xml_node<>* input_node, const string& dst_name,
+                                   unsigned int dstNum)
+{
+    string src_name = ModelPreflight::attribute_value (input_node, "src");
+    string src_port = ModelPreflight::attribute_value (input_node, "src_port");
+    string dst_port = ModelPreflight::attribute_value (input_node, "dst_port");
+
+    Item item;
+    item.kind = "input";
+    item.name = src_name + "/" + src_port + " to " + dst_name + "/" + dst_port;
+
+    unsigned int srcNum = 0;
+    map<string, unsigned int>::const_iterator si = this->popSizes.find (src_name);
+    if (si != this->popSizes.end()) {
+        srcNum = si->second;
+    } else if (input_node->first_node ("FixedProbabilityConnection")
+               || ModelPreflight::find_fixednumber (input_node)
+               || input_node->first_node ("DistanceBasedConnection")) {
+        stringstream ee;
+        ee << "Failed to find the number of neurons in the src population '" << src_name << "'";
+        throw runtime_error (ee.str());
+    }
+
+    float fixedDelay = this->searchDelayChanges (src_name, src_port, dst_name, dst_port);
+    this->estimate_connectivity (input_node, src_name, srcNum, dst_name, dstNum, fixedDelay, item);
+
+    this->items.push_back (item);
+}
+
+void
+PreflightEstimate::estimate_connectivity (xml_node<>* owner,
+                                          const string& src_name, unsigned int srcNum,
+                                          const string& dst_name, unsigned int dstNum,
+                                          float fixedDelay, Item& item)
+{
+    double src = static_cast<double>(srcNum);
+    double dst = static_cast<double>(dstNum);
+
+    xml_node<>* fixedprob_node = owner->first_node ("FixedProbabilityConnection");
+    xml_node<>* fixednum_node = ModelPreflight::find_fixednumber (owner);
+    xml_node<>* distance_node = owner->first_node ("DistanceBasedConnection");
+    xml_node<>* connlist_node = owner->first_node ("ConnectionList");
+    xml_node<>* delay_parent = (xml_node<>*)0;
+    bool explicitDelays = false;
+    double seconds = 0;
+
+    if (fixedprob_node) {
+        double p = strtod (ModelPreflight::attribute_value (fixedprob_node, "probability").c_str(), 0);
+        item.connections = p * src * dst;
+        seconds = src * dst * this->rates.candidate;
+        delay_parent = fixedprob_node;
+
+        // generateFixedProbability grows connectivityC2D by dstNum
+        // elements at a time, each time copying what it has so far.
+        // For a big projection, that is much of the time, and the
+        // old and new copies are held at once.
+        double row = p * dst, size = 0, capacity = dst, copied = 0, largest = 0;
+        for (unsigned int r = 0; r < srcNum; ++r) {
+            size += row;
+            if (size > 0.9 * capacity) {
+                capacity += dst;
+                copied += size;
+                largest = size;
+            }
+        }
+        seconds += copied * sizeof(int) * this->rates.copyByte;
+        item.peakBytes = largest * sizeof(int);
+
+    } else if (fixednum_node) {
+        double number = strtod (ModelPreflight::attribute_value (fixednum_node, "number").c_str(), 0);
+        bool pre = (string(fixednum_node->name()) == "FixedNumberPreConnection");
+        item.connections = number * (pre ? dst : src);
+        // Only the connections are generated, not every candidate
+        // pair, and the rows are gathered into source order once.
+        seconds = item.connections * this->rates.candidate;
+        seconds += item.connections * sizeof(int) * this->rates.copyByte;
+        delay_parent = fixednum_node;
+        item.peakBytes = item.connections * sizeof(int);
+
+    } else if (distance_node) {
+        DistanceConnectivity dc;
+        dc.read (distance_node);
+        map<string, xml_node<>*>::const_iterator si = this->popLayouts.find (src_name);
+        map<string, xml_node<>*>::const_iterator di = this->popLayouts.find (dst_name);
+        dc.setLayouts (si != this->popLayouts.end() ? si->second : (xml_node<>*)0, srcNum,
+                       di != this->popLayouts.end() ? di->second : (xml_node<>*)0, dstNum,
+                       this->modeldir);
+        item.connections = dc.expectedConnections (ESTIMATE_DISTANCE_ROWS);
+        // As for a fixed number connection, plus the positions and
+        // the grid.
+        seconds = item.connections * this->rates.candidate;
+        seconds += item.connections * sizeof(int) * this->rates.copyByte;
+        delay_parent = distance_node;
+        item.peakBytes = item.connections * sizeof(int) + 4.0 * sizeof(float) * (src + dst);
+
+    } else if (connlist_node) {
+        xml_node<>* binaryfile_node = connlist_node->first_node ("BinaryFile");
+        if (binaryfile_node) {
+            // Already binary; nothing to do.
+            item.connections = strtod (ModelPreflight::attribute_value (binaryfile_node,
+                                                                        "num_connections").c_str(), 0);
+            return;
+        }
+        xml_node<>* conn_node = connlist_node->first_node ("Connection");
+        explicitDelays = (conn_node && conn_node->first_attribute ("delay"));
+        double n = 0;
+        for (; conn_node; conn_node = conn_node->next_sibling ("Connection")) {
+            ++n;
+        }
+        item.connections = n;
+        seconds = n * (explicitDelays ? 3 : 2) * this->rates.parseNumber;
+        delay_parent = connlist_node;
+
+    } else {
+        if (owner->first_node ("OneToOneConnection")) {
+            item.connections = dst;
+        } else if (owner->first_node ("AllToAllConnection")) {
+            item.connections = src * dst;
+        }
+        return;
+    }
+
+    // A normal or uniform delay distribution is generated into an
+    // explicit list, unless the experiment fixes the delay.
+    xml_node<>* delay_node = delay_parent->first_node ("Delay");
+    bool generateDelays = (fixedDelay < 0.0 && delay_node
+                           && (delay_node->first_node ("NormalDistribution")
+                               || delay_node->first_node ("UniformDistribution")));
+    explicitDelays = explicitDelays || generateDelays;
+    if (generateDelays) {
+        seconds += item.connections * this->rates.delay;
+    }
+
+    double values_per_conn = explicitDelays ? 3 : 2;
+    seconds += item.connections * values_per_conn * this->rates.smallWrite;
+
+    item.files += 1;
+    item.bytes += item.connections * (explicitDelays ? ESTIMATE_CONN_DELAY_BYTES : ESTIMATE_CONN_BYTES);
+    item.seconds += seconds;
+    // connectivityS2C (a vector per source neuron, holding connection
+    // indices), connectivityC2D and connectivityC2Delay.
+    item.peakBytes += src * sizeof(vector<int>)
+        + item.connections * 2 * sizeof(int)
+        + (explicitDelays ? item.connections * sizeof(float) : 0);
+}
+
+void
+PreflightEstimate::estimate_properties (xml_node<>* component_node, double num, Item& item)
+{
+    if (!component_node) {
+        return;
+    }
+    string cmpt_name = this->component_name (component_node);
+    if (cmpt_name.empty() || cmpt_name == "SpikeSource") {
+        return;
+    }
+    Component* cmpt = (Component*)0;
+    try {
+        cmpt = this->components.load (this->modeldir, cmpt_name);
+    } catch (const std::exception& e) {
+        stringstream ee;
+        ee << "Failed to read component " << cmpt_name << ": " << e.what() << ".\n";
+        throw runtime_error (ee.str());
+    }
+
+    for (xml_node<>* prop_node = component_node->first_node ("Property");
+         prop_node;
+         prop_node = prop_node->next_sibling ("Property")) {
+
+        if (!cmpt->containsStateVariable (ModelPreflight::attribute_value (prop_node, "name"))) {
+            continue;
+        }
+
+        double seconds = num * 2 * this->rates.smallWrite;
+        double peak = 0;
+        xml_node<>* vl_node = prop_node->first_node ("ValueList");
+        if (vl_node) {
+            if (vl_node->first_node ("BinaryFile")) {
+                continue;
+            }
+            double nvalues = 0;
+            for (xml_node<>* v = vl_node->first_node ("Value"); v; v = v->next_sibling ("Value")) {
+                ++nvalues;
+            }
+            seconds += nvalues * 2 * this->rates.parseNumber;
+            peak = nvalues * ESTIMATE_VALUELIST_NODE_BYTES;
+        } else if (prop_node->first_node ("UniformDistribution")
+                   || prop_node->first_node ("NormalDistribution")) {
+            seconds += num * this->rates.delay;
+        }
+
+        item.files += 1;
+        item.bytes += num * ESTIMATE_VL_BYTES;
+        item.seconds += seconds;
+        item.peakBytes = max (item.peakBytes, peak);
+    }
+}
+
+string
+PreflightEstimate::component_name (xml_node<>* component_node)
+{
+    string cmpt_name = ModelPreflight::attribute_value (component_node, "url");
+    Util::stripFileSuffix (cmpt_name);
+    return cmpt_name;
+}
+
+void
+PreflightEstimate::count_nodes (xml_node<>* node, double& nodes, double& attrs) const
+{
+    ++nodes;
+    for (xml_attribute<>* a = node->first_attribute(); a; a = a->next_attribute()) {
+        ++attrs;
+    }
+    for (xml_node<>* c = node->first_node(); c; c = c->next_sibling()) {
+        this->count_nodes (c, nodes, attrs);
+    }
+}
+
+float
+PreflightEstimate::searchDelayChanges (const string& src, const string& dst,
+                                       const string& synapseNum) const
+{
+    vector<DelayChange>::const_iterator i = this->delayChanges.begin();
+    while (i != this->delayChanges.end()) {
+        if (i->matches(src, dst, synapseNum)) {
+            return i->delay;
+        }
+        ++i;
+    }
+    return -1.0;
+}
+
+float
+PreflightEstimate::searchDelayChanges (const string& src, const string& srcPort,
+                                       const string& dst, const string& dstPort) const
+{
+    vector<DelayChange>::const_iterator i = this->delayChanges.begin();
+    while (i != this->delayChanges.end()) {
+        if (i->matches(src, srcPort, dst, dstPort)) {
+            return i->delay;
+        }
+        ++i;
+    }
+    return -1.0;
+}
+
+PreflightEstimate::Item
+PreflightEstimate::total (void) const
+{
+    Item t;
+    t.kind = "total";
+    t.bytes = this->modelBytes;
+    t.peakBytes = this->modelPeakBytes;
+    double seconds = 0, longest = 0;
+    vector<double> peaks;
+    vector<Item>::const_iterator i = this->items.begin();
+    while (i != this->items.end()) {
+        t.connections += i->connections;
+        t.files += i->files;
+        t.bytes += i->bytes;
+        seconds += i->seconds;
+        longest = max (longest, i->seconds);
+        peaks.push_back (i->peakBytes);
+        ++i;
+    }
+
+    // With several threads, that many connection lists can be in
+    // memory at once, and the work is shared between them (though it
+    // can't finish before the biggest item does).
+    unsigned int nthreads = max (this->threads, 1u);
+    sort (peaks.begin(), peaks.end(), greater<double>());
+    for (unsigned int p = 0; p < peaks.size() && p < nthreads; ++p) {
+        t.peakBytes += peaks[p];
+    }
+    t.seconds = this->xmlSeconds + max (seconds / nthreads, longest);
+    return t;
+}
+
+//! Bytes per MB in the table.
+#define ESTIMATE_MB (1024.0 * 1024.0)
+
+void
+PreflightEstimate::writeTable (ostream& os) const
+{
+    os << "Preflight estimate for " << this->modeldir << this->modelfile << "\n\n";
+    os << left << setw(40) << "item" << right
+       << setw(14) << "connections" << setw(7) << "files"
+       << setw(12) << "output MB" << setw(10) << "peak MB" << setw(11) << "seconds" << "\n";
+
+    Item xml;
+    xml.kind = "model.xml";
+    xml.name = "(parse and write)";
+    xml.bytes = this->modelBytes;
+    xml.peakBytes = this->modelPeakBytes;
+    xml.seconds = this->xmlSeconds;
+    vector<Item> rows (this->items);
+    rows.push_back (xml);
+    rows.push_back (this->total());
+
+    os << fixed;
+    vector<Item>::const_iterator i = rows.begin();
+    while (i != rows.end()) {
+        os << left << setw(40) << (i->kind + " " + i->name) << right
+           << setw(14) << setprecision(0) << i->connections
+           << setw(7) << i->files
+           << setw(12) << setprecision(2) << i->bytes / ESTIMATE_MB
+           << setw(10) << setprecision(2) << i->peakBytes / ESTIMATE_MB
+           << setw(11) << setprecision(3) << i->seconds << "\n";
+        ++i;
+    }
+    if (this->threads > 1) {
+        os << "(total peak memory and time for " << this->threads << " threads)\n";
+    }
+}
+
+void
+PreflightEstimate::writeJson (ostream& os) const
+{
+    os << fixed;
+    os << "{\n  \"model\": " << Util::jsonString (this->modeldir + this->modelfile) << ",\n"
+       << "  \"threads\": " << this->threads << ",\n"
+       << "  \"model_xml\": { \"bytes\": " << setprecision(0) << this->modelBytes
+       << ", \"peak_bytes\": " << this->modelPeakBytes
+       << ", \"seconds\": " << setprecision(6) << this->xmlSeconds << " },\n"
+       << "  \"items\": [";
+
+    vector<Item> rows (this->items);
+    rows.push_back (this->total());
+    vector<Item>::const_iterator i = rows.begin();
+    while (i != rows.end()) {
+        if (i + 1 == rows.end()) {
+            os << "\n  ],\n  \"total\": {";
+        } else {
+            os << (i == rows.begin() ? "\n" : ",\n")
+               << "    { \"kind\": " << Util::jsonString (i->kind)
+               << ", \"name\": " << Util::jsonString (i->name) << ",";
+        }
+        os << " \"connections\": " << setprecision(0) << i->connections
+           << ", \"files\": " << i->files
+           << ", \"bytes\": " << i->bytes
+           << ", \"peak_bytes\": " << i->peakBytes
+           << ", \"seconds\": " << setprecision(6) << i->seconds << " }";
+        ++i;
+    }
+    os << "\n}\n";
+}
@@ -0,0 +1,221 @@
+/*!
+ * Estimate the cost of preflighting a model without doing it.
+ */
+
+#ifndef _PREFLIGHTESTIMATE_H_
+#define _PREFLIGHTESTIMATE_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include "rapidxml.hpp"
+#include "allocandread.h"
+#include "componentcache.h"
+#include "delaychange.h"
+
+namespace spineml
+{
+    /*!
+     * Walks model.xml and works out, from population sizes,
+     * connection probabilities, delay distributions and component
+     * state variables, what ModelPreflight would produce: the number
+     * of connections, the number and size of the binary files, the
+     * peak memory and the time it would take. Nothing is generated
+     * and nothing is written.
+     *
+     * A FixedProbabilityConnection is counted at its expected number
+     * of connections, p * srcNum * dstNum, and a fixed number
+     * connection at exactly number * dstNum (FixedNumberPre) or
+     * number * srcNum (FixedNumberPost). A DistanceBasedConnection
+     * depends on where the neurons are, so the two populations'
+     * layouts are generated and the connection probabilities summed
+     * over a sample of source neurons. Times are projected from
+     * rates measured on this machine by calibrate() (the connectivity
+     * RNG, delay generation, small binary writes to a scratch file in
+     * the model directory, and number parsing) and from the time
+     * taken to parse model.xml. The scratch file is removed
+     * straight away.
+     *
+     * Memory is the peak for the default (non-streaming) mode: the
+     * model text and its parsed nodes, plus the largest connection
+     * list (or, with several threads, lists) held at once.
+     */
+    class PreflightEstimate
+    {
+    public:
+        /*!
+         * @param fdir The directory containing model.xml, including
+         * trailing '/'.
+         *
+         * @param fname The file name of the model xml file.
+         */
+        PreflightEstimate (const std::string& fdir, const std::string& fname);
+
+        /*!
+         * Use @param path as the component cache file; "none"
+         * disables it.
+         */
+        void setComponentCacheFile (const std::string& path);
+
+        /*!
+         * Walk the model and estimate the cost of each population,
+         * synapse and generic input. The experiment-layer delay
+         * changes in @param exptDelayChanges are taken into account,
+         * as they decide whether explicit delays are written.
+         */
+        void estimate (const std::vector<DelayChange>& exptDelayChanges);
+
+        /*!
+         * Write the estimate to @param os as a table, one row per
+         * population, synapse and input, then the totals.
+         */
+        void writeTable (std::ostream& os) const;
+
+        /*!
+         * Write the estimate to @param os as a JSON object.
+         */
+        void writeJson (std::ostream& os) const;
+
+        /*!
+         * The number of threads the preflight will run on. Peak
+         * memory allows for this many connection lists at once; the
+         * projected time is divided between them.
+         */
+        unsigned int threads;
+
+    private:
+        /*!
+         * The estimate for one population (its neuron state
+         * variables), synapse (connectivity, PostSynapse and
+         * WeightUpdate state variables) or generic input.
+         */
+        struct Item {
+            Item() : connections (0), files (0), bytes (0), peakBytes (0), seconds (0) {}
+            //! "population", "projection" or "input"
+            std::string kind;
+            //! A readable name, like "A to B synapse 0"
+            std::string name;
+            //! Expected number of connections generated
+            double connections;
+            //! Number of binary files written
+            unsigned int files;
+            //! Total size of those files
+            double bytes;
+            //! Memory held while this item is preflighted
+            double peakBytes;
+            //! Projected wall time
+            double seconds;
+        };
+
+        /*!
+         * Measured costs, in seconds, of the unit operations which
+         * the times are projected from.
+         */
+        struct Rates {
+            //! One connectivity RNG draw and test (per src/dst pair)
+            double candidate;
+            //! One generated delay
+            double delay;
+            //! One small ostream write, as made for each value in a binary file
+            double smallWrite;
+            //! Converting one attribute to a number with a stringstream
+            double parseNumber;
+            //! Per byte, copying a large vector into newly allocated memory
+            double copyByte;
+        };
+
+        /*!
+         * The totals over all the items, including model.xml. For
+         * peak memory and time, @see threads is taken into account.
+         */
+        Item total (void) const;
+
+        //! Measure @see rates.
+        void calibrate (void);
+
+        //! Estimate a population's Neuron properties, then its projections and inputs.
+        void estimate_population (rapidxml::xml_node<>* pop_node);
+
+        //! Estimate one Synapse within a Projection.
+        void estimate_synapse (rapidxml::xml_node<>* syn_node, const std::string& src_name,
+                               unsigned int srcNum, const std::string& dst_name,
+                               unsigned int synapse_num);
+
+        //! Estimate one generic Input into the population dst_name.
+        void estimate_input (rapidxml::xml_node<>* input_node, const std::string& dst_name,
+                             unsigned int dstNum);
+
+        /*!
+         * Add the cost of the connectivity element in @param owner
+         * (a Synapse or Input), from the population @param src_name
+         * to @param dst_name, to @param item. @param fixedDelay is
+         * an experiment-layer delay override, or <0 for none.
+         */
+        void estimate_connectivity (rapidxml::xml_node<>* owner,
+                                    const std::string& src_name, unsigned int srcNum,
+                                    const std::string& dst_name, unsigned int dstNum,
+                                    float fixedDelay, Item& item);
+
+        /*!
+         * Add the cost of expanding the state variable Properties of
+         * @param component_node (a Neuron, PostSynapse or
+         * WeightUpdate) to @param num elements each, to @param item.
+         */
+        void estimate_properties (rapidxml::xml_node<>* component_node, double num, Item& item);
+
+        //! Component name from the url attribute of @param component_node
+        std::string component_name (rapidxml::xml_node<>* component_node);
+
+        //! Count the nodes and attributes below @param node
+        void count_nodes (rapidxml::xml_node<>* node, double& nodes, double& attrs) const;
+
+        //! As ModelPreflight::searchDelayChanges (projection form)
+        float searchDelayChanges (const std::string& src, const std::string& dst,
+                                  const std::string& synapseNum) const;
+
+        //! As ModelPreflight::searchDelayChanges (generic input form)
+        float searchDelayChanges (const std::string& src, const std::string& srcPort,
+                                  const std::string& dst, const std::string& dstPort) const;
+
+        //! Path to directory containing modelfile, with trailing '/'.
+        std::string modeldir;
+
+        //! Name of the XML text file.
+        std::string modelfile;
+
+        //! The text of model.xml.
+        spineml::AllocAndRead modeldata;
+
+        //! The parsed model.
+        rapidxml::xml_document<> doc;
+
+        //! State variable information for each component.
+        spineml::ComponentCache components;
+
+        //! Population name to size.
+        std::map<std::string, unsigned int> popSizes;
+
+        //! Population name to Layout, for those populations with one.
+        std::map<std::string, rapidxml::xml_node<>*> popLayouts;
+
+        //! The experiment-layer delay changes.
+        std::vector<DelayChange> delayChanges;
+
+        //! The estimate, in model order.
+        std::vector<Item> items;
+
+        //! Measured costs.
+        Rates rates;
+
+        //! Size of model.xml, and the memory used to hold it parsed.
+        double modelBytes;
+        double modelPeakBytes;
+
+        //! Time to parse model.xml and to print it out again.
+        double xmlSeconds;
+    };
+
+} // namespace spineml
+
+#endif // _PREFLIGHTESTIMATE_H_
@@ -0,0 +1,65 @@
+/*!
+ * The interface for one unit of work in a parallel preflight.
+ */
+
+#ifndef _PREFLIGHTJOB_H_
+#define _PREFLIGHTJOB_H_
+
+#include <string>
+#include <stdexcept>
+#include "xmledit.h"
+
+namespace spineml
+{
+    /*!
+     * An independent piece of preflight work. ModelPreflight plans
+     * these with their output file names already assigned and runs
+     * them on a pool of threads. A job never modifies the XML
+     * document; it describes its change in @see edit, and the edits
+     * are applied on the main thread, through an XmlEditJournal, in
+     * the order in which the jobs were planned.
+     */
+    class PreflightJob
+    {
+    public:
+        PreflightJob() : writeFiles (true), failed (false), error ("") {}
+        virtual ~PreflightJob() {}
+
+        /*!
+         * Do the work: generate the data, write the binary file
+         * and fill in @see edit. Safe to call from any thread. Any
+         * error is recorded in @see failed and @see error rather
+         * than thrown.
+         */
+        void execute (void)
+        {
+            try {
+                this->run();
+            } catch (const std::exception& e) {
+                this->failed = true;
+                this->error = e.what();
+            }
+        }
+
+        //! If false (for a dry run), don't write the binary file.
+        bool writeFiles;
+
+        //! The change to the document, once execute() has succeeded.
+        spineml::XmlEdit edit;
+
+        //! True if execute() failed.
+        bool failed;
+
+        //! The error message if execute() failed.
+        std::string error;
+
+    protected:
+        /*!
+         * The work itself, as called by execute(). May throw.
+         */
+        virtual void run (void) = 0;
+    };
+
+} // namespace spineml
+
+#endif // _PREFLIGHTJOB_H_
@@ -8,7 +8,11 @@
 #include <sstream>
 #include <fstream>
 #include <stdexcept>
+#include <vector>
 #include "propertycontent.h"
+#include "bufferedwriter.h"
+#include "metrics.h"
+#include "trace.h"
 #include "rapidxml.hpp"
 
 using namespace std;
@@ -17,12 +21,14 @@ using namespace rapidxml;
 
 PropertyContent::PropertyContent(xml_node<>* fv_node, const unsigned int num_in_pop)
     : alreadyBinary (false)
+    , memory (MemoryUse::Properties)
     , numInPopulation (num_in_pop)
 {
 }
 
 PropertyContent::PropertyContent()
     : alreadyBinary (false)
+    , memory (MemoryUse::Properties)
     , numInPopulation (0)
 {
 }
@@ -45,18 +51,46 @@ PropertyContent::writeVLBinary (rapidxml::xml_node<>* into_node,
                                 const std::string& model_root,
                                 const std::string& binary_file_name)
 {
+    Metrics::Scope ms (Metrics::Phase, "properties");
     string path = model_root + binary_file_name;
+
+    // The values are written through a buffer of our own, which is
+    // counted in MemoryUse::Properties for as long as it is in use.
+    size_t bufsz = static_cast<size_t>(this->numInPopulation)
+        * (sizeof(unsigned int) + sizeof(double));
+    if (bufsz > BUFFEREDWRITER_BUFSZ) {
+        bufsz = BUFFEREDWRITER_BUFSZ;
+    } else if (bufsz == 0) {
+        bufsz = 1;
+    }
+    vector<char> buf (bufsz);
+    double held = this->memory.bytes();
+    this->memory.set (held + static_cast<double>(bufsz));
+
     ofstream f;
+    f.rdbuf()->pubsetbuf (&buf[0], static_cast<streamsize>(bufsz));
     f.open (path.c_str(), ios::out|ios::trunc);
     if (!f.is_open()) {
         stringstream ee;
         ee << __FUNCTION__ << " Failed to open file '" << path << "' for writing.";
+        this->memory.set (held);
         throw runtime_error (ee.str());
     }
 
-    this->writeVLBinaryData (f);
+    {
+        Trace::Scope ts ("writeVLBinaryData");
+        if (Trace::enabled() && into_node && into_node->parent()) {
+            rapidxml::xml_attribute<>* name_attr = into_node->parent()->first_attribute ("name");
+            ts.arg ("property", name_attr ? name_attr->value() : this->propertyName);
+        }
+        ts.arg ("file", binary_file_name);
+        ts.arg ("values", this->numInPopulation);
+        this->writeVLBinaryData (f);
+    }
+    ms.count (this->numInPopulation, static_cast<double>(f.tellp()));
 
     f.close();
+    this->memory.set (held);
 }
 
 void
@@ -64,29 +98,25 @@ PropertyContent::writeVLXml (rapidxml::xml_node<>* into_node,
                              const std::string& model_root,
                              const std::string& binary_file_name)
 {
-    // into_node should be the PropertyContent node itself.
-    xml_document<>* thedoc = into_node->document();
-    // Remove any attributes and child nodes from into_node.
-    into_node->remove_all_attributes();
-    into_node->remove_all_nodes();
-    // Change name of node from whatever
-    // (e.g. FixedProbabilityConnection) to .
-    into_node->name("ValueList");
+    this->vlXmlEdit (into_node, binary_file_name).apply();
+}
 
-    // Add the BinaryFile node
-    xml_node<>* binfile_node = thedoc->allocate_node (node_element, "BinaryFile");
-    char* bfn_alloced = thedoc->allocate_string (binary_file_name.c_str());
-    xml_attribute<>* file_name_attr = thedoc->allocate_attribute ("file_name", bfn_alloced);
+XmlEdit
+PropertyContent::vlXmlEdit (rapidxml::xml_node<>* into_node,
+                            const std::string& binary_file_name) const
+{
+    // into_node should be the PropertyContent node itself. It loses
+    // its attributes and children and becomes a ValueList.
+    XmlEdit edit (into_node, "ValueList");
 
+    // Add the BinaryFile node
+    int binfile_el = edit.addElement ("BinaryFile");
+    edit.addAttribute (binfile_el, "file_name", binary_file_name);
     stringstream num_elem_ss;
     num_elem_ss << this->numInPopulation;
-    char* num_elem_alloced = thedoc->allocate_string (num_elem_ss.str().c_str());
-    xml_attribute<>* num_elem_attr = thedoc->allocate_attribute ("num_elements", num_elem_alloced);
-
-    binfile_node->append_attribute (file_name_attr);
-    binfile_node->append_attribute (num_elem_attr);
+    edit.addAttribute (binfile_el, "num_elements", num_elem_ss.str());
 
-    into_node->prepend_node (binfile_node);
+    return edit;
 }
 
 void
@@ -10,6 +10,8 @@
 
 #include <string>
 #include "rapidxml.hpp"
+#include "xmledit.h"
+#include "memoryuse.h"
 
 namespace spineml
 {
@@ -46,6 +48,12 @@ namespace spineml
          */
         PropertyContent();
 
+        /*!
+         * Virtual, as PropertyContents are deleted through base
+         * class pointers by PropertyJob.
+         */
+        virtual ~PropertyContent() {}
+
         /*!
          * Writes out this PropertyContent as a ValueList, with explicit
          * binary data in a file.
@@ -96,9 +104,32 @@ namespace spineml
         void writeULProperty (rapidxml::xml_document<>* the_doc,
                               rapidxml::xml_node<>* into_node);
 
-    protected:
         /*!
-         * Write out the fixed values as an explicit binary file.
+         * Re-writes the ConnectionList node's XML, in preparation for
+         * writing out the connection list as an explicit binary file.
+         *
+         * @param into_node The (e.g.) FixedValue node, which will be
+         * renamed as a ValueList node.
+         *
+         * @param model_root The root path of the model
+         *
+         * @param binary_file_name The file name of the binary file
+         * into which the actual value list data will be written.
+         */
+        void writeVLXml (rapidxml::xml_node<>* into_node,
+                         const std::string& model_root,
+                         const std::string& binary_file_name);
+
+        /*!
+         * Describe the change which writeVLXml makes to @param
+         * into_node, without making it.
+         */
+        spineml::XmlEdit vlXmlEdit (rapidxml::xml_node<>* into_node,
+                                    const std::string& binary_file_name) const;
+
+        /*!
+         * Write out the fixed values as an explicit binary file. The
+         * XML is not modified, so this may be called on any thread.
          *
          * @param into_node The (e.g.) FixedValue node, which will be
          * renamed as a ValueList node.
@@ -112,6 +143,13 @@ namespace spineml
                             const std::string& model_root,
                             const std::string& binary_file_name);
 
+        /*!
+         * @return true if this property is already a binary
+         * ValueList, in which case there is nothing to write.
+         */
+        bool isAlreadyBinary (void) const { return this->alreadyBinary; }
+
+    protected:
         /*!
          * Write out the actual data to the binary file stream, which
          * will have been opened by @see writeVLBinary
@@ -126,22 +164,6 @@ namespace spineml
          */
         virtual void writeVLBinaryData (std::ostream& f) = 0;
 
-        /*!
-         * Re-writes the ConnectionList node's XML, in preparation for
-         * writing out the connection list as an explicit binary file.
-         *
-         * @param into_node The (e.g.) FixedValue node, which will be
-         * renamed as a ValueList node.
-         *
-         * @param model_root The root path of the model
-         *
-         * @param binary_file_name The file name of the binary file
-         * into which the actual value list data will be written.
-         */
-        void writeVLXml (rapidxml::xml_node<>* into_node,
-                         const std::string& model_root,
-                         const std::string& binary_file_name);
-
         /*!
          * The content-specific write property value thing.
          *
@@ -170,6 +192,13 @@ namespace spineml
          */
         std::string propertyDim;
 
+        /*!
+         * The memory held for this property's values, and for the
+         * buffer they are written through, counted in
+         * MemoryUse::Properties.
+         */
+        spineml::MemoryUse::Hold memory;
+
     public:
         /*!
          * The number of neurons for the population to which the
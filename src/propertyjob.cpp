@@ -0,0 +1,54 @@
+/*
+ * Implementation of PropertyJob.
+ */
+
+#include <string>
+#include "propertyjob.h"
+#include "trace.h"
+
+using namespace std;
+using namespace rapidxml;
+using namespace spineml;
+
+PropertyJob::PropertyJob (PropertyContent* c, xml_node<>* content_node,
+                          const string& model_root, const string& binary_file_name)
+    : synapse ((xml_node<>*)0)
+    , srcNum (0)
+    , dstNum (0)
+    , content (c)
+    , node (content_node)
+    , modelRoot (model_root)
+    , binaryFileName (binary_file_name)
+{
+}
+
+PropertyJob::~PropertyJob()
+{
+    delete this->content;
+}
+
+void
+PropertyJob::setSizeFrom (xml_node<>* synapse_node,
+                          unsigned int num_in_src, unsigned int num_in_dst)
+{
+    this->synapse = synapse_node;
+    this->srcNum = num_in_src;
+    this->dstNum = num_in_dst;
+}
+
+void
+PropertyJob::setSize (unsigned int n)
+{
+    this->content->setNumInPopulation (n);
+}
+
+void
+PropertyJob::run (void)
+{
+    Trace::Scope ts ("PropertyJob");
+    ts.arg ("file", this->binaryFileName);
+    if (this->writeFiles) {
+        this->content->writeVLBinary (this->node, this->modelRoot, this->binaryFileName);
+    }
+    this->edit = this->content->vlXmlEdit (this->node, this->binaryFileName);
+}
@@ -0,0 +1,75 @@
+/*!
+ * A PreflightJob which writes a state variable property out as a
+ * binary value list.
+ */
+
+#ifndef _PROPERTYJOB_H_
+#define _PROPERTYJOB_H_
+
+#include <string>
+#include "rapidxml.hpp"
+#include "propertycontent.h"
+#include "preflightjob.h"
+
+namespace spineml
+{
+    /*!
+     * Writes the values of a PropertyContent (FixedValue,
+     * UniformDistribution, etc) to a binary file. The edit turns the
+     * content element into a ValueList referring to that file.
+     */
+    class PropertyJob : public PreflightJob
+    {
+    public:
+        /*!
+         * @param content The property content, which this job then
+         * owns.
+         *
+         * @param content_node The content element (e.g. FixedValue).
+         *
+         * @param model_root The model directory, with trailing '/'.
+         *
+         * @param binary_file_name The pre-assigned name for the
+         * binary data file.
+         */
+        PropertyJob (spineml::PropertyContent* content, rapidxml::xml_node<>* content_node,
+                     const std::string& model_root, const std::string& binary_file_name);
+        ~PropertyJob();
+
+        /*!
+         * The size of a WeightUpdate property is the number of
+         * connections in its synapse, which may not be known until
+         * the synapse's ConnectionJob has been committed. Record the
+         * synapse here so that the size can be set later with
+         * setSize().
+         */
+        void setSizeFrom (rapidxml::xml_node<>* synapse_node,
+                          unsigned int num_in_src, unsigned int num_in_dst);
+
+        //! Set the number of values to write.
+        void setSize (unsigned int n);
+
+        //! The synapse which determines the size, or null.
+        rapidxml::xml_node<>* synapse;
+        //! Source population size, for the synapse
+        unsigned int srcNum;
+        //! Destination population size, for the synapse
+        unsigned int dstNum;
+
+    protected:
+        void run (void);
+
+    private:
+        //! Not copyable; content is owned.
+        PropertyJob (const PropertyJob&);
+        PropertyJob& operator= (const PropertyJob&);
+
+        spineml::PropertyContent* content;
+        rapidxml::xml_node<>* node;
+        std::string modelRoot;
+        std::string binaryFileName;
+    };
+
+} // namespace spineml
+
+#endif // _PROPERTYJOB_H_
@@ -33,7 +33,7 @@ float uniformGCC(RngData* rd)
 float nfix (RngData* rd) /*provides RNOR if #define cannot */
 {
     const float r = 3.442620f;
-    static float x, y;
+    float x, y; // Not static; each RngData may be in use on a different thread.
     for (;;) {
         x=rd->hz*rd->wn[rd->iz];
         if (rd->iz==0) {
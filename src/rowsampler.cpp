@@ -0,0 +1,77 @@
+/*
+ * Implementation of RowSampler.
+ */
+
+#include <vector>
+#include <algorithm>
+#include "rowsampler.h"
+
+using namespace std;
+using namespace spineml;
+
+/*!
+ * The SplitMix64 finaliser: a bijective mix of all 64 bits of @param z.
+ */
+static inline unsigned long long
+mix64 (unsigned long long z)
+{
+    z += 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+RowSampler::RowSampler (int seed, unsigned int num)
+    : key (mix64 (static_cast<unsigned long long>(static_cast<unsigned int>(seed))))
+    , n (num)
+{
+}
+
+double
+RowSampler::uniform (unsigned int row, unsigned int k, unsigned int stream) const
+{
+    unsigned long long h = mix64 (this->key ^ ((static_cast<unsigned long long>(row) << 2) | stream));
+    h = mix64 (h + k);
+    // The top 53 bits, as a double in [0,1)
+    return static_cast<double>(h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+unsigned int
+RowSampler::next (unsigned int row, unsigned int k)
+{
+    if (this->perm.size() != this->n) {
+        this->perm.resize (this->n);
+        for (unsigned int i = 0; i < this->n; ++i) {
+            this->perm[i] = i;
+        }
+    }
+    unsigned int j = k + static_cast<unsigned int>(this->uniform (row, k, 1) * (this->n - k));
+    if (j >= this->n) {
+        j = this->n - 1;
+    }
+    std::swap (this->perm[k], this->perm[j]);
+    this->swaps.push_back (j);
+    return this->perm[k];
+}
+
+void
+RowSampler::reset (void)
+{
+    unsigned int k = static_cast<unsigned int>(this->swaps.size());
+    while (k > 0) {
+        --k;
+        std::swap (this->perm[k], this->perm[this->swaps[k]]);
+    }
+    this->swaps.clear();
+}
+
+void
+RowSampler::choose (unsigned int row, unsigned int count, vector<int>& out)
+{
+    out.resize (count);
+    for (unsigned int k = 0; k < count; ++k) {
+        out[k] = static_cast<int>(this->next (row, k));
+    }
+    this->reset();
+    sort (out.begin(), out.end());
+}
@@ -0,0 +1,64 @@
+/*!
+ * Counter-based random sampling without replacement, a row at a time.
+ */
+
+#ifndef _ROWSAMPLER_H_
+#define _ROWSAMPLER_H_
+
+#include <vector>
+
+namespace spineml
+{
+    /*!
+     * Draws random numbers which depend only on a seed and a
+     * position (a row, a counter within the row and a stream), rather
+     * than on what was drawn before. Any row of a connectivity
+     * pattern can therefore be generated on its own, on any thread,
+     * and come out the same.
+     *
+     * Sampling without replacement from 0..n-1 is a partial
+     * Fisher-Yates shuffle, which next() extends one position at a
+     * time and reset() undoes, so that each row costs time in
+     * proportion to the number chosen from it, not to n. The shuffle
+     * is held in n integers, which is why each thread needs its own
+     * RowSampler.
+     */
+    class RowSampler
+    {
+    public:
+        RowSampler (int seed, unsigned int n);
+
+        /*!
+         * A uniform number in [0,1) for position @param k of stream
+         * @param stream in row @param row.
+         */
+        double uniform (unsigned int row, unsigned int k, unsigned int stream) const;
+
+        /*!
+         * Choose the element at position @param k of the shuffle of
+         * row @param row and return it. k must be the number of
+         * elements already chosen since the last reset().
+         */
+        unsigned int next (unsigned int row, unsigned int k);
+
+        //! Undo the shuffle, ready for another row.
+        void reset (void);
+
+        /*!
+         * Set @param out to @param count distinct elements of 0..n-1,
+         * chosen at random for row @param row, in ascending order.
+         */
+        void choose (unsigned int row, unsigned int count, std::vector<int>& out);
+
+    private:
+        unsigned long long key;
+        unsigned int n;
+        //! The shuffle, which is the identity after reset().
+        std::vector<unsigned int> perm;
+        //! The position swapped into each position of perm so far.
+        std::vector<unsigned int> swaps;
+    };
+
+} // namespace spineml
+
+#endif // _ROWSAMPLER_H_
@@ -0,0 +1,151 @@
+/*
+ * spineml_modelgen main() function
+ */
+
+/*!
+ * Writes a synthetic SpineML model (model.xml, experiment.xml and
+ * its components) of a given size, for benchmarking
+ * spineml_preflight. See ModelGenerator.
+ */
+
+#include <exception>
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include "modelgenerator.h"
+
+extern "C" {
+#include <popt.h>
+}
+
+using namespace std;
+
+/*!
+ * libpopt features - the features that are available to change on the
+ * command line.
+ */
+struct CmdOptions {
+    //! To hold the directory to write the model into. The -o option.
+    char * out_dir;
+    //! To hold the number of populations.
+    int populations;
+    //! To hold the number of neurons per population. 0 if connections is given instead.
+    int size;
+    //! To hold the approximate total number of connections, which sets size.
+    double connections;
+    //! To hold the connection probability.
+    double probability;
+    //! To hold the delay distribution: "fixed", "normal" or "uniform".
+    char * delay;
+    //! To hold the number of neuron state variables.
+    int state_vars;
+    //! To hold the first seed written into the model.
+    int seed;
+};
+
+/*!
+ * Initializes a CmdOptions object via a @param copts pointer
+ */
+void zeroCmdOptions (CmdOptions* copts)
+{
+    copts->out_dir = NULL;
+    copts->populations = 2;
+    copts->size = 0;
+    copts->connections = 0;
+    copts->probability = 0.1;
+    copts->delay = NULL;
+    copts->state_vars = 2;
+    copts->seed = 123;
+}
+
+/*!
+ * main entry point for spineml_modelgen
+ */
+int main (int argc, char * argv[])
+{
+    int rtn = 0;
+
+    CmdOptions cmdOptions;
+    zeroCmdOptions (&cmdOptions);
+
+    struct poptOption opt[] = {
+        POPT_AUTOHELP
+
+        {"out_dir", 'o',
+         POPT_ARG_STRING, &(cmdOptions.out_dir), 0,
+         "The directory to write the model into. It is created if necessary."},
+
+        {"populations", '\0',
+         POPT_ARG_INT, &(cmdOptions.populations), 0,
+         "The number of populations, each projecting to the next in a ring. Default: 2"},
+
+        {"size", '\0',
+         POPT_ARG_INT, &(cmdOptions.size), 0,
+         "The number of neurons in each population. Default: 1000"},
+
+        {"connections", '\0',
+         POPT_ARG_DOUBLE, &(cmdOptions.connections), 0,
+         "Instead of --size, choose the population size to give about this many "
+         "connections in total."},
+
+        {"probability", '\0',
+         POPT_ARG_DOUBLE, &(cmdOptions.probability), 0,
+         "The connection probability of each projection. Default: 0.1"},
+
+        {"delay", '\0',
+         POPT_ARG_STRING, &(cmdOptions.delay), 0,
+         "The delay distribution: fixed, normal or uniform. Default: normal"},
+
+        {"state_vars", '\0',
+         POPT_ARG_INT, &(cmdOptions.state_vars), 0,
+         "The number of state variables in the neuron component, each given an "
+         "initial value property. Default: 2"},
+
+        {"seed", '\0',
+         POPT_ARG_INT, &(cmdOptions.seed), 0,
+         "The first of the RNG seeds written into the model. Default: 123"},
+
+        POPT_AUTOALIAS
+        POPT_TABLEEND
+    };
+    poptContext con;
+    con = poptGetContext (argv[0], argc, (const char**)argv, opt, 0);
+    while (poptGetNextOpt(con) != -1) {}
+
+    try {
+        if (cmdOptions.out_dir == NULL) {
+            throw runtime_error ("Please supply the directory to write the model "
+                                 "into with the -o option.");
+        }
+        if (cmdOptions.populations < 1 || cmdOptions.state_vars < 0
+            || cmdOptions.probability <= 0 || cmdOptions.probability > 1) {
+            throw runtime_error ("Need at least one population, a probability in (0,1] "
+                                 "and no fewer than 0 state variables.");
+        }
+
+        spineml::ModelGenerator gen;
+        gen.populations = static_cast<unsigned int>(cmdOptions.populations);
+        gen.probability = static_cast<float>(cmdOptions.probability);
+        gen.stateVariables = static_cast<unsigned int>(cmdOptions.state_vars);
+        gen.seed = cmdOptions.seed;
+        if (cmdOptions.delay != NULL) {
+            gen.setDelayType (cmdOptions.delay);
+        }
+        if (cmdOptions.connections > 0) {
+            gen.setSizeForConnections (cmdOptions.connections);
+        } else if (cmdOptions.size > 0) {
+            gen.size = static_cast<unsigned int>(cmdOptions.size);
+        }
+
+        gen.write (cmdOptions.out_dir);
+        cout << "Wrote model of " << gen.populations << " population(s) of " << gen.size
+             << " neurons, about " << gen.expectedConnections() << " connections, to "
+             << cmdOptions.out_dir << endl;
+    } catch (const exception& e) {
+        cerr << "Modelgen Error: " << e.what() << endl;
+        rtn = -1;
+    }
+
+    poptFreeContext(con);
+    return rtn;
+}
@@ -36,8 +36,15 @@
 #include <exception>
 #include <iostream>
 #include <string>
+#include <stdexcept>
+#include <unistd.h>
 #include "experiment.h"
 #include "modelpreflight.h"
+#include "streamingpreflight.h"
+#include "preflightestimate.h"
+#include "metrics.h"
+#include "trace.h"
+#include "memoryuse.h"
 #include "util.h"
 
 extern "C" {
@@ -56,6 +63,38 @@ struct CmdOptions {
     char * expt_path;
     //! To hold a flag to say whether the model.xml file should be backed up before being modified. The -b option.
     int backup_model;
+    //! To hold a flag to say whether model.xml should be preflighted in streaming mode.
+    int streaming;
+    //! To hold a flag to say that model.xml and experiment.xml should be written without indentation.
+    int no_indent;
+    //! To hold the path to the component cache file, or "none". Default cache if NULL.
+    char * component_cache;
+    //! To hold the number of threads to use. 0 means one per processor.
+    int threads;
+    //! To hold the memory budget in MB. 0 for no budget.
+    int memory_budget;
+    //! To hold a flag to say that the peak memory held by each part of preflight should be reported.
+    int memory_report;
+    //! To hold a flag to say that nothing should be written; the changes to model.xml are printed instead.
+    int dry_run;
+    //! To hold a flag to say that binary files should be named from what they contain, not numbered.
+    int stable_names;
+    //! To hold a flag to say that explicit connection delays go in a file of their own.
+    int separate_delays;
+    //! To hold a flag to say that fixed probability connections use coupled sampling.
+    int coupled_sampling;
+    //! To hold the directory in which coupled sampling keeps its caches.
+    char * sampling_cache;
+    //! To hold a flag to say that connections from a population to itself make no autapses.
+    int no_autapses;
+    //! To hold a flag to say that the cost of preflight should be estimated instead of preflighting.
+    int estimate;
+    //! To hold the format of the estimate: "table" or "json". Table if NULL.
+    char * estimate_format;
+    //! To hold the path of the JSON performance metrics report. No report if NULL.
+    char * metrics_out;
+    //! To hold the path of the Chrome trace-event timeline. No timeline if NULL.
+    char * trace_out;
     //! To take the option to list components used in the model
     int list_components;
     //! To take the option to show the model file name
@@ -89,6 +128,22 @@ void zeroCmdOptions (CmdOptions* copts)
 {
     copts->expt_path = NULL;
     copts->backup_model = 0;
+    copts->streaming = 0;
+    copts->no_indent = 0;
+    copts->component_cache = NULL;
+    copts->threads = 1;
+    copts->memory_budget = 0;
+    copts->memory_report = 0;
+    copts->dry_run = 0;
+    copts->stable_names = 0;
+    copts->separate_delays = 0;
+    copts->coupled_sampling = 0;
+    copts->sampling_cache = NULL;
+    copts->no_autapses = 0;
+    copts->estimate = 0;
+    copts->estimate_format = NULL;
+    copts->metrics_out = NULL;
+    copts->trace_out = NULL;
     copts->property_change = NULL;
     copts->property_changes.clear();
     copts->constant_current = NULL;
@@ -167,6 +222,95 @@ int main (int argc, char * argv[])
          POPT_ARG_NONE, &(cmdOptions.backup_model), 0,
          "If set, make a backup of model.xml as model.xml.bu."},
 
+        {"streaming", '\0',
+         POPT_ARG_NONE, &(cmdOptions.streaming), 0,
+         "If set, preflight model.xml in a single streaming pass, without holding "
+         "the whole model in memory. For models with very large inline connection "
+         "or value lists. --threads, --memory_budget and --sampling_cache are ignored "
+         "and --dry_run can't be used."},
+
+        {"no_indent", '\0',
+         POPT_ARG_NONE, &(cmdOptions.no_indent), 0,
+         "If set, write model.xml and experiment.xml without indentation. This "
+         "makes the files smaller and quicker to write."},
+
+        {"component_cache", '\0',
+         POPT_ARG_STRING, &(cmdOptions.component_cache), 0,
+         "Path to the file in which the state variables of parsed components are "
+         "cached between runs, or 'none' to disable the cache. Default: "
+         "~/.cache/spineml_preflight/components"},
+
+        {"threads", '\0',
+         POPT_ARG_INT, &(cmdOptions.threads), 0,
+         "Preflight connections and properties on this many threads (0 for one per "
+         "processor). Output is the same whatever the number of threads. Default: 1"},
+
+        {"memory_budget", '\0',
+         POPT_ARG_INT, &(cmdOptions.memory_budget), 0,
+         "Try to keep the memory held for the model and its connection lists and properties "
+         "within this many MB. A fixed probability, fixed number or distance-based "
+         "connection which would go over it is written out as it is generated instead of "
+         "being held in memory. Output is the same. The peak memory use is reported at "
+         "the end. Default: no budget"},
+
+        {"memory_report", '\0',
+         POPT_ARG_NONE, &(cmdOptions.memory_report), 0,
+         "If set, report the peak memory held for the model text, its parsed document, "
+         "connection lists and properties, and by the process, at the end."},
+
+        {"dry_run", '\0',
+         POPT_ARG_NONE, &(cmdOptions.dry_run), 0,
+         "If set, write nothing. Print the changes which would be made to model.xml instead."},
+
+        {"stable_names", '\0',
+         POPT_ARG_NONE, &(cmdOptions.stable_names), 0,
+         "If set, name each binary file after the population, projection or input and "
+         "property it belongs to, rather than numbering the files pf_connectionN.bin and "
+         "pf_explicitDataN.bin. Unchanged parts of a model keep the same file names."},
+
+        {"separate_delays", '\0',
+         POPT_ARG_NONE, &(cmdOptions.separate_delays), 0,
+         "If set, write explicit connection delays to a file of their own, alongside the "
+         "connection file, so that a later delay change doesn't rewrite the connections."},
+
+        {"coupled_sampling", '\0',
+         POPT_ARG_NONE, &(cmdOptions.coupled_sampling), 0,
+         "If set, generate fixed probability connections so that those for a smaller "
+         "probability are a subset of those for a larger one (with the same seed). The "
+         "connectivity differs from the default generator's."},
+
+        {"sampling_cache", '\0',
+         POPT_ARG_STRING, &(cmdOptions.sampling_cache), 0,
+         "With --coupled_sampling, keep a cache of each fixed probability connection in this "
+         "directory, so that a run at another probability is derived from it."},
+
+        {"no_autapses", '\0',
+         POPT_ARG_NONE, &(cmdOptions.no_autapses), 0,
+         "If set, fixed probability and fixed number connections from a population to "
+         "itself connect no neuron to itself. Every other pair keeps its probability; a "
+         "fixed number is chosen from the rest of the population."},
+
+        {"estimate", '\0',
+         POPT_ARG_NONE, &(cmdOptions.estimate), 0,
+         "If set, generate and write nothing. Estimate the number of connections, the size of "
+         "the binary files, the peak memory and the time preflight would take, for each "
+         "population, projection and input and in total."},
+
+        {"estimate_format", '\0',
+         POPT_ARG_STRING, &(cmdOptions.estimate_format), 0,
+         "The format of the --estimate report: 'table' or 'json'. Default: table"},
+
+        {"metrics_out", '\0',
+         POPT_ARG_STRING, &(cmdOptions.metrics_out), 0,
+         "Write a JSON report of the wall time, CPU time, items produced, bytes written "
+         "and throughput of each phase of preflight, and of each projection, to this file."},
+
+        {"trace_out", '\0',
+         POPT_ARG_STRING, &(cmdOptions.trace_out), 0,
+         "Write a timeline of the run, showing when each population, synapse, connection "
+         "list, binary file and XML file was processed and on which thread, to this file "
+         "in Chrome trace-event JSON format (for Perfetto or about:tracing)."},
+
         {"list_components", 'l',
          POPT_ARG_NONE, &(cmdOptions.list_components), 0,
          "If set, list the components of the model, one per line on stdout."},
@@ -249,6 +393,16 @@ int main (int argc, char * argv[])
                                  "with the -e option.");
         }
 
+        if (cmdOptions.metrics_out != NULL) {
+            spineml::Metrics::enable();
+        }
+        if (cmdOptions.trace_out != NULL) {
+            spineml::Trace::enable();
+        }
+        if (cmdOptions.memory_budget > 0) {
+            spineml::MemoryUse::setBudget (cmdOptions.memory_budget * 1048576.0);
+        }
+
         string expt_path(cmdOptions.expt_path);
         string model_dir(cmdOptions.expt_path);
         Util::stripUnixFile (model_dir);
@@ -262,6 +416,12 @@ int main (int argc, char * argv[])
 
         spineml::Experiment expt (cmdOptions.expt_path);
         expt.setModelDir (model_dir);
+        if (cmdOptions.no_indent > 0) {
+            expt.indent = false;
+        }
+        if (cmdOptions.dry_run > 0 || cmdOptions.estimate > 0) {
+            expt.dryRun = true;
+        }
 
         vector<string>::const_iterator pciter = cmdOptions.property_changes.begin();
         while (pciter != cmdOptions.property_changes.end()) {
@@ -298,28 +458,147 @@ int main (int argc, char * argv[])
             ++pciter;
         }
 
-        // Get path from the expt above
-        spineml::ModelPreflight model (model_dir, expt.modelUrl());
-        if (cmdOptions.backup_model > 0) {
-            model.backup = true;
+        unsigned int nthreads = 1;
+        if (cmdOptions.threads == 0) {
+            long nproc = sysconf (_SC_NPROCESSORS_ONLN);
+            nthreads = nproc > 0 ? static_cast<unsigned int>(nproc) : 1;
+        } else if (cmdOptions.threads > 0) {
+            nthreads = static_cast<unsigned int>(cmdOptions.threads);
+        } else {
+            throw runtime_error ("The number of threads can't be negative.");
         }
-        if (cmdOptions.list_components > 0 || cmdOptions.show_model_file > 0) {
-            if (cmdOptions.list_components > 0) {
-                set<string> clist = model.get_component_set();
-                set<string>::const_iterator clisti = clist.begin();
-                while (clisti != clist.end()) {
-                    cout << *clisti << endl;
-                    ++clisti;
-                }
+#ifndef _OPENMP
+        if (nthreads > 1 && cmdOptions.streaming == 0) {
+            cout << "Preflight: WARNING: built without OpenMP; --threads " << cmdOptions.threads
+                 << " runs on one thread.\n";
+        }
+#endif
+
+        if (cmdOptions.streaming > 0 && cmdOptions.dry_run > 0 && cmdOptions.estimate == 0) {
+            // A dry run needs the whole model in memory, which is what
+            // --streaming is there to avoid.
+            throw runtime_error ("--dry_run can't be used with --streaming; "
+                                 "run the dry run without --streaming.");
+        }
+
+        if (cmdOptions.estimate > 0) {
+            string format = cmdOptions.estimate_format ? cmdOptions.estimate_format : "table";
+            if (format != "table" && format != "json") {
+                throw runtime_error ("The estimate format should be 'table' or 'json'.");
             }
-            if (cmdOptions.show_model_file > 0) {
-                cout << expt.modelUrl() << endl;
+            spineml::PreflightEstimate est (model_dir, expt.modelUrl());
+            if (cmdOptions.component_cache != NULL) {
+                est.setComponentCacheFile (cmdOptions.component_cache);
             }
-        } else {
-            model.preflight(expt.delayChanges);
-            // Write out the now modified xml:
-            model.write();
+            est.threads = nthreads;
+            est.estimate (expt.delayChanges);
+            if (format == "json") {
+                est.writeJson (cout);
+            } else {
+                est.writeTable (cout);
+            }
+
+        } else if (cmdOptions.streaming > 0
+            && cmdOptions.list_components == 0 && cmdOptions.show_model_file == 0) {
+            // Stream model.xml; ModelPreflight would read it all into memory.
+            spineml::StreamingPreflight smodel (model_dir, expt.modelUrl());
+            if (cmdOptions.backup_model > 0) {
+                smodel.backup = true;
+            }
+            if (cmdOptions.component_cache != NULL) {
+                smodel.setComponentCacheFile (cmdOptions.component_cache);
+            }
+            if (cmdOptions.stable_names > 0) {
+                smodel.stableNames = true;
+            }
+            if (cmdOptions.separate_delays > 0) {
+                smodel.separateDelays = true;
+            }
+            if (cmdOptions.coupled_sampling > 0) {
+                smodel.coupledSampling = true;
+            }
+            if (cmdOptions.no_autapses > 0) {
+                smodel.noAutapses = true;
+            }
+            if (cmdOptions.threads != 1) {
+                cout << "Preflight: WARNING: --threads is ignored with --streaming.\n";
+            }
+            if (cmdOptions.no_indent > 0) {
+                cout << "Preflight: WARNING: --no_indent only applies to experiment.xml "
+                     << "with --streaming.\n";
+            }
+            if (cmdOptions.memory_budget > 0) {
+                cout << "Preflight: WARNING: --memory_budget is ignored with --streaming.\n";
+            }
+            if (cmdOptions.sampling_cache != NULL) {
+                cout << "Preflight: WARNING: --sampling_cache is ignored with --streaming.\n";
+            }
+            smodel.preflight (expt.delayChanges);
             cout << "Preflight Finished.\n";
+
+        } else {
+            // Get path from the expt above
+            spineml::ModelPreflight model (model_dir, expt.modelUrl());
+            if (cmdOptions.backup_model > 0) {
+                model.backup = true;
+            }
+            if (cmdOptions.no_indent > 0) {
+                model.indent = false;
+            }
+            if (cmdOptions.component_cache != NULL) {
+                model.setComponentCacheFile (cmdOptions.component_cache);
+            }
+            model.threads = nthreads;
+            if (cmdOptions.dry_run > 0) {
+                model.dryRun = true;
+            }
+            if (cmdOptions.stable_names > 0) {
+                model.stableNames = true;
+            }
+            if (cmdOptions.separate_delays > 0) {
+                model.separateDelays = true;
+            }
+            if (cmdOptions.coupled_sampling > 0) {
+                model.coupledSampling = true;
+            }
+            if (cmdOptions.sampling_cache != NULL) {
+                model.samplingCache = cmdOptions.sampling_cache;
+            }
+            if (cmdOptions.no_autapses > 0) {
+                model.noAutapses = true;
+            }
+            if (cmdOptions.list_components > 0 || cmdOptions.show_model_file > 0) {
+                if (cmdOptions.list_components > 0) {
+                    set<string> clist = model.get_component_set();
+                    set<string>::const_iterator clisti = clist.begin();
+                    while (clisti != clist.end()) {
+                        cout << *clisti << endl;
+                        ++clisti;
+                    }
+                }
+                if (cmdOptions.show_model_file > 0) {
+                    cout << expt.modelUrl() << endl;
+                }
+            } else {
+                model.preflight(expt.delayChanges);
+                if (cmdOptions.dry_run > 0) {
+                    cout << "Preflight Finished (dry run; nothing was written).\n";
+                } else {
+                    // Write out the now modified xml:
+                    model.write();
+                    cout << "Preflight Finished.\n";
+                }
+            }
+        }
+
+        if (cmdOptions.memory_report > 0 || cmdOptions.memory_budget > 0) {
+            spineml::MemoryUse::writeReport (cout);
+        }
+        if (cmdOptions.metrics_out != NULL) {
+            spineml::Metrics::write (cmdOptions.metrics_out);
+        }
+        if (cmdOptions.trace_out != NULL) {
+            spineml::Trace::write (cmdOptions.trace_out);
         }
     } catch (const exception& e) {
         cerr << "Preflight Error: " << e.what() << endl;
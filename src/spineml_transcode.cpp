@@ -0,0 +1,303 @@
+/*
+ * spineml_transcode main() function
+ */
+
+/*!
+ * Converts the binary connection lists and explicit value lists of
+ * an already preflighted model to a different layout - 16 bit
+ * indices, float values, dense value lists, or back to the layout
+ * preflight writes - and updates their BinaryFile elements in
+ * model.xml to match. See BinaryTranscoder.
+ */
+
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <unistd.h>
+#include "rapidxml.hpp"
+#include "allocandread.h"
+#include "binarytranscoder.h"
+#include "bufferedwriter.h"
+#include "util.h"
+
+extern "C" {
+#include <popt.h>
+}
+
+using namespace std;
+using namespace rapidxml;
+using spineml::BinaryTranscoder;
+using spineml::Util;
+
+/*!
+ * libpopt features - the features that are available to change on the
+ * command line.
+ */
+struct CmdOptions {
+    //! To hold the path to the model.xml file. The -m option
+    char * model_path;
+    //! To hold the index width to convert to; 0 to leave it as it is.
+    int index_bits;
+    //! To hold the value width to convert to; 0 to leave it as it is.
+    int value_bits;
+    //! To hold a flag to say that value lists should be made dense.
+    int dense;
+    //! To hold a flag to say that dense value lists should be given indices.
+    int indexed;
+    //! To hold a flag to say that files should go back to the layout preflight writes.
+    int standard;
+    //! To hold "values" or "connections" to convert only those files.
+    char * only;
+    //! To hold the number of threads to use. 0 means one per processor.
+    int threads;
+    //! To hold a flag to say that the original files are kept as .bu files.
+    int backup;
+};
+
+/*!
+ * Initializes a CmdOptions object via a @param copts pointer
+ */
+void zeroCmdOptions (CmdOptions* copts)
+{
+    copts->model_path = NULL;
+    copts->index_bits = 0;
+    copts->value_bits = 0;
+    copts->dense = 0;
+    copts->indexed = 0;
+    copts->standard = 0;
+    copts->only = NULL;
+    copts->threads = 0;
+    copts->backup = 0;
+}
+
+/*!
+ * A file to convert.
+ */
+struct Target {
+    xml_node<>* node;
+    string path;
+    BinaryTranscoder::Layout from;
+    BinaryTranscoder::Layout to;
+    unsigned long long elements;
+};
+
+/*!
+ * Add every BinaryFile element at or below @param node to @param
+ * found, other than those of neuron positions, which have only the
+ * one layout.
+ */
+void findBinaryFiles (xml_node<>* node, vector<xml_node<>*>& found)
+{
+    for (xml_node<>* n = node->first_node(); n; n = n->next_sibling()) {
+        if (string(n->name()) == "BinaryFile") {
+            found.push_back (n);
+        } else if (string(n->name()) == "Layout") {
+            continue;
+        } else {
+            findBinaryFiles (n, found);
+        }
+    }
+}
+
+/*!
+ * main entry point for spineml_transcode
+ */
+int main (int argc, char * argv[])
+{
+    int rtn = 0;
+
+    CmdOptions cmdOptions;
+    zeroCmdOptions (&cmdOptions);
+
+    struct poptOption opt[] = {
+        POPT_AUTOHELP
+
+        {"model_path", 'm',
+         POPT_ARG_STRING, &(cmdOptions.model_path), 0,
+         "Provide the path to the model.xml file for the model you wish to update."},
+
+        {"index_bits", '\0',
+         POPT_ARG_INT, &(cmdOptions.index_bits), 0,
+         "Convert indices to this width: 16 or 32."},
+
+        {"value_bits", '\0',
+         POPT_ARG_INT, &(cmdOptions.value_bits), 0,
+         "Convert values (and connection delays) to this width: 32 (float) or 64 (double)."},
+
+        {"dense", '\0',
+         POPT_ARG_NONE, &(cmdOptions.dense), 0,
+         "Store value lists without indices. Each must have a value for every index."},
+
+        {"indexed", '\0',
+         POPT_ARG_NONE, &(cmdOptions.indexed), 0,
+         "Store an index with each value of a dense value list."},
+
+        {"standard", '\0',
+         POPT_ARG_NONE, &(cmdOptions.standard), 0,
+         "Convert back to the layout preflight writes, before applying any other option."},
+
+        {"only", '\0',
+         POPT_ARG_STRING, &(cmdOptions.only), 0,
+         "Convert only \"values\" or only \"connections\"."},
+
+        {"threads", '\0',
+         POPT_ARG_INT, &(cmdOptions.threads), 0,
+         "Convert on this many threads. Default: 0, one per processor."},
+
+        {"backup", 'b',
+         POPT_ARG_NONE, &(cmdOptions.backup), 0,
+         "If set, keep each original file, and model.xml, with a .bu suffix."},
+
+        POPT_AUTOALIAS
+        POPT_TABLEEND
+    };
+    poptContext con;
+    con = poptGetContext (argv[0], argc, (const char**)argv, opt, 0);
+    while (poptGetNextOpt(con) != -1) {}
+
+    vector<Target> targets;
+    string tmppath("");
+    try {
+        if (cmdOptions.model_path == NULL) {
+            throw runtime_error ("Please supply the path to model xml file "
+                                 "with the -m option.");
+        }
+        if ((cmdOptions.index_bits != 0 && cmdOptions.index_bits != 16 && cmdOptions.index_bits != 32)
+            || (cmdOptions.value_bits != 0 && cmdOptions.value_bits != 32 && cmdOptions.value_bits != 64)) {
+            throw runtime_error ("index_bits should be 16 or 32 and value_bits 32 or 64.");
+        }
+        if (cmdOptions.dense && cmdOptions.indexed) {
+            throw runtime_error ("Give only one of --dense and --indexed.");
+        }
+        string only (cmdOptions.only != NULL ? cmdOptions.only : "");
+        if (!only.empty() && only != "values" && only != "connections") {
+            throw runtime_error ("--only should be \"values\" or \"connections\".");
+        }
+        unsigned int nthreads = 1;
+        if (cmdOptions.threads == 0) {
+            long nproc = sysconf (_SC_NPROCESSORS_ONLN);
+            nthreads = nproc > 0 ? static_cast<unsigned int>(nproc) : 1;
+        } else if (cmdOptions.threads > 0) {
+            nthreads = static_cast<unsigned int>(cmdOptions.threads);
+        } else {
+            throw runtime_error ("The number of threads can't be negative.");
+        }
+#ifndef _OPENMP
+        if (cmdOptions.threads > 1) {
+            cout << "Transcode: WARNING: built without OpenMP; --threads " << cmdOptions.threads
+                 << " runs on one thread.\n";
+        }
+#endif
+
+        string model_dir(cmdOptions.model_path);
+        Util::stripUnixFile (model_dir);
+        if (model_dir == cmdOptions.model_path) {
+            model_dir = ".";
+        }
+        model_dir += "/";
+        string model_path (cmdOptions.model_path);
+
+        spineml::AllocAndRead modeldata (model_path);
+        xml_document<> doc;
+        doc.parse<parse_declaration_node | parse_no_data_nodes>(modeldata.data());
+        xml_node<>* root_node = doc.first_node ("LL:SpineML");
+        if (!root_node) {
+            throw runtime_error ("No root node LL:SpineML!");
+        }
+
+        // Work out what is to be done for each file.
+        vector<xml_node<>*> found;
+        findBinaryFiles (root_node, found);
+        for (unsigned int i = 0; i < found.size(); ++i) {
+            xml_attribute<>* fattr = found[i]->first_attribute ("file_name");
+            if (!fattr) {
+                throw runtime_error ("A BinaryFile has no file_name.");
+            }
+            Target t;
+            t.node = found[i];
+            t.path = model_dir + fattr->value();
+            t.from = BinaryTranscoder::layoutOf (found[i]);
+            if ((only == "values" && t.from.connections)
+                || (only == "connections" && !t.from.connections)) {
+                continue;
+            }
+            xml_attribute<>* eattr = found[i]->first_attribute (t.from.connections
+                                                                ? "num_connections" : "num_elements");
+            if (!eattr) {
+                stringstream ee;
+                ee << "The BinaryFile for " << fattr->value() << " has no "
+                   << (t.from.connections ? "num_connections." : "num_elements.");
+                throw runtime_error (ee.str());
+            }
+            stringstream ss;
+            ss << eattr->value();
+            ss >> t.elements;
+
+            t.to = t.from;
+            if (cmdOptions.standard) {
+                t.to.setStandard();
+            }
+            if (cmdOptions.index_bits) {
+                t.to.indexBits = static_cast<unsigned int>(cmdOptions.index_bits);
+            }
+            if (cmdOptions.value_bits) {
+                t.to.valueBits = static_cast<unsigned int>(cmdOptions.value_bits);
+            }
+            if (!t.to.connections && (cmdOptions.dense || cmdOptions.indexed)) {
+                t.to.dense = (cmdOptions.dense != 0);
+            }
+            if (t.to != t.from) {
+                targets.push_back (t);
+            }
+        }
+
+        // Convert every file alongside its original. Nothing is
+        // replaced until they have all converted.
+        for (unsigned int i = 0; i < targets.size(); ++i) {
+            unsigned long long n = BinaryTranscoder::transcode (targets[i].path, targets[i].from,
+                                                                targets[i].path + ".out", targets[i].to,
+                                                                targets[i].elements, nthreads);
+            cout << "Transcode: " << targets[i].path << ": " << n << " records, "
+                 << targets[i].from.describe() << " to " << targets[i].to.describe() << endl;
+            BinaryTranscoder::setLayout (doc, targets[i].node, targets[i].to);
+        }
+
+        tmppath = Util::tempPathFor (model_path);
+        {
+            spineml::BufferedWriter f (tmppath);
+            f.writeXml (doc);
+            f.sync();
+            f.close();
+        }
+        for (unsigned int i = 0; i < targets.size(); ++i) {
+            if (cmdOptions.backup) {
+                Util::keepPreviousVersion (targets[i].path, targets[i].path + ".bu");
+            }
+            Util::replaceFile (targets[i].path + ".out", targets[i].path);
+        }
+        if (cmdOptions.backup) {
+            Util::keepPreviousVersion (model_path, model_path + ".bu");
+        }
+        Util::replaceFile (tmppath, model_path);
+        targets.clear();
+        tmppath = "";
+        cout << "Transcode Finished.\n";
+
+    } catch (const exception& e) {
+        // Leave the model as it was.
+        for (unsigned int i = 0; i < targets.size(); ++i) {
+            unlink ((targets[i].path + ".out").c_str());
+        }
+        if (!tmppath.empty()) {
+            unlink (tmppath.c_str());
+        }
+        cout << "Transcode Error: " << e.what() << endl;
+        rtn = -1;
+    }
+
+    poptFreeContext(con);
+    return rtn;
+}
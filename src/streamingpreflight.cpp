@@ -0,0 +1,1258 @@
+/*
+ * Implementation of the class StreamingPreflight.
+ *
+ * Licence: GNU GPL
+ */
+
+#include <string>
+#include <set>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "rapidxml.hpp"
+#include "rng.h"
+#include "util.h"
+#include "bufferedwriter.h"
+#include "modelpreflight.h"
+#include "streamingpreflight.h"
+#include "metrics.h"
+#include "trace.h"
+#include "fixedvalue.h"
+#include "uniformdistribution.h"
+#include "normaldistribution.h"
+#include "valuelist.h"
+#include "neuronlayout.h"
+#include "distanceconnectivity.h"
+#include "binarytranscoder.h"
+
+using namespace std;
+using namespace rapidxml;
+using namespace spineml;
+
+/*!
+ * The number of temporary connection records read at a time when
+ * writing out a binary connection list.
+ */
+#define STREAM_CONN_CHUNK 65536
+
+StreamingPreflight::StreamingPreflight (const string& fdir, const string& fname)
+    : backup (false)
+    , stableNames (false)
+    , separateDelays (false)
+    , coupledSampling (false)
+    , noAutapses (false)
+    , modeldir (fdir)
+    , modelfile (fname)
+    , in ((XmlStreamReader*)0)
+    , out ((BufferedWriter*)0)
+    , popSize (0)
+    , dstNum (0)
+    , synapseNum (0)
+    , fixedDelay (-1.0)
+    , numConnections (0)
+    , binfilenum (0)
+    , explicitData_binfilenum (0)
+    , layout_binfilenum (0)
+{
+}
+
+StreamingPreflight::~StreamingPreflight()
+{
+    this->discardBinaryChanges();
+    if (this->in) {
+        delete this->in;
+    }
+    if (this->out) {
+        delete this->out;
+    }
+}
+
+void
+StreamingPreflight::preflight (const vector<DelayChange>& exptDelayChanges)
+{
+    this->delayChanges = exptDelayChanges;
+    this->scanPopulations();
+
+    string filepath = this->modeldir + this->modelfile;
+    string tmppath = Util::tempPathFor (filepath);
+
+    // As ModelPreflight::write, a failure part way through leaves
+    // model.xml and its binary files as they were, with no temporary
+    // files behind.
+    try {
+        this->in = new XmlStreamReader (filepath);
+        this->out = new BufferedWriter (tmppath);
+
+        XmlToken t;
+        while (this->in->next (t)) {
+            this->processToken (t);
+        }
+
+        this->out->sync();
+        this->out->close();
+    } catch (const std::exception& e) {
+        delete this->out;
+        this->out = (BufferedWriter*)0;
+        delete this->in;
+        this->in = (XmlStreamReader*)0;
+        unlink (tmppath.c_str());
+        if (!this->connTmpPath.empty()) {
+            unlink (this->connTmpPath.c_str());
+            this->connTmpPath.clear();
+        }
+        this->discardBinaryChanges();
+        throw;
+    }
+    delete this->out;
+    this->out = (BufferedWriter*)0;
+    delete this->in;
+    this->in = (XmlStreamReader*)0;
+
+    if (this->backup == true) {
+        Util::keepPreviousVersion (filepath, filepath + ".bu");
+    }
+    Util::replaceFile (tmppath, filepath);
+    this->commitBinaryChanges();
+
+    this->components.save();
+}
+
+void
+StreamingPreflight::commitBinaryChanges (void)
+{
+    vector<pair<string, string> >::const_iterator ri = this->pendingReplacements.begin();
+    while (ri != this->pendingReplacements.end()) {
+        Util::replaceFile (ri->first, ri->second);
+        ++ri;
+    }
+    this->pendingReplacements.clear();
+    vector<string>::const_iterator di = this->pendingRemovals.begin();
+    while (di != this->pendingRemovals.end()) {
+        cout << "Preflight: Removing the delay file " << *di << endl;
+        unlink (di->c_str());
+        ++di;
+    }
+    this->pendingRemovals.clear();
+}
+
+void
+StreamingPreflight::discardBinaryChanges (void)
+{
+    vector<pair<string, string> >::const_iterator ri = this->pendingReplacements.begin();
+    while (ri != this->pendingReplacements.end()) {
+        unlink (ri->first.c_str());
+        ++ri;
+    }
+    this->pendingReplacements.clear();
+    this->pendingRemovals.clear();
+}
+
+void
+StreamingPreflight::setComponentCacheFile (const string& path)
+{
+    this->components.setCacheFile (path);
+}
+
+void
+StreamingPreflight::scanPopulations (void)
+{
+    XmlStreamReader r (this->modeldir + this->modelfile);
+    XmlToken t;
+    set<string> cmpt_names;
+    string name("");
+    while (r.next (t)) {
+        if (t.opens (LVL"Neuron")) {
+            string size("");
+            name = "";
+            t.getAttribute ("name", name);
+            if (t.getAttribute ("size", size)) {
+                // First population with a given name wins, as in
+                // ModelPreflight::find_num_neurons
+                this->popSizes.insert (make_pair (name, strtoul (size.c_str(), 0, 10)));
+            }
+        } else if (t.opens ("Layout")) {
+            string text("");
+            StreamingPreflight::captureElement (r, t, text);
+            this->popLayouts.insert (make_pair (name, text));
+            continue;
+        }
+        // Note the components too, so that they can all be loaded
+        // at once before the main pass.
+        if (t.opens (LVL"Neuron") || t.opens (LVL"WeightUpdate") || t.opens (LVL"PostSynapse")) {
+            string cmpt_name("");
+            t.getAttribute ("url", cmpt_name);
+            Util::stripFileSuffix (cmpt_name);
+            if (!cmpt_name.empty() && cmpt_name != "SpikeSource") {
+                cmpt_names.insert (cmpt_name);
+            }
+        }
+    }
+    this->components.prefetch (this->modeldir, cmpt_names);
+}
+
+const string&
+StreamingPreflight::ancestor (unsigned int n) const
+{
+    static const string none("");
+    if (this->stack.size() > n) {
+        return this->stack[this->stack.size()-1-n];
+    }
+    return none;
+}
+
+void
+StreamingPreflight::processToken (XmlToken& t)
+{
+    if (t.type == XmlToken::EndTag) {
+        if (t.name == LVL"Synapse") {
+            ++this->synapseNum;
+        }
+        if (!this->stack.empty()) {
+            this->stack.pop_back();
+        }
+        this->out->write (t.raw);
+        return;
+    }
+
+    if (t.type != XmlToken::StartTag && t.type != XmlToken::EmptyTag) {
+        this->out->write (t.raw);
+        return;
+    }
+
+    const string& parent = this->ancestor (0);
+
+    if (t.name == LVL"Neuron") {
+        this->popName = "";
+        t.getAttribute ("name", this->popName);
+        string pop_num("");
+        t.getAttribute ("size", pop_num);
+        this->popSize = strtoul (pop_num.c_str(), 0, 10);
+        this->popComponent = this->get_component_name (t);
+        cout << "Preflight: processing population: '" << this->popName
+             << "' (size " << pop_num << ")\n";
+
+    } else if (t.name == "Layout" && parent == LVL"Population") {
+        this->processLayout (t);
+        return;
+
+    } else if (t.name == LVL"Projection") {
+        this->dstPopulation = "";
+        t.getAttribute ("dst_population", this->dstPopulation);
+        this->synapseNum = 0;
+        cout << "PreFlight: processing projection " << this->popName
+             << " to " << this->dstPopulation << endl;
+
+    } else if (t.name == LVL"Synapse" && parent == LVL"Projection") {
+        stringstream synss;
+        synss << this->synapseNum;
+        this->fixedDelay = this->searchDelayChanges (this->popName, this->dstPopulation, synss.str());
+        this->connIdentity.clear();
+        this->connIdentity.push_back (this->popName);
+        this->connIdentity.push_back (this->dstPopulation);
+        this->connIdentity.push_back (synss.str());
+        int dstNum_ = this->find_num_neurons (this->dstPopulation);
+        if (dstNum_ == -1) {
+            stringstream ee;
+            ee << "Failed to find the number of neurons in the destination population '"
+               << this->dstPopulation << "'";
+            throw runtime_error (ee.str());
+        }
+        this->dstNum = static_cast<unsigned int>(dstNum_);
+        this->numConnections = 0;
+
+    } else if (t.name == LVL"Input" && parent == LVL"Neuron") {
+        string src_port(""), dst_port("");
+        this->inputSrc = "";
+        t.getAttribute ("src", this->inputSrc);
+        t.getAttribute ("src_port", src_port);
+        t.getAttribute ("dst_port", dst_port);
+        cout << "PreFlight: processing generic input " << this->inputSrc << "/" << src_port
+             << " to " << this->popName << "/" << dst_port << endl;
+        this->fixedDelay = this->searchDelayChanges (this->inputSrc, src_port, this->popName, dst_port);
+        this->connIdentity.clear();
+        this->connIdentity.push_back (this->inputSrc);
+        this->connIdentity.push_back (src_port);
+        this->connIdentity.push_back (this->popName);
+        this->connIdentity.push_back (dst_port);
+
+    } else if ((t.name == LVL"PostSynapse" || t.name == LVL"WeightUpdate")
+               && parent == LVL"Synapse") {
+        this->synComponent = this->get_component_name (t);
+        this->synName = "";
+        t.getAttribute ("name", this->synName);
+
+    } else if (parent == LVL"Synapse"
+               || (parent == LVL"Input" && this->ancestor (1) == LVL"Neuron")) {
+
+        bool inSynapse = (parent == LVL"Synapse");
+        if (t.name == "FixedProbabilityConnection"
+            || t.name == "FixedNumberPreConnection"
+            || t.name == "FixedNumberPostConnection"
+            || t.name == "DistanceBasedConnection"
+            || t.name == "ConnectionList") {
+            unsigned int srcNum = this->popSize;
+            unsigned int dstNum = this->dstNum;
+            string srcName = this->popName;
+            string dstName = this->dstPopulation;
+            if (!inSynapse) {
+                int srcNum_ = this->find_num_neurons (this->inputSrc);
+                if (srcNum_ == -1) {
+                    stringstream ee;
+                    ee << "Failed to find the number of neurons in the src population '"
+                       << this->inputSrc << "'";
+                    throw runtime_error (ee.str());
+                }
+                srcNum = static_cast<unsigned int>(srcNum_);
+                dstNum = this->popSize;
+                srcName = this->inputSrc;
+                dstName = this->popName;
+            }
+            if (t.name == "ConnectionList") {
+                this->processConnectionList (t, srcNum, dstNum);
+                return;
+            }
+            bool recurrent = (srcName == dstName);
+            if (t.name == "FixedProbabilityConnection") {
+                this->replaceFixedProb (t, srcNum, dstNum, recurrent);
+            } else if (t.name == "DistanceBasedConnection") {
+                this->replaceDistanceBased (t, srcName, srcNum, dstName, dstNum);
+            } else {
+                this->replaceFixedNumber (t, srcNum, dstNum, recurrent);
+            }
+            return;
+
+        } else if (inSynapse && t.name == "OneToOneConnection") {
+            this->numConnections = this->dstNum;
+
+        } else if (inSynapse && t.name == "AllToAllConnection") {
+            this->numConnections = this->popSize * this->dstNum;
+        }
+
+    } else if (t.name == "Property") {
+        if (parent == LVL"Neuron" && this->popComponent != "SpikeSource") {
+            this->processProperty (t, this->popSize, this->popComponent);
+            return;
+        } else if (parent == LVL"PostSynapse" && this->ancestor (1) == LVL"Synapse") {
+            // size should be size of dest population
+            this->processProperty (t, this->dstNum, this->synComponent);
+            return;
+        } else if (parent == LVL"WeightUpdate" && this->ancestor (1) == LVL"Synapse") {
+            // size is the number of connections in the synapse
+            this->processProperty (t, this->numConnections, this->synComponent);
+            return;
+        }
+    }
+
+    this->out->write (t.raw);
+    if (t.type == XmlToken::StartTag) {
+        this->stack.push_back (t.name);
+    }
+}
+
+void
+StreamingPreflight::processProperty (XmlToken& t, unsigned int pop_size,
+                                     const string& component_name)
+{
+    string prop_name("");
+    if (!t.getAttribute ("name", prop_name)) {
+        throw runtime_error ("Failed to get property name");
+    }
+    this->propIdentity.clear();
+    this->propIdentity.push_back (this->ancestor (0) == LVL"Neuron" ? this->popName : this->synName);
+    this->propIdentity.push_back (prop_name);
+
+    if (!this->components.at(component_name)->containsStateVariable (prop_name)) {
+        // A parameter, not a state variable; leave it alone.
+        this->copyElement (t);
+        return;
+    }
+
+    if (t.type == XmlToken::EmptyTag) {
+        // Empty property; treat as if it had FixedValue 0.
+        this->out->write (t.asStartTag());
+        this->writeZeroProperty (pop_size);
+        this->out->write ("</" + t.name + ">");
+        return;
+    }
+
+    this->out->write (t.raw);
+    bool converted = false;
+    int depth = 0;
+    XmlToken c;
+    while (this->in->next (c)) {
+        if (depth == 0 && c.type == XmlToken::EndTag) {
+            if (!converted) {
+                this->writeZeroProperty (pop_size);
+            }
+            this->out->write (c.raw);
+            return;
+        }
+
+        if (depth == 0 && !converted) {
+            if (c.opens ("ValueList")) {
+                this->processValueList (c, pop_size);
+                converted = true;
+                continue;
+            }
+            if (c.opens ("FixedValue")
+                || c.opens ("UniformDistribution")
+                || c.opens ("NormalDistribution")) {
+                string text("");
+                this->captureElement (c, text);
+                xml_document<> d;
+                vector<char> buf;
+                xml_node<>* n = this->parseCaptured (d, buf, text);
+                bool wrote = false;
+                if (c.name == "UniformDistribution") {
+                    spineml::UniformDistribution ud (n, pop_size);
+                    wrote = ud.writeAsBinaryValueList (n, this->modeldir, this->nextExplicitDataPath());
+                } else if (c.name == "NormalDistribution") {
+                    spineml::NormalDistribution nd (n, pop_size);
+                    wrote = nd.writeAsBinaryValueList (n, this->modeldir, this->nextExplicitDataPath());
+                } else {
+                    spineml::FixedValue fv (n, pop_size);
+                    wrote = fv.writeAsBinaryValueList (n, this->modeldir, this->nextExplicitDataPath());
+                }
+                if (!wrote) {
+                    this->explicitData_binfilenum--;
+                }
+                this->writeNode (n);
+                converted = true;
+                continue;
+            }
+        }
+
+        if (c.type == XmlToken::StartTag) {
+            ++depth;
+        } else if (c.type == XmlToken::EndTag) {
+            --depth;
+        }
+        this->out->write (c.raw);
+    }
+    throw runtime_error ("Unexpected end of model file inside a Property");
+}
+
+void
+StreamingPreflight::writeZeroProperty (unsigned int pop_size)
+{
+    xml_document<> d;
+    xml_node<>* fixedvalue_node = d.allocate_node (node_element, "FixedValue");
+    d.append_node (fixedvalue_node);
+    spineml::FixedValue fv;
+    fv.setValue (0.0);
+    fv.setNumInPopulation (pop_size);
+    if (!fv.writeAsBinaryValueList (fixedvalue_node, this->modeldir,
+                                    this->nextExplicitDataPath())) {
+        this->explicitData_binfilenum--;
+    }
+    this->writeNode (fixedvalue_node);
+}
+
+void
+StreamingPreflight::processValueList (XmlToken& t, unsigned int pop_size)
+{
+    // Text seen before the first Value, kept in case this turns out
+    // to be a binary ValueList which has to be copied unchanged.
+    string held = t.raw;
+
+    string binfile("");
+    ofstream bf;
+    bool sorted = true;
+    int lastIndex = 0;
+    unsigned int count = 0;
+
+    if (t.type == XmlToken::StartTag) {
+        int depth = 0;
+        XmlToken c;
+        for (;;) {
+            if (!this->in->next (c)) {
+                throw runtime_error ("Unexpected end of model file inside a ValueList");
+            }
+            if (depth == 0 && c.type == XmlToken::EndTag) {
+                break;
+            }
+            if (depth == 0 && binfile.empty() && c.opens ("BinaryFile")) {
+                // Already binary; copy the lot.
+                this->out->write (held);
+                this->copyElement (c);
+                this->copyContent();
+                return;
+            }
+            if (depth == 0 && c.opens ("Value")) {
+                if (binfile.empty()) {
+                    binfile = this->nextExplicitDataPath();
+                    string path = this->modeldir + binfile;
+                    bf.open (path.c_str(), ios::out|ios::trunc);
+                    if (!bf.is_open()) {
+                        stringstream ee;
+                        ee << __FUNCTION__ << " Failed to open file '" << path << "' for writing.";
+                        throw runtime_error (ee.str());
+                    }
+                }
+                string attr("");
+                if (!c.getAttribute ("index", attr)) {
+                    throw runtime_error ("ValueList: Badly formed ValueList; no index.");
+                }
+                int index = static_cast<int>(strtol (attr.c_str(), 0, 10));
+                if (!c.getAttribute ("value", attr)) {
+                    throw runtime_error ("ValueList: Badly formed ValueList; no value.");
+                }
+                double value = strtod (attr.c_str(), 0);
+                bf.write (reinterpret_cast<const char*>(&index), sizeof(unsigned int));
+                bf.write (reinterpret_cast<const char*>(&value), sizeof(double));
+                if (count > 0 && index <= lastIndex) {
+                    sorted = false;
+                }
+                lastIndex = index;
+                ++count;
+                if (c.type == XmlToken::StartTag) {
+                    ++depth;
+                }
+                continue;
+            }
+            if (c.type == XmlToken::StartTag) {
+                ++depth;
+            } else if (c.type == XmlToken::EndTag) {
+                --depth;
+            }
+            if (binfile.empty()) {
+                held += c.raw;
+            }
+        }
+    }
+
+    if (binfile.empty()) {
+        // No Values at all; write an empty list.
+        binfile = this->nextExplicitDataPath();
+        string path = this->modeldir + binfile;
+        bf.open (path.c_str(), ios::out|ios::trunc);
+    }
+    bf.close();
+
+    if (!sorted) {
+        // The values have to come out in index order, with the first
+        // value for any repeated index taking precedence, as in
+        // ValueList. Only now do we need to hold the list in memory.
+        string path = this->modeldir + binfile;
+        map<int, double> values;
+        ifstream rf (path.c_str(), ios::in|ios::binary);
+        int index;
+        double value;
+        while (rf.read (reinterpret_cast<char*>(&index), sizeof(unsigned int))
+               && rf.read (reinterpret_cast<char*>(&value), sizeof(double))) {
+            values.insert (make_pair (index, value));
+        }
+        rf.close();
+        ofstream wf (path.c_str(), ios::out|ios::trunc);
+        map<int, double>::const_iterator i = values.begin();
+        while (i != values.end()) {
+            wf.write (reinterpret_cast<const char*>(&i->first), sizeof(unsigned int));
+            wf.write (reinterpret_cast<const char*>(&i->second), sizeof(double));
+            ++i;
+        }
+        wf.close();
+    }
+
+    xml_document<> d;
+    xml_node<>* vl_node = d.allocate_node (node_element, "ValueList");
+    d.append_node (vl_node);
+    spineml::ValueList vl (vl_node, pop_size);
+    vl.writeVLXml (vl_node, this->modeldir, binfile);
+    this->writeNode (vl_node);
+}
+
+void
+StreamingPreflight::processConnectionList (XmlToken& t, unsigned int srcNum, unsigned int dstNum)
+{
+    Metrics::Scope ps (Metrics::Projection,
+                       Metrics::enabled() ? ModelPreflight::connection_label (this->connIdentity) : "");
+    Trace::Scope ts ("processConnectionList");
+    if (Trace::enabled()) {
+        ts.arg ("projection", ModelPreflight::connection_label (this->connIdentity));
+    }
+    string held = t.raw;
+    string delayText("");
+    bool have_delay_element = false;
+    string binfile("");
+    string tmppath("");
+    ofstream tf;
+    vector<unsigned int> srcCounts;
+    unsigned int nConn = 0;
+    unsigned int nWithDelay = 0;
+
+    if (t.type == XmlToken::StartTag) {
+        int depth = 0;
+        XmlToken c;
+        for (;;) {
+            if (!this->in->next (c)) {
+                throw runtime_error ("Unexpected end of model file inside a ConnectionList");
+            }
+            if (depth == 0 && c.type == XmlToken::EndTag) {
+                break;
+            }
+            if (depth == 0 && binfile.empty() && c.opens ("BinaryFile")) {
+                // Already a binary list. Record the number of
+                // connections for any WeightUpdate and copy it over.
+                string nc("");
+                if (c.getAttribute ("num_connections", nc)) {
+                    this->numConnections = strtoul (nc.c_str(), 0, 10);
+                }
+                if (this->fixedDelay >= 0.0) {
+                    // The whole list is small, so capture it and
+                    // change it as ModelPreflight does.
+                    string text = held;
+                    this->captureElement (c, text);
+                    this->captureContent (text);
+                    this->binaryConnectionDelayChange (text);
+                    return;
+                }
+                this->out->write (held);
+                this->copyElement (c);
+                this->copyContent();
+                return;
+            }
+            if (depth == 0 && c.opens ("Delay")) {
+                string text("");
+                this->captureElement (c, text);
+                delayText += text;
+                have_delay_element = true;
+                if (binfile.empty()) {
+                    held += text;
+                }
+                continue;
+            }
+            if (depth == 0 && c.opens ("Connection")) {
+                if (binfile.empty()) {
+                    binfile = this->nextConnectionPath();
+                    tmppath = this->modeldir + binfile + ".tmp";
+                    this->connTmpPath = tmppath;
+                    tf.open (tmppath.c_str(), ios::out|ios::trunc);
+                    if (!tf.is_open()) {
+                        stringstream ee;
+                        ee << __FUNCTION__ << " Failed to open file '" << tmppath << "' for writing.";
+                        throw runtime_error (ee.str());
+                    }
+                    held.clear();
+                    srcCounts.assign (srcNum, 0);
+                }
+                string attr("");
+                if (!c.getAttribute ("src_neuron", attr)) {
+                    throw runtime_error ("Failed to get src_neuron, malformed XML.");
+                }
+                int src = static_cast<int>(strtol (attr.c_str(), 0, 10));
+                if (!c.getAttribute ("dst_neuron", attr)) {
+                    throw runtime_error ("Failed to get dst_neuron, malformed XML.");
+                }
+                int dst = static_cast<int>(strtol (attr.c_str(), 0, 10));
+                float delay = 0;
+                if (c.getAttribute ("delay", attr)) {
+                    delay = strtof (attr.c_str(), 0);
+                    ++nWithDelay;
+                }
+                // Checked here, as an index out of range would grow
+                // srcCounts or go straight into the binary file.
+                if (src < 0 || static_cast<unsigned int>(src) >= srcNum
+                    || dst < 0 || static_cast<unsigned int>(dst) >= dstNum) {
+                    stringstream ee;
+                    ee << "Connection src_neuron " << src << " or dst_neuron " << dst
+                       << " is out of range for source and destination populations of "
+                       << srcNum << " and " << dstNum << " neurons.";
+                    throw runtime_error (ee.str());
+                }
+                ++srcCounts[src];
+                ++nConn;
+                tf.write (reinterpret_cast<const char*>(&src), sizeof(int));
+                tf.write (reinterpret_cast<const char*>(&dst), sizeof(int));
+                tf.write (reinterpret_cast<const char*>(&delay), sizeof(float));
+                if (c.type == XmlToken::StartTag) {
+                    ++depth;
+                }
+                continue;
+            }
+            if (c.type == XmlToken::StartTag) {
+                ++depth;
+            } else if (c.type == XmlToken::EndTag) {
+                --depth;
+            }
+            if (binfile.empty()) {
+                held += c.raw;
+            }
+        }
+    }
+
+    if (binfile.empty()) {
+        // No Connections in the list.
+        binfile = this->nextConnectionPath();
+        tmppath = this->modeldir + binfile + ".tmp";
+        this->connTmpPath = tmppath;
+        tf.open (tmppath.c_str(), ios::out|ios::trunc);
+    }
+    tf.close();
+
+    // Work out the delays in the same way as
+    // ModelPreflight::connection_list_to_binary
+    spineml::ConnectionList cl;
+    cl.separateDelays = this->separateDelays;
+    xml_document<> d;
+    vector<char> buf;
+    xml_node<>* cl_node = this->parseCaptured (d, buf, "<ConnectionList>" + delayText + "</ConnectionList>");
+    ModelPreflight::setup_connection_delays (cl_node, cl, this->fixedDelay);
+    if (nWithDelay > 0) {
+        // Explicit delays in Connection elements mean that the
+        // delays are an explicit list.
+        cl.delayDistributionType = spineml::Dist_ExplicitList;
+    }
+    if (nConn > nWithDelay && !have_delay_element) {
+        unlink (tmppath.c_str());
+        throw runtime_error ("Failed to get a delay attribute for this "
+                             "Connection and there is no Delay element to use.");
+    }
+    if (nWithDelay > 0 && nWithDelay != nConn) {
+        unlink (tmppath.c_str());
+        stringstream ee;
+        ee << __FUNCTION__ << " Error: Don't have the same number of delays ("
+           << nWithDelay << ") as destinations (" << nConn << ").";
+        throw runtime_error (ee.str());
+    }
+
+    this->writeConnectionBinary (tmppath, this->modeldir + binfile, srcCounts, cl);
+    unlink (tmppath.c_str());
+    this->connTmpPath.clear();
+
+    cl.writeXml (cl_node, this->modeldir, binfile, nConn);
+    this->writeNode (cl_node);
+    this->numConnections = nConn;
+    ps.count (nConn, cl.binaryFileSize (nConn));
+}
+
+void
+StreamingPreflight::binaryConnectionDelayChange (const string& text)
+{
+    xml_document<> d;
+    vector<char> buf;
+    xml_node<>* cl_node = this->parseCaptured (d, buf, text);
+    xml_node<>* binaryfile_node = cl_node->first_node ("BinaryFile");
+    string fname = ModelPreflight::attribute_value (binaryfile_node, "file_name");
+    string nconn = ModelPreflight::attribute_value (binaryfile_node, "num_connections");
+    if (fname.empty() || nconn.empty()) {
+        throw runtime_error ("A binary ConnectionList's BinaryFile has no file_name "
+                             "or num_connections.");
+    }
+    unsigned long long num_connections = strtoull (nconn.c_str(), 0, 10);
+    BinaryTranscoder::Layout layout = BinaryTranscoder::layoutOf (binaryfile_node);
+
+    XmlEdit edit = ModelPreflight::binary_delay_change_edit (cl_node, binaryfile_node,
+                                                             this->fixedDelay);
+
+    string path = this->modeldir + fname;
+    string dfname = ModelPreflight::attribute_value (binaryfile_node, "delay_file_name");
+    if (!dfname.empty()) {
+        string dpath = this->modeldir + dfname;
+        cout << "Preflight: The delay file " << dpath
+             << " will be removed for the delay change to " << this->fixedDelay << " ms\n";
+        this->pendingRemovals.push_back (dpath);
+    } else if (layout.delays) {
+        cout << "Preflight: Removing the delays from binary connection list " << path
+             << " for the delay change to " << this->fixedDelay << " ms\n";
+        BinaryTranscoder::Layout nodelays = layout;
+        nodelays.delays = false;
+        string tmppath = Util::tempPathFor (path);
+        this->pendingReplacements.push_back (make_pair (tmppath, path));
+        BinaryTranscoder::transcode (path, layout, tmppath, nodelays, num_connections);
+    } else {
+        cout << "Preflight: Setting the delay of binary connection list " << path
+             << " to " << this->fixedDelay << " ms\n";
+    }
+
+    edit.apply();
+    this->writeNode (cl_node);
+}
+
+void
+StreamingPreflight::writeConnectionBinary (const string& tmppath, const string& binpath,
+                                           const vector<unsigned int>& srcCounts,
+                                           ConnectionList& cl)
+{
+    Metrics::Scope ms (Metrics::Phase, "binary_write");
+    bool explicitDelays = (cl.delayDistributionType != spineml::Dist_FixedValue);
+    bool delayColumn = explicitDelays && !cl.separateDelays;
+    bool generate = (cl.delayDistributionType == spineml::Dist_Normal
+                     || cl.delayDistributionType == spineml::Dist_Uniform);
+    RngData rngData;
+    if (generate) {
+        cl.initDelayRng (&rngData);
+    }
+    const size_t recsz = delayColumn ? 2*sizeof(int)+sizeof(float) : 2*sizeof(int);
+
+    // The output is grouped by source neuron, in the order in which
+    // connections were given for each source; work out where each
+    // source's group starts.
+    vector<size_t> offsets (srcCounts.size(), 0);
+    size_t total = 0;
+    for (unsigned int i = 0; i < srcCounts.size(); ++i) {
+        offsets[i] = total;
+        total += srcCounts[i];
+    }
+
+    int fd = open (binpath.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0) {
+        stringstream ee;
+        ee << __FUNCTION__ << " Failed to open file '" << binpath << "' for writing.";
+        throw runtime_error (ee.str());
+    }
+    cout << "Preflight: Opened connection binary file " << binpath << endl;
+    if (total == 0) {
+        cout << "Preflight: WARNING: no connectivity between source and destination populations!\n";
+        close (fd);
+        return;
+    }
+
+    if (ftruncate (fd, total * recsz)) {
+        close (fd);
+        stringstream ee;
+        ee << __FUNCTION__ << " Failed to size '" << binpath << "': " << strerror (errno);
+        throw runtime_error (ee.str());
+    }
+    char* mapped = static_cast<char*>(mmap (0, total * recsz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0));
+    if (mapped == MAP_FAILED) {
+        close (fd);
+        stringstream ee;
+        ee << __FUNCTION__ << " Failed to map '" << binpath << "': " << strerror (errno);
+        throw runtime_error (ee.str());
+    }
+
+    // With separate delays, the delay for the connection in slot i
+    // of the connection file goes in slot i of the delay file.
+    int dfd = -1;
+    char* dmapped = (char*)0;
+    const size_t dsz = total * sizeof(float);
+    if (explicitDelays && cl.separateDelays) {
+        string dpath = ConnectionList::delayFileName (binpath);
+        dfd = open (dpath.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+        if (dfd < 0 || ftruncate (dfd, dsz)
+            || (dmapped = static_cast<char*>(mmap (0, dsz, PROT_READ|PROT_WRITE,
+                                                  MAP_SHARED, dfd, 0))) == MAP_FAILED) {
+            stringstream ee;
+            ee << __FUNCTION__ << " Failed to write '" << dpath << "': " << strerror (errno);
+            if (dfd >= 0) {
+                close (dfd);
+            }
+            munmap (mapped, total * recsz);
+            close (fd);
+            throw runtime_error (ee.str());
+        }
+    }
+
+    FILE* tf = fopen (tmppath.c_str(), "rb");
+    if (!tf) {
+        if (dmapped) {
+            munmap (dmapped, dsz);
+            close (dfd);
+        }
+        munmap (mapped, total * recsz);
+        close (fd);
+        stringstream ee;
+        ee << __FUNCTION__ << " Failed to open '" << tmppath << "' for reading.";
+        throw runtime_error (ee.str());
+    }
+
+    // Delays are generated in the order the connections were given,
+    // just as ConnectionList::generateDelays does.
+    const size_t tmprec = 2*sizeof(int)+sizeof(float);
+    vector<char> chunk (STREAM_CONN_CHUNK * tmprec);
+    size_t got = 0;
+    while ((got = fread (&chunk[0], tmprec, STREAM_CONN_CHUNK, tf)) > 0) {
+        for (size_t r = 0; r < got; ++r) {
+            const char* rec = &chunk[r * tmprec];
+            int src;
+            memcpy (&src, rec, sizeof(int));
+            size_t slot = offsets[src]++;
+            char* p = mapped + slot * recsz;
+            memcpy (p, rec, 2*sizeof(int));
+            if (explicitDelays) {
+                float delay;
+                if (generate) {
+                    delay = cl.nextDelay (&rngData);
+                } else {
+                    memcpy (&delay, rec + 2*sizeof(int), sizeof(float));
+                }
+                if (delayColumn) {
+                    memcpy (p + 2*sizeof(int), &delay, sizeof(float));
+                } else {
+                    memcpy (dmapped + slot * sizeof(float), &delay, sizeof(float));
+                }
+            }
+        }
+    }
+    fclose (tf);
+    ms.count (total, cl.binaryFileSize (total));
+
+    if (dmapped) {
+        munmap (dmapped, dsz);
+        close (dfd);
+    }
+    munmap (mapped, total * recsz);
+    close (fd);
+}
+
+void
+StreamingPreflight::replaceFixedProb (XmlToken& t, unsigned int srcNum, unsigned int dstNum,
+                                      bool recurrent)
+{
+    string text("");
+    this->captureElement (t, text);
+    xml_document<> d;
+    vector<char> buf;
+    xml_node<>* fixedprob_node = this->parseCaptured (d, buf, text);
+
+    float probabilityValue = 0;
+    xml_attribute<>* fp_probability_attr = fixedprob_node->first_attribute ("probability");
+    if (!fp_probability_attr) {
+        throw runtime_error ("Failed to get FixedProbability's probability attr from xml");
+    }
+    {
+        stringstream ss;
+        ss << fp_probability_attr->value();
+        ss >> probabilityValue;
+    }
+
+    int seed = 0;
+    xml_attribute<>* fp_seed_attr = fixedprob_node->first_attribute ("seed");
+    if (!fp_seed_attr) {
+        throw runtime_error ("Failed to get FixedProbability's seed attr from model.xml");
+    }
+    {
+        stringstream ss;
+        ss << fp_seed_attr->value();
+        ss >> seed;
+    }
+
+    spineml::ConnectionList cl;
+    cl.separateDelays = this->separateDelays;
+    cl.coupledSampling = this->coupledSampling;
+    cl.noAutapses = this->noAutapses && recurrent;
+    ModelPreflight::setup_connection_delays (fixedprob_node, cl, this->fixedDelay);
+
+    Metrics::Scope ps (Metrics::Projection,
+                       Metrics::enabled() ? ModelPreflight::connection_label (this->connIdentity) : "");
+    Trace::Scope ts ("streamFixedProbability");
+    if (Trace::enabled()) {
+        ts.arg ("projection", ModelPreflight::connection_label (this->connIdentity));
+    }
+    string binfile = this->nextConnectionPath();
+    unsigned int n = cl.streamFixedProbability (seed, probabilityValue, srcNum, dstNum,
+                                                this->modeldir + binfile);
+    cl.writeXml (fixedprob_node, this->modeldir, binfile, n);
+    this->writeNode (fixedprob_node);
+    this->numConnections = n;
+    ps.count (n, cl.binaryFileSize (n));
+}
+
+void
+StreamingPreflight::replaceFixedNumber (XmlToken& t, unsigned int srcNum, unsigned int dstNum,
+                                        bool recurrent)
+{
+    string text("");
+    this->captureElement (t, text);
+    xml_document<> d;
+    vector<char> buf;
+    xml_node<>* fixednum_node = this->parseCaptured (d, buf, text);
+
+    bool pre = (t.name == "FixedNumberPreConnection");
+    string fn_number = ModelPreflight::attribute_value (fixednum_node, "number");
+    string fn_seed = ModelPreflight::attribute_value (fixednum_node, "seed");
+    if (fn_number.empty() || fn_seed.empty()) {
+        stringstream ee;
+        ee << "Failed to get " << t.name << "'s number or seed attr from model.xml";
+        throw runtime_error (ee.str());
+    }
+    unsigned int number = 0;
+    int seed = 0;
+    {
+        stringstream ss;
+        ss << fn_number << " " << fn_seed;
+        ss >> number >> seed;
+    }
+
+    // These are generated in memory; a row of a FixedNumberPre
+    // connection is a destination, so the connections can't be
+    // written out in source order as they are made.
+    spineml::ConnectionList cl;
+    cl.separateDelays = this->separateDelays;
+    cl.noAutapses = this->noAutapses && recurrent;
+    ModelPreflight::setup_connection_delays (fixednum_node, cl, this->fixedDelay);
+
+    Metrics::Scope ps (Metrics::Projection,
+                       Metrics::enabled() ? ModelPreflight::connection_label (this->connIdentity) : "");
+    cl.generateFixedNumber (seed, number, pre, srcNum, dstNum);
+    cl.generateDelays();
+    cl.write (fixednum_node, this->modeldir, this->nextConnectionPath());
+    this->writeNode (fixednum_node);
+    this->numConnections = cl.connectivityC2D.size();
+    ps.count (this->numConnections, cl.binaryFileSize (this->numConnections));
+}
+
+void
+StreamingPreflight::replaceDistanceBased (XmlToken& t, const string& srcName, unsigned int srcNum,
+                                          const string& dstName, unsigned int dstNum)
+{
+    string text("");
+    this->captureElement (t, text);
+    xml_document<> d;
+    vector<char> buf;
+    xml_node<>* distance_node = this->parseCaptured (d, buf, text);
+
+    spineml::DistanceConnectivity dc;
+    dc.read (distance_node);
+
+    spineml::ConnectionList cl;
+    cl.separateDelays = this->separateDelays;
+    cl.noAutapses = this->noAutapses && srcName == dstName;
+    ModelPreflight::setup_connection_delays (distance_node, cl, this->fixedDelay);
+
+    // The Layouts as they were in the input, whether or not this pass
+    // has reached them yet.
+    xml_document<> srcd, dstd;
+    vector<char> srcbuf, dstbuf;
+    xml_node<>* src_layout = (xml_node<>*)0;
+    xml_node<>* dst_layout = (xml_node<>*)0;
+    map<string, string>::const_iterator li = this->popLayouts.find (srcName);
+    if (li != this->popLayouts.end()) {
+        src_layout = this->parseCaptured (srcd, srcbuf, li->second);
+    }
+    li = this->popLayouts.find (dstName);
+    if (li != this->popLayouts.end()) {
+        dst_layout = this->parseCaptured (dstd, dstbuf, li->second);
+    }
+
+    Metrics::Scope ps (Metrics::Projection,
+                       Metrics::enabled() ? ModelPreflight::connection_label (this->connIdentity) : "");
+    dc.setLayouts (src_layout, srcNum, dst_layout, dstNum, this->modeldir);
+    cl.generateDistanceBased (dc);
+    dc.clear();
+    cl.generateDelays();
+    cl.write (distance_node, this->modeldir, this->nextConnectionPath());
+    this->writeNode (distance_node);
+    this->numConnections = cl.connectivityC2D.size();
+    ps.count (this->numConnections, cl.binaryFileSize (this->numConnections));
+}
+
+void
+StreamingPreflight::processLayout (XmlToken& t)
+{
+    string text("");
+    this->captureElement (t, text);
+    xml_document<> d;
+    vector<char> buf;
+    xml_node<>* layout_node = this->parseCaptured (d, buf, text);
+
+    NeuronLayout layout;
+    if (!layout.read (layout_node, this->popSize)) {
+        this->out->write (text);
+        return;
+    }
+    layout.generate();
+    layout.write (layout_node, this->modeldir, this->nextLayoutPath());
+    this->writeNode (layout_node);
+}
+
+void
+StreamingPreflight::copyElement (const XmlToken& t)
+{
+    this->out->write (t.raw);
+    if (t.type == XmlToken::StartTag) {
+        this->copyContent();
+    }
+}
+
+void
+StreamingPreflight::copyContent (void)
+{
+    int depth = 0;
+    XmlToken c;
+    while (this->in->next (c)) {
+        this->out->write (c.raw);
+        if (c.type == XmlToken::StartTag) {
+            ++depth;
+        } else if (c.type == XmlToken::EndTag) {
+            if (depth-- == 0) {
+                return;
+            }
+        }
+    }
+    throw runtime_error ("Unexpected end of model file");
+}
+
+void
+StreamingPreflight::captureElement (const XmlToken& t, string& text)
+{
+    StreamingPreflight::captureElement (*this->in, t, text);
+}
+
+void
+StreamingPreflight::captureElement (XmlStreamReader& r, const XmlToken& t, string& text)
+{
+    text += t.raw;
+    if (t.type != XmlToken::StartTag) {
+        return;
+    }
+    int depth = 0;
+    XmlToken c;
+    while (r.next (c)) {
+        text += c.raw;
+        if (c.type == XmlToken::StartTag) {
+            ++depth;
+        } else if (c.type == XmlToken::EndTag) {
+            if (depth-- == 0) {
+                return;
+            }
+        }
+    }
+    throw runtime_error ("Unexpected end of model file");
+}
+
+void
+StreamingPreflight::captureContent (string& text)
+{
+    int depth = 0;
+    XmlToken c;
+    while (this->in->next (c)) {
+        text += c.raw;
+        if (c.type == XmlToken::StartTag) {
+            ++depth;
+        } else if (c.type == XmlToken::EndTag) {
+            if (depth-- == 0) {
+                return;
+            }
+        }
+    }
+    throw runtime_error ("Unexpected end of model file");
+}
+
+xml_node<>*
+StreamingPreflight::parseCaptured (xml_document<>& d, vector<char>& buf, const string& text)
+{
+    buf.assign (text.begin(), text.end());
+    buf.push_back ('\0');
+    d.parse<parse_no_data_nodes>(&buf[0]);
+    xml_node<>* n = d.first_node();
+    if (!n) {
+        stringstream ee;
+        ee << "Failed to parse model fragment '" << text.substr (0, 64) << "'";
+        throw runtime_error (ee.str());
+    }
+    return n;
+}
+
+void
+StreamingPreflight::writeNode (const xml_node<>* node)
+{
+    this->out->writeXml (*node, false);
+}
+
+string
+StreamingPreflight::get_component_name (const XmlToken& t)
+{
+    string cmpt_name("");
+    t.getAttribute ("url", cmpt_name);
+    Util::stripFileSuffix (cmpt_name);
+
+    if (cmpt_name.empty()) {
+        throw runtime_error ("Failed to read component name; can't proceed");
+    } else if (cmpt_name == "SpikeSource") {
+        return cmpt_name;
+    }
+
+    if (!this->components.count (cmpt_name)) {
+        try {
+            this->components.load (this->modeldir, cmpt_name);
+        } catch (const std::exception& e) {
+            stringstream ee;
+            ee << "Failed to read component " << cmpt_name << ": " << e.what() << ".\n";
+            throw runtime_error (ee.str());
+        }
+    }
+    return cmpt_name;
+}
+
+float
+StreamingPreflight::searchDelayChanges (const string& src, const string& dst,
+                                        const string& synapseNum)
+{
+    vector<DelayChange>::const_iterator i = this->delayChanges.begin();
+    while (i != this->delayChanges.end()) {
+        if (i->matches(src, dst, synapseNum)) {
+            return i->delay;
+        }
+        ++i;
+    }
+    return -1.0;
+}
+
+float
+StreamingPreflight::searchDelayChanges (const string& src, const string& srcPort,
+                                        const string& dst, const string& dstPort)
+{
+    vector<DelayChange>::const_iterator i = this->delayChanges.begin();
+    while (i != this->delayChanges.end()) {
+        if (i->matches(src, srcPort, dst, dstPort)) {
+            return i->delay;
+        }
+        ++i;
+    }
+    return -1.0;
+}
+
+int
+StreamingPreflight::find_num_neurons (const string& name)
+{
+    map<string, unsigned int>::const_iterator i = this->popSizes.find (name);
+    if (i == this->popSizes.end()) {
+        return -1;
+    }
+    return static_cast<int>(i->second);
+}
+
+string
+StreamingPreflight::nextConnectionPath (void)
+{
+    if (this->stableNames) {
+        this->binfilenum++;
+        return Util::stableFileName ("pf_connection_", this->connIdentity);
+    }
+    stringstream ss;
+    ss << "pf_connection" << this->binfilenum++ << ".bin";
+    return ss.str();
+}
+
+string
+StreamingPreflight::nextLayoutPath (void)
+{
+    if (this->stableNames) {
+        this->layout_binfilenum++;
+        return Util::stableFileName ("pf_layout_", vector<string>(1, this->popName));
+    }
+    stringstream ss;
+    ss << "pf_layout" << this->layout_binfilenum++ << ".bin";
+    return ss.str();
+}
+
+string
+StreamingPreflight::nextExplicitDataPath (void)
+{
+    if (this->stableNames) {
+        this->explicitData_binfilenum++;
+        return Util::stableFileName ("pf_explicitData_", this->propIdentity);
+    }
+    stringstream ss;
+    ss << "pf_explicitData" << this->explicitData_binfilenum++ << ".bin";
+    return ss.str();
+}
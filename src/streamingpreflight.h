@@ -0,0 +1,349 @@
+/*!
+ * A streaming model.xml preflight class.
+ */
+
+#ifndef _STREAMINGPREFLIGHT_H_
+#define _STREAMINGPREFLIGHT_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include "rapidxml.hpp"
+#include "componentcache.h"
+#include "connection_list.h"
+#include "delaychange.h"
+#include "xmlstreamreader.h"
+#include "bufferedwriter.h"
+
+namespace spineml
+{
+    /*!
+     * Does the same job as ModelPreflight, but without ever holding
+     * the whole of model.xml in memory. The model is read one token
+     * at a time with an XmlStreamReader; anything which doesn't need
+     * to change is copied straight to the output file. Inline
+     * ConnectionLists and ValueLists are written to their binary
+     * files as they are read and FixedProbabilityConnections are
+     * generated a row at a time, so the memory used is bounded by the
+     * metadata for the largest single block (for a ConnectionList,
+     * one counter per source neuron). The exceptions are fixed
+     * number and distance-based connections, which are generated in
+     * memory.
+     *
+     * Small elements (a FixedProbabilityConnection with its Delay, or
+     * a FixedValue) are parsed into a small rapidxml document so that
+     * the same ConnectionList and PropertyContent code used by
+     * ModelPreflight does the conversion.
+     *
+     * The binary files are numbered in document order, so a neuron
+     * population's properties are numbered before those of its
+     * projections (ModelPreflight does projections first). The data
+     * in the files is the same, and with stableNames so are the file
+     * names.
+     */
+    class StreamingPreflight
+    {
+    public:
+        /*!
+         * @param fdir The directory containing model.xml, including
+         * trailing '/'.
+         *
+         * @param fname The file name of the model xml file.
+         */
+        StreamingPreflight (const std::string& fdir, const std::string& fname);
+        ~StreamingPreflight();
+
+        /*!
+         * Preflight the model, applying the experiment-layer delay
+         * changes in @param exptDelayChanges. The new model is
+         * written to a temporary file which then replaces
+         * model.xml. If anything fails, the temporary files are
+         * removed before the exception is rethrown.
+         */
+        void preflight (const std::vector<DelayChange>& exptDelayChanges);
+
+        /*!
+         * Use @param path as the component cache file; "none"
+         * disables it.
+         */
+        void setComponentCacheFile (const std::string& path);
+
+        /*!
+         * If true, then make a backup of model.xml
+         */
+        bool backup;
+
+        //! As ModelPreflight::stableNames; both give the same names.
+        bool stableNames;
+
+        //! As ModelPreflight::separateDelays.
+        bool separateDelays;
+
+        //! As ModelPreflight::coupledSampling. There is no cache when streaming.
+        bool coupledSampling;
+
+        //! As ModelPreflight::noAutapses.
+        bool noAutapses;
+
+    private:
+        /*!
+         * First pass over the file to find the size of each neuron
+         * population, which is needed before the projections which
+         * refer to it can be expanded, and the text of its Layout,
+         * which a distance-based connection needs. The components
+         * named in the model are prefetched at the end of this pass.
+         */
+        void scanPopulations (void);
+
+        /*!
+         * Deal with a single token from the main loop: copy it to
+         * the output, or hand it to one of the process methods.
+         */
+        void processToken (XmlToken& t);
+
+        /*!
+         * Process a Property with start tag @param t. If it's a state
+         * variable of the component @param component_name, its
+         * content is replaced with a binary ValueList of @param
+         * pop_size elements.
+         */
+        void processProperty (XmlToken& t, unsigned int pop_size,
+                              const std::string& component_name);
+
+        /*!
+         * Convert the ValueList starting with @param t, streaming
+         * Value elements straight into a binary file. A ValueList
+         * which already contains a BinaryFile is copied unchanged.
+         */
+        void processValueList (XmlToken& t, unsigned int pop_size);
+
+        /*!
+         * Convert an inline ConnectionList starting with @param t
+         * into a binary connection list. Connections are written to
+         * a temporary file as they are read and then sorted into
+         * source order in a single scatter pass. @param srcNum and
+         * @param dstNum are the sizes of the source and destination
+         * populations; a connection outside them is an error.
+         */
+        void processConnectionList (XmlToken& t, unsigned int srcNum, unsigned int dstNum);
+
+        /*!
+         * Replace the FixedProbabilityConnection starting with @param
+         * t with a binary connection list. @param recurrent is true
+         * for a connection from a population to itself.
+         */
+        void replaceFixedProb (XmlToken& t, unsigned int srcNum, unsigned int dstNum, bool recurrent);
+
+        /*!
+         * Replace the FixedNumberPreConnection or
+         * FixedNumberPostConnection starting with @param t with a
+         * binary connection list, as replaceFixedProb.
+         */
+        void replaceFixedNumber (XmlToken& t, unsigned int srcNum, unsigned int dstNum, bool recurrent);
+
+        /*!
+         * Replace the DistanceBasedConnection starting with @param t,
+         * from population @param srcName to @param dstName, with a
+         * binary connection list. The positions come from the
+         * Layouts found by scanPopulations.
+         */
+        void replaceDistanceBased (XmlToken& t, const std::string& srcName, unsigned int srcNum,
+                                   const std::string& dstName, unsigned int dstNum);
+
+        /*!
+         * Expand the Layout starting with @param t, of the current
+         * population, into a binary file of positions if it is one
+         * which NeuronLayout generates; otherwise copy it.
+         */
+        void processLayout (XmlToken& t);
+
+        /*!
+         * Write out the binary connection list @param binpath from
+         * the (src, dst, delay) records in @param tmppath. @param
+         * srcCounts holds the number of connections from each source
+         * neuron. The delay settings in @param cl decide whether
+         * delays are written, to a column or to their own file, and
+         * whether they are generated.
+         */
+        void writeConnectionBinary (const std::string& tmppath, const std::string& binpath,
+                                    const std::vector<unsigned int>& srcCounts,
+                                    spineml::ConnectionList& cl);
+
+        /*!
+         * Copy the element starting with @param t, and all of its
+         * content, to the output.
+         */
+        void copyElement (const XmlToken& t);
+
+        /*!
+         * Copy the remaining content of the current element, up to
+         * and including its end tag, to the output.
+         */
+        void copyContent (void);
+
+        /*!
+         * Read the element starting with @param t, and all of its
+         * content, into @param text.
+         */
+        void captureElement (const XmlToken& t, std::string& text);
+
+        //! captureElement, reading from @param r.
+        static void captureElement (XmlStreamReader& r, const XmlToken& t, std::string& text);
+
+        /*!
+         * Read the remaining content of the current element, up to
+         * and including its end tag, into @param text.
+         */
+        void captureContent (std::string& text);
+
+        /*!
+         * Parse @param text into @param d, using @param buf as the
+         * storage for the parsed string. Returns the first node.
+         */
+        rapidxml::xml_node<>* parseCaptured (rapidxml::xml_document<>& d,
+                                             std::vector<char>& buf,
+                                             const std::string& text);
+
+        /*!
+         * Write @param node to the output.
+         */
+        void writeNode (const rapidxml::xml_node<>* node);
+
+        /*!
+         * Apply the delay change fixedDelay to the binary
+         * ConnectionList captured in @param text, and write it to the
+         * output. As ModelPreflight::binary_connection_delay_change,
+         * the delays are removed from the binary file (into a
+         * temporary file) or their file is marked for removal, and
+         * neither is done to the model's files until
+         * commitBinaryChanges().
+         */
+        void binaryConnectionDelayChange (const std::string& text);
+
+        //! Replace the rewritten binary files and remove the delay files.
+        void commitBinaryChanges (void);
+
+        //! Delete any rewritten binary files which haven't replaced their originals.
+        void discardBinaryChanges (void);
+
+        /*!
+         * Write a ValueList BinaryFile for a property with no content
+         * (which is treated as FixedValue 0).
+         */
+        void writeZeroProperty (unsigned int pop_size);
+
+        /*!
+         * Load the Component from the url attribute of @param t and
+         * return its name.
+         */
+        std::string get_component_name (const XmlToken& t);
+
+        //! As ModelPreflight::searchDelayChanges (projection form)
+        float searchDelayChanges (const std::string& src, const std::string& dst,
+                                  const std::string& synapseNum);
+
+        //! As ModelPreflight::searchDelayChanges (generic input form)
+        float searchDelayChanges (const std::string& src, const std::string& srcPort,
+                                  const std::string& dst, const std::string& dstPort);
+
+        //! Number of neurons in population @param name, or -1 if not known.
+        int find_num_neurons (const std::string& name);
+
+        //! Generate the next pf_connectionN.bin file name (or stable name, from connIdentity)
+        std::string nextConnectionPath (void);
+
+        //! Generate the next pf_explicitDataN.bin file name (or stable name, from propIdentity)
+        std::string nextExplicitDataPath (void);
+
+        //! Generate the next pf_layoutN.bin file name (or stable name, from popName)
+        std::string nextLayoutPath (void);
+
+        //! Return the name of the element @param n levels up the stack (0 is the parent).
+        const std::string& ancestor (unsigned int n) const;
+
+        //! Path to directory containing modelfile, with trailing '/'.
+        std::string modeldir;
+
+        //! Name of the XML text file.
+        std::string modelfile;
+
+        //! The input
+        XmlStreamReader* in;
+
+        //! The output
+        BufferedWriter* out;
+
+        //! Names of the open elements which have been copied to the output.
+        std::vector<std::string> stack;
+
+        //! Population name to size, from scanPopulations.
+        std::map<std::string, unsigned int> popSizes;
+
+        //! Population name to the text of its Layout, from scanPopulations.
+        std::map<std::string, std::string> popLayouts;
+
+        //! State variable information for each component.
+        spineml::ComponentCache components;
+
+        //! The experiment-layer delay changes.
+        std::vector<DelayChange> delayChanges;
+
+        //! The current population's name, size and component name.
+        std::string popName;
+        unsigned int popSize;
+        std::string popComponent;
+
+        //! The destination of the current projection, and its size
+        std::string dstPopulation;
+        unsigned int dstNum;
+
+        //! The source population of the current generic input
+        std::string inputSrc;
+
+        //! The current synapse's number within its projection
+        int synapseNum;
+
+        //! Delay override for the current synapse or input (<0 for none)
+        float fixedDelay;
+
+        //! The number of connections in the current synapse, once known.
+        unsigned int numConnections;
+
+        //! The component name of the current PostSynapse or WeightUpdate
+        std::string synComponent;
+
+        //! The name attribute of the current PostSynapse or WeightUpdate
+        std::string synName;
+
+        //! As ModelPreflight::connection_identity, for the current synapse or input
+        std::vector<std::string> connIdentity;
+
+        //! Container name and property name of the current Property
+        std::vector<std::string> propIdentity;
+
+        //! The number for the next pf_connectionN.bin
+        unsigned int binfilenum;
+
+        //! The number for the next pf_explicitDataN.bin
+        unsigned int explicitData_binfilenum;
+
+        //! The number for the next pf_layoutN.bin
+        unsigned int layout_binfilenum;
+
+        /*!
+         * The file of (src, dst, delay) records of the ConnectionList
+         * being converted, or empty. Removed if preflight() fails.
+         */
+        std::string connTmpPath;
+
+        //! As ModelPreflight::pendingReplacements
+        std::vector<std::pair<std::string, std::string> > pendingReplacements;
+
+        //! As ModelPreflight::pendingRemovals
+        std::vector<std::string> pendingRemovals;
+    };
+
+} // namespace spineml
+
+#endif // _STREAMINGPREFLIGHT_H_
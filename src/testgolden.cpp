@@ -0,0 +1,481 @@
+/*
+ * Golden output test for spineml_preflight.
+ */
+
+/*!
+ * Preflights each case listed in golden/golden.txt, in the default
+ * and the streaming mode and on each of several thread counts, and
+ * checks that model.xml, experiment.xml and every pf_*.bin file
+ * written has the size and FNV-1a hash recorded there. Any change to
+ * the output of a case, or a file written or not written, is a
+ * failure.
+ *
+ * The golden file has a line for each case,
+ *
+ *   case <name> <model directory> [spineml_preflight arguments...]
+ *
+ * and a line for each file a case writes in each mode,
+ *
+ *   <name> <mode> <file> <size> <hash>
+ *
+ * Run with --update to rewrite the file lines from the current
+ * output, when a change to the output is intended.
+ */
+
+#include <exception>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include <cstdio>
+#include <stdexcept>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern "C" {
+#include <popt.h>
+}
+
+using namespace std;
+
+/*!
+ * One case: a model and the arguments to preflight it with.
+ */
+struct GoldenCase {
+    string name;
+    string model;
+    vector<string> args;
+};
+
+/*!
+ * The size and hash of an output file.
+ */
+struct FileHash {
+    FileHash() : size (0), hash (0) {}
+    unsigned long long size;
+    unsigned long long hash;
+    bool operator== (const FileHash& other) const
+    {
+        return this->size == other.size && this->hash == other.hash;
+    }
+};
+
+//! Files by name, for one case in one mode.
+typedef map<string, FileHash> FileHashes;
+
+/*!
+ * 64 bit FNV-1a hash and size of the file at @param path.
+ */
+FileHash hashFile (const string& path)
+{
+    ifstream f (path.c_str(), ios::in|ios::binary);
+    if (!f.is_open()) {
+        stringstream ee;
+        ee << "Failed to open '" << path << "'.";
+        throw runtime_error (ee.str());
+    }
+    FileHash fh;
+    fh.hash = 14695981039346656037ULL;
+    char buf[65536];
+    while (f) {
+        f.read (buf, sizeof(buf));
+        streamsize n = f.gcount();
+        for (streamsize i = 0; i < n; ++i) {
+            fh.hash ^= static_cast<unsigned char>(buf[i]);
+            fh.hash *= 1099511628211ULL;
+        }
+        fh.size += static_cast<unsigned long long>(n);
+    }
+    return fh;
+}
+
+/*!
+ * The names of the files in @param dir.
+ */
+vector<string> listDir (const string& dir)
+{
+    vector<string> names;
+    DIR* d = opendir (dir.c_str());
+    if (!d) {
+        stringstream ee;
+        ee << "Failed to read directory '" << dir << "'.";
+        throw runtime_error (ee.str());
+    }
+    struct dirent* e;
+    while ((e = readdir (d)) != (struct dirent*)0) {
+        string name (e->d_name);
+        if (name != "." && name != "..") {
+            names.push_back (name);
+        }
+    }
+    closedir (d);
+    return names;
+}
+
+/*!
+ * Copy the files in @param from into the new directory @param to.
+ */
+void copyDir (const string& from, const string& to)
+{
+    if (mkdir (to.c_str(), 0755) != 0) {
+        stringstream ee;
+        ee << "Failed to create directory '" << to << "'.";
+        throw runtime_error (ee.str());
+    }
+    vector<string> names = listDir (from);
+    for (unsigned int i = 0; i < names.size(); ++i) {
+        ifstream in ((from + "/" + names[i]).c_str(), ios::in|ios::binary);
+        ofstream out ((to + "/" + names[i]).c_str(), ios::out|ios::trunc|ios::binary);
+        out << in.rdbuf();
+    }
+}
+
+/*!
+ * Remove the files in @param dir and @param dir itself.
+ */
+void removeDir (const string& dir)
+{
+    vector<string> names = listDir (dir);
+    for (unsigned int i = 0; i < names.size(); ++i) {
+        unlink ((dir + "/" + names[i]).c_str());
+    }
+    rmdir (dir.c_str());
+}
+
+/*!
+ * Run @param args with stdout and stderr sent to @param logpath.
+ * Returns the exit status.
+ */
+int run (const vector<string>& args, const string& logpath)
+{
+    vector<char*> argv;
+    for (unsigned int i = 0; i < args.size(); ++i) {
+        argv.push_back (const_cast<char*>(args[i].c_str()));
+    }
+    argv.push_back ((char*)0);
+
+    // Else the child would write out anything still buffered here.
+    cout.flush();
+    fflush (stdout);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        throw runtime_error ("Failed to fork.");
+    }
+    if (pid == 0) {
+        if (freopen (logpath.c_str(), "w", stdout) == (FILE*)0
+            || dup2 (fileno (stdout), fileno (stderr)) < 0) {
+            _exit (127);
+        }
+        execvp (argv[0], &argv[0]);
+        _exit (127);
+    }
+    int status = 0;
+    if (waitpid (pid, &status, 0) < 0) {
+        throw runtime_error ("Failed to wait for spineml_preflight.");
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/*!
+ * Preflight @param gc into a copy of its model in @param work, and
+ * return the hashes of the files it writes. Throws if preflight
+ * fails.
+ */
+FileHashes preflightCase (const GoldenCase& gc, const string& corpus, const string& preflight,
+                          const string& work, bool streaming, unsigned int threads)
+{
+    stringstream dss;
+    dss << work << "/" << gc.name << (streaming ? "_streaming_" : "_dom_") << threads;
+    string dir = dss.str();
+    copyDir (corpus + "/" + gc.model, dir);
+
+    vector<string> args;
+    args.push_back (preflight);
+    args.push_back ("-e");
+    args.push_back (dir + "/experiment.xml");
+    args.push_back ("--component_cache");
+    args.push_back ("none");
+    if (streaming) {
+        args.push_back ("--streaming");
+    }
+    stringstream tss;
+    tss << threads;
+    args.push_back ("--threads");
+    args.push_back (tss.str());
+    args.insert (args.end(), gc.args.begin(), gc.args.end());
+
+    string logpath = dir + ".log";
+    int status = run (args, logpath);
+    if (status != 0) {
+        ifstream log (logpath.c_str());
+        stringstream ee;
+        ee << "spineml_preflight exited with status " << status << ":\n" << log.rdbuf();
+        throw runtime_error (ee.str());
+    }
+    unlink (logpath.c_str());
+
+    FileHashes hashes;
+    vector<string> names = listDir (dir);
+    for (unsigned int i = 0; i < names.size(); ++i) {
+        if (names[i] == "model.xml" || names[i] == "experiment.xml"
+            || names[i].compare (0, 3, "pf_") == 0) {
+            hashes[names[i]] = hashFile (dir + "/" + names[i]);
+        }
+    }
+    removeDir (dir);
+    return hashes;
+}
+
+/*!
+ * Read the golden file at @param path into @param cases and @param
+ * golden (keyed by "<case> <mode>"). Comment and case lines are also
+ * kept in @param header, for --update.
+ */
+void readGolden (const string& path, vector<GoldenCase>& cases,
+                 map<string, FileHashes>& golden, vector<string>& header)
+{
+    ifstream f (path.c_str());
+    if (!f.is_open()) {
+        stringstream ee;
+        ee << "Failed to open golden file '" << path << "'.";
+        throw runtime_error (ee.str());
+    }
+    string line;
+    while (getline (f, line)) {
+        stringstream ls (line);
+        string first;
+        if (!(ls >> first) || first[0] == '#') {
+            header.push_back (line);
+            continue;
+        }
+        if (first == "case") {
+            GoldenCase gc;
+            ls >> gc.name >> gc.model;
+            string a;
+            while (ls >> a) {
+                gc.args.push_back (a);
+            }
+            cases.push_back (gc);
+            header.push_back (line);
+        } else {
+            string mode, file;
+            FileHash fh;
+            ls >> mode >> file >> fh.size >> hex >> fh.hash;
+            if (ls.fail()) {
+                stringstream ee;
+                ee << "Badly formed line in golden file: '" << line << "'";
+                throw runtime_error (ee.str());
+            }
+            golden[first + " " + mode][file] = fh;
+        }
+    }
+}
+
+/*!
+ * Compare @param got with @param want, printing the differences.
+ * Returns true if they match.
+ */
+bool compare (const string& label, const FileHashes& want, const FileHashes& got)
+{
+    bool ok = true;
+    FileHashes::const_iterator wi = want.begin();
+    while (wi != want.end()) {
+        FileHashes::const_iterator gi = got.find (wi->first);
+        if (gi == got.end()) {
+            cout << "FAIL " << label << ": " << wi->first << " was not written\n";
+            ok = false;
+        } else if (!(gi->second == wi->second)) {
+            cout << "FAIL " << label << ": " << wi->first << " differs (size " << gi->second.size
+                 << ", expected " << wi->second.size << "; hash " << hex << setw(16) << setfill('0')
+                 << gi->second.hash << ", expected " << setw(16) << wi->second.hash
+                 << setfill(' ') << dec << ")\n";
+            ok = false;
+        }
+        ++wi;
+    }
+    FileHashes::const_iterator gi = got.begin();
+    while (gi != got.end()) {
+        if (want.find (gi->first) == want.end()) {
+            cout << "FAIL " << label << ": " << gi->first << " was not expected\n";
+            ok = false;
+        }
+        ++gi;
+    }
+    return ok;
+}
+
+/*!
+ * libpopt features - the features that are available to change on the
+ * command line.
+ */
+struct CmdOptions {
+    //! To hold the directory of the model corpus, containing golden.txt.
+    char * corpus;
+    //! To hold the path to spineml_preflight.
+    char * preflight;
+    //! To hold the thread counts to test, comma separated.
+    char * threads;
+    //! To hold a flag to say that golden.txt should be rewritten.
+    int update;
+};
+
+/*!
+ * Initializes a CmdOptions object via a @param copts pointer
+ */
+void zeroCmdOptions (CmdOptions* copts)
+{
+    copts->corpus = NULL;
+    copts->preflight = NULL;
+    copts->threads = NULL;
+    copts->update = 0;
+}
+
+int main (int argc, char * argv[])
+{
+    int rtn = 0;
+
+    CmdOptions cmdOptions;
+    zeroCmdOptions (&cmdOptions);
+
+    struct poptOption opt[] = {
+        POPT_AUTOHELP
+
+        {"corpus", '\0',
+         POPT_ARG_STRING, &(cmdOptions.corpus), 0,
+         "The directory holding the models and golden.txt."},
+
+        {"preflight", '\0',
+         POPT_ARG_STRING, &(cmdOptions.preflight), 0,
+         "The spineml_preflight program to test. Default: the one alongside this program."},
+
+        {"threads", '\0',
+         POPT_ARG_STRING, &(cmdOptions.threads), 0,
+         "Comma separated thread counts to test. Default: 1,2,4"},
+
+        {"update", '\0',
+         POPT_ARG_NONE, &(cmdOptions.update), 0,
+         "If set, rewrite golden.txt from the current output instead of testing."},
+
+        POPT_AUTOALIAS
+        POPT_TABLEEND
+    };
+    poptContext con;
+    con = poptGetContext (argv[0], argc, (const char**)argv, opt, 0);
+    while (poptGetNextOpt(con) != -1) {}
+
+    string work("");
+    try {
+        if (cmdOptions.corpus == NULL) {
+            throw runtime_error ("Please give the corpus directory with --corpus.");
+        }
+        string corpus (cmdOptions.corpus);
+        string goldenPath = corpus + "/golden.txt";
+        string preflight;
+        if (cmdOptions.preflight != NULL) {
+            preflight = cmdOptions.preflight;
+        } else {
+            string dir (argv[0]);
+            string::size_type slash = dir.rfind ('/');
+            preflight = (slash == string::npos) ? "spineml_preflight"
+                : dir.substr (0, slash) + "/spineml_preflight";
+        }
+
+        vector<unsigned int> threads;
+        {
+            string tl (cmdOptions.threads != NULL ? cmdOptions.threads : "1,2,4");
+            for (string::size_type i = 0; i < tl.size(); ++i) {
+                if (tl[i] == ',') { tl[i] = ' '; }
+            }
+            stringstream ss (tl);
+            unsigned int t;
+            while (ss >> t) {
+                threads.push_back (t);
+            }
+        }
+
+        vector<GoldenCase> cases;
+        map<string, FileHashes> golden;
+        vector<string> header;
+        readGolden (goldenPath, cases, golden, header);
+
+        const char* tmp = getenv ("TMPDIR");
+        string tmpl = string ((tmp && tmp[0]) ? tmp : "/tmp") + "/testgolden_XXXXXX";
+        vector<char> tbuf (tmpl.begin(), tmpl.end());
+        tbuf.push_back ('\0');
+        if (mkdtemp (&tbuf[0]) == (char*)0) {
+            throw runtime_error ("Failed to make a working directory.");
+        }
+        work = &tbuf[0];
+
+        const char* modes[] = { "dom", "streaming" };
+
+        if (cmdOptions.update) {
+            ofstream f (goldenPath.c_str(), ios::out|ios::trunc);
+            for (unsigned int i = 0; i < header.size(); ++i) {
+                f << header[i] << "\n";
+            }
+            for (unsigned int c = 0; c < cases.size(); ++c) {
+                for (int m = 0; m < 2; ++m) {
+                    FileHashes h = preflightCase (cases[c], corpus, preflight, work, m == 1, 1);
+                    FileHashes::const_iterator hi = h.begin();
+                    while (hi != h.end()) {
+                        f << cases[c].name << " " << modes[m] << " " << hi->first << " "
+                          << dec << hi->second.size << " " << hex << setw(16) << setfill('0')
+                          << hi->second.hash << setfill(' ') << dec << "\n";
+                        ++hi;
+                    }
+                }
+            }
+            f.close();
+            if (f.fail()) {
+                throw runtime_error ("Failed to write the golden file.");
+            }
+            cout << "Updated " << goldenPath << "\n";
+        } else {
+            unsigned int runs = 0, failures = 0;
+            for (unsigned int c = 0; c < cases.size(); ++c) {
+                for (int m = 0; m < 2; ++m) {
+                    string key = cases[c].name + " " + modes[m];
+                    if (golden.find (key) == golden.end()) {
+                        cout << "FAIL " << key << ": no golden hashes\n";
+                        failures++;
+                        continue;
+                    }
+                    for (unsigned int t = 0; t < threads.size(); ++t) {
+                        stringstream label;
+                        label << key << " threads=" << threads[t];
+                        FileHashes h = preflightCase (cases[c], corpus, preflight, work,
+                                                      m == 1, threads[t]);
+                        runs++;
+                        if (compare (label.str(), golden[key], h)) {
+                            cout << "ok   " << label.str() << "\n";
+                        } else {
+                            failures++;
+                        }
+                    }
+                }
+            }
+            cout << (runs - failures) << " of " << runs << " golden runs passed.\n";
+            if (failures > 0) {
+                rtn = 1;
+            }
+        }
+    } catch (const exception& e) {
+        cout << "testgolden Error: " << e.what() << endl;
+        rtn = -1;
+    }
+
+    if (!work.empty()) {
+        removeDir (work);
+    }
+    poptFreeContext(con);
+    return rtn;
+}
@@ -0,0 +1,151 @@
+/*
+ * Implementation of Trace.
+ */
+
+#include <string>
+#include <vector>
+#include <set>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <unistd.h>
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+#include "trace.h"
+#include "util.h"
+
+using namespace std;
+using namespace spineml;
+
+bool Trace::on = false;
+double Trace::startTime = 0;
+vector<Trace::Event> Trace::events;
+
+Trace::Scope::Scope (const char* n)
+    : name (n)
+    , active (Trace::on)
+    , start (0)
+{
+    if (this->active) {
+        this->start = Util::monotonicSeconds();
+    }
+}
+
+Trace::Scope::~Scope()
+{
+    if (this->active) {
+        Trace::add (this->name, this->start, Util::monotonicSeconds(), this->args);
+    }
+}
+
+void
+Trace::Scope::arg (const char* key, const string& value)
+{
+    if (!this->active) {
+        return;
+    }
+    if (!this->args.empty()) {
+        this->args += ", ";
+    }
+    this->args += Util::jsonString (key) + ": " + Util::jsonString (value);
+}
+
+void
+Trace::Scope::arg (const char* key, double value)
+{
+    if (!this->active) {
+        return;
+    }
+    stringstream ss;
+    ss << Util::jsonString (key) << ": " << setprecision(12) << value;
+    if (!this->args.empty()) {
+        this->args += ", ";
+    }
+    this->args += ss.str();
+}
+
+void
+Trace::enable (void)
+{
+    Trace::on = true;
+    Trace::startTime = Util::monotonicSeconds();
+}
+
+void
+Trace::add (const char* name, double start, double end, const string& args)
+{
+    Event e;
+    e.name = name;
+    e.ts = (start - Trace::startTime) * 1e6;
+    e.dur = (end - start) * 1e6;
+    e.tid = Trace::threadId();
+    e.args = args;
+#pragma omp critical (spineml_trace)
+    {
+        Trace::events.push_back (e);
+    }
+}
+
+int
+Trace::threadId (void)
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+void
+Trace::write (const string& path)
+{
+    ofstream f (path.c_str(), ios::out|ios::trunc);
+    if (!f.is_open()) {
+        stringstream ee;
+        ee << "Failed to open trace file '" << path << "' for writing.";
+        throw runtime_error (ee.str());
+    }
+
+    int pid = static_cast<int>(getpid());
+    f << fixed << setprecision(3)
+      << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+      << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << pid
+      << ", \"tid\": 0, \"args\": {\"name\": \"spineml_preflight\"}}";
+
+    // Name each thread which has events, so they are listed in order.
+    set<int> tids;
+    vector<Event>::const_iterator ei = Trace::events.begin();
+    while (ei != Trace::events.end()) {
+        tids.insert (ei->tid);
+        ++ei;
+    }
+    set<int>::const_iterator ti = tids.begin();
+    while (ti != tids.end()) {
+        f << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+          << ", \"tid\": " << *ti << ", \"args\": {\"name\": \""
+          << (*ti == 0 ? "main" : "worker") << " " << *ti << "\"}}";
+        ++ti;
+    }
+
+    ei = Trace::events.begin();
+    while (ei != Trace::events.end()) {
+        f << ",\n{\"name\": " << Util::jsonString (ei->name)
+          << ", \"ph\": \"X\", \"pid\": " << pid << ", \"tid\": " << ei->tid
+          << ", \"ts\": " << ei->ts << ", \"dur\": " << ei->dur;
+        if (!ei->args.empty()) {
+            f << ", \"args\": {" << ei->args << "}";
+        }
+        f << "}";
+        ++ei;
+    }
+    f << "\n]}\n";
+
+    f.close();
+    if (f.fail()) {
+        stringstream ee;
+        ee << "Failed to write trace file '" << path << "'.";
+        throw runtime_error (ee.str());
+    }
+}
@@ -0,0 +1,89 @@
+/*!
+ * A timeline of a preflight run, in Chrome trace-event format.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <string>
+#include <vector>
+
+namespace spineml
+{
+    /*!
+     * Records when each traced section of code began and ended, and
+     * on which thread, and writes the events out as Chrome
+     * trace-event JSON, which can be loaded into Perfetto
+     * (ui.perfetto.dev) or about:tracing.
+     *
+     * A section is traced by making a Trace::Scope on the stack. It
+     * becomes one complete ("X") event, with any arguments given to
+     * arg() shown alongside it. Scopes made within another on the
+     * same thread show up nested inside it.
+     *
+     * Until enable() is called, a Scope tests a flag and does nothing
+     * else; arg() returns straight away too. Where working out an
+     * argument is itself costly, test Trace::enabled() first.
+     */
+    class Trace
+    {
+    public:
+        /*!
+         * Traces the time from its construction to its destruction
+         * as an event called @param name, which should be a string
+         * literal.
+         */
+        class Scope
+        {
+        public:
+            explicit Scope (const char* name);
+            ~Scope();
+
+            //! Show @param key = @param value with the event.
+            void arg (const char* key, const std::string& value);
+            void arg (const char* key, double value);
+
+        private:
+            const char* name;
+            bool active;
+            double start;
+            //! The arguments, as the inside of a JSON object.
+            std::string args;
+        };
+
+        //! Start recording. Event times are measured from here.
+        static void enable (void);
+
+        //! true if enable() has been called.
+        static bool enabled (void) { return Trace::on; }
+
+        /*!
+         * Write the recorded events to @param path. Throws if the
+         * file can't be written.
+         */
+        static void write (const std::string& path);
+
+    private:
+        //! One complete event. Times are in microseconds.
+        struct Event {
+            const char* name;
+            double ts;
+            double dur;
+            int tid;
+            std::string args;
+        };
+
+        //! Record a finished Scope.
+        static void add (const char* name, double start, double end, const std::string& args);
+
+        //! A small number for the calling thread, to group its events.
+        static int threadId (void);
+
+        static bool on;
+        static double startTime;
+        static std::vector<Event> events;
+    };
+
+} // namespace spineml
+
+#endif // _TRACE_H_
@@ -0,0 +1,36 @@
+/*
+ * Implementation of TranscodeJob.
+ */
+
+#include <string>
+#include "transcodejob.h"
+#include "trace.h"
+
+using namespace std;
+using namespace spineml;
+
+TranscodeJob::TranscodeJob (const string& inpath, const BinaryTranscoder::Layout& from,
+                            const string& outpath, const BinaryTranscoder::Layout& to,
+                            unsigned long long n, const XmlEdit& e)
+    : inPath (inpath)
+    , fromLayout (from)
+    , outPath (outpath)
+    , toLayout (to)
+    , elements (n)
+    , plannedEdit (e)
+{
+}
+
+void
+TranscodeJob::run (void)
+{
+    Trace::Scope ts ("TranscodeJob");
+    ts.arg ("file", this->inPath);
+    if (this->writeFiles) {
+        // On the job's own thread; a parallel region here would be
+        // inactive anyway.
+        BinaryTranscoder::transcode (this->inPath, this->fromLayout,
+                                     this->outPath, this->toLayout, this->elements);
+    }
+    this->edit = this->plannedEdit;
+}
@@ -0,0 +1,53 @@
+/*!
+ * A PreflightJob which rewrites an existing binary file in another
+ * layout.
+ */
+
+#ifndef _TRANSCODEJOB_H_
+#define _TRANSCODEJOB_H_
+
+#include <string>
+#include "binarytranscoder.h"
+#include "preflightjob.h"
+#include "xmledit.h"
+
+namespace spineml
+{
+    /*!
+     * Converts a binary file which the model already refers to (for
+     * example, to drop the delays of a binary connection list) into
+     * a new file alongside it. The original is left alone: the new
+     * file only replaces it once model.xml has been written (see
+     * ModelPreflight::write), so that a failure anywhere in the run
+     * leaves the model and its data as they were. The edit is given
+     * at construction.
+     */
+    class TranscodeJob : public PreflightJob
+    {
+    public:
+        /*!
+         * Convert @param inpath, in layout @param from, into @param
+         * outpath in layout @param to; see
+         * BinaryTranscoder::transcode. @param e is the change which
+         * goes with the conversion.
+         */
+        TranscodeJob (const std::string& inpath, const BinaryTranscoder::Layout& from,
+                      const std::string& outpath, const BinaryTranscoder::Layout& to,
+                      unsigned long long elements, const spineml::XmlEdit& e);
+
+    protected:
+        void run (void);
+
+    private:
+        std::string inPath;
+        BinaryTranscoder::Layout fromLayout;
+        std::string outPath;
+        BinaryTranscoder::Layout toLayout;
+        unsigned long long elements;
+        //! The edit, copied to PreflightJob::edit when the job runs.
+        spineml::XmlEdit plannedEdit;
+    };
+
+} // namespace spineml
+
+#endif // _TRANSCODEJOB_H_
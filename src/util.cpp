@@ -8,6 +8,18 @@
 #include <stdexcept>
 #include <sstream>
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef __linux__
+# include <linux/fs.h>
+#endif
 #include "util.h"
 
 using namespace std;
@@ -242,3 +254,166 @@ Util::getValueWithDimension (const std::string& str)
 
     return rtn;
 }
+
+string
+Util::tempPathFor (const string& path)
+{
+    stringstream ss;
+    ss << path << ".pftmp" << getpid();
+    return ss.str();
+}
+
+void
+Util::keepPreviousVersion (const string& path, const string& bupath)
+{
+    // Remove any old backup; link() won't overwrite.
+    if (unlink (bupath.c_str()) && errno != ENOENT) {
+        stringstream ee;
+        ee << "Failed to remove old backup '" << bupath << "': " << strerror (errno);
+        throw runtime_error (ee.str());
+    }
+
+    // A second name for the same inode. The later rename() of the new
+    // file over path leaves bupath holding the old content.
+    if (link (path.c_str(), bupath.c_str()) == 0) {
+        return;
+    }
+
+    int in = open (path.c_str(), O_RDONLY);
+    if (in < 0) {
+        stringstream ee;
+        ee << "Failed to open '" << path << "' for backup: " << strerror (errno);
+        throw runtime_error (ee.str());
+    }
+    int out = open (bupath.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (out < 0) {
+        close (in);
+        stringstream ee;
+        ee << "Failed to open '" << bupath << "' for writing: " << strerror (errno);
+        throw runtime_error (ee.str());
+    }
+
+#ifdef FICLONE
+    if (ioctl (out, FICLONE, in) == 0) {
+        close (in);
+        close (out);
+        return;
+    }
+#endif
+
+    // Plain copy.
+    vector<char> buf (1024*1024);
+    ssize_t n = 0;
+    while ((n = read (in, &buf[0], buf.size())) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+        ssize_t done = 0;
+        while (done < n) {
+            ssize_t w = write (out, &buf[done], n - done);
+            if (w < 0) {
+                if (errno == EINTR) { continue; }
+                n = -1;
+                break;
+            }
+            done += w;
+        }
+        if (n < 0) {
+            break;
+        }
+    }
+    int err = errno;
+    close (in);
+    if (close (out) || n < 0) {
+        stringstream ee;
+        ee << "Failed to copy '" << path << "' to '" << bupath << "': " << strerror (err);
+        throw runtime_error (ee.str());
+    }
+}
+
+void
+Util::replaceFile (const string& tmppath, const string& path)
+{
+    // Keep the permissions of the file being replaced.
+    struct stat st;
+    if (stat (path.c_str(), &st) == 0) {
+        chmod (tmppath.c_str(), st.st_mode & 07777);
+    }
+    if (rename (tmppath.c_str(), path.c_str())) {
+        stringstream ee;
+        ee << "Failed to move '" << tmppath << "' to '" << path << "': " << strerror (errno);
+        throw runtime_error (ee.str());
+    }
+    // Make the directory entry durable too.
+    string dir (path);
+    Util::stripUnixFile (dir);
+    if (dir == path) {
+        dir = ".";
+    }
+    int dfd = open (dir.c_str(), O_RDONLY);
+    if (dfd >= 0) {
+        fsync (dfd);
+        close (dfd);
+    }
+}
+
+/*!
+ * The readable part of a stable file name is cut to this length.
+ */
+#define STABLE_NAME_READABLE_MAX 48
+
+string
+Util::stableFileName (const string& prefix, const vector<string>& identity)
+{
+    unsigned int h = 2166136261u;
+    string readable("");
+    vector<string>::const_iterator i = identity.begin();
+    while (i != identity.end()) {
+        for (string::size_type j = 0; j < i->size(); ++j) {
+            unsigned char c = static_cast<unsigned char>((*i)[j]);
+            h = (h ^ c) * 16777619u;
+            readable += isalnum (c) ? static_cast<char>(c) : '_';
+        }
+        // A NUL after each part, so that ("ab","c") and ("a","bc") differ.
+        h = h * 16777619u;
+        readable += '_';
+        ++i;
+    }
+    if (readable.size() > STABLE_NAME_READABLE_MAX) {
+        readable.resize (STABLE_NAME_READABLE_MAX);
+    }
+
+    char hex[16];
+    snprintf (hex, sizeof(hex), "%08x", h & 0xffffffffu);
+    return prefix + readable + hex + ".bin";
+}
+
+double
+Util::monotonicSeconds (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+}
+
+string
+Util::jsonString (const string& s)
+{
+    string rtn("\"");
+    for (string::size_type i = 0; i < s.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (c == '"' || c == '\\') {
+            rtn += '\\';
+            rtn += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char esc[8];
+            snprintf (esc, sizeof(esc), "\\u%04x", c);
+            rtn += esc;
+        } else {
+            rtn += static_cast<char>(c);
+        }
+    }
+    rtn += '"';
+    return rtn;
+}
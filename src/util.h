@@ -152,6 +152,51 @@ namespace spineml
          */
         static std::pair<std::string, std::string> getDistWithDimension (const std::string& str);
 
+        /*!
+         * Return a name for a temporary file in the same directory as
+         * @param path, so that it can later be renamed over path.
+         */
+        static std::string tempPathFor (const std::string& path);
+
+        /*!
+         * Keep the current content of @param path as @param bupath,
+         * replacing any existing bupath. A hard link is made if
+         * possible, then a reflink (copy-on-write clone), and only if
+         * neither is supported is the data copied.
+         */
+        static void keepPreviousVersion (const std::string& path, const std::string& bupath);
+
+        /*!
+         * Atomically replace @param path with the (already fsynced)
+         * file @param tmppath, and sync the directory so that the
+         * rename itself is durable.
+         */
+        static void replaceFile (const std::string& tmppath, const std::string& path);
+
+        /*!
+         * Make a binary file name which depends only on @param
+         * identity, the parts which name the thing being written
+         * (e.g. population and property name). The result is @param
+         * prefix, a readable (sanitized and truncated) form of the
+         * parts, an FNV-1a hash of the unmodified parts in hex and
+         * ".bin". The hash keeps names distinct when sanitizing or
+         * truncating would not.
+         */
+        static std::string stableFileName (const std::string& prefix,
+                                           const std::vector<std::string>& identity);
+
+        /*!
+         * A monotonic clock, in seconds from an arbitrary start, for
+         * timing sections of the program.
+         */
+        static double monotonicSeconds (void);
+
+        /*!
+         * Return @param s as a quoted JSON string, with quotes,
+         * backslashes and control characters escaped.
+         */
+        static std::string jsonString (const std::string& s);
+
     }; // utility class
 } // namespace
 
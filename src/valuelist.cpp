@@ -54,6 +54,10 @@ ValueList::ValueList(xml_node<>* vl_node, const unsigned int num_in_pop)
 
         this->values.insert (make_pair (index, value));
     }
+    // Each map entry is a tree node: three pointers and a colour
+    // besides the pair itself.
+    this->memory.set (static_cast<double>(this->values.size()
+                                          * (sizeof(pair<const int, double>) + 4 * sizeof(void*))));
 }
 
 void
@@ -0,0 +1,188 @@
+/*
+ * Implementation of XmlEdit.
+ */
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <ostream>
+#include "rapidxml.hpp"
+#include "xmledit.h"
+
+using namespace std;
+using namespace rapidxml;
+using namespace spineml;
+
+XmlEdit::XmlEdit()
+    : target ((xml_node<>*)0)
+    , name ("")
+    , append (false)
+    , before ("")
+    , path ("")
+{
+}
+
+XmlEdit::XmlEdit (xml_node<>* target_node, const string& new_name)
+    : target (target_node)
+    , name (new_name)
+    , append (false)
+    , before ("")
+    , path ("")
+{
+    this->describeTarget();
+}
+
+XmlEdit::XmlEdit (xml_node<>* target_node)
+    : target (target_node)
+    , name (target_node->name())
+    , append (true)
+    , before ("")
+    , path ("")
+{
+    this->describeTarget();
+}
+
+void
+XmlEdit::describeTarget (void)
+{
+    stringstream ss;
+    ss << "<" << this->target->name();
+    for (xml_attribute<>* a = this->target->first_attribute(); a; a = a->next_attribute()) {
+        ss << " " << a->name() << "=\"" << a->value() << "\"";
+    }
+    unsigned int nchildren = 0;
+    for (xml_node<>* c = this->target->first_node(); c; c = c->next_sibling()) {
+        if (c->type() == node_element) {
+            ++nchildren;
+        }
+    }
+    ss << ">";
+    if (nchildren > 0) {
+        ss << " (" << nchildren << (nchildren == 1 ? " child element)" : " child elements)");
+    }
+    this->before = ss.str();
+
+    // The path to the target. Elements are identified by their
+    // name attribute if they have one, otherwise by their position
+    // among siblings of the same name.
+    vector<string> names;
+    for (xml_node<>* n = this->target; n && n->type() == node_element; n = n->parent()) {
+        stringstream ps;
+        ps << n->name();
+        xml_attribute<>* nattr = n->first_attribute ("name");
+        if (nattr) {
+            ps << "[@name='" << nattr->value() << "']";
+        } else if (n->parent()) {
+            unsigned int idx = 1;
+            for (xml_node<>* s = n->previous_sibling (n->name()); s; s = s->previous_sibling (n->name())) {
+                ++idx;
+            }
+            ps << "[" << idx << "]";
+        }
+        names.push_back (ps.str());
+    }
+    vector<string>::const_reverse_iterator pi = names.rbegin();
+    while (pi != names.rend()) {
+        this->path += "/" + *pi;
+        ++pi;
+    }
+}
+
+int
+XmlEdit::addElement (const string& element_name, int parent)
+{
+    Element e;
+    e.name = element_name;
+    e.parent = parent;
+    this->elements.push_back (e);
+    return static_cast<int>(this->elements.size()) - 1;
+}
+
+void
+XmlEdit::addAttribute (int element, const string& attr_name, const string& attr_value)
+{
+    this->elements[element].attributes.push_back (make_pair (attr_name, attr_value));
+}
+
+void
+XmlEdit::apply (void) const
+{
+    if (!this->target) {
+        return;
+    }
+    xml_document<>* thedoc = this->target->document();
+
+    if (!this->append) {
+        this->target->remove_all_attributes();
+        this->target->remove_all_nodes();
+        this->target->name (thedoc->allocate_string (this->name.c_str()));
+    }
+
+    // Parents come before their children in elements, so each
+    // parent node exists by the time it's needed.
+    vector<xml_node<>*> nodes (this->elements.size(), (xml_node<>*)0);
+    for (unsigned int i = 0; i < this->elements.size(); ++i) {
+        const Element& e = this->elements[i];
+        nodes[i] = thedoc->allocate_node (node_element, thedoc->allocate_string (e.name.c_str()));
+        vector<pair<string, string> >::const_iterator ai = e.attributes.begin();
+        while (ai != e.attributes.end()) {
+            nodes[i]->append_attribute (thedoc->allocate_attribute (thedoc->allocate_string (ai->first.c_str()),
+                                                                     thedoc->allocate_string (ai->second.c_str())));
+            ++ai;
+        }
+        xml_node<>* parent_node = e.parent < 0 ? this->target : nodes[e.parent];
+        parent_node->append_node (nodes[i]);
+    }
+}
+
+void
+XmlEdit::print (ostream& os) const
+{
+    if (!this->target) {
+        return;
+    }
+
+    if (this->append) {
+        // The target is unchanged; only the new children are shown.
+        os << "@@ " << this->path << "\n  " << this->before << "\n";
+    } else {
+        os << "@@ " << this->path << "\n- " << this->before << "\n";
+        os << "+ <" << this->name << ">\n";
+    }
+    for (unsigned int i = 0; i < this->elements.size(); ++i) {
+        if (this->elements[i].parent < 0) {
+            this->printElement (os, i, 1);
+        }
+    }
+    if (!this->append) {
+        os << "+ </" << this->name << ">\n";
+    }
+}
+
+void
+XmlEdit::printElement (ostream& os, int i, unsigned int depth) const
+{
+    const Element& e = this->elements[i];
+    string indent = "+ " + string (2*depth, ' ');
+    os << indent << "<" << e.name;
+    vector<pair<string, string> >::const_iterator ai = e.attributes.begin();
+    while (ai != e.attributes.end()) {
+        os << " " << ai->first << "=\"" << ai->second << "\"";
+        ++ai;
+    }
+    bool haveChildren = false;
+    for (unsigned int j = i+1; j < this->elements.size(); ++j) {
+        if (this->elements[j].parent == i) {
+            if (!haveChildren) {
+                os << ">\n";
+                haveChildren = true;
+            }
+            this->printElement (os, j, depth+1);
+        }
+    }
+    if (haveChildren) {
+        os << indent << "</" << e.name << ">\n";
+    } else {
+        os << "/>\n";
+    }
+}
@@ -0,0 +1,124 @@
+/*!
+ * A deferred change to one element of a rapidxml document.
+ */
+
+#ifndef _XMLEDIT_H_
+#define _XMLEDIT_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <ostream>
+#include "rapidxml.hpp"
+
+namespace spineml
+{
+    /*!
+     * Describes the replacement of an element's attributes and
+     * content, without touching the document. This is the kind of
+     * change preflight makes: a FixedProbabilityConnection becomes a
+     * ConnectionList holding a BinaryFile, a FixedValue becomes a
+     * ValueList, and so on. An edit can instead only add children,
+     * as when a Layout gains the BinaryFile of its positions.
+     *
+     * An XmlEdit can be made on any thread, as it only reads the
+     * target element. apply() allocates from the document's memory
+     * pool, so it must only be called by the one thread which owns
+     * the document.
+     */
+    class XmlEdit
+    {
+    public:
+        /*!
+         * One new element in the replacement content.
+         */
+        struct Element {
+            //! Element name
+            std::string name;
+            //! Attribute names and values, in order.
+            std::vector<std::pair<std::string, std::string> > attributes;
+            //! Index of the parent in XmlEdit::elements, or -1 for the target.
+            int parent;
+        };
+
+        //! An empty edit, which does nothing.
+        XmlEdit();
+
+        /*!
+         * An edit which will rename @param target_node to @param
+         * new_name and remove all its attributes and children. The
+         * target's path and original start tag are recorded for
+         * print().
+         */
+        XmlEdit (rapidxml::xml_node<>* target_node, const std::string& new_name);
+
+        /*!
+         * An edit which will only add new elements after the
+         * existing children of @param target_node, leaving its name,
+         * attributes and content as they are.
+         */
+        explicit XmlEdit (rapidxml::xml_node<>* target_node);
+
+        /*!
+         * Add a new element called @param element_name as the last
+         * child of the element with index @param parent (-1 for the
+         * target).
+         *
+         * @return the index of the new element.
+         */
+        int addElement (const std::string& element_name, int parent = -1);
+
+        /*!
+         * Add the attribute @param attr_name=@param attr_value to the
+         * new element with index @param element.
+         */
+        void addAttribute (int element, const std::string& attr_name,
+                           const std::string& attr_value);
+
+        /*!
+         * Make the change in the target's document.
+         */
+        void apply (void) const;
+
+        /*!
+         * Write the change to @param os, as the path to the target,
+         * its start tag before the change (prefixed with "- ") and
+         * the new element (each line prefixed with "+ ").
+         */
+        void print (std::ostream& os) const;
+
+        //! The element to change. Null for an empty edit.
+        rapidxml::xml_node<>* target;
+
+    private:
+        /*!
+         * Print the new element at index @param i, and its children,
+         * at indentation level @param depth.
+         */
+        void printElement (std::ostream& os, int i, unsigned int depth) const;
+
+        /*!
+         * Record the target's start tag and path for print(). Called
+         * by the constructors.
+         */
+        void describeTarget (void);
+
+        //! The new name of the target
+        std::string name;
+
+        //! True if the target keeps its attributes and children.
+        bool append;
+
+        //! The new content, parents before their children.
+        std::vector<Element> elements;
+
+        //! The start tag of the target before the change.
+        std::string before;
+
+        //! The path to the target before the change.
+        std::string path;
+    };
+
+} // namespace spineml
+
+#endif // _XMLEDIT_H_
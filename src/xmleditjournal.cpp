@@ -0,0 +1,48 @@
+/*
+ * Implementation of XmlEditJournal.
+ */
+
+#include <vector>
+#include <ostream>
+#include "xmleditjournal.h"
+
+using namespace std;
+using namespace spineml;
+
+XmlEditJournal::XmlEditJournal()
+    : numCommitted (0)
+{
+}
+
+void
+XmlEditJournal::add (const XmlEdit& e)
+{
+    if (e.target) {
+        this->edits.push_back (e);
+    }
+}
+
+void
+XmlEditJournal::commit (void)
+{
+    while (this->numCommitted < this->edits.size()) {
+        this->edits[this->numCommitted++].apply();
+    }
+}
+
+void
+XmlEditJournal::print (ostream& os) const
+{
+    vector<XmlEdit>::const_iterator ei = this->edits.begin();
+    while (ei != this->edits.end()) {
+        ei->print (os);
+        ++ei;
+    }
+}
+
+void
+XmlEditJournal::clear (void)
+{
+    this->edits.clear();
+    this->numCommitted = 0;
+}
@@ -0,0 +1,56 @@
+/*!
+ * An ordered list of XmlEdits to be applied to a document.
+ */
+
+#ifndef _XMLEDITJOURNAL_H_
+#define _XMLEDITJOURNAL_H_
+
+#include <vector>
+#include <ostream>
+#include "xmledit.h"
+
+namespace spineml
+{
+    /*!
+     * Collects the XmlEdits made by preflight jobs so that they can
+     * be applied to the document by one committer, in a fixed
+     * order, or printed instead as a dry run.
+     */
+    class XmlEditJournal
+    {
+    public:
+        XmlEditJournal();
+
+        /*!
+         * Add @param e to the end of the journal.
+         */
+        void add (const XmlEdit& e);
+
+        /*!
+         * Apply the edits added since the last commit(), in the
+         * order in which they were added.
+         */
+        void commit (void);
+
+        /*!
+         * Print all the edits to @param os. @see XmlEdit::print
+         */
+        void print (std::ostream& os) const;
+
+        //! @return the number of edits in the journal.
+        unsigned int size (void) const { return this->edits.size(); }
+
+        //! Empty the journal.
+        void clear (void);
+
+    private:
+        //! The edits, in order.
+        std::vector<XmlEdit> edits;
+
+        //! The number of edits at the start of @see edits which have been applied.
+        unsigned int numCommitted;
+    };
+
+} // namespace spineml
+
+#endif // _XMLEDITJOURNAL_H_
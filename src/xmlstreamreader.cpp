@@ -0,0 +1,266 @@
+/*
+ * Implementation of XmlToken and XmlStreamReader.
+ */
+
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include "xmlstreamreader.h"
+
+using namespace std;
+using namespace spineml;
+
+/*!
+ * The size of the read buffer used by XmlStreamReader.
+ */
+#define XMLSTREAM_BUFSZ (1024*1024)
+
+XmlToken::XmlToken()
+    : type (XmlToken::Text)
+{
+}
+
+void
+XmlToken::clear (void)
+{
+    this->type = XmlToken::Text;
+    this->raw.clear();
+    this->name.clear();
+}
+
+bool
+XmlToken::opens (const string& n) const
+{
+    return (this->type == XmlToken::StartTag || this->type == XmlToken::EmptyTag)
+        && this->name == n;
+}
+
+string
+XmlToken::asStartTag (void) const
+{
+    if (this->type != XmlToken::EmptyTag) {
+        return this->raw;
+    }
+    // Strip the "/>" and any whitespace before it.
+    string::size_type e = this->raw.find_last_of ('/');
+    string::size_type last = this->raw.find_last_not_of (" \t\r\n", e-1);
+    return this->raw.substr (0, last+1) + ">";
+}
+
+bool
+XmlToken::getAttribute (const string& attr_name, string& value) const
+{
+    if (this->type != XmlToken::StartTag && this->type != XmlToken::EmptyTag) {
+        return false;
+    }
+
+    // Skip '<' and the element name.
+    string::size_type i = 1 + this->name.size();
+    const string::size_type sz = this->raw.size();
+    while (i < sz) {
+        // Skip whitespace to the attribute name
+        while (i < sz && isspace (this->raw[i])) { ++i; }
+        if (i >= sz || this->raw[i] == '/' || this->raw[i] == '>') {
+            break;
+        }
+        string::size_type nstart = i;
+        while (i < sz && this->raw[i] != '=' && !isspace (this->raw[i])) { ++i; }
+        string::size_type nend = i;
+        while (i < sz && (isspace (this->raw[i]) || this->raw[i] == '=')) { ++i; }
+        if (i >= sz) {
+            break;
+        }
+        char q = this->raw[i++];
+        if (q != '"' && q != '\'') {
+            // Malformed; give up.
+            break;
+        }
+        string::size_type vstart = i;
+        while (i < sz && this->raw[i] != q) { ++i; }
+        string::size_type vend = i++;
+
+        if (nend - nstart == attr_name.size()
+            && this->raw.compare (nstart, nend - nstart, attr_name) == 0) {
+            // Found it. Decode entities into value.
+            value.clear();
+            for (string::size_type j = vstart; j < vend; ++j) {
+                if (this->raw[j] != '&') {
+                    value += this->raw[j];
+                    continue;
+                }
+                string::size_type semi = this->raw.find (';', j);
+                if (semi == string::npos || semi > vend) {
+                    value += this->raw[j];
+                    continue;
+                }
+                string ent = this->raw.substr (j+1, semi-j-1);
+                if (ent == "lt") { value += '<'; }
+                else if (ent == "gt") { value += '>'; }
+                else if (ent == "amp") { value += '&'; }
+                else if (ent == "quot") { value += '"'; }
+                else if (ent == "apos") { value += '\''; }
+                else if (!ent.empty() && ent[0] == '#') {
+                    unsigned long code = (ent.size() > 1 && ent[1] == 'x')
+                        ? strtoul (ent.c_str()+2, 0, 16)
+                        : strtoul (ent.c_str()+1, 0, 10);
+                    // Attribute values we need are plain ASCII.
+                    value += static_cast<char>(code);
+                } else {
+                    // Unknown entity, leave as is.
+                    value += this->raw.substr (j, semi-j+1);
+                }
+                j = semi;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+XmlStreamReader::XmlStreamReader (const string& p)
+    : f ((FILE*)0)
+    , buf (XMLSTREAM_BUFSZ)
+    , pos (0)
+    , end (0)
+    , path (p)
+{
+    this->f = fopen (this->path.c_str(), "rb");
+    if (!this->f) {
+        stringstream ee;
+        ee << "XmlStreamReader: Failed to open file '" << this->path << "' for reading.";
+        throw runtime_error (ee.str());
+    }
+}
+
+XmlStreamReader::~XmlStreamReader()
+{
+    if (this->f) {
+        fclose (this->f);
+    }
+}
+
+bool
+XmlStreamReader::ensure (size_t n)
+{
+    if (this->end - this->pos >= n) {
+        return true;
+    }
+    // Move the unread remainder to the start of the buffer and refill.
+    size_t remain = this->end - this->pos;
+    if (remain > 0 && this->pos > 0) {
+        memmove (&this->buf[0], &this->buf[this->pos], remain);
+    }
+    this->pos = 0;
+    this->end = remain;
+    while (this->end < n) {
+        size_t got = fread (&this->buf[this->end], 1, this->buf.size() - this->end, this->f);
+        if (got == 0) {
+            return false;
+        }
+        this->end += got;
+    }
+    return true;
+}
+
+bool
+XmlStreamReader::lookingAt (const char* s)
+{
+    size_t n = strlen (s);
+    if (!this->ensure (n)) {
+        return false;
+    }
+    return memcmp (&this->buf[this->pos], s, n) == 0;
+}
+
+void
+XmlStreamReader::readMarkup (string& raw, const char* term, bool quoted, size_t minlen)
+{
+    const size_t tl = strlen (term);
+    const char last = term[tl-1];
+    char q = '\0';
+    for (;;) {
+        if (this->pos == this->end && !this->ensure (1)) {
+            stringstream ee;
+            ee << "XmlStreamReader: Unexpected end of file in '" << this->path
+               << "' while reading markup starting '" << raw.substr (0, 64) << "'";
+            throw runtime_error (ee.str());
+        }
+        char c = this->buf[this->pos++];
+        raw += c;
+        if (quoted) {
+            if (q != '\0') {
+                if (c == q) { q = '\0'; }
+                continue;
+            }
+            if (c == '"' || c == '\'') {
+                q = c;
+                continue;
+            }
+        }
+        if (c == last && raw.size() >= minlen + tl
+            && raw.compare (raw.size() - tl, tl, term) == 0) {
+            return;
+        }
+    }
+}
+
+bool
+XmlStreamReader::next (XmlToken& tok)
+{
+    tok.clear();
+    if (!this->ensure (1)) {
+        return false;
+    }
+
+    if (this->buf[this->pos] != '<') {
+        // Text runs up to the next '<' or the end of the file.
+        tok.type = XmlToken::Text;
+        for (;;) {
+            const char* b = &this->buf[this->pos];
+            size_t avail = this->end - this->pos;
+            const char* lt = static_cast<const char*>(memchr (b, '<', avail));
+            if (lt) {
+                tok.raw.append (b, lt - b);
+                this->pos += lt - b;
+                break;
+            }
+            tok.raw.append (b, avail);
+            this->pos = this->end;
+            if (!this->ensure (1)) {
+                break;
+            }
+        }
+        return true;
+    }
+
+    if (this->lookingAt ("<!--")) {
+        tok.type = XmlToken::Other;
+        this->readMarkup (tok.raw, "-->", false, 4);
+    } else if (this->lookingAt ("<![CDATA[")) {
+        tok.type = XmlToken::Other;
+        this->readMarkup (tok.raw, "]]>", false, 9);
+    } else if (this->lookingAt ("<?")) {
+        tok.type = XmlToken::Other;
+        this->readMarkup (tok.raw, "?>", true, 2);
+    } else if (this->lookingAt ("<!")) {
+        tok.type = XmlToken::Other;
+        this->readMarkup (tok.raw, ">", true, 2);
+    } else {
+        this->readMarkup (tok.raw, ">", true, 1);
+        string::size_type nstart = 1;
+        if (tok.raw.size() > 1 && tok.raw[1] == '/') {
+            tok.type = XmlToken::EndTag;
+            nstart = 2;
+        } else if (tok.raw.size() > 2 && tok.raw[tok.raw.size()-2] == '/') {
+            tok.type = XmlToken::EmptyTag;
+        } else {
+            tok.type = XmlToken::StartTag;
+        }
+        string::size_type nend = tok.raw.find_first_of (" \t\r\n/>", nstart);
+        tok.name = tok.raw.substr (nstart, nend - nstart);
+    }
+    return true;
+}
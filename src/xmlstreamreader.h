@@ -0,0 +1,139 @@
+/*!
+ * A sequential XML tokenizer, used to preflight models which are too
+ * large to hold in memory as a DOM.
+ */
+
+#ifndef _XMLSTREAMREADER_H_
+#define _XMLSTREAMREADER_H_
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+namespace spineml
+{
+    /*!
+     * One token from an XML file. The raw text of the token is kept
+     * exactly as it was found in the file so that it can be copied
+     * to the output unchanged.
+     */
+    class XmlToken
+    {
+    public:
+        /*!
+         * The kinds of token returned by XmlStreamReader.
+         */
+        enum Type {
+            //! Character data between tags (often just whitespace)
+            Text,
+            //! An opening tag, like \verbatim<Property name="m">\endverbatim
+            StartTag,
+            //! A self-closing tag, like \verbatim<FixedValue value="1"/>\endverbatim
+            EmptyTag,
+            //! A closing tag, like \verbatim</Property>\endverbatim
+            EndTag,
+            //! A comment, CDATA section, processing instruction or declaration
+            Other
+        };
+
+        XmlToken();
+
+        /*!
+         * Reset the token to an empty Text token.
+         */
+        void clear (void);
+
+        /*!
+         * Find the attribute @param attr_name in the tag and place
+         * its (entity-decoded) value in @param value.
+         *
+         * @return true if the attribute was found.
+         */
+        bool getAttribute (const std::string& attr_name, std::string& value) const;
+
+        /*!
+         * Return true if this is a StartTag or EmptyTag called @param n
+         */
+        bool opens (const std::string& n) const;
+
+        /*!
+         * Return the raw text of this EmptyTag re-written as a
+         * StartTag, e.g. \verbatim<Property name="m"/>\endverbatim
+         * becomes \verbatim<Property name="m">\endverbatim
+         */
+        std::string asStartTag (void) const;
+
+        //! The type of the token
+        Type type;
+
+        //! The exact text of the token as it appeared in the file
+        std::string raw;
+
+        //! The element name, for StartTag, EmptyTag and EndTag tokens
+        std::string name;
+    };
+
+    /*!
+     * Reads an XML file one token at a time through a fixed-size
+     * buffer. No attempt is made to validate the XML; the reader only
+     * finds the boundaries of tags (respecting quoted attribute
+     * values), comments, CDATA sections and text.
+     */
+    class XmlStreamReader
+    {
+    public:
+        /*!
+         * Open the XML file at @param path for reading. Throws on
+         * failure.
+         */
+        XmlStreamReader (const std::string& path);
+        ~XmlStreamReader();
+
+        /*!
+         * Read the next token from the file into @param tok.
+         *
+         * @return false if the end of the file has been reached.
+         */
+        bool next (XmlToken& tok);
+
+    private:
+        /*!
+         * Make sure at least @param n characters are available in
+         * the buffer from pos, refilling from the file as
+         * necessary.
+         *
+         * @return false if fewer than n characters remain in the file.
+         */
+        bool ensure (size_t n);
+
+        /*!
+         * Append characters to @param raw up to and including the
+         * terminator @param term. If @param quoted is true, a
+         * terminator within a quoted attribute value is ignored.
+         * @param minlen is the length of the opening sequence, which
+         * may not overlap the terminator.
+         */
+        void readMarkup (std::string& raw, const char* term, bool quoted, size_t minlen);
+
+        //! Return true if the buffer at pos begins with @param s
+        bool lookingAt (const char* s);
+
+        //! The file being read.
+        FILE* f;
+
+        //! The read buffer
+        std::vector<char> buf;
+
+        //! The current position in buf
+        size_t pos;
+
+        //! One past the last valid character in buf
+        size_t end;
+
+        //! Path to the file, for error messages
+        std::string path;
+    };
+
+} // namespace spineml
+
+#endif // _XMLSTREAMREADER_H_